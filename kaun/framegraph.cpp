@@ -0,0 +1,370 @@
+#include "framegraph.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+#include "log.hpp"
+#include "render.hpp"
+#include "rendertarget.hpp"
+#include "rendertexturepool.hpp"
+
+namespace kaun {
+namespace {
+    bool contains(const std::vector<FramePass::Resource>& resources, FramePass::Resource resource)
+    {
+        return std::find(resources.begin(), resources.end(), resource) != resources.end();
+    }
+
+    // the pass doesn't need the previous contents of the resource
+    bool overwrites(const FramePass& pass, FramePass::Resource resource)
+    {
+        if (pass.isResolve())
+            return true;
+        if (pass.clearColor && contains(pass.colorAttachments, resource))
+            return true;
+        return pass.clearDepth && pass.depthStencil == resource;
+    }
+}
+
+FrameGraph::FrameGraph()
+    : mCompiled(false)
+{
+    clear();
+}
+
+FrameGraph::~FrameGraph()
+{
+    for (auto& resource : mResources) {
+        if (!resource.imported && resource.texture)
+            releaseRenderTexture(resource.texture);
+    }
+}
+
+FrameGraph::Resource FrameGraph::createTexture(const std::string& name, const TextureDesc& desc)
+{
+    if (getResource(name) != none) {
+        LOG_ERROR("Frame graph resource '%s' already exists", name.c_str());
+        return none;
+    }
+    mResources.push_back(ResourceInfo { name, desc, nullptr, false, false, 0, 0 });
+    mCompiled = false;
+    return mResources.size() - 1;
+}
+
+FrameGraph::Resource FrameGraph::importTexture(
+    const std::string& name, Texture* texture, bool output)
+{
+    if (getResource(name) != none) {
+        LOG_ERROR("Frame graph resource '%s' already exists", name.c_str());
+        return none;
+    }
+    TextureDesc desc { texture->getPixelFormat(), texture->getWidth(), texture->getHeight(),
+        texture->getSamples() };
+    mResources.push_back(ResourceInfo { name, desc, texture, true, output, 0, 0 });
+    mCompiled = false;
+    return mResources.size() - 1;
+}
+
+void FrameGraph::setOutput(Resource resource, bool output)
+{
+    assert(resource < mResources.size());
+    mResources[resource].output = output;
+    mCompiled = false;
+}
+
+FrameGraph::Resource FrameGraph::getResource(const std::string& name) const
+{
+    for (size_t i = 0; i < mResources.size(); ++i) {
+        if (mResources[i].name == name)
+            return i;
+    }
+    return none;
+}
+
+const std::string& FrameGraph::getResourceName(Resource resource) const
+{
+    assert(resource < mResources.size());
+    return mResources[resource].name;
+}
+
+Texture* FrameGraph::getTexture(Resource resource) const
+{
+    assert(resource < mResources.size());
+    return mResources[resource].texture;
+}
+
+size_t FrameGraph::addPass(FramePass pass)
+{
+    std::vector<Resource> resources = getWrites(pass);
+    const std::vector<Resource> reads = getReads(pass);
+    resources.insert(resources.end(), reads.begin(), reads.end());
+    for (auto resource : resources) {
+        if (resource >= mResources.size()) {
+            LOG_ERROR("Invalid resource in frame graph pass '%s'", pass.name.c_str());
+            return none;
+        }
+    }
+    if (contains(pass.colorAttachments, window) || pass.depthStencil == window
+        || contains(reads, window)) {
+        LOG_ERROR("Passes without attachments render to the window, it can not be used in '%s'",
+            pass.name.c_str());
+        return none;
+    }
+    mPasses.push_back(std::move(pass));
+    mCompiled = false;
+    return mPasses.size() - 1;
+}
+
+size_t FrameGraph::addResolvePass(const std::string& name, const std::vector<Resource>& srcColor,
+    Resource srcDepthStencil, const std::vector<Resource>& dstColor, Resource dstDepthStencil)
+{
+    if (srcColor.empty() && srcDepthStencil == none) {
+        LOG_ERROR("Resolve pass '%s' has no source attachments", name.c_str());
+        return none;
+    }
+    FramePass pass;
+    pass.name = name;
+    pass.colorAttachments = dstColor;
+    pass.depthStencil = dstDepthStencil;
+    pass.resolveColorAttachments = srcColor;
+    pass.resolveDepthStencil = srcDepthStencil;
+    return addPass(std::move(pass));
+}
+
+std::vector<FrameGraph::Resource> FrameGraph::getWrites(const FramePass& pass) const
+{
+    std::vector<Resource> writes = pass.colorAttachments;
+    if (pass.depthStencil != none)
+        writes.push_back(pass.depthStencil);
+    if (writes.empty())
+        writes.push_back(window);
+    return writes;
+}
+
+std::vector<FrameGraph::Resource> FrameGraph::getReads(const FramePass& pass) const
+{
+    std::vector<Resource> reads = pass.reads;
+    reads.insert(
+        reads.end(), pass.resolveColorAttachments.begin(), pass.resolveColorAttachments.end());
+    if (pass.resolveDepthStencil != none)
+        reads.push_back(pass.resolveDepthStencil);
+    return reads;
+}
+
+bool FrameGraph::sortPasses(std::vector<size_t>& order) const
+{
+    const size_t passCount = mPasses.size();
+    std::vector<std::vector<size_t>> successors(passCount);
+    std::vector<size_t> inDegree(passCount, 0);
+    auto addEdge = [&](size_t from, size_t to) {
+        if (from != to) {
+            successors[from].push_back(to);
+            inDegree[to]++;
+        }
+    };
+
+    // Every access depends on the last write before it (in the order the passes were added) and
+    // writes wait for the reads of the previous contents. Transient textures have no previous
+    // contents, so reading them before they are written depends on the first write.
+    for (Resource resource = 0; resource < mResources.size(); ++resource) {
+        size_t firstWriter = none;
+        for (size_t p = 0; p < passCount && firstWriter == none; ++p) {
+            if (contains(getWrites(mPasses[p]), resource))
+                firstWriter = p;
+        }
+
+        size_t lastWriter = none;
+        std::vector<size_t> readers;
+        for (size_t p = 0; p < passCount; ++p) {
+            const bool writes = contains(getWrites(mPasses[p]), resource);
+            const bool reads = contains(getReads(mPasses[p]), resource);
+            if (reads && !writes) {
+                if (lastWriter != none) {
+                    addEdge(lastWriter, p);
+                    readers.push_back(p);
+                } else if (isTransient(resource)) {
+                    if (firstWriter != none)
+                        addEdge(firstWriter, p);
+                } else {
+                    readers.push_back(p);
+                }
+            }
+            if (writes) {
+                if (lastWriter != none)
+                    addEdge(lastWriter, p);
+                for (auto reader : readers)
+                    addEdge(reader, p);
+                readers.clear();
+                lastWriter = p;
+            }
+        }
+    }
+
+    // Kahn's algorithm, if there is a choice the pass that was added first comes first
+    order.clear();
+    std::vector<bool> done(passCount, false);
+    while (order.size() < passCount) {
+        size_t next = none;
+        for (size_t p = 0; p < passCount; ++p) {
+            if (!done[p] && inDegree[p] == 0) {
+                next = p;
+                break;
+            }
+        }
+        if (next == none) {
+            LOG_ERROR("Frame graph passes have cyclic dependencies");
+            return false;
+        }
+        done[next] = true;
+        order.push_back(next);
+        for (auto successor : successors[next])
+            inDegree[successor]--;
+    }
+    return true;
+}
+
+void FrameGraph::cullPasses(std::vector<size_t>& order) const
+{
+    // walking backwards, a resource is needed if a pass after this point uses its contents
+    std::vector<bool> needed(mResources.size(), false);
+    for (Resource resource = 0; resource < mResources.size(); ++resource)
+        needed[resource] = mResources[resource].output;
+
+    std::vector<size_t> alive;
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        const FramePass& pass = mPasses[*it];
+        const std::vector<Resource> writes = getWrites(pass);
+        if (std::none_of(writes.begin(), writes.end(), [&](Resource r) { return needed[r]; }))
+            continue;
+        alive.push_back(*it);
+        for (auto resource : writes) {
+            if (overwrites(pass, resource))
+                needed[resource] = false;
+        }
+        for (auto resource : getReads(pass))
+            needed[resource] = true;
+    }
+    order.assign(alive.rbegin(), alive.rend());
+}
+
+bool FrameGraph::compile()
+{
+    std::vector<size_t> order;
+    if (!sortPasses(order))
+        return false;
+    const size_t passCount = order.size();
+    cullPasses(order);
+    if (order.size() < passCount)
+        LOG_DEBUG("Culled %zu frame graph passes", passCount - order.size());
+
+    for (auto& resource : mResources) {
+        resource.firstUse = none;
+        resource.lastUse = 0;
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+        const FramePass& pass = mPasses[order[i]];
+        std::vector<Resource> resources = getWrites(pass);
+        const std::vector<Resource> reads = getReads(pass);
+        resources.insert(resources.end(), reads.begin(), reads.end());
+        for (auto resource : resources) {
+            ResourceInfo& info = mResources[resource];
+            info.firstUse = std::min(info.firstUse, i);
+            info.lastUse = std::max(info.lastUse, i);
+        }
+    }
+
+    mOrder = std::move(order);
+    mCompiled = true;
+    return true;
+}
+
+void FrameGraph::executePass(size_t orderIndex)
+{
+    // textures released by earlier passes are reused here if they have the same shape
+    for (auto& resource : mResources) {
+        if (!resource.imported && resource.firstUse == orderIndex) {
+            const TextureDesc& desc = resource.desc;
+            resource.texture
+                = acquireRenderTexture(desc.format, desc.width, desc.height, desc.samples);
+        }
+    }
+
+    auto getAttachments = [this](const std::vector<Resource>& colors) {
+        std::vector<const RenderAttachment*> attachments;
+        for (auto color : colors)
+            attachments.push_back(mResources[color].texture);
+        return attachments;
+    };
+    auto getAttachment = [this](Resource resource) -> const RenderAttachment* {
+        return resource != none ? mResources[resource].texture : nullptr;
+    };
+    // buffers that are not used after this pass
+    auto getDeadMask = [this, orderIndex](const std::vector<Resource>& colors, Resource depth) {
+        auto dead = [this, orderIndex](Resource resource) {
+            return isTransient(resource) && mResources[resource].lastUse == orderIndex;
+        };
+        GLbitfield mask = 0;
+        if (!colors.empty() && std::all_of(colors.begin(), colors.end(), dead))
+            mask |= GL_COLOR_BUFFER_BIT;
+        if (depth != none && dead(depth))
+            mask |= GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+        return mask;
+    };
+
+    const FramePass& pass = mPasses[mOrder[orderIndex]];
+    RenderTarget* target = setRenderTarget(
+        getAttachments(pass.colorAttachments), getAttachment(pass.depthStencil), false);
+    if (pass.isResolve()) {
+        const RenderTarget* source = RenderTarget::get(
+            getAttachments(pass.resolveColorAttachments), getAttachment(pass.resolveDepthStencil));
+        GLbitfield mask = 0;
+        if (!pass.resolveColorAttachments.empty())
+            mask |= GL_COLOR_BUFFER_BIT;
+        if (pass.resolveDepthStencil != none)
+            mask |= GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+        source->resolve(*target, mask, false);
+        source->invalidate(getDeadMask(pass.resolveColorAttachments, pass.resolveDepthStencil));
+    } else {
+        if (pass.clearColor) {
+            const size_t count = std::max<size_t>(1, pass.colorAttachments.size());
+            for (size_t i = 0; i < count; ++i)
+                kaun::clear(pass.clearColorValue, static_cast<int>(i));
+        }
+        if (pass.clearDepth)
+            kaun::clearDepth(pass.clearDepthValue);
+        if (pass.execute)
+            pass.execute();
+        flush();
+    }
+    target->invalidate(getDeadMask(pass.colorAttachments, pass.depthStencil));
+
+    for (auto& resource : mResources) {
+        if (!resource.imported && resource.lastUse == orderIndex && resource.texture) {
+            releaseRenderTexture(resource.texture);
+            resource.texture = nullptr;
+        }
+    }
+}
+
+bool FrameGraph::execute()
+{
+    if (!mCompiled && !compile())
+        return false;
+    for (size_t i = 0; i < mOrder.size(); ++i)
+        executePass(i);
+    return true;
+}
+
+void FrameGraph::clear()
+{
+    for (auto& resource : mResources) {
+        if (!resource.imported && resource.texture)
+            releaseRenderTexture(resource.texture);
+    }
+    mResources.clear();
+    mResources.push_back(ResourceInfo { "window", TextureDesc(), nullptr, true, true, 0, 0 });
+    mPasses.clear();
+    mOrder.clear();
+    mCompiled = false;
+}
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "renderattachment.hpp"
+#include "texture.hpp"
+
+namespace kaun {
+struct FramePass {
+    using Resource = size_t;
+    static constexpr Resource none = static_cast<Resource>(-1);
+
+    std::string name;
+    // A pass without any attachments renders to the window
+    std::vector<Resource> colorAttachments;
+    Resource depthStencil = none;
+    // textures that are sampled in the pass
+    std::vector<Resource> reads;
+    // A cleared attachment doesn't need its previous contents, so the passes writing them before
+    // might be culled
+    bool clearColor = false;
+    glm::vec4 clearColorValue = glm::vec4(0.0f);
+    bool clearDepth = false;
+    float clearDepthValue = 1.0f;
+    // If any of these are set, they are resolved into the attachments instead of calling execute
+    std::vector<Resource> resolveColorAttachments;
+    Resource resolveDepthStencil = none;
+    // queues the draws of the pass, it is flushed afterwards
+    std::function<void()> execute;
+
+    bool isResolve() const
+    {
+        return !resolveColorAttachments.empty() || resolveDepthStencil != none;
+    }
+};
+
+// Declarative render passes. Passes declare the attachments they write and the textures they
+// read and the graph
+// - orders them, so every pass comes after the passes writing what it reads,
+// - culls passes whose results are never used by a pass that writes an output (the window),
+// - allocates transient textures from the render texture pool for the passes using them only,
+//   so transient textures with the same shape and non-overlapping lifetimes share memory,
+// - clears the attachments at the start of a pass and invalidates transient attachments after
+//   the last pass using them.
+class FrameGraph {
+public:
+    using Resource = FramePass::Resource;
+    static constexpr Resource none = FramePass::none;
+    // the window's framebuffer, always an output
+    static constexpr Resource window = 0;
+
+    struct TextureDesc {
+        PixelFormat format = PixelFormat::NONE;
+        int width = 0, height = 0;
+        size_t samples = 0;
+    };
+
+private:
+    struct ResourceInfo {
+        std::string name;
+        TextureDesc desc;
+        // imported or acquired from the pool (only between the first and last use)
+        Texture* texture;
+        bool imported;
+        bool output;
+        // indices into mOrder
+        size_t firstUse, lastUse;
+    };
+
+    std::vector<ResourceInfo> mResources;
+    std::vector<FramePass> mPasses;
+    // the passes that are not culled in execution order
+    std::vector<size_t> mOrder;
+    bool mCompiled;
+
+    bool isTransient(Resource resource) const
+    {
+        return !mResources[resource].imported;
+    }
+    std::vector<Resource> getWrites(const FramePass& pass) const;
+    std::vector<Resource> getReads(const FramePass& pass) const;
+    bool sortPasses(std::vector<size_t>& order) const;
+    void cullPasses(std::vector<size_t>& order) const;
+    void executePass(size_t orderIndex);
+
+public:
+    FrameGraph();
+    ~FrameGraph();
+
+    FrameGraph(const FrameGraph& other) = delete;
+    FrameGraph& operator=(const FrameGraph& other) = delete;
+
+    // Transient textures only exist while passes using them are executed
+    Resource createTexture(const std::string& name, const TextureDesc& desc);
+    // The texture has to outlive the graph. Imported textures are outputs if output is true.
+    Resource importTexture(const std::string& name, Texture* texture, bool output = false);
+    void setOutput(Resource resource, bool output);
+    // none if there is no resource with this name
+    Resource getResource(const std::string& name) const;
+    const std::string& getResourceName(Resource resource) const;
+    // Transient textures are only valid during the passes that use them
+    Texture* getTexture(Resource resource) const;
+
+    // Returns the index of the pass or none if the resources are invalid
+    size_t addPass(FramePass pass);
+    // Resolves (blits) the source attachments into the destination (the window if there are none)
+    size_t addResolvePass(const std::string& name, const std::vector<Resource>& srcColor,
+        Resource srcDepthStencil, const std::vector<Resource>& dstColor, Resource dstDepthStencil);
+    const FramePass& getPass(size_t index) const
+    {
+        return mPasses[index];
+    }
+    size_t getPassCount() const
+    {
+        return mPasses.size();
+    }
+
+    // Sorts and culls the passes. Returns false if there is a cycle.
+    bool compile();
+    // Compiles if the graph changed since the last compile
+    bool execute();
+    // Removes all passes and resources except the window
+    void clear();
+
+    // indices of the passes that are executed, in order
+    const std::vector<size_t>& getExecutionOrder() const
+    {
+        return mOrder;
+    }
+};
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "aabb.hpp"
+
+namespace kaun {
+struct Frustum {
+    // xyz = normal pointing inside, w = distance
+    glm::vec4 planes[6];
+
+    // Gribb/Hartmann: the frustum in the space that matrix transforms from, e.g. pass a
+    // model-view-projection matrix to get the frustum in model space
+    Frustum(const glm::mat4& matrix)
+    {
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; ++i)
+            rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+        for (int i = 0; i < 3; ++i) {
+            planes[i * 2 + 0] = rows[3] + rows[i];
+            planes[i * 2 + 1] = rows[3] - rows[i];
+        }
+    }
+
+    // conservative: might return true for boxes just outside of the corners
+    bool intersects(const AABoundingBox& box) const
+    {
+        for (int i = 0; i < 6; ++i) {
+            // the corner furthest along the plane normal
+            glm::vec3 corner;
+            for (int c = 0; c < 3; ++c)
+                corner[c] = planes[i][c] >= 0.0f ? box.max[c] : box.min[c];
+            if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+}
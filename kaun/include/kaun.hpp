@@ -3,16 +3,30 @@
 #include <glad/glad.h>
 
 #include "aabb.hpp"
+#include "framegraph.hpp"
 #include "log.hpp"
 #include "mesh.hpp"
+#include "mesh_arena.hpp"
+#include "mipmap.hpp"
+#include "noise.hpp"
+#include "pixelbuffer.hpp"
 #include "render.hpp"
 #include "renderstate.hpp"
 #include "rendertarget.hpp"
+#include "rendertexturepool.hpp"
+#include "sampler.hpp"
 #include "shader.hpp"
+#include "shadowatlas.hpp"
 #include "signal.hpp"
+#include "terrain.hpp"
 #include "texture.hpp"
+#include "texture_atlas.hpp"
+#include "texture_compression.hpp"
+#include "texture_loader.hpp"
+#include "texture_manager.hpp"
 #include "transform.hpp"
 #include "utility.hpp"
+#include "view.hpp"
 #include "window.hpp"
 
 #include <glm/glm.hpp>
@@ -8,10 +8,32 @@
 
 #include "aabb.hpp"
 #include "log.hpp"
+#include "mesh_arena.hpp"
 #include "mesh_buffers.hpp"
 #include "mesh_vertexaccessor.hpp"
 
 namespace kaun {
+// A small, spatially coherent group of triangles (a "meshlet"), used for culling parts of large
+// meshes. The cone is in the format described here:
+// https://github.com/zeux/meshoptimizer#cluster-culling
+struct MeshCluster {
+    size_t firstIndex;
+    size_t count;
+    AABoundingBox bounds;
+    glm::vec3 sphereCenter;
+    float sphereRadius;
+    glm::vec3 coneAxis;
+    // 1.0 if the cluster can never be backfacing
+    float coneCutoff;
+
+    // Backfacing from every point of view inside the bounding sphere (in model space)
+    bool backfacing(const glm::vec3& cameraPosition) const
+    {
+        glm::vec3 rel = sphereCenter - cameraPosition;
+        return glm::dot(rel, coneAxis) >= coneCutoff * glm::length(rel) + sphereRadius;
+    }
+};
+
 class Mesh {
 public:
     enum class DrawMode : GLenum {
@@ -25,16 +47,42 @@ public:
     };
 
 private:
+    friend class MeshArena;
+
     DrawMode mMode;
     GLuint mVAO;
     std::vector<std::unique_ptr<VertexBuffer>> mVertexBuffers;
     std::unique_ptr<IndexBuffer> mIndexBuffer;
+    // The stream offsets the attribute pointers of each vertex buffer were last set up with
+    std::vector<size_t> mAttributeOffsets;
+    // If the mesh was added to an arena, it is drawn from the arena's buffers
+    MeshArena* mArena;
+    MeshArena::Allocation mArenaAllocation;
+    std::vector<DrawRange> mDrawRanges;
+    std::vector<MeshCluster> mClusters;
 
     mutable AABoundingBox mBoundingBox;
     mutable bool mBBoxDirty;
 
     static GLuint currentVAO;
 
+    // expects the VAO and the vertex buffer to be bound
+    void setAttributePointers(size_t bufferIndex);
+
+    void transformVertices(const glm::mat4& transform, size_t firstVertex, size_t count,
+        const std::vector<AttributeType>& pointAttributes,
+        const std::vector<AttributeType>& vectorAttributes);
+
+    // number of indices or, if there is no index buffer, vertices
+    size_t getElementCount() const;
+    // The VAO is recompiled on the next draw and the clusters, which refer to the old indices, are
+    // removed. Draw ranges are kept, unless they exceed the new index count (an error is logged).
+    void replaceIndexBuffer(std::unique_ptr<IndexBuffer> indexBuffer);
+    // compiles, uploads and binds everything necessary for a draw call
+    void prepareDraw();
+    void fenceBuffers();
+    void drawElements(size_t first, size_t count, int baseVertex, size_t instanceCount);
+
 public:
     static void ensureGlState();
 
@@ -42,10 +90,17 @@ public:
         : mMode(mode)
         , mVAO(0)
         , mIndexBuffer(nullptr)
+        , mArena(nullptr)
         , mBBoxDirty(true)
     {
     }
 
+    ~Mesh()
+    {
+        if (mArena != nullptr)
+            mArena->remove(*this);
+    }
+
     // I'm not really sure what I want these to do
     Mesh(const Mesh& other) = delete;
     Mesh& operator=(const Mesh& other) = delete;
@@ -77,6 +132,13 @@ public:
     // returns nullptr if the given attribute is not present in any vertexbuffer
     VertexBuffer* hasAttribute(AttributeType attrType) const;
 
+    // Copies size bytes of raw vertex data (interleaved, in the vertex format of the buffer) to
+    // byteOffset in the vertex buffer with the given index. The buffer grows if necessary, which
+    // invalidates pointers to its data.
+    bool setVertexData(const void* data, size_t byteOffset, size_t size, size_t bufferIndex = 0);
+    // Call this after writing to the data of a vertex buffer directly
+    void markVertexDataDirty(size_t byteOffset, size_t size, size_t bufferIndex = 0);
+
     template <typename T>
     VertexAttributeAccessor<T> getAccessor(AttributeType attrType) const
     {
@@ -89,19 +151,91 @@ public:
     }
 
     // add might be confusing since every Mesh object can only hold a single instance of IndexBuffer
-    // if another one is added, the old one is detached and free'd
+    // if another one is added, the old one is detached and free'd (see replaceIndexBuffer)
     template <typename... Ts>
     IndexBuffer* setIndexBuffer(Ts&&... args)
     {
-        IndexBuffer* iData = new IndexBuffer(std::forward<Ts>(args)...);
-        mIndexBuffer.reset(iData);
-        return iData;
+        replaceIndexBuffer(std::make_unique<IndexBuffer>(std::forward<Ts>(args)...));
+        return mIndexBuffer.get();
+    }
+
+    // Replaces the index buffer with count indices of the given type read from data. The type of
+    // the index buffer is picked from the number of vertices (see getIndexBufferType), so it may
+    // differ from type. Fails if an index is out of range for the first vertex buffer.
+    // Removes the clusters and the draw ranges that exceed the new index count, so don't call it
+    // between kaun::draw and kaun::flush.
+    IndexBuffer* setIndices(const void* data, IndexBufferType type, size_t count,
+        UsageHint usage = UsageHint::STATIC);
+
+    IndexBuffer* getIndexBuffer()
+    {
+        return mIndexBuffer.get();
+    }
+
+    DrawMode getDrawMode() const
+    {
+        return mMode;
+    }
+
+    MeshArena* getArena() const
+    {
+        return mArena;
+    }
+
+    const MeshArena::Allocation& getArenaAllocation() const
+    {
+        return mArenaAllocation;
+    }
+
+    // The VAO used to draw this mesh (the arena's, if it is in one)
+    GLuint getVertexArray() const
+    {
+        return mArena != nullptr ? mArena->getVertexArray() : mVAO;
+    }
+
+    // Adding a range invalidates pointers to the other ranges of this mesh. The range has to be
+    // inside the indices (or the vertices if there are none). Returns nullptr if it is not.
+    const DrawRange* addDrawRange(const std::string& name, size_t firstIndex, size_t count,
+        int baseVertex = 0, int materialSlot = -1);
+
+    const std::vector<DrawRange>& getDrawRanges() const
+    {
+        return mDrawRanges;
+    }
+
+    // returns nullptr if there is no range with that name
+    const DrawRange* getDrawRange(const std::string& name) const;
+
+    void clearDrawRanges()
+    {
+        mDrawRanges.clear();
+    }
+
+    // Reorders the triangles of an indexed TRIANGLES mesh, so they can be split into clusters of at
+    // most maxVertices unique vertices and maxTriangles triangles. Triangles are not moved across
+    // draw range boundaries, so existing draw ranges stay valid. If the index buffer is changed
+    // afterwards, the clusters need to be rebuilt (and the mesh added to its arena again).
+    // If clusters are present, kaun::draw culls them against the view frustum and (if back faces
+    // are culled) for backfacing and only draws the visible ones.
+    bool buildClusters(size_t maxVertices = 64, size_t maxTriangles = 124);
+
+    const std::vector<MeshCluster>& getClusters() const
+    {
+        return mClusters;
+    }
+
+    void clearClusters()
+    {
+        mClusters.clear();
     }
 
     void compile();
 
     // instanceCount = 0 means, that the draw commands will not be instanced
     void draw(size_t instanceCount = 0);
+    void draw(const DrawRange& range, size_t instanceCount = 0);
+    // Draws the clusters with the given indices with a single multi-draw
+    void drawClusters(const uint32_t* clusters, size_t count);
 
     // ---- geometry manipulation
     // these functions are here (and not in VertexBuffer), because some of them have to
@@ -122,6 +256,14 @@ public:
         const std::vector<AttributeType>& vectorAttributes
         = { AttributeType::NORMAL, AttributeType::TANGENT, AttributeType::BITANGENT });
 
+    // uv' = uv * scale + offset, with uvTransform = (scale, offset), e.g. from an AtlasRegion.
+    // If layer >= 0 and the attribute has at least 3 components, z is set to the layer (for
+    // array textures). Layers above 0 fail with 2 component texture coordinates. Meshes that
+    // share an atlas texture this way can be merged (see merge) or put into an arena, so they can
+    // be drawn with a single draw call.
+    bool remapTexCoords(const glm::vec4& uvTransform, int layer = -1,
+        AttributeType attrType = AttributeType::TEXCOORD0);
+
     const AABoundingBox& boundingBox() const;
 
     // Centroid of the bounding box
@@ -140,6 +282,22 @@ public:
     // Make sure this can be used to make a "line mesh"?
     static Mesh* plane(
         float width, float height, int segmentsX, int segmentsY, const VertexFormat& format);
+    // Like plane(), but the y coordinates are taken from heights, which has
+    // (segmentsX + 1) * (segmentsY + 1) values (rows along x, e.g. from fbmNoise), multiplied by
+    // heightScale. The normals are calculated from the neighbouring heights.
+    static Mesh* plane(float width, float height, int segmentsX, int segmentsY,
+        const float* heights, float heightScale, const VertexFormat& format);
+
+    // Bakes the transforms into the vertices (like transform()) and merges all meshes into a single
+    // indexed mesh. All meshes need to have the same draw mode (POINTS, LINES or TRIANGLES) and a
+    // single vertex buffer with the same vertex format. Every source mesh gets a draw range named
+    // "source<n>" (n being the index into meshes). The sources are also grouped into cubic chunks
+    // of chunkSize (by the center of their bounding box), each of which gets a draw range named
+    // "chunk<n>" with its bounding box, so the chunks can be culled separately. chunkSize <= 0
+    // puts everything into one chunk. The draw ranges of the sources come last, named
+    // "source<n>:<name>" and with their material slots.
+    static Mesh* merge(
+        const std::vector<std::pair<Mesh*, glm::mat4>>& meshes, float chunkSize = 0.0f);
 
     static Mesh* objFile(const std::string& filename, const VertexFormat& format);
     static Mesh* objFile(const uint8_t* buffer, size_t size, const VertexFormat& format);
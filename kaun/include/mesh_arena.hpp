@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "mesh_buffers.hpp"
+#include "mesh_vertexformat.hpp"
+
+namespace kaun {
+class Mesh;
+
+// First-fit allocator over [0, capacity). Freed blocks are coalesced with their neighbours.
+class FreeList {
+private:
+    // offset, size - sorted by offset
+    std::vector<std::pair<size_t, size_t>> mFree;
+    size_t mCapacity;
+
+public:
+    static const size_t INVALID = SIZE_MAX;
+
+    FreeList(size_t capacity)
+        : mFree { std::make_pair(0, capacity) }
+        , mCapacity(capacity)
+    {
+    }
+
+    // returns INVALID if there is no block large enough
+    size_t allocate(size_t size);
+    void free(size_t offset, size_t size);
+
+    size_t getCapacity() const
+    {
+        return mCapacity;
+    }
+    size_t getFreeCount() const;
+};
+
+// A MeshArena holds the vertex and index data of many meshes with the same vertex format in a
+// single VBO/IBO pair (and a single VAO), so they can be drawn without switching buffers and
+// consecutive draws can be merged into glMultiDrawElementsBaseVertex calls in flush().
+// Meshes in an arena should be static: the data is copied into the arena when the mesh is added,
+// so later changes to the mesh's own buffers are not visible until it is added again.
+class MeshArena {
+public:
+    struct Allocation {
+        size_t baseVertex;
+        size_t vertexCount;
+        size_t firstIndex;
+        size_t indexCount;
+    };
+
+private:
+    VertexFormat mVertexFormat;
+    VertexBuffer mVertices;
+    IndexBuffer mIndices;
+    FreeList mFreeVertices;
+    FreeList mFreeIndices;
+    GLuint mVAO;
+    std::vector<Mesh*> mMeshes;
+
+    void compile();
+
+public:
+    // Index values are relative to the base vertex of each mesh, so the index type is chosen
+    // from vertexCapacity, which is an upper bound for the size of a single mesh.
+    MeshArena(const VertexFormat& format, size_t vertexCapacity, size_t indexCapacity);
+    ~MeshArena();
+
+    MeshArena(const MeshArena& other) = delete;
+    MeshArena& operator=(const MeshArena& other) = delete;
+
+    const VertexFormat& getVertexFormat() const
+    {
+        return mVertexFormat;
+    }
+
+    // The mesh needs to have a single vertex buffer with the arena's vertex format and no
+    // instanced attributes. Meshes without an index buffer get sequential indices.
+    // Returns false if the mesh is not compatible or the arena is full.
+    bool add(Mesh& mesh);
+    void remove(Mesh& mesh);
+
+    size_t getFreeVertexCount() const
+    {
+        return mFreeVertices.getFreeCount();
+    }
+    size_t getFreeIndexCount() const
+    {
+        return mFreeIndices.getFreeCount();
+    }
+
+    GLuint getVertexArray() const
+    {
+        return mVAO;
+    }
+
+    // uploads pending changes and binds the VAO
+    void bind();
+
+    // firstIndex and baseVertex are relative to the mesh's allocation
+    void draw(const Mesh& mesh, size_t firstIndex, size_t count, int baseVertex = 0,
+        size_t instanceCount = 0);
+    // All meshes need to be in this arena and have the same draw mode.
+    // If the range is nullptr, the whole mesh is drawn.
+    void draw(const std::vector<std::pair<const Mesh*, const DrawRange*>>& draws);
+};
+}
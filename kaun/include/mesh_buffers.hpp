@@ -2,10 +2,13 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <glad/glad.h>
 
+#include "aabb.hpp"
 #include "mesh_vertexformat.hpp"
 
 namespace kaun {
@@ -16,6 +19,11 @@ enum class UsageHint : GLenum {
 };
 
 class GLBuffer {
+public:
+    // If more ranges than this are dirty, the two closest ones are merged
+    static const size_t MAX_DIRTY_RANGES = 8;
+    static const size_t STREAM_REGIONS = 3;
+
 protected:
     GLenum mTarget;
     int mSize;
@@ -27,6 +35,25 @@ protected:
     GLuint mBufferObject;
     int mLastUploadedSize;
     int mUploadCount;
+    // Sorted, non-overlapping [begin, end) byte ranges that have changed since the last upload
+    std::vector<std::pair<size_t, size_t>> mDirtyRanges;
+    size_t mUploadedBytes;
+    // STREAM and DYNAMIC buffers are a ring of STREAM_REGIONS copies of the data. Every upload
+    // goes to the next region, so we never write to memory the GPU might still be reading from.
+    // Only the dirty ranges come from the CPU, the rest is copied from the previous region.
+    size_t mStreamRegion;
+    GLsync mStreamFences[STREAM_REGIONS];
+    // Whether draws read from the current region. It is fenced by the next upload, after the copy
+    // out of it.
+    bool mStreamRegionUsed;
+
+    static size_t totalUploadedBytes;
+    static size_t totalStreamStalls;
+
+    size_t uploadStreaming();
+    void writeStreamRange(size_t offset, size_t size);
+    void fenceStreamRegion(size_t region);
+    void deleteStreamFences();
 
 public:
     // GLBuffer does take ownership of the data passed to it!
@@ -38,11 +65,18 @@ public:
         , mBufferObject(0)
         , mLastUploadedSize(0)
         , mUploadCount(0)
+        , mUploadedBytes(0)
+        , mStreamRegion(0)
+        , mStreamRegionUsed(false)
     {
+        for (auto& fence : mStreamFences)
+            fence = nullptr;
+        markDirty();
     }
 
     ~GLBuffer()
     {
+        deleteStreamFences();
         if (mBufferObject != 0)
             glDeleteBuffers(1, &mBufferObject);
     }
@@ -53,8 +87,50 @@ public:
     // http://hacksoflife.blogspot.de/2015/06/glmapbuffer-no-longer-cool.html - Don't implement
     // map()?
 
+    // Uploads the whole buffer (only the dirty ranges for STREAM and DYNAMIC buffers)
     void upload();
 
+    // Uploads only the dirty ranges (or the whole buffer, if it has never been uploaded or was
+    // reallocated since)
+    void flush();
+
+    void markDirty(size_t offset, size_t size);
+    void markDirty()
+    {
+        mDirtyRanges.clear();
+        markDirty(0, mSize);
+    }
+
+    bool isDirty() const
+    {
+        return mDirtyRanges.size() > 0;
+    }
+
+    const std::vector<std::pair<size_t, size_t>>& getDirtyRanges() const
+    {
+        return mDirtyRanges;
+    }
+
+    bool isStreaming() const
+    {
+        return mUsage != UsageHint::STATIC;
+    }
+
+    // The offset (in bytes) of the data that was last uploaded inside the buffer object.
+    // This is always 0 for STATIC buffers.
+    size_t getStreamOffset() const
+    {
+        return mStreamRegion * mSize;
+    }
+
+    // Call this after submitting draw commands that read from the current stream region, so the
+    // region is not overwritten before the GPU is done with it. This is cheap, the fence is only
+    // created once per region, when the next upload moves on to another one.
+    void fence()
+    {
+        mStreamRegionUsed = isStreaming();
+    }
+
     virtual void reallocate(size_t num, bool copyOld) = 0;
 
     virtual void* getData()
@@ -72,6 +148,29 @@ public:
         return mUploadCount;
     }
 
+    // Number of bytes sent to the GPU for this buffer since it was created
+    size_t getUploadedBytes() const
+    {
+        return mUploadedBytes;
+    }
+
+    // Number of bytes sent to the GPU for all buffers since the last reset
+    static size_t getTotalUploadedBytes()
+    {
+        return totalUploadedBytes;
+    }
+
+    static void resetTotalUploadedBytes()
+    {
+        totalUploadedBytes = 0;
+    }
+
+    // Number of times an upload had to wait for the GPU to release a stream region
+    static size_t getTotalStreamStalls()
+    {
+        return totalStreamStalls;
+    }
+
     // If you uploaded your data, you can call release to delete the local copy
     void freeLocal()
     {
@@ -80,8 +179,7 @@ public:
 
     void bind()
     {
-        if (mUploadCount == 0)
-            upload();
+        flush();
         glBindBuffer(mTarget, mBufferObject);
     }
 };
@@ -217,4 +315,17 @@ public:
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     }
 };
+
+// A named part of a mesh, e.g. all faces using the same material. For meshes without an index
+// buffer firstIndex and count refer to vertices and baseVertex is ignored.
+struct DrawRange {
+    std::string name;
+    size_t firstIndex;
+    size_t count;
+    int baseVertex;
+    // -1 if there is no material associated with this range
+    int materialSlot;
+    // Optional (empty if unknown), range draws are culled with it
+    AABoundingBox bounds;
+};
 }
@@ -17,6 +17,7 @@ class VertexAttributeAccessor {
         "Invalid Type for VertexAttributeAccessor");
 
 private:
+    VertexBuffer* mBuffer;
     void* mData;
     int mSize;
     int mStride;
@@ -55,7 +56,8 @@ public:
     // This is an invalid VertexAttributeAccessor. This only exists so I can return invalid
     // accessors from Mesh::getAccessor
     VertexAttributeAccessor()
-        : mData(nullptr)
+        : mBuffer(nullptr)
+        , mData(nullptr)
         , mSize(0)
         , mStride(0)
         , mCount(0)
@@ -65,7 +67,8 @@ public:
     }
 
     VertexAttributeAccessor(VertexBuffer& buffer, AttributeType attrType)
-        : mData(nullptr)
+        : mBuffer(&buffer)
+        , mData(nullptr)
         , mSize(0)
         , mStride(0)
         , mCount(0)
@@ -101,7 +104,9 @@ public:
     void set(int index, const T& val)
     {
         assert(isValid());
-        return setInternal(index, val);
+        setInternal(index, val);
+        mBuffer->markDirty(mStride * index + mAttr->offset,
+            getAttributeDataTypeSize(mAttr->dataType) * mAttr->num);
     }
 };
 
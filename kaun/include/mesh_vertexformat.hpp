@@ -95,6 +95,9 @@ public:
     // returns *this, so you can chain them
     VertexFormat& add(AttributeType attrType, int num, AttributeDataType dataType,
         bool normalized = false, unsigned int divisor = 0);
+
+    // same attributes in the same order with the same layout
+    bool operator==(const VertexFormat& other) const;
 };
 
 extern VertexFormat defaultVertexFormat;
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kaun {
+enum class MipmapFilter {
+    BOX, // averages the pixels covered by the smaller one
+    KAISER, // Kaiser windowed sinc, sharper, but slower
+};
+
+struct MipmapParams {
+    MipmapFilter filter = MipmapFilter::BOX;
+    // The color channels (not alpha) are sRGB encoded and are filtered in linear space.
+    // Only used for images with 3 or 4 components.
+    bool srgb = false;
+    // If > 0, the alpha of every level is scaled, so the fraction of pixels with an alpha above
+    // this stays the same as in the base level. Alpha tested textures (foliage) fade out in the
+    // distance otherwise. Only used for images with 4 components.
+    float alphaCoverageReference = 0.0f;
+    // 0 goes down to 1x1
+    int maxLevels = 0;
+    // 0 uses as many threads as there are hardware threads
+    int threadCount = 0;
+};
+
+// An 8 bit image with all its levels (levels[0] is the base level)
+struct MipChain {
+    struct Level {
+        int width, height;
+        size_t offset, size; // into data
+    };
+
+    int components = 0;
+    std::vector<Level> levels;
+    std::vector<uint8_t> data;
+
+    const uint8_t* getLevelData(size_t level) const
+    {
+        return data.data() + levels[level].offset;
+    }
+};
+
+// Builds the mip chain of width * height pixels with 1-4 components each on the CPU, so it can be
+// done on a worker thread and doesn't depend on the driver's filtering.
+void buildMipChain(const uint8_t* pixels, int width, int height, int components, MipChain& chain,
+    const MipmapParams& params = MipmapParams());
+}
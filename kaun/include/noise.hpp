@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "texture.hpp"
+
+namespace kaun {
+// Fractal brownian motion: a weighted sum of octaves of 2D gradient noise.
+// Sample (x, y) of a width * height map is evaluated at (x / width, y / height) * frequency, with
+// the frequency starting at baseFrequency and being multiplied by frequencyFactor every octave,
+// so the result is independent of the resolution.
+struct FbmParams {
+    float baseFrequency = 1.0f;
+    float frequencyFactor = 2.0f;
+    // One weight per octave. They are normalized, so the result is always in [0, 1].
+    std::vector<float> octaveWeights = { 1.0f, 0.5f, 0.25f, 0.125f };
+    // height = pow(height, redistribution), applied after the hull falloff.
+    // > 1 makes valleys flatter, < 1 makes peaks flatter.
+    float redistribution = 1.0f;
+    // If > 0, the height is multiplied by 1 inside a circle with this radius around the center
+    // (in normalized coordinates) and falls off linearly to 0 at a distance of 0.5 (islands).
+    float hullRadius = 0.0f;
+    uint32_t seed = 0;
+};
+
+// Single octave of gradient noise in [-1, 1]
+float gradientNoise(float x, float y, uint32_t seed = 0);
+
+// Writes width * height values (rows along x) into out. The rows are split between threadCount
+// threads. threadCount = 0 uses as many threads as there are hardware threads.
+void fbmNoise(float* out, int width, int height, const FbmParams& params, int threadCount = 0);
+std::vector<float> fbmNoise(int width, int height, const FbmParams& params, int threadCount = 0);
+
+// Single channel texture (R32F or R16F)
+Texture* fbmNoiseTexture(int width, int height, const FbmParams& params,
+    PixelFormat format = PixelFormat::R32F, int threadCount = 0);
+}
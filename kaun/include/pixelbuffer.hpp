@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <glad/glad.h>
+
+namespace kaun {
+// Summed over all pixel buffer rings
+struct PixelBufferStats {
+    size_t bytes = 0; // mapped for writing
+    size_t uploads = 0;
+    size_t stalls = 0; // maps that had to wait for the GPU
+    size_t busy = 0; // maps that failed, because the buffer was still in use
+};
+
+// A ring of pixel unpack buffers used to upload texture data asynchronously. Write the data into
+// the mapped buffer, then call glTex(Sub)Image with offsets into it instead of pointers.
+// Every buffer is fenced after use, so the CPU never writes into a buffer the GPU is still
+// reading from and the uploads don't have to wait for the copy to finish.
+class PixelBufferRing {
+private:
+    struct Buffer {
+        GLuint object;
+        size_t size;
+        GLsync fence;
+    };
+
+    std::vector<Buffer> mBuffers;
+    size_t mCurrent;
+    bool mMapped;
+
+public:
+    PixelBufferRing(size_t count = 3);
+    ~PixelBufferRing();
+
+    PixelBufferRing(const PixelBufferRing& other) = delete;
+    PixelBufferRing& operator=(const PixelBufferRing& other) = delete;
+
+    // Maps the next buffer for writing (at least size bytes). If the GPU is still reading from
+    // it, this returns nullptr, unless wait is true.
+    void* map(size_t size, bool wait = false);
+    // Unmaps the buffer and binds it to GL_PIXEL_UNPACK_BUFFER. Issue the uploads after this.
+    // Returns false if the data got corrupted while it was mapped.
+    bool unmap();
+    // Fences the buffer after the uploads have been issued and unbinds it
+    void finish();
+
+    // Whether the next buffer can be mapped without waiting
+    bool isNextAvailable() const;
+
+    size_t getCount() const
+    {
+        return mBuffers.size();
+    }
+
+    // The stats of the last finished frame
+    static const PixelBufferStats& getFrameStats();
+    static void endFrame();
+};
+}
@@ -9,13 +9,30 @@
 #include "shader.hpp"
 #include "transform.hpp"
 #include "uniform.hpp"
+#include "view.hpp"
 
 namespace kaun {
+// Clears are queued like draws and start a new pass on the current render target. Draws are only
+// sorted within their pass.
 void clear(const glm::vec4& color = glm::vec4(0.0f), int colorAttachmentIndex = 0);
 void clearDepth(float value = 1.0f);
+// Starts a new pass on the current render target without clearing
+void nextPass();
+// Clear the view's render target (limited to its scissor rectangle)
+void clear(
+    const View& view, const glm::vec4& color = glm::vec4(0.0f), int colorAttachmentIndex = 0);
+void clearDepth(const View& view, float value = 1.0f);
 void setViewport();
 void setViewport(int x, int y, int w, int h);
 void setViewport(const glm::ivec4& viewport);
+// Like the viewport, queued draws and clears use the scissor rectangle that was current when they
+// were queued. It is not changed by setRenderTarget.
+void setScissor(int x, int y, int w, int h);
+void setScissor(const glm::ivec4& rect);
+// Disables the scissor test
+void resetScissor();
+// The width is negative if the scissor test is disabled
+const glm::ivec4& getScissor();
 void setSrgbEnabled(bool enabled);
 bool getSrgbEnabled();
 
@@ -32,14 +49,38 @@ glm::mat4 getModelMatrix();
 // http://supercomputingblog.com/windows/ordered-map-vs-unordered-map-a-performance-study/
 void draw(Mesh& mesh, Shader& shader, const std::vector<Uniform>& uniforms,
     const RenderState& state = defaultRenderState);
+// Only draws a part of the mesh. The range is copied, so it doesn't have to stay alive until
+// flush(). It is culled if it has bounds (which are in model space) outside of the view frustum.
+void draw(Mesh& mesh, const DrawRange& range, Shader& shader, const std::vector<Uniform>& uniforms,
+    const RenderState& state = defaultRenderState);
+// Queues the draw for every view whose frustum intersects the mesh's bounding box (transformed by
+// the current model matrix), so meshes displaced in their shaders need bounds that include that.
+// The mesh is culled and the uniforms are converted once for all views.
+void draw(const std::vector<const View*>& views, Mesh& mesh, Shader& shader,
+    const std::vector<Uniform>& uniforms, const RenderState& state = defaultRenderState);
+// Tests the bounds of the range instead, if it has any
+void draw(const std::vector<const View*>& views, Mesh& mesh, const DrawRange& range,
+    Shader& shader, const std::vector<Uniform>& uniforms,
+    const RenderState& state = defaultRenderState);
 
 enum class SortType {
     DEFAULT, // sort by shader, textures, etc.
     SUBMISSION, // sort by order of submission
 };
 
+// Every queued draw and clear remembers the render target, viewport and scissor rectangle that
+// were current when it was queued, so draws to different targets can be queued in any order. The
+// targets are drawn in the order they were first used in, but a target whose attachments are
+// sampled by draws to another target is drawn before that one. The current render target,
+// viewport and scissor rectangle are the same afterwards. setRenderTarget flushes before switching
+// to a target that queued draws sample, so rendering to it again (e.g. ping-pong blurs) doesn't
+// change what those draws see. Deleting an attachment of a target with queued entries flushes them.
 void flush(SortType sortType = SortType::DEFAULT);
 
+bool isQueuedRenderTarget(const RenderTarget& target);
+// Whether queued draws to other render targets sample attachments of target
+bool isSampledByQueuedDraws(const RenderTarget& target);
+
 void ensureGlState();
 void checkGlError();
 }
@@ -1,8 +1,25 @@
 #pragma once
 
+#include <cstddef>
+#include <utility>
+
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+// The loader only has core GL 3.3, which includes RGTC (BC4/BC5), but not these
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
 namespace kaun {
 enum class PixelFormat : GLenum {
     NONE = 0, // for default arguments and such
@@ -28,13 +45,48 @@ enum class PixelFormat : GLenum {
     DEPTH32F = GL_DEPTH_COMPONENT32F,
     DEPTH32F_STENCIL8 = GL_DEPTH32F_STENCIL8,
     DEPTH24_STENCIL8 = GL_DEPTH24_STENCIL8,
-    STENCIL8 = GL_STENCIL_INDEX8
+    STENCIL8 = GL_STENCIL_INDEX8,
+    // Block compressed, 4x4 pixel blocks. These can only be sampled from.
+    BC1 = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, // DXT1
+    BC1_SRGB = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT,
+    BC3 = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, // DXT5
+    BC3_SRGB = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT,
+    BC4 = GL_COMPRESSED_RED_RGTC1,
+    BC5 = GL_COMPRESSED_RG_RGTC2,
+    BC7 = GL_COMPRESSED_RGBA_BPTC_UNORM,
+    BC7_SRGB = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
 };
 
+// Bytes per pixel of tightly packed client side data in this format (see getPixelTransferFormat)
+// 0 for compressed formats
+size_t getPixelSize(PixelFormat format);
+bool isCompressed(PixelFormat format);
+// Bytes per 4x4 block of a compressed format, 0 otherwise
+size_t getBlockSize(PixelFormat format);
+// Bytes of a width * height image in this format (compressed or not)
+size_t getImageSize(PixelFormat format, int width, int height);
+// For extensions the loader doesn't know about (it only has core GL 3.3). Needs a context.
+bool hasExtension(const char* name);
+// Compressed formats need extensions that are not part of GL 3.3. Needs a context.
+bool isPixelFormatSupported(PixelFormat format);
+// The format and type to pass to glTexImage2D/glTexSubImage2D for client side data in this
+// internal format, e.g. GL_RGBA, GL_UNSIGNED_BYTE for RGBA8 or GL_RED, GL_HALF_FLOAT for R16F
+std::pair<GLenum, GLenum> getPixelTransferFormat(PixelFormat format);
+
 class RenderAttachment {
+private:
+    friend class RenderTarget;
+    // number of cached render targets using this attachment
+    mutable size_t mRenderTargetCount = 0;
+
+protected:
+    // Deletes the cached render targets using this attachment (flushing their queued entries). The
+    // derived classes call this before deleting their GL object, which the flush might still use.
+    void removeRenderTargets() const;
+
 public:
     virtual void attach(GLenum attachmentPoint) const = 0;
-    virtual ~RenderAttachment() = default;
+    virtual ~RenderAttachment();
 
     virtual PixelFormat getPixelFormat() const = 0;
     virtual int getWidth() const = 0;
@@ -61,6 +113,7 @@ public:
     RenderBuffer(PixelFormat format, int width, int height, size_t samples = 0);
     ~RenderBuffer()
     {
+        removeRenderTargets();
         if (mRbo != 0)
             glDeleteRenderbuffers(1, &mRbo);
     }
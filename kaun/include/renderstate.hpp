@@ -165,6 +165,18 @@ public:
 
     void apply(bool force = false) const;
 
+    bool operator==(const RenderState& other) const
+    {
+        return mDepthWrite == other.mDepthWrite && mDepthFunc == other.mDepthFunc
+            && mCullFaces == other.mCullFaces && mFrontFace == other.mFrontFace
+            && mBlendEnabled == other.mBlendEnabled && mBlendSrcFactor == other.mBlendSrcFactor
+            && mBlendDstFactor == other.mBlendDstFactor && mBlendEquation == other.mBlendEquation;
+    }
+    bool operator!=(const RenderState& other) const
+    {
+        return !(*this == other);
+    }
+
     // stencil func - glStencilFunc
     // stencil op - glStencilOp
 };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <unordered_map>
 #include <vector>
 
 #include "renderattachment.hpp"
@@ -7,7 +8,9 @@
 namespace kaun {
 class RenderTarget {
 protected:
-    static std::vector<RenderTarget*> renderTargetCache;
+    // keyed by the hash of the attachments, collisions are resolved by comparing them
+    static std::unordered_map<size_t, std::vector<RenderTarget*>> renderTargetCache;
+    static size_t renderTargetCount;
 
     std::vector<const RenderAttachment*> mColorAttachments;
     const RenderAttachment* mDepthStencil;
@@ -15,18 +18,29 @@ protected:
     size_t mSamples;
     int mWidth, mHeight;
     GLbitfield mClearMask;
+    GLbitfield mDiscardMask;
 
     void createFbo();
+    bool hasAttachments(const std::vector<const RenderAttachment*>& colorAttachments,
+        const RenderAttachment* depthStencil) const;
 
 public:
     static const RenderTarget* currentDraw;
     static const RenderTarget* currentRead;
     static RenderTarget* get(const std::vector<const RenderAttachment*>& colorAttachments,
         const RenderAttachment* depthStencil);
+    // Deletes the cached render targets using this attachment. Called by the RenderAttachment
+    // destructor.
+    static void removeAttachment(const RenderAttachment& attachment);
+    static size_t getCacheSize();
     static void ensureGlState();
 
     RenderTarget(const std::vector<const RenderAttachment*>& colorAttachments,
         const RenderAttachment* depthStencil);
+    ~RenderTarget();
+
+    RenderTarget(const RenderTarget& other) = delete;
+    RenderTarget& operator=(const RenderTarget& other) = delete;
 
     int getWidth() const
     {
@@ -44,10 +58,31 @@ public:
     {
         return mClearMask;
     }
+    bool usesAttachment(const RenderAttachment& attachment) const;
+
+    // Buffers (GL_COLOR_BUFFER_BIT etc.) that are only needed while this is the current render
+    // target. They are invalidated when setRenderTarget switches to another one.
+    void setDiscardMask(GLbitfield mask)
+    {
+        mDiscardMask = mask;
+    }
+    GLbitfield getDiscardMask() const
+    {
+        return mDiscardMask;
+    }
 
     void setViewport() const;
     void bind(bool read = true, bool draw = true) const;
 
+    // Tells the driver the contents of these buffers are not needed anymore, so it doesn't have to
+    // write them back to memory (or keep them at all). Needs GL 4.3 or ARB_invalidate_subdata,
+    // otherwise this does nothing.
+    void invalidate(GLbitfield mask) const;
+    static bool isInvalidateSupported();
+    // Blits the buffers in mask to dst, which resolves multisampled buffers. If discard is true,
+    // they are invalidated here afterwards. The current render targets stay bound.
+    void resolve(const RenderTarget& dst, GLbitfield mask, bool discard) const;
+
 protected:
     // this is only used by WindowRenderTarget
     RenderTarget()
@@ -58,6 +93,7 @@ protected:
         , mHeight(0)
         , mSamples(0)
         , mClearMask(0)
+        , mDiscardMask(0)
     {
     }
 
@@ -94,6 +130,9 @@ public:
 
 void setWindowDimensions(int width, int height);
 
+// Draws and clears queued afterwards go to this render target, the queue is not flushed (unless
+// blitCurrent is true). The discard mask of the previous render target is invalidated after
+// blitting it.
 RenderTarget* setRenderTarget(const std::vector<const RenderAttachment*>& colorAttachments,
     const RenderAttachment* depthStencil, bool blitCurrent);
 RenderTarget* setRenderTarget(const RenderTarget& renderTarget, bool blitCurrent);
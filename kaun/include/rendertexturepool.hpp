@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+
+#include "renderattachment.hpp"
+#include "texture.hpp"
+
+namespace kaun {
+struct RenderTexturePoolStats {
+    size_t textures = 0;
+    size_t acquired = 0;
+    // since the last trimRenderTexturePool
+    size_t created = 0;
+    size_t reused = 0;
+};
+
+// Transient render textures for passes that only need them for a while (post processing, blur
+// chains, resizable targets). Released textures with the same format, size and samples are reused
+// across passes and frames, so their render targets are reused too. The pool owns the textures.
+Texture* acquireRenderTexture(PixelFormat format, int width, int height, size_t samples = 0);
+// Returns false if the texture is not an acquired pool texture
+bool releaseRenderTexture(const Texture* texture);
+// True for acquired and released textures that were not deleted yet
+bool isPooledRenderTexture(const Texture* texture);
+// Textures with references are not deleted by trimRenderTexturePool, even if they were released,
+// e.g. while a script still holds them (lua-kaun adds one for every userdata)
+void addRenderTextureReference(const Texture* texture);
+void removeRenderTextureReference(const Texture* texture);
+// Deletes released textures that were not acquired again for more than maxUnusedFrames calls.
+// Call once per frame (lua-kaun does this in updateTextureLoads).
+void trimRenderTexturePool(size_t maxUnusedFrames = 2);
+const RenderTexturePoolStats& getRenderTexturePoolStats();
+}
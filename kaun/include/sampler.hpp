@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "renderstate.hpp"
+#include "texture.hpp"
+
+namespace kaun {
+struct SamplerState {
+    Texture::WrapMode wrapS = Texture::WrapMode::CLAMP_TO_EDGE;
+    Texture::WrapMode wrapT = Texture::WrapMode::CLAMP_TO_EDGE;
+    Texture::WrapMode wrapR = Texture::WrapMode::CLAMP_TO_EDGE;
+    Texture::MinFilter minFilter = Texture::MinFilter::LINEAR;
+    Texture::MagFilter magFilter = Texture::MagFilter::LINEAR;
+    // DISABLED turns depth comparison off, anything else is used for shadow samplers
+    RenderState::DepthFunc compareFunc = RenderState::DepthFunc::DISABLED;
+    // Only used if EXT_texture_filter_anisotropic is supported. 1 is off.
+    float maxAnisotropy = 1.0f;
+    float lodBias = 0.0f;
+    float minLod = -1000.0f, maxLod = 1000.0f;
+    glm::vec4 borderColor = glm::vec4(0.0f);
+
+    bool operator==(const SamplerState& other) const;
+    bool operator!=(const SamplerState& other) const
+    {
+        return !(*this == other);
+    }
+
+    size_t hash() const;
+};
+
+// A sampler object overrides the sampling parameters of any texture bound to the same unit, so
+// the same texture can be sampled in different ways without changing it.
+// Samplers are shared: get returns the same sampler for the same state.
+class Sampler {
+private:
+    GLuint mSamplerObject;
+    SamplerState mState;
+
+public:
+    static const size_t MAX_UNITS = Texture::MAX_UNITS;
+    static const Sampler* currentBoundSamplers[MAX_UNITS];
+
+    // Creates the sampler if there is none with this state yet. They live until clearCache.
+    static const Sampler* get(const SamplerState& state);
+    // Deletes all samplers. Uniforms using them must not be used anymore!
+    static void clearCache();
+    static size_t getCacheSize();
+
+    static void ensureGlState();
+
+    explicit Sampler(const SamplerState& state);
+    ~Sampler();
+
+    Sampler(const Sampler& other) = delete;
+    Sampler& operator=(const Sampler& other) = delete;
+
+    void bind(unsigned int unit) const;
+    // Afterwards the texture's own parameters are used on this unit again
+    static void unbind(unsigned int unit);
+
+    GLuint getSamplerObject() const
+    {
+        return mSamplerObject;
+    }
+
+    const SamplerState& getState() const
+    {
+        return mState;
+    }
+};
+}
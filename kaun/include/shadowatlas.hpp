@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "texture.hpp"
+#include "texture_atlas.hpp"
+
+namespace kaun {
+// Allocates square tiles of a single depth texture, so the shadow maps of several lights can be
+// rendered with one render target bind and one flush. Tiles are power of two sized nodes of a
+// quadtree, so freeing a tile merges it with its free siblings again.
+// For every tile: atlas.bindTile(tile) (which sets the viewport and scissor rectangle and queues a
+// clear), queue the shadow casters, then resetScissor() and flush() once at the end. Shaders have
+// to map their shadow map coordinates into the tile with getRegion(tile).getUvTransform().
+class ShadowAtlas {
+public:
+    using Tile = size_t;
+    static constexpr Tile none = static_cast<Tile>(-1);
+
+private:
+    enum class NodeState { FREE, SPLIT, USED, UNUSED };
+
+    struct Node {
+        glm::ivec2 position;
+        int size;
+        NodeState state;
+        size_t parent;
+        // the four children are stored consecutively, none if the node was never split
+        size_t firstChild;
+    };
+
+    Texture& mTexture;
+    int mMinTileSize;
+    std::vector<Node> mNodes;
+    size_t mUsedArea;
+
+    Tile find(size_t index, int size, bool split);
+    void merge(size_t index);
+
+public:
+    // The texture has to outlive the atlas. Only the largest power of two square of it is used.
+    ShadowAtlas(Texture& texture, int minTileSize = 64);
+
+    Texture& getTexture() const
+    {
+        return mTexture;
+    }
+
+    // size is rounded up to a power of two (at least minTileSize). Returns none if it doesn't fit.
+    Tile allocate(int size);
+    void free(Tile tile);
+    // Frees all tiles
+    void reset();
+    bool isAllocated(Tile tile) const
+    {
+        return tile < mNodes.size() && mNodes[tile].state == NodeState::USED;
+    }
+
+    // x, y, width, height in pixels
+    glm::ivec4 getRect(Tile tile) const;
+    AtlasRegion getRegion(Tile tile) const;
+
+    // Sets the atlas as the render target (if it is not already) and the viewport and scissor
+    // rectangle to the tile. If clear is true, a depth clear of the tile is queued.
+    void bindTile(Tile tile, bool clear = true) const;
+
+    // Fraction of the area that is allocated
+    float getOccupancy() const;
+};
+}
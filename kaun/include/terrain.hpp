@@ -0,0 +1,110 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "aabb.hpp"
+#include "frustum.hpp"
+#include "mesh.hpp"
+#include "render.hpp"
+#include "texture.hpp"
+
+namespace kaun {
+// Heightmap terrain with CDLOD (Continuous Distance-Dependent Level of Detail) by Filip Strugar:
+// https://github.com/fstrugar/CDLOD
+// The terrain is a quadtree of nodes, which are all drawn with the same small grid mesh (the
+// patch). The vertex shader samples the heightmap texture and morphs the vertices of each patch
+// towards the grid of the next coarser level, depending on the distance to the camera, so there
+// are no cracks between levels. Use shaderChunk in the vertex shader of the terrain shader.
+// The terrain spans [0, size] on x and z in model space.
+class Terrain {
+private:
+    struct Node {
+        AABoundingBox bounds;
+        // index of the first child, the other three follow. 0 for leaves
+        size_t children;
+    };
+
+    struct Selection {
+        size_t node;
+        int level;
+        // -1 to draw the whole node, otherwise the index of the quadrant (child)
+        int quadrant;
+    };
+
+    std::vector<float> mHeights;
+    int mResolutionX, mResolutionZ;
+    float mSize;
+    float mHeight;
+    int mPatchResolution;
+    int mLodLevels;
+    // mLodRanges[level], level 0 is the finest
+    std::vector<float> mLodRanges;
+    float mMorphStartRatio;
+    std::vector<Node> mNodes;
+
+    VertexFormat mPatchFormat;
+    std::unique_ptr<Mesh> mPatch;
+    // The patch is split into quadrants (draw ranges), so nodes can be drawn partially
+    const DrawRange* mQuadrants[4];
+
+    const Texture* mHeightmap;
+    std::unique_ptr<Texture> mOwnedHeightmap;
+
+    std::vector<Selection> mSelection;
+
+    float getSample(int x, int z) const;
+    void buildPatch();
+    void buildNode(size_t index, float x, float z, float size, int level);
+    void selectNode(size_t index, int level, const glm::vec3& cameraPos, const Frustum& frustum);
+
+public:
+    static std::string_view shaderChunk;
+
+    // heights has resolutionX * resolutionZ values, rows along x. Every height is multiplied by
+    // height. patchResolution is the number of quads along one side of the patch mesh and has
+    // to be even.
+    Terrain(const float* heights, int resolutionX, int resolutionZ, float size, float height,
+        int patchResolution = 32, int lodLevels = 5);
+    // Reads the first channel of the texture back. The texture is used by the terrain as is, so
+    // it needs to stay alive as long as the terrain.
+    Terrain(const Texture& heightmap, float size, float height, int patchResolution = 32,
+        int lodLevels = 5);
+
+    Terrain(const Terrain& other) = delete;
+    Terrain& operator=(const Terrain& other) = delete;
+
+    // The LOD range of level 0 (finest) is lodDistance, every level doubles it.
+    // Morphing starts at morphStartRatio between two ranges.
+    void setLodDistance(float lodDistance, float morphStartRatio = 0.66f);
+
+    float getSize() const
+    {
+        return mSize;
+    }
+    float getHeightScale() const
+    {
+        return mHeight;
+    }
+    const Texture& getHeightmap() const
+    {
+        return *mHeightmap;
+    }
+    int getLodLevels() const
+    {
+        return mLodLevels;
+    }
+
+    // x, z in model space. Interpolates like the triangles of the finest level would.
+    float getHeight(float x, float z) const;
+    glm::vec3 getNormal(float x, float z) const;
+
+    // Selects the nodes to draw (with the current view, projection and model matrix) and queues
+    // them with kaun::draw. Returns the number of queued draws.
+    size_t draw(Shader& shader, const std::vector<Uniform>& uniforms,
+        const RenderState& state = defaultRenderState);
+};
+}
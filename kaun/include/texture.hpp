@@ -1,19 +1,38 @@
 #pragma once
 
+#include <algorithm>
+#include <functional>
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include "log.hpp"
+#include "pixelbuffer.hpp"
 #include "renderattachment.hpp"
 #include "renderstate.hpp"
 
 namespace kaun {
+class TextureLoad;
+struct CompressedImage;
+struct MipChain;
+
+// Counted by Texture::bind and Texture::bindTextures
+struct TextureBindStats {
+    size_t binds = 0; // glBindTexture calls
+    size_t unitSwitches = 0; // glActiveTexture calls
+    size_t hits = 0; // textures passed to bindTextures, that were still bound
+    size_t evictions = 0; // textures that were unbound to make room for another one
+};
+
 class Texture : public RenderAttachment {
 public:
+    using LoadCallback = std::function<void(bool success, const std::string& error)>;
+
     enum class WrapMode : GLenum {
         CLAMP_TO_EDGE = GL_CLAMP_TO_EDGE,
         CLAMP_TO_BORDER = GL_CLAMP_TO_BORDER,
@@ -61,21 +80,39 @@ private:
     GLuint mTextureObject;
     PixelFormat mPixelFormat;
     int mWidth, mHeight;
+    int mLayers;
+    // number of allocated mip levels
+    int mLevels;
     size_t mSamples;
     bool mImmutable;
     WrapMode mSWrap, mTWrap;
     MinFilter mMinFilter;
     MagFilter mMagFilter;
+    // the unit this texture is bound to, -1 if it's not bound
+    mutable int mUnit;
+    // number of unfinished asynchronous loads
+    size_t mPendingLoads;
+    // index into the TextureManager's list, -1 if it's not managed
+    int mManagedIndex;
+    // only set in streaming mode
+    std::unique_ptr<PixelBufferRing> mStreamBuffers;
+    glm::ivec4 mMappedRegion;
+
+    friend class TextureLoader;
+    friend class TextureManager;
 
     void setParameter(GLenum param, GLenum val)
     {
         if (mTextureObject != 0) {
-            bind(0);
+            activate();
             glTexParameteri(static_cast<GLenum>(mTarget), param, val);
         }
     }
 
+    bool checkRegion(int x, int y, int width, int height) const;
     void initSampler();
+    // Allocates levels for 8 bit data with the given number of components
+    void initStorage(Target target, int width, int height, int components, bool srgb, int levels);
 
 public:
     static const size_t MAX_UNITS = 16;
@@ -91,12 +128,18 @@ public:
         , mPixelFormat(PixelFormat::NONE)
         , mWidth(-1)
         , mHeight(-1)
+        , mLayers(1)
+        , mLevels(0)
         , mSamples(0)
         , mImmutable(false)
         , mSWrap(WrapMode::CLAMP_TO_EDGE)
         , mTWrap(WrapMode::CLAMP_TO_EDGE)
         , mMinFilter(MinFilter::LINEAR)
         , mMagFilter(MagFilter::LINEAR)
+        , mUnit(-1)
+        , mPendingLoads(0)
+        , mManagedIndex(-1)
+        , mMappedRegion(0)
     {
     }
 
@@ -120,17 +163,44 @@ public:
         loadFromFile(filename, genMipmaps);
     }
 
-    ~Texture()
-    {
-        glDeleteTextures(1, &mTextureObject);
-    }
+    ~Texture();
 
     void loadFromMemory(const uint8_t* buffer, int width, int height, int components,
         bool genMipmaps = true, Target target = Target::NONE, bool replace = false);
+    // Loads layers of 8 bit data (one after another) into a TEX_2D_ARRAY texture
+    void loadArrayFromMemory(const uint8_t* buffer, int width, int height, int layers,
+        int components, bool genMipmaps = true);
+    // Tightly packed data in the client side representation of format (see
+    // getPixelTransferFormat), e.g. from a love ImageData. data may be nullptr.
+    void loadFromMemory(PixelFormat format, const void* data, int width, int height,
+        bool genMipmaps = false);
+    // KTX and DDS files are detected by loadEncodedFromMemory and loadFromFile and are loaded
+    // with their own mip chain (genMipmaps is ignored)
     bool loadEncodedFromMemory(
         const uint8_t* encBuffer, int len, bool genMipmaps = true, Target target = Target::NONE);
     bool loadFromFile(
         const std::string& filename, bool genMipmaps = true, Target target = Target::NONE);
+    // Uploads all levels, e.g. built with buildMipChain. srgb works like getSrgbEnabled() for
+    // loadFromMemory.
+    void loadMipChain(const MipChain& chain, bool srgb, Target target = Target::NONE);
+    // Uploads all levels with glCompressedTexImage2D
+    bool loadCompressed(const CompressedImage& image, Target target = Target::NONE);
+    // Decodes the image and compresses it on the CPU first (see compressImage)
+    bool loadEncodedCompressed(
+        const uint8_t* encBuffer, int len, PixelFormat format, bool genMipmaps = true);
+
+    // Decodes the image on a worker thread and uploads it later, in TextureLoader::update. Until
+    // then the texture keeps its old data or, if it has none, is a 1x1 placeholder.
+    std::shared_ptr<TextureLoad> loadAsync(const std::string& filename, bool genMipmaps = true,
+        Target target = Target::NONE, LoadCallback callback = nullptr);
+    // Takes the encoded image data (e.g. the contents of a PNG file)
+    std::shared_ptr<TextureLoad> loadEncodedAsync(std::vector<uint8_t> encoded,
+        bool genMipmaps = true, Target target = Target::NONE, LoadCallback callback = nullptr);
+
+    // Moves a TEX_2D texture to new storage with a width x height base level and the given number
+    // of levels. New level i gets the contents of old level i + shift, if that exists. The copy
+    // never leaves the GPU.
+    void reallocateLevels(int width, int height, int levels, int shift);
 
     void setStorage(PixelFormat format, int width, int height, int levels = 1);
     void setStorageMultisample(PixelFormat format, int width, int height, size_t samples,
@@ -138,12 +208,36 @@ public:
 
     void updateData(GLenum format, GLenum type, const void* data, int level = 0, int width = -1,
         int height = -1, int x = 0, int y = 0);
+    // Updates a rectangle of the base level with tightly packed data in the client side
+    // representation of the texture's pixel format
+    bool replacePixels(const void* data, int x, int y, int width, int height,
+        bool updateMipmaps = false);
+
+    // Streaming mode is for data that changes every frame (video, CPU rendered UI, lightmaps).
+    // The data is written into a ring of bufferCount pixel buffers and uploaded from there, so
+    // neither the copy nor the next update have to wait for the GPU. 0 disables it.
+    void setStreaming(size_t bufferCount = 3);
+    bool isStreaming() const
+    {
+        return mStreamBuffers != nullptr;
+    }
+    // Maps a buffer for a region of the base level. Write tightly packed data in the client side
+    // representation of the pixel format into it. Returns nullptr if all buffers are still in use
+    // and wait is false - skip the update or try again later.
+    void* mapPixels(int x, int y, int width, int height, bool wait = false);
+    // Issues the upload of the mapped region
+    bool unmapPixels(bool updateMipmaps = false);
+    // Like replacePixels, but through the pixel buffers. Returns false if the update was skipped.
+    bool streamPixels(const void* data, int x, int y, int width, int height, bool wait = false,
+        bool updateMipmaps = false);
+
     // if you've set the base level + data, call this. this can also be called on an immutable
     // texture
     void updateMipmaps()
     {
-        bind(0);
+        activate();
         glGenerateMipmap(static_cast<GLenum>(mTarget));
+        mLevels = getMipLevelCount(mWidth, mHeight);
     }
 
     bool isValid() const
@@ -151,6 +245,12 @@ public:
         return mTextureObject != 0;
     }
 
+    // If true, the TextureManager decides how many mip levels are resident
+    bool isManaged() const
+    {
+        return mManagedIndex >= 0;
+    }
+
     void attach(GLenum attachmentPoint) const;
 
     void setTarget(Target target)
@@ -178,6 +278,26 @@ public:
     {
         return mHeight;
     }
+    // Only > 1 for array textures
+    int getLayerCount() const
+    {
+        return mLayers;
+    }
+    int getLevelCount() const
+    {
+        return mLevels;
+    }
+    // Estimated from the pixel format, size and levels (drivers might pad or align)
+    size_t getMemorySize() const;
+
+    // Levels of a full mip chain down to 1x1
+    static int getMipLevelCount(int width, int height)
+    {
+        int levels = 1;
+        while ((std::max(width, height) >> levels) > 0)
+            ++levels;
+        return levels;
+    }
     size_t getSamples() const
     {
         return mSamples;
@@ -218,41 +338,36 @@ public:
 
     void setBorderColor(const glm::vec4& col)
     {
-        bind(0);
+        activate();
         glTexParameterfv(
             static_cast<GLenum>(mTarget), GL_TEXTURE_BORDER_COLOR, glm::value_ptr(col));
     }
 
-    void bind(unsigned int unit) const
-    {
-        if (currentBoundTextures[unit] != this && mTextureObject != 0) {
-            glActiveTexture(GL_TEXTURE0 + unit);
-            glBindTexture(static_cast<GLenum>(mTarget), mTextureObject);
-            currentBoundTextures[unit] = this;
-        }
-    }
+    void bind(unsigned int unit) const;
+    // Makes the active unit the one this texture is bound to, so glTex* calls modify it. If it
+    // is not bound, it replaces the least recently used texture, so unit 0 is not disturbed.
+    void activate() const;
 
+    // -1 if the texture is not bound
     int getUnit() const
     {
-        for (int unit = 0; unit < MAX_UNITS; ++unit) {
-            if (currentBoundTextures[unit] == this)
-                return unit;
-        }
-        return -1;
+        return mUnit;
     }
 
-    static void unbind(unsigned int unit)
+    static void unbind(unsigned int unit);
+
+    // Makes sure all textures are bound to some unit (see getUnit). Textures that are still bound
+    // stay where they are, the others replace the least recently used textures not in the list.
+    // So consecutive draws using the same textures don't bind anything.
+    static void bindTextures(const Texture* const* textures, size_t count);
+    static void bindTextures(const std::vector<const Texture*>& textures)
     {
-        if (currentBoundTextures[unit] != nullptr) {
-            glActiveTexture(GL_TEXTURE0 + unit);
-            // There can only be one texture bound to a single unit (independent of type), so i can
-            // unbind with whatever I want Bonus: unbind can be static!
-            glBindTexture(GL_TEXTURE_2D, 0);
-            currentBoundTextures[unit] = nullptr;
-        }
+        bindTextures(textures.data(), textures.size());
     }
 
-    static void bindTextures(const std::vector<const Texture*>& textures);
+    // The stats of the last finished frame
+    static const TextureBindStats& getBindStats();
+    static void endFrame();
 
     static Texture* pixel(const glm::vec4& col); // col in SRGB
     static Texture* checkerBoard(int width, int height, int checkerSize,
@@ -261,5 +376,9 @@ public:
     static Texture* cubeMap(const std::string& posX, const std::string& negX,
         const std::string& posY, const std::string& negY, const std::string& posZ,
         const std::string& negZ);
+    // Loads the faces with loadAsync. The callback is called once all of them are finished.
+    static Texture* cubeMapAsync(const std::string& posX, const std::string& negX,
+        const std::string& posY, const std::string& negY, const std::string& posZ,
+        const std::string& negZ, LoadCallback callback = nullptr);
 };
 }
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "texture.hpp"
+
+namespace kaun {
+// Where an image ended up in an atlas: uv' = uv * uvScale + uvOffset, in layer of an array
+// texture (always 0 for 2D atlases). Use Mesh::remapTexCoords to bake this into a mesh, so
+// meshes with different images can share a texture and their draws can be merged.
+struct AtlasRegion {
+    int layer = 0;
+    glm::vec2 uvScale = glm::vec2(1.0f);
+    glm::vec2 uvOffset = glm::vec2(0.0f);
+    glm::ivec4 rect = glm::ivec4(0); // x, y, width, height in pixels
+
+    // (scale, offset), e.g. for a uniform
+    glm::vec4 getUvTransform() const
+    {
+        return glm::vec4(uvScale, uvOffset);
+    }
+};
+
+// Bottom-left skyline rectangle packer
+class SkylinePacker {
+private:
+    struct Segment {
+        int x, y, width;
+    };
+
+    int mWidth, mHeight;
+    std::vector<Segment> mSkyline;
+    size_t mUsedArea;
+
+    // returns the y the rectangle would be placed at, starting at segment index, or -1
+    int fit(size_t index, int width, int height) const;
+
+public:
+    SkylinePacker(int width, int height);
+
+    // returns false if the rectangle doesn't fit anymore
+    bool insert(int width, int height, glm::ivec2& position);
+    void reset();
+
+    // Fraction of the area that is used
+    float getOccupancy() const
+    {
+        return static_cast<float>(mUsedArea) / (static_cast<float>(mWidth) * mHeight);
+    }
+};
+
+// Packs many small images into a single 2D texture or the layers of a TEX_2D_ARRAY texture.
+class TextureAtlas {
+private:
+    struct Image {
+        std::vector<uint8_t> pixels; // RGBA
+        int width, height;
+    };
+
+    int mWidth, mHeight, mPadding;
+    std::vector<Image> mImages;
+    std::vector<AtlasRegion> mRegions;
+    size_t mLayerCount;
+
+public:
+    // Size of the atlas (or of every layer). padding is the number of pixels around every image,
+    // which are filled with its edge pixels, so filtering doesn't bleed into neighbouring images.
+    TextureAtlas(int width, int height, int padding = 2);
+
+    // Copies 8 bit pixels with 1-4 components. Returns the id of the image for getRegion.
+    size_t add(const uint8_t* pixels, int width, int height, int components);
+
+    // Packs all images. target has to be TEX_2D (fails if they don't fit into one texture) or
+    // TEX_2D_ARRAY (adds layers as needed). Returns nullptr on failure.
+    Texture* build(Texture::Target target = Texture::Target::TEX_2D_ARRAY, bool genMipmaps = true);
+
+    // Only valid after build, for the images that were added before it (id < getRegionCount())
+    const AtlasRegion& getRegion(size_t id) const
+    {
+        return mRegions[id];
+    }
+
+    size_t getRegionCount() const
+    {
+        return mRegions.size();
+    }
+
+    size_t getLayerCount() const
+    {
+        return mLayerCount;
+    }
+
+    size_t getImageCount() const
+    {
+        return mImages.size();
+    }
+};
+}
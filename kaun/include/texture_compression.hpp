@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mipmap.hpp"
+#include "renderattachment.hpp"
+
+namespace kaun {
+// A block compressed image with its mip chain (levels[0] is the base level)
+struct CompressedImage {
+    struct Level {
+        int width, height;
+        size_t offset, size; // into data
+    };
+
+    PixelFormat format = PixelFormat::NONE;
+    std::vector<Level> levels;
+    std::vector<uint8_t> data;
+
+    const uint8_t* getLevelData(size_t level) const
+    {
+        return data.data() + levels[level].offset;
+    }
+};
+
+// Whether the data starts with a KTX (version 1) or DDS identifier
+bool isCompressedImageContainer(const uint8_t* data, size_t size);
+// Only 2D textures in one of the compressed PixelFormats are supported
+bool loadCompressedImage(
+    const uint8_t* data, size_t size, CompressedImage& image, std::string& error);
+bool loadCompressedImage(const std::string& filename, CompressedImage& image, std::string& error);
+// Writes a KTX file, e.g. to cook textures offline
+bool saveKtx(const std::string& filename, const CompressedImage& image);
+
+// Compresses 8 bit pixels with 1-4 components into BC1, BC3, BC4 or BC5 (or their sRGB
+// variants). Missing components are 0 (alpha 255). If genMipmaps is true, the mip chain is
+// built with buildMipChain (box filter) first. The blocks are split between threadCount threads,
+// threadCount = 0 uses as many threads as there are hardware threads.
+bool compressImage(const uint8_t* pixels, int width, int height, int components,
+    PixelFormat format, CompressedImage& image, bool genMipmaps = true, int threadCount = 0);
+// Compresses every level of the chain, e.g. to save it with saveKtx
+bool compressMipChain(
+    const MipChain& chain, PixelFormat format, CompressedImage& image, int threadCount = 0);
+}
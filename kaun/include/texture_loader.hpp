@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mipmap.hpp"
+#include "texture.hpp"
+
+namespace kaun {
+// 8 bit image decoded with stb_image
+struct DecodedImage {
+    struct Deleter {
+        void operator()(uint8_t* pixels) const;
+    };
+
+    std::unique_ptr<uint8_t[], Deleter> pixels;
+    int width = 0, height = 0, components = 0;
+};
+
+// These are thread-safe. error is set if decoding fails.
+bool decodeImage(const std::string& filename, DecodedImage& image, std::string& error);
+bool decodeImage(const uint8_t* data, size_t size, DecodedImage& image, std::string& error);
+
+// The state of a single asynchronous image load started with Texture::loadAsync
+class TextureLoad {
+public:
+    enum class Status { DECODING, DECODED, UPLOADING, DONE, FAILED };
+
+    Status getStatus() const
+    {
+        return mStatus;
+    }
+
+    bool isFinished() const
+    {
+        const Status status = mStatus;
+        return status == Status::DONE || status == Status::FAILED;
+    }
+
+    // Fraction of the image (all levels) that has been uploaded. Can be called from any thread.
+    float getProgress() const
+    {
+        if (mStatus == Status::DONE)
+            return 1.0f;
+        if (mStatus != Status::UPLOADING || mTotalBytes == 0)
+            return 0.0f;
+        return static_cast<float>(mUploadedBytes) / mTotalBytes;
+    }
+
+    // Only valid if the status is FAILED
+    const std::string& getError() const
+    {
+        return mError;
+    }
+
+    // Size of the decoded image, 0 while it is still DECODING (the worker thread writes it)
+    int getImageWidth() const
+    {
+        return mStatus == Status::DECODING ? 0 : mImage.width;
+    }
+    int getImageHeight() const
+    {
+        return mStatus == Status::DECODING ? 0 : mImage.height;
+    }
+    // Number of levels at the top of the mip chain that were left out because of the max size
+    int getSkippedLevels() const
+    {
+        return mSkipLevels;
+    }
+
+private:
+    friend class TextureLoader;
+
+    // nullptr if the texture was destroyed before the load finished. Only touched on the GL thread,
+    // like mCallback.
+    Texture* mTexture = nullptr;
+    Texture::Target mTarget = Texture::Target::NONE;
+    bool mGenMipmaps = false;
+    // levels larger than this are not uploaded, 0 means no limit
+    int mMaxSize = 0;
+    bool mSrgb = false;
+    MipmapParams mMipmapParams;
+    // either a file name or the encoded data is used
+    std::string mFilename;
+    std::vector<uint8_t> mEncoded;
+    Texture::LoadCallback mCallback;
+
+    // set by the worker thread, everything below is only valid once it is not DECODING anymore
+    std::atomic<Status> mStatus { Status::DECODING };
+    std::string mError;
+    DecodedImage mImage;
+    // the levels are built on the worker thread too, if mGenMipmaps is set
+    MipChain mMips;
+
+    int mSkipLevels = 0;
+    // levels of the full chain from this one on are kept, see TextureLoader::load
+    int mResidentLevel = -1;
+    // the levels are uploaded smallest first, so the texture is always complete
+    int mUploadLevel = 0, mUploadedRows = 0;
+    std::atomic<size_t> mTotalBytes { 0 }, mUploadedBytes { 0 };
+};
+
+// Decodes images on a pool of worker threads and uploads them through a ring of pixel buffer
+// objects on the GL thread, a limited number of bytes per update, so loading never stalls a frame
+// for long. Call update once per frame (lua-kaun does this in love.run).
+class TextureLoader {
+private:
+    static std::shared_ptr<TextureLoad> start(Texture& texture, std::shared_ptr<TextureLoad> load,
+        bool genMipmaps, Texture::Target target, Texture::LoadCallback callback, int maxSize,
+        int residentLevel);
+    static void decode(TextureLoad& load);
+    // returns the number of bytes uploaded, 0 if no pixel buffer was available
+    static size_t upload(TextureLoad& load, size_t byteBudget);
+    static void finish(TextureLoad& load, bool success);
+    static int getLevelCount(const TextureLoad& load);
+    static const uint8_t* getLevel(const TextureLoad& load, int level, int& width, int& height);
+
+public:
+    static constexpr size_t defaultUploadBudget = 4 * 1024 * 1024;
+
+    // Used for the mip chains of loads started after this (on the worker thread). srgb and
+    // threadCount are ignored.
+    static void setMipmapParams(const MipmapParams& params);
+    static const MipmapParams& getMipmapParams();
+
+    // The texture is given a 1x1 placeholder if it doesn't have any data yet. If genMipmaps is
+    // true and maxSize > 0, the levels with a width or height above maxSize are left out.
+    // If residentLevel >= 0, the TEX_2D texture already has the levels of the full chain from
+    // that one on. They are kept and only the levels above them are uploaded.
+    static std::shared_ptr<TextureLoad> load(Texture& texture, const std::string& filename,
+        bool genMipmaps, Texture::Target target, Texture::LoadCallback callback,
+        int maxSize = 0, int residentLevel = -1);
+    static std::shared_ptr<TextureLoad> load(Texture& texture, std::vector<uint8_t> encoded,
+        bool genMipmaps, Texture::Target target, Texture::LoadCallback callback,
+        int maxSize = 0, int residentLevel = -1);
+
+    // Uploads decoded images (at most byteBudget bytes, but at least one row) and calls the
+    // callbacks of finished loads. Returns the number of bytes uploaded.
+    static size_t update(size_t byteBudget = defaultUploadBudget);
+
+    // Drops all loads for this texture. Called by the Texture destructor.
+    static void cancel(const Texture& texture);
+
+    static size_t getPendingCount();
+};
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "texture.hpp"
+#include "texture_loader.hpp"
+
+namespace kaun {
+struct TextureManagerStats {
+    size_t budget = 0;
+    // memory of all managed textures, with pending reloads counted at their new size
+    size_t residentBytes = 0;
+    size_t textureCount = 0;
+    size_t pendingLoads = 0;
+    // the following are reset every update
+    size_t droppedLevels = 0;
+    size_t restoredLevels = 0;
+};
+
+// Keeps the textures loaded through it within a memory budget by streaming their mip levels.
+// The render queue reports how large every managed texture is drawn on screen, which decides how
+// many of the top levels are actually needed. If the budget is exceeded, the levels that are not
+// needed are dropped first, then the least recently used textures lose their top levels one by
+// one. Levels are restored (most recently used textures first) once they are needed and fit again.
+// Dropped levels are really freed: the remaining ones are moved to smaller storage on the GPU.
+// Restoring levels decodes the image again through the TextureLoader, but the resident levels are
+// kept and only the missing ones are uploaded (largest last), so the texture never gets blurrier.
+class TextureManager {
+public:
+    static constexpr size_t defaultBudget = 256 * 1024 * 1024;
+    // textures never drop levels below this size
+    static constexpr int minSize = 16;
+
+    // Loads a 2D texture with mipmaps asynchronously. It starts out with the levels up to
+    // initialSize (0 loads all of them) and is managed until it is destroyed.
+    static std::shared_ptr<TextureLoad> load(
+        Texture& texture, const std::string& filename, int initialSize = 64);
+    static std::shared_ptr<TextureLoad> load(
+        Texture& texture, std::vector<uint8_t> encoded, int initialSize = 64);
+    // The texture keeps its current levels. Called by the Texture destructor.
+    static void remove(Texture& texture);
+
+    static void setBudget(size_t bytes);
+    static size_t getBudget();
+    // Added to the mip level computed from the screen size.
+    // > 0 saves memory, < 0 keeps more detail.
+    static void setLodBias(float bias);
+    static float getLodBias();
+
+    // Called by the render queue for every draw. screenSize is the size of the draw in pixels.
+    static void touch(const Texture& texture, float screenSize);
+
+    // Call once per frame, before TextureLoader::update (lua-kaun does this in love.run).
+    // At most maxReloads textures drop or restore levels.
+    static void update(size_t maxReloads = 2);
+
+    static const TextureManagerStats& getStats();
+};
+}
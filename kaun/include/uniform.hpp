@@ -1,6 +1,7 @@
 #include <memory>
 #include <variant>
 
+#include "sampler.hpp"
 #include "shader.hpp"
 #include "texture.hpp"
 
@@ -39,8 +40,10 @@ private:
     int mCount;
     using DataPtr = std::shared_ptr<const uint8_t>;
     std::variant<const Texture*, DataPtr> mData;
+    // only for textures, nullptr uses the texture's own parameters
+    const Sampler* mSampler = nullptr;
 
-    int getTypeSize()
+    int getTypeSize() const
     { // in bytes
         switch (mType) {
         case Type::BOOL:
@@ -297,11 +300,12 @@ public:
     }
 
     // Deleting the texture before flush() means trouble
-    Uniform(const std::string& name, const Texture& tex)
+    Uniform(const std::string& name, const Texture& tex, const Sampler* sampler = nullptr)
         : mName(name)
         , mType(Type::TEXTURE)
         , mCount(0)
         , mData(&tex)
+        , mSampler(sampler)
     {
     }
 
@@ -327,6 +331,25 @@ public:
         assert(mType == Type::TEXTURE);
         return std::get<const Texture*>(mData);
     }
+    const Sampler* getSampler() const
+    {
+        return mSampler;
+    }
+
+    // Compares the values, not the data pointers
+    bool operator==(const Uniform& other) const
+    {
+        if (mType != other.mType || mCount != other.mCount || mName != other.mName)
+            return false;
+        if (mType == Type::TEXTURE)
+            return getTexture() == other.getTexture() && mSampler == other.mSampler;
+        return std::memcmp(getData<uint8_t>(), other.getData<uint8_t>(), getTypeSize() * mCount)
+            == 0;
+    }
+    bool operator!=(const Uniform& other) const
+    {
+        return !(*this == other);
+    }
 
     void set(Shader::UniformLocation loc) const
     {
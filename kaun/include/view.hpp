@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "renderstate.hpp"
+#include "rendertarget.hpp"
+#include "shader.hpp"
+#include "transform.hpp"
+
+namespace kaun {
+// A camera and where it renders to. Passing several views to draw() culls the draw against all
+// of them at once and queues it for every view that sees it, e.g. a shadow map and the main camera.
+class View {
+private:
+    glm::mat4 mProjection, mInvProjection;
+    glm::mat4 mView, mInvView;
+    glm::mat4 mViewProjection, mInvViewProjection;
+    // Cached render targets are deleted with their attachments, so the target is looked up when
+    // it is needed
+    bool mHasTarget;
+    std::vector<const RenderAttachment*> mColorAttachments;
+    const RenderAttachment* mDepthStencil;
+    glm::ivec4 mViewport;
+    glm::ivec4 mScissor;
+    Shader* mShader;
+    const RenderState* mRenderState;
+
+    void updateViewProjection();
+
+public:
+    View();
+
+    void setProjection(const glm::mat4& matrix);
+    const glm::mat4& getProjection() const
+    {
+        return mProjection;
+    }
+    const glm::mat4& getInvProjection() const
+    {
+        return mInvProjection;
+    }
+    bool isOrthographic() const
+    {
+        return mProjection[3][3] == 1.0f;
+    }
+
+    void setViewMatrix(const glm::mat4& view);
+    void setViewTransform(const Transform& viewTransform);
+    const glm::mat4& getViewMatrix() const
+    {
+        return mView;
+    }
+    const glm::mat4& getInvViewMatrix() const
+    {
+        return mInvView;
+    }
+    const glm::mat4& getViewProjection() const
+    {
+        return mViewProjection;
+    }
+    const glm::mat4& getInvViewProjection() const
+    {
+        return mInvViewProjection;
+    }
+
+    // Without a render target (the default) the view draws to the render target, viewport and
+    // scissor rectangle that are current when the draw is queued. No attachments at all is the
+    // window. The attachments have to outlive the view.
+    void setRenderTarget(const std::vector<const RenderAttachment*>& colorAttachments,
+        const RenderAttachment* depthStencil);
+    void resetRenderTarget();
+    bool hasRenderTarget() const
+    {
+        return mHasTarget;
+    }
+    // nullptr if the view has no render target
+    RenderTarget* getRenderTarget() const;
+
+    // Only used with a render target. The default (width < 0) is the whole target.
+    void setViewport(const glm::ivec4& viewport)
+    {
+        mViewport = viewport;
+    }
+    glm::ivec4 getViewport() const;
+
+    // Only used with a render target, width < 0 disables the scissor test (the default)
+    void setScissor(const glm::ivec4& rect)
+    {
+        mScissor = rect;
+    }
+    const glm::ivec4& getScissor() const
+    {
+        return mScissor;
+    }
+
+    // Replace the shader or render state of the draws in this view, e.g. a depth only shader for a
+    // shadow map. nullptr (the default) uses the ones passed to draw().
+    void setShader(Shader* shader)
+    {
+        mShader = shader;
+    }
+    Shader* getShader() const
+    {
+        return mShader;
+    }
+    void setRenderState(const RenderState* state)
+    {
+        mRenderState = state;
+    }
+    const RenderState* getRenderState() const
+    {
+        return mRenderState;
+    }
+};
+}
@@ -1,3 +1,10 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #define GLM_ENABLE_EXPERIMENTAL
@@ -25,28 +32,152 @@ VertexBuffer* Mesh::hasAttribute(AttributeType attrType) const
     return nullptr;
 }
 
+bool Mesh::setVertexData(const void* data, size_t byteOffset, size_t size, size_t bufferIndex)
+{
+    if (bufferIndex >= mVertexBuffers.size()) {
+        LOG_ERROR("Vertex buffer index %zu out of range", bufferIndex);
+        return false;
+    }
+    if (mArena != nullptr) {
+        LOG_ERROR("The vertex data of meshes in an arena can not be changed. Remove it first.");
+        return false;
+    }
+    VertexBuffer& vBuf = *mVertexBuffers[bufferIndex];
+    if (vBuf.getData() == nullptr && vBuf.getSize() > 0) {
+        LOG_ERROR("Mesh has no local vertex data (freeLocal has been called).");
+        return false;
+    }
+
+    const size_t stride = vBuf.getVertexFormat().getStride();
+    const size_t end = byteOffset + size;
+    if (end > static_cast<size_t>(vBuf.getSize()))
+        vBuf.reallocate((end + stride - 1) / stride, true);
+    ::memcpy(reinterpret_cast<uint8_t*>(vBuf.getData()) + byteOffset, data, size);
+    markVertexDataDirty(byteOffset, size, bufferIndex);
+    return true;
+}
+
+namespace {
+    template <typename Src, typename Dst>
+    bool copyIndices(const void* src, void* dst, size_t count, size_t vertexCount)
+    {
+        const Src* in = reinterpret_cast<const Src*>(src);
+        Dst* out = reinterpret_cast<Dst*>(dst);
+        Src maxIndex = 0;
+        for (size_t i = 0; i < count; ++i) {
+            maxIndex = std::max(maxIndex, in[i]);
+            out[i] = static_cast<Dst>(in[i]);
+        }
+        return count == 0 || maxIndex < vertexCount;
+    }
+
+    template <typename Src>
+    bool copyIndices(const void* src, IndexBuffer& dst, size_t count, size_t vertexCount)
+    {
+        void* out = dst.getData<uint8_t>();
+        switch (dst.getDataType()) {
+        case IndexBufferType::UI8:
+            return copyIndices<Src, uint8_t>(src, out, count, vertexCount);
+        case IndexBufferType::UI16:
+            return copyIndices<Src, uint16_t>(src, out, count, vertexCount);
+        case IndexBufferType::UI32:
+            return copyIndices<Src, uint32_t>(src, out, count, vertexCount);
+        }
+        return false;
+    }
+}
+
+IndexBuffer* Mesh::setIndices(
+    const void* data, IndexBufferType type, size_t count, UsageHint usage)
+{
+    if (mVertexBuffers.empty()) {
+        LOG_ERROR("Mesh needs a vertex buffer before indices can be set");
+        return nullptr;
+    }
+    if (mArena != nullptr) {
+        LOG_ERROR("The indices of meshes in an arena can not be changed. Remove it first.");
+        return nullptr;
+    }
+    const size_t vertexCount = mVertexBuffers[0]->getNumVertices();
+    auto indexBuffer = std::make_unique<IndexBuffer>(vertexCount, count, usage);
+    bool valid = false;
+    switch (type) {
+    case IndexBufferType::UI8:
+        valid = copyIndices<uint8_t>(data, *indexBuffer, count, vertexCount);
+        break;
+    case IndexBufferType::UI16:
+        valid = copyIndices<uint16_t>(data, *indexBuffer, count, vertexCount);
+        break;
+    case IndexBufferType::UI32:
+        valid = copyIndices<uint32_t>(data, *indexBuffer, count, vertexCount);
+        break;
+    }
+    if (!valid) {
+        LOG_ERROR("Index out of range (mesh has %zu vertices)", vertexCount);
+        return nullptr;
+    }
+    // the constructor marked everything dirty already
+    replaceIndexBuffer(std::move(indexBuffer));
+    return mIndexBuffer.get();
+}
+
+void Mesh::replaceIndexBuffer(std::unique_ptr<IndexBuffer> indexBuffer)
+{
+    mIndexBuffer = std::move(indexBuffer);
+    // the VAO still references the old index buffer (or none), prepareDraw compiles it again
+    mAttributeOffsets.clear();
+    mClusters.clear();
+    // ranges that don't fit into the new indices anymore would draw garbage
+    const size_t elementCount = getElementCount();
+    auto exceeds = [elementCount](const DrawRange& range) {
+        if (range.firstIndex + range.count <= elementCount)
+            return false;
+        LOG_ERROR("Draw range '%s' (%zu + %zu) exceeds the new index count (%zu) and is removed",
+            range.name.c_str(), range.firstIndex, range.count, elementCount);
+        return true;
+    };
+    mDrawRanges.erase(
+        std::remove_if(mDrawRanges.begin(), mDrawRanges.end(), exceeds), mDrawRanges.end());
+}
+
+void Mesh::markVertexDataDirty(size_t byteOffset, size_t size, size_t bufferIndex)
+{
+    assert(bufferIndex < mVertexBuffers.size());
+    mVertexBuffers[bufferIndex]->markDirty(byteOffset, size);
+    mBBoxDirty = true;
+}
+
+void Mesh::setAttributePointers(size_t bufferIndex)
+{
+    VertexBuffer& vData = *mVertexBuffers[bufferIndex];
+    const size_t streamOffset = vData.getStreamOffset();
+    // Not sure if this should be in VertexFormat
+    const VertexFormat& format = vData.getVertexFormat();
+    const auto& attributes = format.getAttributes();
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        const auto& attr = attributes[i];
+        int location = static_cast<int>(attr.type);
+        // this saves the ARRAY_BUFFER binding
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, attr.alignedNum, static_cast<GLenum>(attr.dataType),
+            attr.normalized ? GL_TRUE : GL_FALSE, format.getStride(),
+            reinterpret_cast<GLvoid*>(streamOffset + attr.offset));
+        if (attr.divisor > 0)
+            glVertexAttribDivisor(location, attr.divisor);
+    }
+    mAttributeOffsets[bufferIndex] = streamOffset;
+}
+
 void Mesh::compile()
 {
     if (mVAO == 0)
         glGenVertexArrays(1, &mVAO);
     glBindVertexArray(mVAO);
 
-    // Not sure if this should be in VertexFormat
-    for (auto& vData : mVertexBuffers) {
-        vData->bind();
-        const VertexFormat& format = vData->getVertexFormat();
-        const auto& attributes = format.getAttributes();
-        for (size_t i = 0; i < attributes.size(); ++i) {
-            const auto& attr = attributes[i];
-            int location = static_cast<int>(attr.type);
-            // this saves the ARRAY_BUFFER binding
-            glEnableVertexAttribArray(location);
-            glVertexAttribPointer(location, attr.alignedNum, static_cast<GLenum>(attr.dataType),
-                attr.normalized ? GL_TRUE : GL_FALSE, format.getStride(),
-                reinterpret_cast<GLvoid*>(attr.offset));
-            if (attr.divisor > 0)
-                glVertexAttribDivisor(location, attr.divisor);
-        }
+    mAttributeOffsets.resize(mVertexBuffers.size());
+    for (size_t i = 0; i < mVertexBuffers.size(); ++i) {
+        mVertexBuffers[i]->bind();
+        setAttributePointers(i);
     }
 
     if (mIndexBuffer != nullptr)
@@ -59,51 +190,334 @@ void Mesh::compile()
     IndexBuffer::unbind();
 }
 
+const DrawRange* Mesh::addDrawRange(
+    const std::string& name, size_t firstIndex, size_t count, int baseVertex, int materialSlot)
+{
+    const size_t elementCount = getElementCount();
+    if (firstIndex > elementCount || count > elementCount - firstIndex) {
+        LOG_ERROR("Draw range '%s' (%zu + %zu) exceeds the element count (%zu)", name.c_str(),
+            firstIndex, count, elementCount);
+        return nullptr;
+    }
+    // the base vertex is ignored for meshes without indices
+    const size_t vertexCount = mVertexBuffers.size() > 0 ? mVertexBuffers[0]->getNumVertices() : 0;
+    if (baseVertex < 0
+        || (baseVertex > 0
+            && (mIndexBuffer == nullptr || static_cast<size_t>(baseVertex) >= vertexCount))) {
+        LOG_ERROR("Invalid base vertex %d for draw range '%s' (mesh has %zu vertices)", baseVertex,
+            name.c_str(), vertexCount);
+        return nullptr;
+    }
+    mDrawRanges.push_back(
+        DrawRange { name, firstIndex, count, baseVertex, materialSlot, AABoundingBox() });
+    return &mDrawRanges.back();
+}
+
+const DrawRange* Mesh::getDrawRange(const std::string& name) const
+{
+    for (auto& range : mDrawRanges) {
+        if (range.name == name)
+            return &range;
+    }
+    return nullptr;
+}
+
+size_t Mesh::getElementCount() const
+{
+    if (mIndexBuffer != nullptr)
+        return mIndexBuffer->getNumIndices();
+    // If someone had the great idea of having multiple VertexBuffer objects attached and
+    // changing their size after attaching this might break
+    if (mVertexBuffers.size() > 0)
+        return mVertexBuffers[0]->getNumVertices();
+    return 0;
+}
+
 void Mesh::draw(size_t instanceCount)
 {
-    if (mVAO == 0) {
+    if (mArena != nullptr) {
+        mArena->draw(*this, 0, mArenaAllocation.indexCount, 0, instanceCount);
+        return;
+    }
+    drawElements(0, getElementCount(), 0, instanceCount);
+}
+
+void Mesh::draw(const DrawRange& range, size_t instanceCount)
+{
+    assert(range.firstIndex + range.count <= getElementCount());
+    if (mArena != nullptr) {
+        mArena->draw(*this, range.firstIndex, range.count, range.baseVertex, instanceCount);
+        return;
+    }
+    drawElements(range.firstIndex, range.count, range.baseVertex, instanceCount);
+}
+
+void Mesh::prepareDraw()
+{
+    // recompile if vertex buffers were added since
+    if (mVAO == 0 || mAttributeOffsets.size() != mVertexBuffers.size()) {
         compile();
     }
 
+    // upload whatever changed since the last draw
+    for (auto& vBuffer : mVertexBuffers)
+        vBuffer->flush();
+    if (mIndexBuffer != nullptr)
+        mIndexBuffer->flush();
+
     if (currentVAO != mVAO) {
         glBindVertexArray(mVAO);
         currentVAO = mVAO;
     }
 
+    // stream buffers might have moved on to another region of their buffer object
+    bool rebound = false;
+    for (size_t i = 0; i < mVertexBuffers.size(); ++i) {
+        if (mVertexBuffers[i]->getStreamOffset() != mAttributeOffsets[i]) {
+            mVertexBuffers[i]->bind();
+            setAttributePointers(i);
+            rebound = true;
+        }
+    }
+    if (rebound)
+        VertexBuffer::unbind();
+}
+
+void Mesh::fenceBuffers()
+{
+    if (mIndexBuffer != nullptr)
+        mIndexBuffer->fence();
+    for (auto& vBuffer : mVertexBuffers)
+        vBuffer->fence();
+}
+
+void Mesh::drawElements(size_t first, size_t count, int baseVertex, size_t instanceCount)
+{
+    prepareDraw();
+
     // A lof of this can go wrong if someone compiles this Mesh without an index buffer attached,
     // then attaches one and compiles it with another shader, while both are in use
     GLenum mode = static_cast<GLenum>(mMode);
     if (mIndexBuffer != nullptr) {
         GLenum indexType = static_cast<GLenum>(mIndexBuffer->getDataType());
+        const GLvoid* indexOffset = reinterpret_cast<const GLvoid*>(mIndexBuffer->getStreamOffset()
+            + first * getIndexBufferTypeSize(mIndexBuffer->getDataType()));
         if (instanceCount > 0) {
-            glDrawElementsInstanced(
-                mode, mIndexBuffer->getNumIndices(), indexType, nullptr, instanceCount);
+            glDrawElementsInstancedBaseVertex(
+                mode, count, indexType, indexOffset, instanceCount, baseVertex);
+        } else if (baseVertex != 0) {
+            glDrawElementsBaseVertex(mode, count, indexType, indexOffset, baseVertex);
         } else {
-            glDrawElements(mode, mIndexBuffer->getNumIndices(), indexType, nullptr);
+            glDrawElements(mode, count, indexType, indexOffset);
         }
     } else {
-        // If someone had the great idea of having multiple VertexBuffer objects attached and
-        // changing their size after attaching this might break
-        size_t size = 0;
-        if (mVertexBuffers.size() > 0)
-            size = mVertexBuffers[0]->getNumVertices();
         if (instanceCount > 0) {
-            glDrawArraysInstanced(mode, 0, size, instanceCount);
+            glDrawArraysInstanced(mode, first, count, instanceCount);
         } else {
-            glDrawArrays(mode, 0, size);
+            glDrawArrays(mode, first, count);
+        }
+    }
+
+    fenceBuffers();
+}
+
+void Mesh::drawClusters(const uint32_t* clusters, size_t count)
+{
+    static std::vector<GLsizei> counts;
+    static std::vector<const GLvoid*> offsets;
+
+    if (count == 0)
+        return;
+
+    if (mArena != nullptr) {
+        for (size_t i = 0; i < count; ++i) {
+            const MeshCluster& cluster = mClusters[clusters[i]];
+            mArena->draw(*this, cluster.firstIndex, cluster.count);
+        }
+        return;
+    }
+
+    assert(mIndexBuffer != nullptr);
+    prepareDraw();
+
+    counts.clear();
+    offsets.clear();
+    const size_t indexSize = getIndexBufferTypeSize(mIndexBuffer->getDataType());
+    const size_t streamOffset = mIndexBuffer->getStreamOffset();
+    for (size_t i = 0; i < count; ++i) {
+        const MeshCluster& cluster = mClusters[clusters[i]];
+        counts.push_back(cluster.count);
+        offsets.push_back(
+            reinterpret_cast<const GLvoid*>(streamOffset + cluster.firstIndex * indexSize));
+    }
+    glMultiDrawElements(static_cast<GLenum>(mMode), counts.data(),
+        static_cast<GLenum>(mIndexBuffer->getDataType()), offsets.data(), count);
+
+    fenceBuffers();
+}
+
+// Interleaves the lower 10 bits of x, y and z
+static uint32_t mortonCode(uint32_t x, uint32_t y, uint32_t z)
+{
+    auto spread = [](uint32_t v) {
+        v &= 0x3FF;
+        v = (v | (v << 16)) & 0x030000FF;
+        v = (v | (v << 8)) & 0x0300F00F;
+        v = (v | (v << 4)) & 0x030C30C3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+}
+
+bool Mesh::buildClusters(size_t maxVertices, size_t maxTriangles)
+{
+    mClusters.clear();
+    if (mMode != DrawMode::TRIANGLES || mIndexBuffer == nullptr) {
+        LOG_ERROR("Clusters can only be built for indexed meshes with draw mode TRIANGLES.");
+        return false;
+    }
+    if (maxVertices < 3 || maxTriangles < 1) {
+        LOG_ERROR("Clusters need to contain at least one triangle.");
+        return false;
+    }
+    if (!hasAttribute(AttributeType::POSITION) || mIndexBuffer->getData<uint8_t>() == nullptr) {
+        LOG_ERROR("Clusters need positions and local index data.");
+        return false;
+    }
+
+    auto position = getAccessor<glm::vec3>(AttributeType::POSITION);
+    const size_t triangleCount = mIndexBuffer->getNumIndices() / 3;
+    const AABoundingBox& bBox = boundingBox();
+    const glm::vec3 scale = 1023.0f / glm::max(bBox.max - bBox.min, glm::vec3(1e-6f));
+
+    // Split points (in triangles): triangles are only sorted between those
+    std::vector<size_t> splits { 0, triangleCount };
+    for (auto& range : mDrawRanges) {
+        splits.push_back(std::min(range.firstIndex / 3, triangleCount));
+        splits.push_back(std::min((range.firstIndex + range.count) / 3, triangleCount));
+    }
+    std::sort(splits.begin(), splits.end());
+    splits.erase(std::unique(splits.begin(), splits.end()), splits.end());
+
+    // Sort triangles along a z-order curve, so consecutive triangles are close to each other
+    std::vector<std::pair<uint32_t, size_t>> order(triangleCount); // morton code, triangle
+    for (size_t t = 0; t < triangleCount; ++t) {
+        glm::vec3 centroid(0.0f);
+        for (size_t v = 0; v < 3; ++v)
+            centroid += position.get(mIndexBuffer->get(t * 3 + v));
+        glm::uvec3 cell = glm::uvec3((centroid / 3.0f - bBox.min) * scale);
+        order[t] = std::make_pair(mortonCode(cell.x, cell.y, cell.z), t);
+    }
+    for (size_t s = 0; s + 1 < splits.size(); ++s)
+        std::stable_sort(order.begin() + splits[s], order.begin() + splits[s + 1]);
+
+    std::vector<uint32_t> indices(triangleCount * 3);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        for (size_t v = 0; v < 3; ++v)
+            indices[t * 3 + v] = mIndexBuffer->get(order[t].second * 3 + v);
+    }
+    for (size_t i = 0; i < indices.size(); ++i)
+        mIndexBuffer->set(i, indices[i]);
+
+    // Greedily fill clusters
+    const size_t noCluster = std::numeric_limits<size_t>::max();
+    std::vector<size_t> vertexCluster(position.getCount(), noCluster);
+    size_t split = 1;
+    size_t clusterVertices = 0;
+    for (size_t t = 0; t < triangleCount; ++t) {
+        size_t newVertices = 0;
+        for (size_t v = 0; v < 3; ++v) {
+            if (vertexCluster[indices[t * 3 + v]] != mClusters.size() - 1)
+                ++newVertices;
+        }
+
+        bool newCluster = mClusters.size() == 0 || t == splits[split]
+            || clusterVertices + newVertices > maxVertices
+            || mClusters.back().count / 3 >= maxTriangles;
+        if (newCluster) {
+            if (t == splits[split])
+                ++split;
+            mClusters.emplace_back();
+            mClusters.back().firstIndex = t * 3;
+            mClusters.back().count = 0;
+            clusterVertices = 0;
+        }
+
+        for (size_t v = 0; v < 3; ++v) {
+            size_t& cluster = vertexCluster[indices[t * 3 + v]];
+            if (cluster != mClusters.size() - 1) {
+                cluster = mClusters.size() - 1;
+                ++clusterVertices;
+            }
+        }
+        mClusters.back().count += 3;
+    }
+
+    // Bounds and normal cones
+    for (auto& cluster : mClusters) {
+        std::vector<glm::vec3> normals;
+        glm::vec3 normalSum(0.0f);
+        const glm::vec3 first = position.get(indices[cluster.firstIndex]);
+        cluster.bounds.min = cluster.bounds.max = first;
+        for (size_t i = cluster.firstIndex; i < cluster.firstIndex + cluster.count; i += 3) {
+            glm::vec3 p[3];
+            for (size_t v = 0; v < 3; ++v) {
+                p[v] = position.get(indices[i + v]);
+                cluster.bounds.fitPoint(p[v]);
+            }
+            glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+            float area = glm::length(normal);
+            // skip degenerate triangles
+            if (area > 1e-12f) {
+                normals.push_back(normal / area);
+                normalSum += normals.back();
+            }
+        }
+
+        cluster.sphereCenter = (cluster.bounds.min + cluster.bounds.max) * 0.5f;
+        cluster.sphereRadius = 0.0f;
+        for (size_t i = cluster.firstIndex; i < cluster.firstIndex + cluster.count; ++i) {
+            cluster.sphereRadius = std::max(cluster.sphereRadius,
+                glm::length(position.get(indices[i]) - cluster.sphereCenter));
+        }
+
+        cluster.coneAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+        cluster.coneCutoff = 1.0f;
+        const float axisLength = glm::length(normalSum);
+        if (axisLength > 1e-6f) {
+            cluster.coneAxis = normalSum / axisLength;
+            float minDot = 1.0f;
+            for (auto& normal : normals)
+                minDot = std::min(minDot, glm::dot(normal, cluster.coneAxis));
+            // If the normals spread too much (cone angle >= ~84 degrees), never cull
+            if (minDot > 0.1f)
+                cluster.coneCutoff = std::sqrt(1.0f - minDot * minDot);
         }
     }
+
+    LOG_DEBUG("Built %zu clusters for %zu triangles", mClusters.size(), triangleCount);
+    return true;
 }
 
 // Transform positions, normals, tangents and bitangents
 void Mesh::transform(const glm::mat4& transform, const std::vector<AttributeType>& pointAttributes,
     const std::vector<AttributeType>& vectorAttributes)
+{
+    size_t vertexCount = mVertexBuffers.size() > 0 ? mVertexBuffers[0]->getNumVertices() : 0;
+    transformVertices(transform, 0, vertexCount, pointAttributes, vectorAttributes);
+}
+
+void Mesh::transformVertices(const glm::mat4& transform, size_t firstVertex, size_t count,
+    const std::vector<AttributeType>& pointAttributes,
+    const std::vector<AttributeType>& vectorAttributes)
 {
     for (auto attrType : pointAttributes) {
         if (!hasAttribute(attrType))
             continue;
         auto attr = getAccessor<glm::vec3>(attrType);
-        for (size_t i = 0; i < attr.getCount(); ++i) {
+        const size_t end = std::min(firstVertex + count, attr.getCount());
+        for (size_t i = firstVertex; i < end; ++i) {
             attr.set(i, glm::vec3(transform * glm::vec4(attr.get(i), 1.0f)));
         }
     }
@@ -112,10 +526,180 @@ void Mesh::transform(const glm::mat4& transform, const std::vector<AttributeType
         if (!hasAttribute(attrType))
             continue;
         auto attr = getAccessor<glm::vec3>(attrType);
-        for (size_t i = 0; i < attr.getCount(); ++i) {
+        const size_t end = std::min(firstVertex + count, attr.getCount());
+        for (size_t i = firstVertex; i < end; ++i) {
             attr.set(i, glm::vec3(transform * glm::vec4(attr.get(i), 0.0f)));
         }
     }
+    mBBoxDirty = true;
+}
+
+bool Mesh::remapTexCoords(const glm::vec4& uvTransform, int layer, AttributeType attrType)
+{
+    VertexBuffer* vBuf = hasAttribute(attrType);
+    if (!vBuf) {
+        LOG_ERROR("Mesh has no texture coordinates to remap");
+        return false;
+    }
+    const glm::vec2 scale(uvTransform.x, uvTransform.y), offset(uvTransform.z, uvTransform.w);
+    const bool hasLayer = vBuf->getVertexFormat().getAttribute(attrType)->num >= 3;
+    if (layer > 0 && !hasLayer) {
+        LOG_ERROR("Texture coordinates need 3 components to store array layer %d", layer);
+        return false;
+    }
+    if (layer >= 0 && hasLayer) {
+        auto attr = getAccessor<glm::vec3>(attrType);
+        for (size_t i = 0; i < attr.getCount(); ++i) {
+            const glm::vec3 uv = attr.get(i);
+            attr.set(i, glm::vec3(glm::vec2(uv) * scale + offset, static_cast<float>(layer)));
+        }
+    } else {
+        auto attr = getAccessor<glm::vec2>(attrType);
+        for (size_t i = 0; i < attr.getCount(); ++i)
+            attr.set(i, attr.get(i) * scale + offset);
+    }
+    return true;
+}
+
+Mesh* Mesh::merge(const std::vector<std::pair<Mesh*, glm::mat4>>& meshes, float chunkSize)
+{
+    if (meshes.size() == 0) {
+        LOG_ERROR("Can't merge an empty list of meshes.");
+        return nullptr;
+    }
+
+    const Mesh* first = meshes[0].first;
+    // strips, fans and loops would connect the primitives of different meshes
+    if (first->mMode != DrawMode::POINTS && first->mMode != DrawMode::LINES
+        && first->mMode != DrawMode::TRIANGLES) {
+        LOG_ERROR("Only meshes with draw mode POINTS, LINES or TRIANGLES can be merged.");
+        return nullptr;
+    }
+    if (first->mVertexBuffers.size() != 1) {
+        LOG_ERROR("Only meshes with a single vertex buffer can be merged.");
+        return nullptr;
+    }
+    const VertexFormat& format = first->mVertexBuffers[0]->getVertexFormat();
+    if (!format.hasAttribute(AttributeType::POSITION)) {
+        LOG_ERROR("Meshes need a position attribute to be merged.");
+        return nullptr;
+    }
+
+    size_t vertexCount = 0, indexCount = 0;
+    for (auto& source : meshes) {
+        const Mesh* mesh = source.first;
+        if (mesh->mMode != first->mMode || mesh->mVertexBuffers.size() != 1
+            || !(mesh->mVertexBuffers[0]->getVertexFormat() == format)) {
+            LOG_ERROR("All merged meshes need the same draw mode and vertex format.");
+            return nullptr;
+        }
+        if (mesh->mVertexBuffers[0]->getData() == nullptr) {
+            LOG_ERROR("Mesh has no local vertex data (freeLocal has been called).");
+            return nullptr;
+        }
+        vertexCount += mesh->mVertexBuffers[0]->getNumVertices();
+        indexCount += mesh->getElementCount();
+    }
+
+    // sort the sources by chunk, so every chunk is a contiguous range
+    std::vector<glm::ivec3> cells(meshes.size(), glm::ivec3(0));
+    if (chunkSize > 0.0f) {
+        for (size_t i = 0; i < meshes.size(); ++i) {
+            AABoundingBox bBox = meshes[i].first->boundingBox();
+            bBox.transform(meshes[i].second);
+            cells[i] = glm::ivec3(glm::floor((bBox.min + bBox.max) * 0.5f / chunkSize));
+        }
+    }
+    auto cellLess = [](const glm::ivec3& a, const glm::ivec3& b) {
+        return a.x != b.x ? a.x < b.x : (a.y != b.y ? a.y < b.y : a.z < b.z);
+    };
+    std::vector<size_t> order(meshes.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+        [&](size_t a, size_t b) { return cellLess(cells[a], cells[b]); });
+
+    Mesh* mesh = new Mesh(first->mMode);
+    VertexBuffer* vData = mesh->addVertexBuffer(format, vertexCount);
+    IndexBuffer* iData = mesh->setIndexBuffer(vertexCount, indexCount);
+    uint8_t* vertices = reinterpret_cast<uint8_t*>(vData->getData());
+    const size_t stride = format.getStride();
+
+    std::vector<DrawRange> sourceRanges(meshes.size());
+    // the draw ranges of the sources, moved to where the source ended up
+    std::vector<std::vector<DrawRange>> carriedRanges(meshes.size());
+    size_t baseVertex = 0, firstIndex = 0;
+    for (size_t o = 0; o < order.size(); ++o) {
+        const size_t i = order[o];
+        Mesh* source = meshes[i].first;
+        VertexBuffer* sourceVertices = source->mVertexBuffers[0].get();
+        const size_t sourceVertexCount = sourceVertices->getNumVertices();
+        std::memcpy(vertices + baseVertex * stride, sourceVertices->getData(),
+            sourceVertexCount * stride);
+        mesh->transformVertices(meshes[i].second, baseVertex, sourceVertexCount,
+            { AttributeType::POSITION },
+            { AttributeType::NORMAL, AttributeType::TANGENT, AttributeType::BITANGENT });
+
+        const IndexBuffer* sourceIndices = source->mIndexBuffer.get();
+        const size_t sourceIndexCount = source->getElementCount();
+        for (size_t n = 0; n < sourceIndexCount; ++n) {
+            const uint32_t index = sourceIndices ? sourceIndices->get(n) : n;
+            iData->set(firstIndex + n, baseVertex + index);
+        }
+
+        DrawRange& range = sourceRanges[i];
+        range.name = "source" + std::to_string(i);
+        range.firstIndex = firstIndex;
+        range.count = sourceIndexCount;
+        range.baseVertex = 0;
+        range.materialSlot = -1;
+        if (sourceVertexCount > 0) {
+            auto position = mesh->getAccessor<glm::vec3>(AttributeType::POSITION);
+            range.bounds.min = range.bounds.max = position.get(baseVertex);
+            for (size_t v = baseVertex + 1; v < baseVertex + sourceVertexCount; ++v)
+                range.bounds.fitPoint(position.get(v));
+        }
+
+        // the indices already include the source's offset into the vertices, so only the index
+        // ranges move
+        for (auto sourceRange : source->mDrawRanges) {
+            sourceRange.name = range.name + ":" + sourceRange.name;
+            sourceRange.firstIndex += firstIndex;
+            if (!sourceRange.bounds.empty())
+                sourceRange.bounds.transform(meshes[i].second);
+            carriedRanges[i].push_back(sourceRange);
+        }
+
+        baseVertex += sourceVertexCount;
+        firstIndex += sourceIndexCount;
+    }
+    vData->markDirty();
+
+    for (auto& range : sourceRanges)
+        mesh->mDrawRanges.push_back(range);
+
+    // chunk ranges
+    size_t chunkCount = 0;
+    for (size_t o = 0; o < order.size();) {
+        DrawRange chunk = sourceRanges[order[o]];
+        chunk.name = "chunk" + std::to_string(chunkCount++);
+        size_t next = o + 1;
+        while (next < order.size() && cells[order[next]] == cells[order[o]]) {
+            const DrawRange& range = sourceRanges[order[next]];
+            chunk.count += range.count;
+            chunk.bounds.fitAABB(range.bounds);
+            ++next;
+        }
+        mesh->mDrawRanges.push_back(chunk);
+        o = next;
+    }
+
+    for (auto& ranges : carriedRanges)
+        mesh->mDrawRanges.insert(mesh->mDrawRanges.end(), ranges.begin(), ranges.end());
+
+    LOG_DEBUG("Merged %zu meshes (%zu vertices) into %zu chunks", meshes.size(), vertexCount,
+        chunkCount);
+    return mesh;
 }
 
 void Mesh::normalize(bool rescale)
@@ -367,6 +951,39 @@ Mesh* Mesh::plane(
     return mesh;
 }
 
+Mesh* Mesh::plane(float width, float height, int segmentsX, int segmentsY, const float* heights,
+    float heightScale, const VertexFormat& format)
+{
+    Mesh* mesh = plane(width, height, segmentsX, segmentsY, format);
+
+    auto position = mesh->getAccessor<glm::vec3>(AttributeType::POSITION);
+    auto normal = mesh->getAccessor<glm::vec3>(AttributeType::NORMAL);
+
+    const int perLine = segmentsX + 1;
+    auto sample = [&](int x, int y) {
+        x = std::clamp(x, 0, segmentsX);
+        y = std::clamp(y, 0, segmentsY);
+        return heights[x + y * perLine] * heightScale;
+    };
+    const float dx = width / segmentsX, dz = height / segmentsY;
+    int index = 0;
+    for (int y = 0; y <= segmentsY; ++y) {
+        for (int x = 0; x <= segmentsX; ++x) {
+            glm::vec3 pos = position.get(index);
+            pos.y = sample(x, y);
+            position.set(index, pos);
+            // central differences, one-sided at the edges
+            const float sx = (sample(x - 1, y) - sample(x + 1, y))
+                / (dx * (std::min(x + 1, segmentsX) - std::max(x - 1, 0)));
+            const float sz = (sample(x, y - 1) - sample(x, y + 1))
+                / (dz * (std::min(y + 1, segmentsY) - std::max(y - 1, 0)));
+            normal.set(index++, glm::normalize(glm::vec3(sx, 1.0f, sz)));
+        }
+    }
+
+    return mesh;
+}
+
 struct objVertex {
     glm::vec3 position;
     glm::vec3 normal;
@@ -376,15 +993,29 @@ struct objVertex {
 Mesh* loadTinyObj(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes,
     const std::vector<tinyobj::material_t>& materials, const VertexFormat& format)
 {
-    // Per-Face Materials are annoying and I am going to ignore them completely.
-    // If I wanted to respect them, I would have to bucket the faces by material, then
-    // build vertex/index buffers from them. This is annoying and slow.
+    // Bucket the faces by material, so every material ends up as a single contiguous draw range.
+    // material id -1 means no material
+    std::map<int, std::vector<std::pair<size_t, size_t>>> faceBuckets; // shape, face
+    for (size_t s = 0; s < shapes.size(); ++s) {
+        const auto& materialIds = shapes[s].mesh.material_ids;
+        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); ++f) {
+            int material = f < materialIds.size() ? materialIds[f] : -1;
+            if (material >= static_cast<int>(materials.size()))
+                material = -1;
+            faceBuckets[material].emplace_back(s, f);
+        }
+    }
 
     std::vector<objVertex> vertices;
-    // loop shapes
-    for (size_t s = 0; s < shapes.size(); ++s) {
+    std::vector<DrawRange> ranges;
+    for (auto& bucket : faceBuckets) {
+        const int material = bucket.first;
+        ranges.push_back(DrawRange { material >= 0 ? materials[material].name : "", vertices.size(),
+            bucket.second.size() * 3, 0, material, AABoundingBox() });
         // loop faces
-        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); ++f) {
+        for (auto& face : bucket.second) {
+            const size_t s = face.first;
+            const size_t f = face.second;
             assert(shapes[s].mesh.num_face_vertices[f] == 3);
             bool missingNormal = true;
             for (size_t v = 0; v < 3; ++v) {
@@ -437,7 +1068,11 @@ Mesh* loadTinyObj(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::sh
         }
     }
 
-    LOG_DEBUG("Loaded mesh (%d vertices, %d faces)", vertices.size(), vertices.size() / 3);
+    for (auto& range : ranges)
+        mesh->addDrawRange(range.name, range.firstIndex, range.count, 0, range.materialSlot);
+
+    LOG_DEBUG("Loaded mesh (%zu vertices, %zu faces, %zu materials)", vertices.size(),
+        vertices.size() / 3, ranges.size());
 
     return mesh;
 }
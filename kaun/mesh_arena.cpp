@@ -0,0 +1,246 @@
+#include "mesh_arena.hpp"
+
+#include <cassert>
+#include <cstring>
+
+#include "log.hpp"
+#include "mesh.hpp"
+
+namespace kaun {
+size_t FreeList::allocate(size_t size)
+{
+    for (auto it = mFree.begin(); it != mFree.end(); ++it) {
+        if (it->second >= size) {
+            const size_t offset = it->first;
+            it->first += size;
+            it->second -= size;
+            if (it->second == 0)
+                mFree.erase(it);
+            return offset;
+        }
+    }
+    return INVALID;
+}
+
+void FreeList::free(size_t offset, size_t size)
+{
+    if (size == 0)
+        return;
+    auto it = mFree.begin();
+    while (it != mFree.end() && it->first < offset)
+        ++it;
+    it = mFree.insert(it, std::make_pair(offset, size));
+    // merge with the next block
+    auto next = it + 1;
+    if (next != mFree.end() && it->first + it->second == next->first) {
+        it->second += next->second;
+        mFree.erase(next);
+    }
+    // merge with the previous block
+    if (it != mFree.begin()) {
+        auto prev = it - 1;
+        if (prev->first + prev->second == it->first) {
+            prev->second += it->second;
+            mFree.erase(it);
+        }
+    }
+}
+
+size_t FreeList::getFreeCount() const
+{
+    size_t count = 0;
+    for (auto& block : mFree)
+        count += block.second;
+    return count;
+}
+
+MeshArena::MeshArena(const VertexFormat& format, size_t vertexCapacity, size_t indexCapacity)
+    : mVertexFormat(format)
+    , mVertices(mVertexFormat, vertexCapacity)
+    , mIndices(vertexCapacity, indexCapacity)
+    , mFreeVertices(vertexCapacity)
+    , mFreeIndices(indexCapacity)
+    , mVAO(0)
+{
+}
+
+MeshArena::~MeshArena()
+{
+    for (auto mesh : mMeshes)
+        mesh->mArena = nullptr;
+    if (mVAO != 0) {
+        if (Mesh::currentVAO == mVAO)
+            Mesh::currentVAO = 0;
+        glDeleteVertexArrays(1, &mVAO);
+    }
+}
+
+void MeshArena::compile()
+{
+    glGenVertexArrays(1, &mVAO);
+    glBindVertexArray(mVAO);
+    Mesh::currentVAO = mVAO;
+
+    mVertices.bind();
+    const auto& attributes = mVertexFormat.getAttributes();
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        const auto& attr = attributes[i];
+        int location = static_cast<int>(attr.type);
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, attr.alignedNum, static_cast<GLenum>(attr.dataType),
+            attr.normalized ? GL_TRUE : GL_FALSE, mVertexFormat.getStride(),
+            reinterpret_cast<GLvoid*>(attr.offset));
+    }
+    mIndices.bind();
+    VertexBuffer::unbind();
+}
+
+bool MeshArena::add(Mesh& mesh)
+{
+    if (mesh.mArena == this)
+        remove(mesh);
+    if (mesh.mArena != nullptr) {
+        LOG_ERROR("Mesh is already part of another arena.");
+        return false;
+    }
+
+    if (mesh.mVertexBuffers.size() != 1) {
+        LOG_ERROR("Only meshes with a single vertex buffer can be added to an arena.");
+        return false;
+    }
+    VertexBuffer& vBuf = *mesh.mVertexBuffers[0];
+    if (!(vBuf.getVertexFormat() == mVertexFormat)) {
+        LOG_ERROR("Vertex format of the mesh does not match the vertex format of the arena.");
+        return false;
+    }
+    for (auto& attr : mVertexFormat.getAttributes()) {
+        if (attr.divisor > 0) {
+            LOG_ERROR("Meshes with instanced attributes can not be added to an arena.");
+            return false;
+        }
+    }
+    if (vBuf.getData() == nullptr) {
+        LOG_ERROR("Mesh has no local vertex data (freeLocal has been called).");
+        return false;
+    }
+
+    IndexBuffer* iBuf = mesh.mIndexBuffer.get();
+    const size_t vertexCount = vBuf.getNumVertices();
+    const size_t indexCount = iBuf ? iBuf->getNumIndices() : vertexCount;
+
+    Allocation alloc;
+    alloc.vertexCount = vertexCount;
+    alloc.indexCount = indexCount;
+    alloc.baseVertex = mFreeVertices.allocate(vertexCount);
+    if (alloc.baseVertex == FreeList::INVALID) {
+        LOG_ERROR("Mesh arena is out of vertex space (%zu vertices requested).", vertexCount);
+        return false;
+    }
+    alloc.firstIndex = mFreeIndices.allocate(indexCount);
+    if (alloc.firstIndex == FreeList::INVALID) {
+        mFreeVertices.free(alloc.baseVertex, vertexCount);
+        LOG_ERROR("Mesh arena is out of index space (%zu indices requested).", indexCount);
+        return false;
+    }
+
+    const size_t stride = mVertexFormat.getStride();
+    uint8_t* vertexData = reinterpret_cast<uint8_t*>(mVertices.getData());
+    ::memcpy(vertexData + alloc.baseVertex * stride, vBuf.getData(), vertexCount * stride);
+    mVertices.markDirty(alloc.baseVertex * stride, vertexCount * stride);
+
+    for (size_t i = 0; i < indexCount; ++i)
+        mIndices.set(alloc.firstIndex + i, iBuf ? iBuf->get(i) : i);
+
+    mesh.mArena = this;
+    mesh.mArenaAllocation = alloc;
+    mMeshes.push_back(&mesh);
+    return true;
+}
+
+void MeshArena::remove(Mesh& mesh)
+{
+    if (mesh.mArena != this)
+        return;
+    const Allocation& alloc = mesh.mArenaAllocation;
+    mFreeVertices.free(alloc.baseVertex, alloc.vertexCount);
+    mFreeIndices.free(alloc.firstIndex, alloc.indexCount);
+    mesh.mArena = nullptr;
+    for (auto it = mMeshes.begin(); it != mMeshes.end(); ++it) {
+        if (*it == &mesh) {
+            mMeshes.erase(it);
+            break;
+        }
+    }
+}
+
+void MeshArena::bind()
+{
+    if (mVAO == 0)
+        compile();
+
+    mVertices.flush();
+    mIndices.flush();
+
+    if (Mesh::currentVAO != mVAO) {
+        glBindVertexArray(mVAO);
+        Mesh::currentVAO = mVAO;
+    }
+}
+
+void MeshArena::draw(
+    const Mesh& mesh, size_t firstIndex, size_t count, int baseVertex, size_t instanceCount)
+{
+    assert(mesh.mArena == this);
+    bind();
+    const Allocation& alloc = mesh.mArenaAllocation;
+    assert(firstIndex + count <= alloc.indexCount);
+    const GLenum mode = static_cast<GLenum>(mesh.getDrawMode());
+    const GLenum indexType = static_cast<GLenum>(mIndices.getDataType());
+    const GLvoid* offset = reinterpret_cast<const GLvoid*>(
+        (alloc.firstIndex + firstIndex) * getIndexBufferTypeSize(mIndices.getDataType()));
+    baseVertex += alloc.baseVertex;
+    if (instanceCount > 0) {
+        glDrawElementsInstancedBaseVertex(
+            mode, count, indexType, offset, instanceCount, baseVertex);
+    } else {
+        glDrawElementsBaseVertex(mode, count, indexType, offset, baseVertex);
+    }
+}
+
+void MeshArena::draw(const std::vector<std::pair<const Mesh*, const DrawRange*>>& draws)
+{
+    static std::vector<GLsizei> counts;
+    static std::vector<const GLvoid*> offsets;
+    static std::vector<GLint> baseVertices;
+
+    if (draws.size() == 0)
+        return;
+    bind();
+
+    counts.clear();
+    offsets.clear();
+    baseVertices.clear();
+    const size_t indexSize = getIndexBufferTypeSize(mIndices.getDataType());
+    const Mesh::DrawMode mode = draws[0].first->getDrawMode();
+    for (auto& draw : draws) {
+        const Mesh* mesh = draw.first;
+        assert(mesh->mArena == this && mesh->getDrawMode() == mode);
+        const Allocation& alloc = mesh->mArenaAllocation;
+        if (draw.second != nullptr) {
+            const DrawRange& range = *draw.second;
+            counts.push_back(range.count);
+            offsets.push_back(
+                reinterpret_cast<const GLvoid*>((alloc.firstIndex + range.firstIndex) * indexSize));
+            baseVertices.push_back(alloc.baseVertex + range.baseVertex);
+        } else {
+            counts.push_back(alloc.indexCount);
+            offsets.push_back(reinterpret_cast<const GLvoid*>(alloc.firstIndex * indexSize));
+            baseVertices.push_back(alloc.baseVertex);
+        }
+    }
+
+    glMultiDrawElementsBaseVertex(static_cast<GLenum>(mode), counts.data(),
+        static_cast<GLenum>(mIndices.getDataType()), offsets.data(), draws.size(),
+        baseVertices.data());
+}
+}
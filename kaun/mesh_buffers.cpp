@@ -1,25 +1,206 @@
 #include "mesh_buffers.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 
 #include "log.hpp"
 
 namespace kaun {
+size_t GLBuffer::totalUploadedBytes = 0;
+size_t GLBuffer::totalStreamStalls = 0;
+
+// All transfers go through GL_COPY_WRITE_BUFFER, so that we don't disturb the element array buffer
+// binding of whatever VAO is currently bound (or the array buffer binding someone else relies on)
 void GLBuffer::upload()
 {
     mUploadCount++;
     if (mBufferObject == 0) {
         glGenBuffers(1, &mBufferObject);
     }
-    glBindBuffer(mTarget, mBufferObject);
-    if (mLastUploadedSize != mSize) {
-        glBufferData(mTarget, mSize, mData.get(), static_cast<GLenum>(mUsage));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mBufferObject);
+    size_t uploaded = mSize;
+    if (isStreaming()) {
+        uploaded = uploadStreaming();
+    } else if (mLastUploadedSize != mSize) {
+        glBufferData(GL_COPY_WRITE_BUFFER, mSize, mData.get(), static_cast<GLenum>(mUsage));
         mLastUploadedSize = mSize;
     } else {
-        glBufferSubData(mTarget, 0, mSize, mData.get());
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, mSize, mData.get());
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    mUploadedBytes += uploaded;
+    totalUploadedBytes += uploaded;
+    mDirtyRanges.clear();
+}
+
+// Expects the buffer object to be bound to GL_COPY_WRITE_BUFFER. Returns the number of bytes
+// uploaded from the CPU.
+size_t GLBuffer::uploadStreaming()
+{
+    const bool reallocated = mLastUploadedSize != mSize;
+    if (reallocated) {
+        deleteStreamFences();
+        glBufferData(GL_COPY_WRITE_BUFFER, mSize * STREAM_REGIONS, nullptr,
+            static_cast<GLenum>(mUsage));
+        mLastUploadedSize = mSize;
+        mStreamRegion = 0;
+    } else {
+        mStreamRegion = (mStreamRegion + 1) % STREAM_REGIONS;
+        GLsync& fence = mStreamFences[mStreamRegion];
+        if (fence != nullptr) {
+            GLenum status = glClientWaitSync(fence, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED) {
+                totalStreamStalls++;
+                const GLuint64 timeout = 1000000; // 1ms
+                do {
+                    status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+                } while (status == GL_TIMEOUT_EXPIRED);
+            }
+            if (status == GL_WAIT_FAILED)
+                LOG_ERROR("Waiting for stream buffer fence failed!");
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    const bool previousUsed = mStreamRegionUsed;
+    mStreamRegionUsed = false;
+
+    if (reallocated) {
+        if (mSize > 0 && mData)
+            writeStreamRange(0, mSize);
+        return mData ? mSize : 0;
+    }
+
+    const size_t previousRegion = (mStreamRegion + STREAM_REGIONS - 1) % STREAM_REGIONS;
+    if (mSize == 0 || !mData) {
+        if (previousUsed)
+            fenceStreamRegion(previousRegion);
+        return 0;
+    }
+
+    // Everything that is not dirty is the same as in the previous region, so it is copied on the
+    // GPU. Regions never overlap, so copying inside the same buffer is fine.
+    const size_t previousOffset = previousRegion * mSize;
+    glBindBuffer(GL_COPY_READ_BUFFER, mBufferObject);
+    bool copied = false;
+    auto copyPrevious = [this, previousOffset, &copied](size_t begin, size_t end) {
+        if (end > begin) {
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, previousOffset + begin,
+                getStreamOffset() + begin, end - begin);
+            copied = true;
+        }
+    };
+    size_t uploaded = 0, cleanBegin = 0;
+    for (auto& range : mDirtyRanges) {
+        copyPrevious(cleanBegin, range.first);
+        writeStreamRange(range.first, range.second - range.first);
+        uploaded += range.second - range.first;
+        cleanBegin = range.second;
+    }
+    copyPrevious(cleanBegin, mSize);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    // The draws and the copy are the last commands reading from the previous region, so it is
+    // fenced after both have been submitted and is not overwritten before they are done.
+    if (previousUsed || copied)
+        fenceStreamRegion(previousRegion);
+    return uploaded;
+}
+
+void GLBuffer::fenceStreamRegion(size_t region)
+{
+    GLsync& fence = mStreamFences[region];
+    if (fence != nullptr)
+        glDeleteSync(fence);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// Writes [offset, offset + size) of the local data to the current stream region
+void GLBuffer::writeStreamRange(size_t offset, size_t size)
+{
+    const size_t dest = getStreamOffset() + offset;
+    // We waited for the fence ourselves, so the driver doesn't have to synchronize
+    const GLbitfield access
+        = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+    void* mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, dest, size, access);
+    if (mapped == nullptr) {
+        LOG_ERROR("Could not map stream buffer region!");
+        glBufferSubData(GL_COPY_WRITE_BUFFER, dest, size, mData.get() + offset);
+        return;
+    }
+    ::memcpy(mapped, mData.get() + offset, size);
+    if (glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_FALSE) {
+        // The data store got corrupted (e.g. by a display mode change), so just upload again
+        glBufferSubData(GL_COPY_WRITE_BUFFER, dest, size, mData.get() + offset);
+    }
+}
+
+void GLBuffer::deleteStreamFences()
+{
+    for (auto& fence : mStreamFences) {
+        if (fence != nullptr) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+}
+
+void GLBuffer::flush()
+{
+    // A stream buffer always moves to the next region, since the data in that region is
+    // STREAM_REGIONS uploads old
+    if (mBufferObject == 0 || mLastUploadedSize != mSize || (isStreaming() && isDirty())) {
+        upload();
+        return;
+    }
+
+    if (mDirtyRanges.size() == 0 || !mData)
+        return;
+
+    mUploadCount++;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mBufferObject);
+    for (auto& range : mDirtyRanges) {
+        const size_t size = range.second - range.first;
+        glBufferSubData(GL_COPY_WRITE_BUFFER, range.first, size, mData.get() + range.first);
+        mUploadedBytes += size;
+        totalUploadedBytes += size;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    mDirtyRanges.clear();
+}
+
+void GLBuffer::markDirty(size_t offset, size_t size)
+{
+    if (size == 0 || offset >= static_cast<size_t>(mSize))
+        return;
+    size_t begin = offset;
+    size_t end = std::min(offset + size, static_cast<size_t>(mSize));
+
+    // find the first range that ends at or after begin (touching ranges are merged too)
+    auto it = mDirtyRanges.begin();
+    while (it != mDirtyRanges.end() && it->second < begin)
+        ++it;
+    // swallow all ranges that overlap or touch [begin, end)
+    auto last = it;
+    while (last != mDirtyRanges.end() && last->first <= end) {
+        begin = std::min(begin, last->first);
+        end = std::max(end, last->second);
+        ++last;
+    }
+    it = mDirtyRanges.erase(it, last);
+    mDirtyRanges.insert(it, std::make_pair(begin, end));
+
+    // Keep the set small. Merging the closest neighbours uploads the least superfluous bytes.
+    while (mDirtyRanges.size() > MAX_DIRTY_RANGES) {
+        size_t closest = 0;
+        for (size_t i = 1; i < mDirtyRanges.size() - 1; ++i) {
+            const size_t gap = mDirtyRanges[i + 1].first - mDirtyRanges[i].second;
+            if (gap < mDirtyRanges[closest + 1].first - mDirtyRanges[closest].second)
+                closest = i;
+        }
+        mDirtyRanges[closest].second = mDirtyRanges[closest + 1].second;
+        mDirtyRanges.erase(mDirtyRanges.begin() + closest + 1);
     }
-    glBindBuffer(mTarget, 0);
 }
 
 void VertexBuffer::reallocate(size_t numVertices, bool copyOld)
@@ -31,6 +212,7 @@ void VertexBuffer::reallocate(size_t numVertices, bool copyOld)
     mData = std::move(newData);
     mNumVertices = numVertices;
     mSize = newSize;
+    markDirty();
 }
 
 int getIndexBufferTypeSize(IndexBufferType type)
@@ -69,6 +251,7 @@ void IndexBuffer::reallocate(size_t numIndices, bool copyOld)
     mData = std::move(newData);
     mNumIndices = numIndices;
     mSize = newSize;
+    markDirty();
 }
 
 uint32_t IndexBuffer::get(size_t index) const
@@ -103,5 +286,7 @@ void IndexBuffer::set(size_t index, uint32_t val)
         *(reinterpret_cast<uint32_t*>(mData.get()) + index) = static_cast<uint32_t>(val);
         break;
     }
+    const size_t typeSize = getIndexBufferTypeSize(mDataType);
+    markDirty(index * typeSize, typeSize);
 }
 }
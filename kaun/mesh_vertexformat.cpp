@@ -115,4 +115,18 @@ bool VertexFormat::hasAttribute(AttributeType attrType) const
             return true;
     return false;
 }
+
+bool VertexFormat::operator==(const VertexFormat& other) const
+{
+    if (mStride != other.mStride || mAttributes.size() != other.mAttributes.size())
+        return false;
+    for (size_t i = 0; i < mAttributes.size(); ++i) {
+        const VertexAttribute& a = mAttributes[i];
+        const VertexAttribute& b = other.mAttributes[i];
+        if (a.type != b.type || a.num != b.num || a.dataType != b.dataType || a.offset != b.offset
+            || a.normalized != b.normalized || a.divisor != b.divisor)
+            return false;
+    }
+    return true;
+}
 }
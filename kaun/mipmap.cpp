@@ -0,0 +1,333 @@
+#include "mipmap.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define KAUN_MIPMAP_SSE
+#include <xmmintrin.h>
+#endif
+
+// Every level is filtered from the previous one, which is kept around as 4 floats per pixel (the
+// colors in linear space). A level is resampled separably: for every row of the smaller level the
+// rows of the larger one are summed up with the vertical filter weights and the result is filtered
+// horizontally. The weights are precomputed per level, so odd sizes are handled too.
+
+namespace kaun {
+namespace {
+    struct Tap {
+        int index;
+        float weight;
+    };
+
+    // The taps of output pixel i are taps[start[i]] until taps[start[i + 1]]
+    struct FilterTable {
+        std::vector<size_t> start;
+        std::vector<Tap> taps;
+    };
+
+    float besselI0(float x)
+    {
+        // power series, converges quickly for the small arguments used here
+        float sum = 1.0f, term = 1.0f;
+        for (int k = 1; k < 20; ++k) {
+            const float f = x / (2.0f * k);
+            term *= f * f;
+            sum += term;
+        }
+        return sum;
+    }
+
+    const float pi = 3.14159265f;
+    const float kaiserRadius = 3.0f; // in destination pixels
+    const float kaiserBeta = 4.0f;
+
+    float kaiser(float x)
+    {
+        if (std::abs(x) >= kaiserRadius)
+            return 0.0f;
+        const float sinc = x == 0.0f ? 1.0f : std::sin(pi * x) / (pi * x);
+        const float t = x / kaiserRadius;
+        return sinc * besselI0(kaiserBeta * std::sqrt(1.0f - t * t)) / besselI0(kaiserBeta);
+    }
+
+    FilterTable buildFilterTable(int srcSize, int dstSize, MipmapFilter filter)
+    {
+        FilterTable table;
+        table.start.reserve(dstSize + 1);
+        const float scale = static_cast<float>(srcSize) / dstSize;
+        for (int i = 0; i < dstSize; ++i) {
+            table.start.push_back(table.taps.size());
+            const size_t first = table.taps.size();
+            float sum = 0.0f;
+            if (filter == MipmapFilter::BOX || srcSize == dstSize) {
+                // weight by the part of the source pixel that is covered
+                const float begin = i * scale, end = (i + 1) * scale;
+                for (int s = static_cast<int>(begin); s < std::min<float>(end, srcSize); ++s) {
+                    const float coverage
+                        = std::min(end, s + 1.0f) - std::max(begin, static_cast<float>(s));
+                    if (coverage > 0.0f) {
+                        table.taps.push_back(Tap { s, coverage });
+                        sum += coverage;
+                    }
+                }
+            } else {
+                const float center = (i + 0.5f) * scale;
+                const int lo = static_cast<int>(std::floor(center - kaiserRadius * scale));
+                const int hi = static_cast<int>(std::ceil(center + kaiserRadius * scale));
+                for (int s = lo; s <= hi; ++s) {
+                    const float weight = kaiser((s + 0.5f - center) / scale);
+                    if (weight != 0.0f) {
+                        const int clamped = std::min(std::max(s, 0), srcSize - 1);
+                        table.taps.push_back(Tap { clamped, weight });
+                        sum += weight;
+                    }
+                }
+            }
+            for (size_t t = first; t < table.taps.size(); ++t)
+                table.taps[t].weight /= sum;
+        }
+        table.start.push_back(table.taps.size());
+        return table;
+    }
+
+    struct ColorTables {
+        float toLinear[256];
+        // linear values half way between two successive sRGB values, for rounding
+        float srgbThresholds[255];
+
+        ColorTables()
+        {
+            auto decode = [](float v) {
+                return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+            };
+            for (int i = 0; i < 256; ++i)
+                toLinear[i] = decode(i / 255.0f);
+            for (int i = 0; i < 255; ++i)
+                srgbThresholds[i] = decode((i + 0.5f) / 255.0f);
+        }
+    };
+
+    const ColorTables& getColorTables()
+    {
+        static ColorTables tables;
+        return tables;
+    }
+
+    uint8_t quantizeLinear(float v)
+    {
+        return static_cast<uint8_t>(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+
+    uint8_t quantizeSrgb(float v)
+    {
+        const float* thresholds = getColorTables().srgbThresholds;
+        return static_cast<uint8_t>(std::upper_bound(thresholds, thresholds + 255, v) - thresholds);
+    }
+
+    // A level as 4 floats per pixel
+    struct FloatImage {
+        int width = 0, height = 0;
+        std::vector<float> pixels;
+    };
+
+    // Either the 8 bit base level or a float level
+    struct Source {
+        const uint8_t* bytes;
+        const FloatImage* floats;
+        int width, height, components;
+        bool srgb;
+
+        // row += weight * source row y
+        void accumulateRow(int y, float weight, float* row) const
+        {
+            if (floats) {
+                const float* src = floats->pixels.data() + static_cast<size_t>(y) * width * 4;
+                const size_t count = static_cast<size_t>(width) * 4;
+#ifdef KAUN_MIPMAP_SSE
+                const __m128 w = _mm_set1_ps(weight);
+                for (size_t i = 0; i < count; i += 4) {
+                    const __m128 sum
+                        = _mm_add_ps(_mm_loadu_ps(row + i), _mm_mul_ps(w, _mm_loadu_ps(src + i)));
+                    _mm_storeu_ps(row + i, sum);
+                }
+#else
+                for (size_t i = 0; i < count; ++i)
+                    row[i] += weight * src[i];
+#endif
+                return;
+            }
+
+            const float* toLinear = getColorTables().toLinear;
+            const uint8_t* src = bytes + static_cast<size_t>(y) * width * components;
+            for (int x = 0; x < width; ++x) {
+                for (int c = 0; c < components; ++c) {
+                    const uint8_t v = src[x * components + c];
+                    const bool decode = srgb && c < 3;
+                    row[x * 4 + c] += weight * (decode ? toLinear[v] : v / 255.0f);
+                }
+            }
+        }
+    };
+
+    // Filters the rows [firstRow, lastRow) of dst
+    void resampleRows(const Source& src, FloatImage& dst, const FilterTable& horizontal,
+        const FilterTable& vertical, int firstRow, int lastRow)
+    {
+        std::vector<float> row(static_cast<size_t>(src.width) * 4);
+        for (int y = firstRow; y < lastRow; ++y) {
+            std::fill(row.begin(), row.end(), 0.0f);
+            for (size_t t = vertical.start[y]; t < vertical.start[y + 1]; ++t)
+                src.accumulateRow(vertical.taps[t].index, vertical.taps[t].weight, row.data());
+
+            float* out = dst.pixels.data() + static_cast<size_t>(y) * dst.width * 4;
+            for (int x = 0; x < dst.width; ++x) {
+#ifdef KAUN_MIPMAP_SSE
+                __m128 sum = _mm_setzero_ps();
+                for (size_t t = horizontal.start[x]; t < horizontal.start[x + 1]; ++t) {
+                    const Tap& tap = horizontal.taps[t];
+                    sum = _mm_add_ps(sum,
+                        _mm_mul_ps(_mm_set1_ps(tap.weight), _mm_loadu_ps(&row[tap.index * 4])));
+                }
+                _mm_storeu_ps(out + x * 4, sum);
+#else
+                float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                for (size_t t = horizontal.start[x]; t < horizontal.start[x + 1]; ++t) {
+                    const Tap& tap = horizontal.taps[t];
+                    for (int c = 0; c < 4; ++c)
+                        sum[c] += tap.weight * row[tap.index * 4 + c];
+                }
+                std::copy(sum, sum + 4, out + x * 4);
+#endif
+            }
+        }
+    }
+
+    template <typename Func>
+    void parallelRows(int rows, int threadCount, int pixelsPerRow, Func func)
+    {
+        // don't bother with threads for tiny levels
+        threadCount = std::min(threadCount, std::max(1, rows * pixelsPerRow / (64 * 64)));
+        threadCount = std::min(threadCount, rows);
+        std::vector<std::thread> threads;
+        const int rowsPerThread = (rows + threadCount - 1) / threadCount;
+        for (int t = 1; t < threadCount; ++t) {
+            const int first = t * rowsPerThread;
+            const int last = std::min(rows, first + rowsPerThread);
+            if (first >= last)
+                break;
+            threads.emplace_back(func, first, last);
+        }
+        // the calling thread does the first chunk
+        func(0, std::min(rows, rowsPerThread));
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    float alphaCoverage(const uint8_t* pixels, size_t count, int components, float reference)
+    {
+        size_t covered = 0;
+        for (size_t i = 0; i < count; ++i)
+            covered += pixels[i * components + 3] / 255.0f > reference;
+        return static_cast<float>(covered) / count;
+    }
+
+    float alphaCoverage(const FloatImage& image, float scale, float reference)
+    {
+        const size_t count = static_cast<size_t>(image.width) * image.height;
+        size_t covered = 0;
+        for (size_t i = 0; i < count; ++i)
+            covered += image.pixels[i * 4 + 3] * scale > reference;
+        return static_cast<float>(covered) / count;
+    }
+
+    // Finds the alpha scale that gives the level the same coverage as the base level
+    float alphaCoverageScale(const FloatImage& image, float coverage, float reference)
+    {
+        float lo = 0.0f, hi = 4.0f;
+        for (int i = 0; i < 12; ++i) {
+            const float mid = (lo + hi) * 0.5f;
+            if (alphaCoverage(image, mid, reference) < coverage)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        return (lo + hi) * 0.5f;
+    }
+}
+
+void buildMipChain(const uint8_t* pixels, int width, int height, int components, MipChain& chain,
+    const MipmapParams& params)
+{
+    assert(width > 0 && height > 0 && components >= 1 && components <= 4);
+    const int threadCount = params.threadCount > 0
+        ? params.threadCount
+        : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    const bool srgb = params.srgb && components >= 3;
+    const bool preserveCoverage = params.alphaCoverageReference > 0.0f && components == 4;
+
+    chain = MipChain();
+    chain.components = components;
+    int levelWidth = width, levelHeight = height;
+    size_t offset = 0;
+    while (true) {
+        const size_t size = static_cast<size_t>(levelWidth) * levelHeight * components;
+        chain.levels.push_back(MipChain::Level { levelWidth, levelHeight, offset, size });
+        offset += size;
+        if ((levelWidth == 1 && levelHeight == 1)
+            || (params.maxLevels > 0 && static_cast<int>(chain.levels.size()) >= params.maxLevels))
+            break;
+        levelWidth = std::max(1, levelWidth / 2);
+        levelHeight = std::max(1, levelHeight / 2);
+    }
+    chain.data.resize(offset);
+    std::memcpy(chain.data.data(), pixels, chain.levels[0].size);
+
+    const float coverage = preserveCoverage
+        ? alphaCoverage(pixels, static_cast<size_t>(width) * height, components,
+              params.alphaCoverageReference)
+        : 0.0f;
+
+    FloatImage previous;
+    for (size_t level = 1; level < chain.levels.size(); ++level) {
+        const auto& info = chain.levels[level];
+        const auto& prevInfo = chain.levels[level - 1];
+        const Source src = { level == 1 ? pixels : nullptr, level == 1 ? nullptr : &previous,
+            prevInfo.width, prevInfo.height, components, srgb };
+        const FilterTable horizontal = buildFilterTable(prevInfo.width, info.width, params.filter);
+        const FilterTable vertical = buildFilterTable(prevInfo.height, info.height, params.filter);
+
+        FloatImage current;
+        current.width = info.width;
+        current.height = info.height;
+        current.pixels.resize(static_cast<size_t>(info.width) * info.height * 4);
+        parallelRows(info.height, threadCount, info.width, [&](int first, int last) {
+            resampleRows(src, current, horizontal, vertical, first, last);
+        });
+
+        // the next level is filtered from the unscaled alpha
+        const float alphaScale = preserveCoverage
+            ? alphaCoverageScale(current, coverage, params.alphaCoverageReference)
+            : 1.0f;
+        uint8_t* out = chain.data.data() + info.offset;
+        parallelRows(info.height, threadCount, info.width, [&](int first, int last) {
+            for (size_t i = static_cast<size_t>(first) * info.width;
+                 i < static_cast<size_t>(last) * info.width; ++i) {
+                for (int c = 0; c < components; ++c) {
+                    const float v = current.pixels[i * 4 + c];
+                    if (srgb && c < 3)
+                        out[i * components + c] = quantizeSrgb(v);
+                    else if (c == 3)
+                        out[i * components + c] = quantizeLinear(v * alphaScale);
+                    else
+                        out[i * components + c] = quantizeLinear(v);
+                }
+            }
+        });
+        previous = std::move(current);
+    }
+}
+}
@@ -0,0 +1,277 @@
+#include "noise.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <thread>
+
+#include "log.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KAUN_NOISE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace kaun {
+// Gradient (Perlin) noise, but the gradients are picked by an integer hash of the lattice
+// coordinates instead of a permutation table, so there are no table lookups (gathers) and four
+// samples can be evaluated at once with SSE2. The gradients are the eight from noise1234 by
+// Stefan Gustavson.
+namespace {
+    constexpr uint32_t hashX = 0x27d4eb2du;
+    constexpr uint32_t hashY = 0x165667b1u;
+    constexpr uint32_t hashMix = 0x2c1b3c6du;
+    // scales the result to [-1, 1]
+    constexpr float noiseScale = 0.507f;
+
+    uint32_t hash(int32_t x, int32_t y, uint32_t seed)
+    {
+        uint32_t n = (static_cast<uint32_t>(x) * hashX) ^ (static_cast<uint32_t>(y) * hashY);
+        n ^= seed;
+        n ^= n >> 15;
+        n *= hashMix;
+        n ^= n >> 12;
+        return n;
+    }
+
+    float gradient(uint32_t hash, float x, float y)
+    {
+        const uint32_t h = hash & 7;
+        const float u = h < 4 ? x : y;
+        const float v = h < 4 ? y : x;
+        return ((h & 1) ? -u : u) + ((h & 2) ? -2.0f * v : 2.0f * v);
+    }
+
+    float fade(float t)
+    {
+        return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+    }
+
+    float lerp(float t, float a, float b)
+    {
+        return a + t * (b - a);
+    }
+
+#ifdef KAUN_NOISE_SSE2
+    // SSE2 has no 32 bit multiply (that's SSE4.1), so do two 64 bit multiplies and shuffle
+    __m128i mullo32(__m128i a, __m128i b)
+    {
+        const __m128i even = _mm_mul_epu32(a, b);
+        const __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+
+    __m128i hash4(__m128i x, __m128i y, __m128i seed)
+    {
+        __m128i n = _mm_xor_si128(mullo32(x, _mm_set1_epi32(static_cast<int>(hashX))),
+            mullo32(y, _mm_set1_epi32(static_cast<int>(hashY))));
+        n = _mm_xor_si128(n, seed);
+        n = _mm_xor_si128(n, _mm_srli_epi32(n, 15));
+        n = mullo32(n, _mm_set1_epi32(static_cast<int>(hashMix)));
+        return _mm_xor_si128(n, _mm_srli_epi32(n, 12));
+    }
+
+    __m128 select4(__m128 mask, __m128 a, __m128 b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    __m128 gradient4(__m128i hash, __m128 x, __m128 y)
+    {
+        const __m128i h = _mm_and_si128(hash, _mm_set1_epi32(7));
+        const __m128 lower = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+        const __m128 u = select4(lower, x, y);
+        const __m128 v = select4(lower, y, x);
+        // move bit 0 and bit 1 into the sign bit
+        const __m128i bit0 = _mm_and_si128(h, _mm_set1_epi32(1));
+        const __m128i bit1 = _mm_and_si128(h, _mm_set1_epi32(2));
+        const __m128 signU = _mm_castsi128_ps(_mm_slli_epi32(bit0, 31));
+        const __m128 signV = _mm_castsi128_ps(_mm_slli_epi32(bit1, 30));
+        return _mm_add_ps(_mm_xor_ps(u, signU), _mm_xor_ps(_mm_add_ps(v, v), signV));
+    }
+
+    __m128 fade4(__m128 t)
+    {
+        __m128 r = _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f));
+        r = _mm_add_ps(_mm_mul_ps(r, t), _mm_set1_ps(10.0f));
+        return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(r, t), t), t);
+    }
+
+    __m128 lerp4(__m128 t, __m128 a, __m128 b)
+    {
+        return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+    }
+
+    __m128i floor4(__m128 x)
+    {
+        // truncation rounds towards zero, so subtract one where that rounded up
+        const __m128i t = _mm_cvttps_epi32(x);
+        const __m128i roundedUp = _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(t), x));
+        return _mm_add_epi32(t, roundedUp);
+    }
+
+    __m128 gradientNoise4(__m128 x, __m128 y, __m128i seed)
+    {
+        const __m128i ix0 = floor4(x);
+        const __m128i iy0 = floor4(y);
+        const __m128i ix1 = _mm_add_epi32(ix0, _mm_set1_epi32(1));
+        const __m128i iy1 = _mm_add_epi32(iy0, _mm_set1_epi32(1));
+        const __m128 fx0 = _mm_sub_ps(x, _mm_cvtepi32_ps(ix0));
+        const __m128 fy0 = _mm_sub_ps(y, _mm_cvtepi32_ps(iy0));
+        const __m128 fx1 = _mm_sub_ps(fx0, _mm_set1_ps(1.0f));
+        const __m128 fy1 = _mm_sub_ps(fy0, _mm_set1_ps(1.0f));
+
+        const __m128 s = fade4(fx0);
+        const __m128 t = fade4(fy0);
+        const __m128 n00 = gradient4(hash4(ix0, iy0, seed), fx0, fy0);
+        const __m128 n01 = gradient4(hash4(ix0, iy1, seed), fx0, fy1);
+        const __m128 n10 = gradient4(hash4(ix1, iy0, seed), fx1, fy0);
+        const __m128 n11 = gradient4(hash4(ix1, iy1, seed), fx1, fy1);
+        const __m128 nx0 = lerp4(t, n00, n01);
+        const __m128 nx1 = lerp4(t, n10, n11);
+        return _mm_mul_ps(_mm_set1_ps(noiseScale), lerp4(s, nx0, nx1));
+    }
+#endif
+
+    // Adds weight * noise (mapped to [0, 1]) of a whole row to out
+    void accumulateRow(float* out, int width, float x0, float dx, float y, float weight,
+        uint32_t seed)
+    {
+        int x = 0;
+#ifdef KAUN_NOISE_SSE2
+        const __m128i seed4 = _mm_set1_epi32(static_cast<int>(seed));
+        const __m128 y4 = _mm_set1_ps(y);
+        const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+        const __m128 halfWeight = _mm_set1_ps(0.5f * weight);
+        for (; x + 4 <= width; x += 4) {
+            // x0 + dx * x like the scalar path, so the results match
+            const __m128 x4 = _mm_add_ps(_mm_set1_ps(x0),
+                _mm_mul_ps(_mm_set1_ps(dx), _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lanes)));
+            const __m128 n = gradientNoise4(x4, y4, seed4);
+            // out += weight * (n * 0.5 + 0.5)
+            const __m128 v = _mm_mul_ps(_mm_add_ps(n, _mm_set1_ps(1.0f)), halfWeight);
+            _mm_storeu_ps(out + x, _mm_add_ps(_mm_loadu_ps(out + x), v));
+        }
+#endif
+        for (; x < width; ++x)
+            out[x] += weight * (gradientNoise(x0 + dx * x, y, seed) * 0.5f + 0.5f);
+    }
+
+    float hullCurve(float nx, float ny, float hullRadius)
+    {
+        const float relX = nx - 0.5f, relY = ny - 0.5f;
+        const float dist = std::sqrt(relX * relX + relY * relY);
+        if (dist < hullRadius)
+            return 1.0f;
+        return std::max(0.0f, 1.0f - (dist - hullRadius) / (0.5f - hullRadius));
+    }
+
+    void fbmRows(float* out, int width, int height, int firstRow, int lastRow,
+        const FbmParams& params, float weightSum)
+    {
+        for (int y = firstRow; y < lastRow; ++y) {
+            float* row = out + static_cast<size_t>(y) * width;
+            std::fill(row, row + width, 0.0f);
+            const float ny = static_cast<float>(y) / height;
+
+            float frequency = params.baseFrequency;
+            for (size_t o = 0; o < params.octaveWeights.size(); ++o) {
+                // every octave gets a different seed, so they don't line up at the origin
+                accumulateRow(row, width, 0.0f, frequency / width, ny * frequency,
+                    params.octaveWeights[o] / weightSum, params.seed + static_cast<uint32_t>(o));
+                frequency *= params.frequencyFactor;
+            }
+
+            if (params.hullRadius <= 0.0f && params.redistribution == 1.0f)
+                continue;
+            for (int x = 0; x < width; ++x) {
+                float h = std::clamp(row[x], 0.0f, 1.0f);
+                if (params.hullRadius > 0.0f)
+                    h *= hullCurve(static_cast<float>(x) / width, ny, params.hullRadius);
+                if (params.redistribution != 1.0f)
+                    h = std::pow(h, params.redistribution);
+                row[x] = h;
+            }
+        }
+    }
+}
+
+float gradientNoise(float x, float y, uint32_t seed)
+{
+    const float flx = std::floor(x), fly = std::floor(y);
+    const int32_t ix0 = static_cast<int32_t>(flx), iy0 = static_cast<int32_t>(fly);
+    const float fx0 = x - flx, fy0 = y - fly;
+    const float fx1 = fx0 - 1.0f, fy1 = fy0 - 1.0f;
+
+    const float s = fade(fx0);
+    const float t = fade(fy0);
+    const float nx0 = lerp(t, gradient(hash(ix0, iy0, seed), fx0, fy0),
+        gradient(hash(ix0, iy0 + 1, seed), fx0, fy1));
+    const float nx1 = lerp(t, gradient(hash(ix0 + 1, iy0, seed), fx1, fy0),
+        gradient(hash(ix0 + 1, iy0 + 1, seed), fx1, fy1));
+    return noiseScale * lerp(s, nx0, nx1);
+}
+
+void fbmNoise(float* out, int width, int height, const FbmParams& params, int threadCount)
+{
+    assert(width > 0 && height > 0);
+    float weightSum = 0.0f;
+    for (auto weight : params.octaveWeights)
+        weightSum += weight;
+    if (weightSum <= 0.0f) {
+        LOG_ERROR("fBm octave weights have to add up to more than 0");
+        std::fill(out, out + static_cast<size_t>(width) * height, 0.0f);
+        return;
+    }
+
+    if (threadCount <= 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    // don't bother with threads for tiny maps
+    threadCount = std::min(threadCount, std::max(1, width * height / (64 * 64)));
+    threadCount = std::min(threadCount, height);
+
+    if (threadCount == 1) {
+        fbmRows(out, width, height, 0, height, params, weightSum);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    const int rowsPerThread = (height + threadCount - 1) / threadCount;
+    for (int t = 1; t < threadCount; ++t) {
+        const int first = t * rowsPerThread;
+        const int last = std::min(height, first + rowsPerThread);
+        if (first >= last)
+            break;
+        threads.emplace_back(
+            fbmRows, out, width, height, first, last, std::cref(params), weightSum);
+    }
+    // the calling thread does the first chunk
+    fbmRows(out, width, height, 0, std::min(height, rowsPerThread), params, weightSum);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+std::vector<float> fbmNoise(int width, int height, const FbmParams& params, int threadCount)
+{
+    std::vector<float> heights(static_cast<size_t>(width) * height);
+    fbmNoise(heights.data(), width, height, params, threadCount);
+    return heights;
+}
+
+Texture* fbmNoiseTexture(
+    int width, int height, const FbmParams& params, PixelFormat format, int threadCount)
+{
+    if (format != PixelFormat::R32F && format != PixelFormat::R16F) {
+        LOG_ERROR("fBm noise textures have to be R32F or R16F");
+        return nullptr;
+    }
+    const auto heights = fbmNoise(width, height, params, threadCount);
+    Texture* texture = new Texture(format, width, height);
+    // GL converts to half floats for R16F
+    texture->updateData(GL_RED, GL_FLOAT, heights.data());
+    return texture;
+}
+}
@@ -0,0 +1,116 @@
+#include "pixelbuffer.hpp"
+
+#include <cassert>
+
+#include "log.hpp"
+
+namespace kaun {
+namespace {
+    PixelBufferStats currentStats, lastFrameStats;
+}
+
+PixelBufferRing::PixelBufferRing(size_t count)
+    : mBuffers(count, Buffer { 0, 0, nullptr })
+    , mCurrent(0)
+    , mMapped(false)
+{
+    assert(count > 0);
+}
+
+PixelBufferRing::~PixelBufferRing()
+{
+    for (auto& buffer : mBuffers) {
+        if (buffer.fence)
+            glDeleteSync(buffer.fence);
+        if (buffer.object != 0)
+            glDeleteBuffers(1, &buffer.object);
+    }
+}
+
+bool PixelBufferRing::isNextAvailable() const
+{
+    const Buffer& buffer = mBuffers[(mCurrent + 1) % mBuffers.size()];
+    if (!buffer.fence)
+        return true;
+    return glClientWaitSync(buffer.fence, 0, 0) != GL_TIMEOUT_EXPIRED;
+}
+
+void* PixelBufferRing::map(size_t size, bool wait)
+{
+    assert(!mMapped);
+    const size_t next = (mCurrent + 1) % mBuffers.size();
+    Buffer& buffer = mBuffers[next];
+    if (buffer.fence) {
+        GLenum status = glClientWaitSync(buffer.fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            if (!wait) {
+                currentStats.busy++;
+                return nullptr;
+            }
+            currentStats.stalls++;
+            const GLuint64 timeout = 1000000; // 1ms
+            do {
+                status = glClientWaitSync(buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+            } while (status == GL_TIMEOUT_EXPIRED);
+        }
+        if (status == GL_WAIT_FAILED)
+            LOG_ERROR("Waiting for pixel buffer fence failed!");
+        glDeleteSync(buffer.fence);
+        buffer.fence = nullptr;
+    }
+    mCurrent = next;
+
+    if (buffer.object == 0)
+        glGenBuffers(1, &buffer.object);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.object);
+    if (buffer.size < size) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        buffer.size = size;
+    }
+    // The fence guarantees the GPU is done with it, so there is no need to synchronize
+    void* data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (data == nullptr) {
+        LOG_ERROR("Could not map pixel buffer");
+        return nullptr;
+    }
+    mMapped = true;
+    currentStats.bytes += size;
+    return data;
+}
+
+bool PixelBufferRing::unmap()
+{
+    assert(mMapped);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mBuffers[mCurrent].object);
+    mMapped = false;
+    if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+        LOG_ERROR("Pixel buffer data got corrupted while it was mapped");
+        return false;
+    }
+    return true;
+}
+
+void PixelBufferRing::finish()
+{
+    Buffer& buffer = mBuffers[mCurrent];
+    if (buffer.fence)
+        glDeleteSync(buffer.fence);
+    buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    currentStats.uploads++;
+    // Texture uploads from client memory (everything else) need this to be unbound
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+const PixelBufferStats& PixelBufferRing::getFrameStats()
+{
+    return lastFrameStats;
+}
+
+void PixelBufferRing::endFrame()
+{
+    lastFrameStats = currentStats;
+    currentStats = PixelBufferStats();
+}
+}
@@ -1,26 +1,22 @@
 #include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <vector>
 
 #include <glm/glm.hpp>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/string_cast.hpp>
 
+#include "frustum.hpp"
+#include "log.hpp"
 #include "render.hpp"
 #include "rendertarget.hpp"
+#include "texture_manager.hpp"
 
 namespace kaun {
 glm::ivec4 viewport;
 bool currentSrgbEnabled = false;
 
-void clear(const glm::vec4& color, int colorAttachmentIndex)
-{
-    glClearBufferfv(GL_COLOR, colorAttachmentIndex, glm::value_ptr(color));
-}
-
-void clearDepth(float value)
-{
-    glClearBufferfv(GL_DEPTH, 0, &value);
-}
 
 void setViewport()
 {
@@ -38,6 +34,44 @@ void setViewport(const glm::ivec4& vp)
     setViewport(vp.x, vp.y, vp.z, vp.w);
 }
 
+// the scissor test is disabled if the width is negative
+const glm::ivec4 noScissor(0, 0, -1, -1);
+glm::ivec4 scissor = noScissor;
+
+void applyScissor(const glm::ivec4& rect, bool force = false)
+{
+    const bool enabled = rect.z >= 0;
+    if (enabled != (scissor.z >= 0) || force) {
+        if (enabled)
+            glEnable(GL_SCISSOR_TEST);
+        else
+            glDisable(GL_SCISSOR_TEST);
+    }
+    if (enabled && (rect != scissor || force))
+        glScissor(rect.x, rect.y, rect.z, rect.w);
+    scissor = rect;
+}
+
+void setScissor(int x, int y, int w, int h)
+{
+    applyScissor(glm::ivec4(x, y, std::max(w, 0), std::max(h, 0)));
+}
+
+void setScissor(const glm::ivec4& rect)
+{
+    setScissor(rect.x, rect.y, rect.z, rect.w);
+}
+
+void resetScissor()
+{
+    applyScissor(noScissor);
+}
+
+const glm::ivec4& getScissor()
+{
+    return scissor;
+}
+
 void setSrgbEnabled(bool enabled)
 {
     if (enabled) {
@@ -53,69 +87,193 @@ bool getSrgbEnabled()
     return currentSrgbEnabled;
 }
 
-glm::mat4 projectionMatrix;
-glm::mat4 invProjectionMatrix;
-glm::mat4 viewMatrix;
-glm::mat4 invViewMatrix;
-glm::mat4 viewProjectionMatrix;
-glm::mat4 invViewProjectionMatrix;
+// setProjection etc. change this one, draws without views use it
+View currentView;
 glm::mat4 modelMatrix;
 glm::mat3 normalMatrix;
 
+enum class QueueCommand {
+    // clears come first in their pass
+    CLEAR_COLOR,
+    CLEAR_DEPTH,
+    DRAW,
+};
+
+// The name is not needed for drawing, so it is not copied
+DrawRange copyDrawRange(const DrawRange* range)
+{
+    if (range == nullptr)
+        return DrawRange { std::string(), 0, 0, 0, -1, AABoundingBox() };
+    return DrawRange { std::string(), range->firstIndex, range->count, range->baseVertex,
+        range->materialSlot, range->bounds };
+}
+
 struct RenderQueueEntry {
+    QueueCommand command;
+    // the render target, viewport and scissor rectangle that were current when this was queued
+    const RenderTarget* target;
+    glm::ivec4 viewport;
+    glm::ivec4 scissor;
+    // clears and nextPass start a new pass on the target, later passes are drawn later
+    uint32_t pass;
+    // position of the target in the order the targets are drawn in, set in flush
+    uint32_t targetRank;
+    // value and color attachment index of clears
+    glm::vec4 clearValue;
+    int clearIndex;
+
     Mesh* mesh;
+    // Otherwise the whole mesh is drawn. The range is copied (without its name), so the ranges of
+    // the mesh may change before the flush.
+    bool hasRange;
+    DrawRange range;
     Shader* shader;
     std::vector<Uniform> uniforms;
     RenderState renderState;
     float depth;
     uint64_t sortKey;
-
-    RenderQueueEntry(Mesh* mesh, Shader* shader, const RenderState& renderState)
-        : mesh(mesh)
+    // If clusterCount > 0, only these clusters (indices into visibleClusters) are drawn
+    size_t firstCluster;
+    size_t clusterCount;
+
+    RenderQueueEntry(
+        Mesh* mesh, const DrawRange* range, Shader* shader, const RenderState& renderState)
+        : command(QueueCommand::DRAW)
+        , target(nullptr)
+        , pass(0)
+        , targetRank(0)
+        , clearIndex(0)
+        , mesh(mesh)
+        , hasRange(range != nullptr)
+        , range(copyDrawRange(range))
         , shader(shader)
         , renderState(renderState)
+        , depth(0.0f)
         , sortKey(0)
+        , firstCluster(0)
+        , clusterCount(0)
+    {
+    }
+
+    RenderQueueEntry(QueueCommand command, const glm::vec4& clearValue, int clearIndex)
+        : command(command)
+        , target(nullptr)
+        , pass(0)
+        , targetRank(0)
+        , clearValue(clearValue)
+        , clearIndex(clearIndex)
+        , mesh(nullptr)
+        , hasRange(false)
+        , range(copyDrawRange(nullptr))
+        , shader(nullptr)
+        , depth(0.0f)
+        , sortKey(0)
+        , firstCluster(0)
+        , clusterCount(0)
     {
     }
 };
 
 std::vector<RenderQueueEntry> renderQueue;
+// cluster indices of all queued entries
+std::vector<uint32_t> visibleClusters;
+// the current pass of every render target with queued entries
+std::vector<std::pair<const RenderTarget*, uint32_t>> targetPasses;
 
-void updateViewProjection()
+uint32_t& getTargetPass(const RenderTarget* target)
 {
-    viewProjectionMatrix = projectionMatrix * viewMatrix;
-    invViewProjectionMatrix = invViewMatrix * invProjectionMatrix;
+    for (auto& targetPass : targetPasses) {
+        if (targetPass.first == target)
+            return targetPass.second;
+    }
+    targetPasses.emplace_back(target, 0);
+    return targetPasses.back().second;
+}
+
+// Where the entries queued for a view go
+struct ViewState {
+    const View* view;
+    const RenderTarget* target;
+    glm::ivec4 viewport;
+    glm::ivec4 scissor;
+
+    ViewState(const View& view)
+        : view(&view)
+        , target(view.getRenderTarget())
+        , viewport(view.getViewport())
+        , scissor(view.getScissor())
+    {
+        if (!target) {
+            target = RenderTarget::currentDraw;
+            viewport = kaun::viewport;
+            scissor = kaun::scissor;
+        }
+    }
+};
+
+RenderQueueEntry& queueEntry(RenderQueueEntry entry, const ViewState& viewState, bool newPass)
+{
+    entry.target = viewState.target;
+    entry.viewport = viewState.viewport;
+    entry.scissor = viewState.scissor;
+    uint32_t& pass = getTargetPass(entry.target);
+    if (newPass)
+        pass++;
+    entry.pass = pass;
+    renderQueue.push_back(std::move(entry));
+    return renderQueue.back();
+}
+
+void clear(const View& view, const glm::vec4& color, int colorAttachmentIndex)
+{
+    queueEntry(RenderQueueEntry(QueueCommand::CLEAR_COLOR, color, colorAttachmentIndex),
+        ViewState(view), true);
+}
+
+void clearDepth(const View& view, float value)
+{
+    queueEntry(RenderQueueEntry(QueueCommand::CLEAR_DEPTH, glm::vec4(value), 0), ViewState(view),
+        true);
+}
+
+void clear(const glm::vec4& color, int colorAttachmentIndex)
+{
+    clear(currentView, color, colorAttachmentIndex);
+}
+
+void clearDepth(float value)
+{
+    clearDepth(currentView, value);
+}
+
+void nextPass()
+{
+    getTargetPass(RenderTarget::currentDraw)++;
 }
 
 void setProjection(const glm::mat4& matrix)
 {
-    projectionMatrix = matrix;
-    invProjectionMatrix = glm::inverse(projectionMatrix);
-    updateViewProjection();
+    currentView.setProjection(matrix);
 }
 
 glm::mat4 getProjection()
 {
-    return projectionMatrix;
+    return currentView.getProjection();
 }
 
 void setViewMatrix(const glm::mat4& view)
 {
-    viewMatrix = view;
-    invViewMatrix = glm::inverse(viewMatrix);
-    updateViewProjection();
+    currentView.setViewMatrix(view);
 }
 
 void setViewTransform(const Transform& viewTransform)
 {
-    invViewMatrix = viewTransform.getMatrix();
-    viewMatrix = glm::inverse(invViewMatrix);
-    updateViewProjection();
+    currentView.setViewTransform(viewTransform);
 }
 
 glm::mat4 getViewMatrix()
 {
-    return viewMatrix;
+    return currentView.getViewMatrix();
 }
 
 void setModelMatrix(const glm::mat4& model)
@@ -134,74 +292,368 @@ glm::mat4 getModelMatrix()
     return modelMatrix;
 }
 
-void draw(
-    Mesh& mesh, Shader& shader, const std::vector<Uniform>& uniforms, const RenderState& state)
+// Appends the visible clusters to visibleClusters and returns how many there are
+size_t cullClusters(const Mesh& mesh, const View& view, const glm::mat4& modelViewProjection,
+    const RenderState& state)
+{
+    const Frustum frustum(modelViewProjection);
+
+    // The cones are built from counter-clockwise triangles and the test needs a camera position,
+    // so it doesn't work for orthographic projections
+    const bool cullBackfacing = !view.isOrthographic()
+        && state.getCullFaces() == RenderState::FaceDirections::BACK
+        && state.getFrontFace() == RenderState::FaceOrientation::CCW;
+    glm::vec3 cameraPosition(0.0f);
+    if (cullBackfacing)
+        cameraPosition = glm::vec3(glm::inverse(modelMatrix) * view.getInvViewMatrix()[3]);
+
+    const auto& clusters = mesh.getClusters();
+    const size_t first = visibleClusters.size();
+    for (size_t i = 0; i < clusters.size(); ++i) {
+        if (cullBackfacing && clusters[i].backfacing(cameraPosition))
+            continue;
+        if (!frustum.intersects(clusters[i].bounds))
+            continue;
+        visibleClusters.push_back(i);
+    }
+    return visibleClusters.size() - first;
+}
+
+// Diameter of the mesh's bounding sphere on screen in pixels
+float getScreenSize(const Mesh& mesh, const View& view, const glm::ivec4& viewport)
+{
+    const AABoundingBox& bounds = mesh.boundingBox();
+    const glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+    const glm::mat3 linear(modelMatrix);
+    const float scale = std::sqrt(std::max({ glm::dot(linear[0], linear[0]),
+        glm::dot(linear[1], linear[1]), glm::dot(linear[2], linear[2]) }));
+    const float radius = glm::length(bounds.max - bounds.min) * 0.5f * scale;
+
+    // projection[1][1] is 1/tan(fovy/2) for perspective and 2/height for orthographic
+    // projections, so 2 * radius * projection[1][1] / distance is the diameter in NDC
+    float distance = 1.0f;
+    if (!view.isOrthographic()) {
+        distance = -(view.getViewMatrix() * modelMatrix * glm::vec4(center, 1.0f)).z;
+        // the camera is inside
+        if (distance <= radius)
+            return static_cast<float>(std::max(viewport.z, viewport.w));
+    }
+    return radius * view.getProjection()[1][1] / distance * viewport.w;
+}
+
+void queueDraw(const ViewState& viewState, const glm::mat4& modelViewProjectionMatrix, Mesh& mesh,
+    const DrawRange* range, Shader& drawShader, const std::vector<Uniform>& uniforms,
+    const RenderState& drawState)
 {
-    renderQueue.emplace_back(&mesh, &shader, state);
-    RenderQueueEntry& entry = renderQueue.back();
+    const View& view = *viewState.view;
+    Shader& shader = view.getShader() ? *view.getShader() : drawShader;
+    const RenderState& state = view.getRenderState() ? *view.getRenderState() : drawState;
+    const glm::mat4 modelViewMatrix = view.getViewMatrix() * modelMatrix;
+
+    size_t firstCluster = visibleClusters.size();
+    size_t clusterCount = 0;
+    if (range == nullptr && mesh.getClusters().size() > 0) {
+        clusterCount = cullClusters(mesh, view, modelViewProjectionMatrix, state);
+        if (clusterCount == 0)
+            return;
+    }
+
+    RenderQueueEntry& entry
+        = queueEntry(RenderQueueEntry(&mesh, range, &shader, state), viewState, false);
+    entry.firstCluster = firstCluster;
+    entry.clusterCount = clusterCount;
 
-    glm::mat4 modelViewMatrix = viewMatrix * modelMatrix;
-    glm::mat4 modelViewProjectionMatrix = viewProjectionMatrix * modelMatrix;
     glm::vec4 projected = modelViewProjectionMatrix * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
     entry.depth = projected.z / projected.w;
 
     // insert built-in uniforms first, so we know where to find them in the vector
-    entry.uniforms.emplace_back("kaun_viewport", viewport);
-    entry.uniforms.emplace_back("kaun_view", viewMatrix);
-    entry.uniforms.emplace_back("kaun_invView", invViewMatrix);
-    entry.uniforms.emplace_back("kaun_projection", projectionMatrix);
-    entry.uniforms.emplace_back("kaun_invProjection", invProjectionMatrix);
-    entry.uniforms.emplace_back("kaun_viewProjection", viewProjectionMatrix);
-    entry.uniforms.emplace_back("kaun_invViewProjection", invViewProjectionMatrix);
+    entry.uniforms.emplace_back("kaun_viewport", viewState.viewport);
+    entry.uniforms.emplace_back("kaun_view", view.getViewMatrix());
+    entry.uniforms.emplace_back("kaun_invView", view.getInvViewMatrix());
+    entry.uniforms.emplace_back("kaun_projection", view.getProjection());
+    entry.uniforms.emplace_back("kaun_invProjection", view.getInvProjection());
+    entry.uniforms.emplace_back("kaun_viewProjection", view.getViewProjection());
+    entry.uniforms.emplace_back("kaun_invViewProjection", view.getInvViewProjection());
     entry.uniforms.emplace_back("kaun_model", modelMatrix);
     entry.uniforms.emplace_back("kaun_normal", normalMatrix);
     entry.uniforms.emplace_back("kaun_modelView", modelViewMatrix);
     entry.uniforms.emplace_back("kaun_modelViewProjection", modelViewProjectionMatrix);
 
+    // the texture manager decides how many mip levels are needed from this
+    float screenSize = -1.0f;
+    for (auto& uniform : uniforms) {
+        if (uniform.getType() != Uniform::Type::TEXTURE || !uniform.getTexture()->isManaged())
+            continue;
+        if (screenSize < 0.0f)
+            screenSize = getScreenSize(mesh, view, viewState.viewport);
+        TextureManager::touch(*uniform.getTexture(), screenSize);
+    }
+
     entry.uniforms.reserve(entry.uniforms.size() + uniforms.size());
-    entry.uniforms.insert(entry.uniforms.end(), uniforms.begin(), uniforms.end());
+    if (&shader == &drawShader) {
+        entry.uniforms.insert(entry.uniforms.end(), uniforms.begin(), uniforms.end());
+        return;
+    }
+    // Textures the replacement shader doesn't sample are not bound. Otherwise a shadow map pass
+    // would bind the shadow map while rendering to it.
+    for (auto& uniform : uniforms) {
+        if (uniform.getType() != Uniform::Type::TEXTURE
+            || shader.getUniformLocation(uniform.getName(), false) != -1)
+            entry.uniforms.push_back(uniform);
+    }
+}
+
+void queueDraw(Mesh& mesh, const DrawRange* range, Shader& shader,
+    const std::vector<Uniform>& uniforms, const RenderState& state)
+{
+    const glm::mat4 modelViewProjectionMatrix = currentView.getViewProjection() * modelMatrix;
+    // ranges with bounds are culled, like the clusters of whole meshes
+    if (range && !range->bounds.empty()
+        && !Frustum(modelViewProjectionMatrix).intersects(range->bounds))
+        return;
+    queueDraw(ViewState(currentView), modelViewProjectionMatrix, mesh, range, shader, uniforms,
+        state);
+}
+
+// The bounding box of the range (if it has one) or the mesh is tested against the frustums of all
+// views, the draw is only queued for the views that see it
+void queueDraw(const std::vector<const View*>& views, Mesh& mesh, const DrawRange* range,
+    Shader& shader, const std::vector<Uniform>& uniforms, const RenderState& state)
+{
+    const AABoundingBox& bounds
+        = range && !range->bounds.empty() ? range->bounds : mesh.boundingBox();
+    for (auto view : views) {
+        const glm::mat4 modelViewProjectionMatrix = view->getViewProjection() * modelMatrix;
+        if (!Frustum(modelViewProjectionMatrix).intersects(bounds))
+            continue;
+        queueDraw(
+            ViewState(*view), modelViewProjectionMatrix, mesh, range, shader, uniforms, state);
+    }
+}
+
+void draw(
+    Mesh& mesh, Shader& shader, const std::vector<Uniform>& uniforms, const RenderState& state)
+{
+    queueDraw(mesh, nullptr, shader, uniforms, state);
 }
 
+void draw(Mesh& mesh, const DrawRange& range, Shader& shader, const std::vector<Uniform>& uniforms,
+    const RenderState& state)
+{
+    queueDraw(mesh, &range, shader, uniforms, state);
+}
+
+void draw(const std::vector<const View*>& views, Mesh& mesh, Shader& shader,
+    const std::vector<Uniform>& uniforms, const RenderState& state)
+{
+    queueDraw(views, mesh, nullptr, shader, uniforms, state);
+}
+
+void draw(const std::vector<const View*>& views, Mesh& mesh, const DrawRange& range,
+    Shader& shader, const std::vector<Uniform>& uniforms, const RenderState& state)
+{
+    queueDraw(views, mesh, &range, shader, uniforms, state);
+}
+
+// draws of the same target and pass are sorted by key, clears stay in submission order
 bool entryCompare(const RenderQueueEntry& a, const RenderQueueEntry& b)
 {
+    if (a.targetRank != b.targetRank)
+        return a.targetRank < b.targetRank;
+    if (a.pass != b.pass)
+        return a.pass < b.pass;
+    if (a.command != b.command)
+        return a.command < b.command;
     return a.sortKey < b.sortKey;
 }
 
+bool entrySubmissionCompare(const RenderQueueEntry& a, const RenderQueueEntry& b)
+{
+    if (a.targetRank != b.targetRank)
+        return a.targetRank < b.targetRank;
+    return a.pass < b.pass;
+}
+
+// Targets are drawn in the order they were first used in, except that a target has to be drawn
+// before the targets that sample its attachments
+void rankTargets()
+{
+    std::vector<const RenderTarget*> targets;
+    for (auto& targetPass : targetPasses)
+        targets.push_back(targetPass.first);
+    if (targets.size() == 1) {
+        for (auto& entry : renderQueue)
+            entry.targetRank = 0;
+        return;
+    }
+
+    auto getIndex = [&targets](const RenderTarget* target) {
+        return std::find(targets.begin(), targets.end(), target) - targets.begin();
+    };
+    std::vector<std::vector<bool>> dependsOn(targets.size(), std::vector<bool>(targets.size()));
+    for (auto& entry : renderQueue) {
+        if (entry.command != QueueCommand::DRAW)
+            continue;
+        const size_t consumer = getIndex(entry.target);
+        for (auto& uniform : entry.uniforms) {
+            if (uniform.getType() != Uniform::Type::TEXTURE)
+                continue;
+            for (size_t producer = 0; producer < targets.size(); ++producer) {
+                if (producer != consumer
+                    && targets[producer]->usesAttachment(*uniform.getTexture()))
+                    dependsOn[consumer][producer] = true;
+            }
+        }
+    }
+
+    std::vector<uint32_t> ranks(targets.size(), 0);
+    std::vector<bool> done(targets.size(), false);
+    for (uint32_t rank = 0; rank < targets.size(); ++rank) {
+        size_t next = targets.size();
+        for (size_t t = 0; t < targets.size() && next == targets.size(); ++t) {
+            if (done[t])
+                continue;
+            bool ready = true;
+            for (size_t producer = 0; producer < targets.size(); ++producer)
+                ready = ready && (done[producer] || !dependsOn[t][producer]);
+            if (ready)
+                next = t;
+        }
+        if (next == targets.size()) {
+            // a target samples itself through another one, queue order is the best we can do
+            LOG_WARNING("Render targets in the queue depend on each other");
+            for (next = 0; done[next]; ++next)
+                ;
+        }
+        done[next] = true;
+        ranks[next] = rank;
+    }
+    for (auto& entry : renderQueue)
+        entry.targetRank = ranks[getIndex(entry.target)];
+}
+
+bool isQueuedRenderTarget(const RenderTarget& target)
+{
+    for (auto& targetPass : targetPasses) {
+        if (targetPass.first == &target)
+            return true;
+    }
+    return false;
+}
+
+bool isSampledByQueuedDraws(const RenderTarget& target)
+{
+    for (auto& entry : renderQueue) {
+        if (entry.command != QueueCommand::DRAW || entry.target == &target)
+            continue;
+        for (auto& uniform : entry.uniforms) {
+            if (uniform.getType() == Uniform::Type::TEXTURE
+                && target.usesAttachment(*uniform.getTexture()))
+                return true;
+        }
+    }
+    return false;
+}
+
 uint64_t defaultSortKey(const RenderQueueEntry& entry)
 {
     // draw opaque geometry first => translucencyType = 0
     uint64_t translucencyType = entry.renderState.getBlendEnabled() ? 1 : 0;
     uint64_t shader = entry.shader->getProgramObject();
     uint64_t depth = static_cast<uint64_t>(entry.depth * 0xFFFFFF);
+    // group opaque draws by VAO, so meshes from the same arena end up next to each other
+    uint64_t vao = 0;
     if (translucencyType > 0)
         depth = 0xFFFFFF - depth;
-    return (translucencyType << 63) | (shader & 0xFFFFFF) << 24 | depth;
+    else
+        vao = entry.mesh->getVertexArray();
+    return (translucencyType << 63) | (shader & 0xFFFFFF) << 39 | (vao & 0x7FFF) << 24 | depth;
+}
+
+// Whether b can be drawn in the same multi-draw call as a
+bool canMergeDraws(const RenderQueueEntry& a, const RenderQueueEntry& b)
+{
+    return b.command == QueueCommand::DRAW && a.target == b.target && a.viewport == b.viewport
+        && a.scissor == b.scissor
+        && a.mesh->getArena() != nullptr && a.mesh->getArena() == b.mesh->getArena()
+        && a.clusterCount == 0 && b.clusterCount == 0
+        && a.mesh->getDrawMode() == b.mesh->getDrawMode() && a.shader == b.shader
+        && a.renderState == b.renderState && a.uniforms == b.uniforms;
 }
 
 void flush(SortType sortType)
 {
-    static std::vector<const Texture*> textures;
+    const Texture* textures[Texture::MAX_UNITS];
+    static std::vector<std::pair<const Mesh*, const DrawRange*>> batch;
+
+    if (renderQueue.empty())
+        return;
 
+    rankTargets();
     switch (sortType) {
     case SortType::DEFAULT:
-        for (auto& entry : renderQueue)
-            entry.sortKey = defaultSortKey(entry);
-        std::sort(renderQueue.begin(), renderQueue.end(), entryCompare);
+        for (auto& entry : renderQueue) {
+            if (entry.command == QueueCommand::DRAW)
+                entry.sortKey = defaultSortKey(entry);
+        }
+        std::stable_sort(renderQueue.begin(), renderQueue.end(), entryCompare);
         break;
     case SortType::SUBMISSION:
-        // don't do anything
+        // only group by target and pass
+        std::stable_sort(renderQueue.begin(), renderQueue.end(), entrySubmissionCompare);
         break;
     }
 
-    for (auto& entry : renderQueue) {
+    // the current render target, viewport and scissor rectangle are restored afterwards
+    const RenderTarget* currentTarget = RenderTarget::currentDraw;
+    const glm::ivec4 currentViewport = viewport;
+    const glm::ivec4 currentScissor = scissor;
+
+    for (size_t i = 0; i < renderQueue.size(); ++i) {
+        auto& entry = renderQueue[i];
+        if (entry.target != RenderTarget::currentDraw)
+            entry.target->bind(true, true);
+        if (entry.viewport != viewport)
+            setViewport(entry.viewport);
+        if (entry.scissor != scissor)
+            applyScissor(entry.scissor);
+
+        if (entry.command == QueueCommand::CLEAR_COLOR) {
+            glClearBufferfv(GL_COLOR, entry.clearIndex, glm::value_ptr(entry.clearValue));
+            continue;
+        } else if (entry.command == QueueCommand::CLEAR_DEPTH) {
+            // glClear respects the depth mask
+            if (!RenderState::currentState.getDepthWrite()) {
+                RenderState state = RenderState::currentState;
+                state.setDepthWrite(true);
+                state.apply();
+            }
+            glClearBufferfv(GL_DEPTH, 0, &entry.clearValue.x);
+            continue;
+        }
+
         entry.renderState.apply();
 
-        textures.clear();
+        size_t textureCount = 0;
+        for (auto& uniform : entry.uniforms) {
+            if (uniform.getType() == Uniform::Type::TEXTURE) {
+                assert(textureCount < Texture::MAX_UNITS);
+                textures[textureCount++] = uniform.getTexture();
+            }
+        }
+        Texture::bindTextures(textures, textureCount);
+        // textures are only bound now, so the samplers have to wait until here
         for (auto& uniform : entry.uniforms) {
-            if (uniform.getType() == Uniform::Type::TEXTURE)
-                textures.push_back(uniform.getTexture());
+            if (uniform.getType() != Uniform::Type::TEXTURE)
+                continue;
+            const int unit = uniform.getTexture()->getUnit();
+            if (unit < 0)
+                continue;
+            if (uniform.getSampler())
+                uniform.getSampler()->bind(unit);
+            else
+                Sampler::unbind(unit);
         }
-        Texture::bindTextures(textures);
 
         entry.shader->bind();
         for (auto& uniform : entry.uniforms) {
@@ -210,9 +662,36 @@ void flush(SortType sortType)
             if (loc != -1)
                 uniform.set(loc);
         }
-        entry.mesh->draw();
+
+        batch.clear();
+        batch.emplace_back(entry.mesh, entry.hasRange ? &entry.range : nullptr);
+        while (i + 1 < renderQueue.size() && canMergeDraws(entry, renderQueue[i + 1])) {
+            ++i;
+            const RenderQueueEntry& next = renderQueue[i];
+            batch.emplace_back(next.mesh, next.hasRange ? &next.range : nullptr);
+        }
+
+        if (entry.clusterCount > 0) {
+            entry.mesh->drawClusters(
+                visibleClusters.data() + entry.firstCluster, entry.clusterCount);
+        } else if (batch.size() > 1) {
+            entry.mesh->getArena()->draw(batch);
+        } else if (entry.hasRange) {
+            entry.mesh->draw(entry.range);
+        } else {
+            entry.mesh->draw();
+        }
     }
     renderQueue.clear();
+    visibleClusters.clear();
+    targetPasses.clear();
+
+    if (RenderTarget::currentDraw != currentTarget)
+        currentTarget->bind(true, true);
+    if (viewport != currentViewport)
+        setViewport(currentViewport);
+    if (scissor != currentScissor)
+        applyScissor(currentScissor);
 
 #ifndef NDEBUG
     checkGlError();
@@ -223,9 +702,11 @@ void ensureGlState()
 {
     setSrgbEnabled(getSrgbEnabled());
     RenderTarget::ensureGlState();
+    applyScissor(scissor, true);
     RenderState::ensureGlState();
     Shader::ensureGlState();
     Texture::ensureGlState();
+    Sampler::ensureGlState();
     Mesh::ensureGlState();
 }
 
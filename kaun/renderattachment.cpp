@@ -1,6 +1,185 @@
 #include "renderattachment.hpp"
 
+#include <cassert>
+#include <cstring>
+
+#include "rendertarget.hpp"
+
 namespace kaun {
+size_t getPixelSize(PixelFormat format)
+{
+    switch (format) {
+    case PixelFormat::NONE:
+        return 0;
+    case PixelFormat::R8:
+    case PixelFormat::STENCIL8:
+        return 1;
+    case PixelFormat::RG8:
+    case PixelFormat::R16F:
+    case PixelFormat::DEPTH16:
+        return 2;
+    case PixelFormat::RGB8:
+    case PixelFormat::SRGB8:
+        return 3;
+    case PixelFormat::RGBA8:
+    case PixelFormat::SRGB8A8:
+    case PixelFormat::RG16F:
+    case PixelFormat::R32F:
+    case PixelFormat::RGB10_A2:
+    case PixelFormat::RG11F_B10F:
+    case PixelFormat::RGB9E5:
+    case PixelFormat::DEPTH24:
+    case PixelFormat::DEPTH32F:
+    case PixelFormat::DEPTH24_STENCIL8:
+        return 4;
+    case PixelFormat::RGB16F:
+        return 6;
+    case PixelFormat::RGBA16F:
+    case PixelFormat::RG32F:
+    case PixelFormat::DEPTH32F_STENCIL8:
+        return 8;
+    case PixelFormat::RGB32F:
+        return 12;
+    case PixelFormat::RGBA32F:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+bool isCompressed(PixelFormat format)
+{
+    return getBlockSize(format) > 0;
+}
+
+size_t getBlockSize(PixelFormat format)
+{
+    switch (format) {
+    case PixelFormat::BC1:
+    case PixelFormat::BC1_SRGB:
+    case PixelFormat::BC4:
+        return 8;
+    case PixelFormat::BC3:
+    case PixelFormat::BC3_SRGB:
+    case PixelFormat::BC5:
+    case PixelFormat::BC7:
+    case PixelFormat::BC7_SRGB:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+size_t getImageSize(PixelFormat format, int width, int height)
+{
+    const size_t blockSize = getBlockSize(format);
+    if (blockSize > 0)
+        return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+    return static_cast<size_t>(width) * height * getPixelSize(format);
+}
+
+bool hasExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        const char* ext = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if (ext && std::strcmp(ext, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool isPixelFormatSupported(PixelFormat format)
+{
+    static const bool s3tc = hasExtension("GL_EXT_texture_compression_s3tc");
+    // The sRGB S3TC formats came with EXT_texture_sRGB (sRGB itself is core)
+    static const bool s3tcSrgb = s3tc
+        && (hasExtension("GL_EXT_texture_sRGB")
+               || hasExtension("GL_EXT_texture_compression_s3tc_srgb"));
+    static const bool bptc = hasExtension("GL_ARB_texture_compression_bptc");
+    switch (format) {
+    case PixelFormat::BC1:
+    case PixelFormat::BC3:
+        return s3tc;
+    case PixelFormat::BC1_SRGB:
+    case PixelFormat::BC3_SRGB:
+        return s3tcSrgb;
+    case PixelFormat::BC7:
+    case PixelFormat::BC7_SRGB:
+        return bptc;
+    default:
+        return true;
+    }
+}
+
+std::pair<GLenum, GLenum> getPixelTransferFormat(PixelFormat format)
+{
+    switch (format) {
+    case PixelFormat::NONE:
+        return std::make_pair(GL_RGBA, GL_UNSIGNED_BYTE);
+    case PixelFormat::R8:
+        return std::make_pair(GL_RED, GL_UNSIGNED_BYTE);
+    case PixelFormat::RG8:
+        return std::make_pair(GL_RG, GL_UNSIGNED_BYTE);
+    case PixelFormat::RGB8:
+    case PixelFormat::SRGB8:
+        return std::make_pair(GL_RGB, GL_UNSIGNED_BYTE);
+    case PixelFormat::RGBA8:
+    case PixelFormat::SRGB8A8:
+        return std::make_pair(GL_RGBA, GL_UNSIGNED_BYTE);
+    case PixelFormat::R16F:
+        return std::make_pair(GL_RED, GL_HALF_FLOAT);
+    case PixelFormat::RG16F:
+        return std::make_pair(GL_RG, GL_HALF_FLOAT);
+    case PixelFormat::RGB16F:
+        return std::make_pair(GL_RGB, GL_HALF_FLOAT);
+    case PixelFormat::RGBA16F:
+        return std::make_pair(GL_RGBA, GL_HALF_FLOAT);
+    case PixelFormat::R32F:
+        return std::make_pair(GL_RED, GL_FLOAT);
+    case PixelFormat::RG32F:
+        return std::make_pair(GL_RG, GL_FLOAT);
+    case PixelFormat::RGB32F:
+        return std::make_pair(GL_RGB, GL_FLOAT);
+    case PixelFormat::RGBA32F:
+        return std::make_pair(GL_RGBA, GL_FLOAT);
+    case PixelFormat::RGB10_A2:
+        return std::make_pair(GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV);
+    case PixelFormat::RG11F_B10F:
+        return std::make_pair(GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV);
+    case PixelFormat::RGB9E5:
+        return std::make_pair(GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV);
+    case PixelFormat::DEPTH16:
+        return std::make_pair(GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT);
+    case PixelFormat::DEPTH24:
+        return std::make_pair(GL_DEPTH_COMPONENT, GL_UNSIGNED_INT);
+    case PixelFormat::DEPTH32F:
+        return std::make_pair(GL_DEPTH_COMPONENT, GL_FLOAT);
+    case PixelFormat::DEPTH24_STENCIL8:
+        return std::make_pair(GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+    case PixelFormat::DEPTH32F_STENCIL8:
+        return std::make_pair(GL_DEPTH_STENCIL, GL_FLOAT_32_UNSIGNED_INT_24_8_REV);
+    case PixelFormat::STENCIL8:
+        return std::make_pair(GL_STENCIL_INDEX, GL_UNSIGNED_BYTE);
+    default:
+        // compressed formats are uploaded with glCompressedTexImage2D
+        return std::make_pair(GL_RGBA, GL_UNSIGNED_BYTE);
+    }
+}
+
+void RenderAttachment::removeRenderTargets() const
+{
+    if (mRenderTargetCount > 0)
+        RenderTarget::removeAttachment(*this);
+}
+
+RenderAttachment::~RenderAttachment()
+{
+    // the derived classes have removed them already
+    assert(mRenderTargetCount == 0);
+}
+
 bool RenderAttachment::hasDepth() const
 {
     PixelFormat fmt = getPixelFormat();
@@ -1,8 +1,15 @@
 #include "rendertarget.hpp"
 #include "render.hpp"
 
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+#include <SDL_video.h>
+
 namespace kaun {
-std::vector<RenderTarget*> RenderTarget::renderTargetCache;
+std::unordered_map<size_t, std::vector<RenderTarget*>> RenderTarget::renderTargetCache;
+size_t RenderTarget::renderTargetCount = 0;
 const RenderTarget* RenderTarget::currentDraw;
 const RenderTarget* RenderTarget::currentRead;
 
@@ -39,6 +46,69 @@ GLenum getDepthStencilAttachmentPoint(const RenderAttachment* attachment)
     }
 }
 
+namespace {
+    using InvalidateFramebufferProc = void(APIENTRYP)(GLenum, GLsizei, const GLenum*);
+
+    // glInvalidateFramebuffer is GL 4.3, which the loader doesn't have
+    InvalidateFramebufferProc getInvalidateFramebuffer()
+    {
+        static bool loaded = false;
+        static InvalidateFramebufferProc proc = nullptr;
+        if (!loaded) {
+            loaded = true;
+            GLint major = 0, minor = 0;
+            glGetIntegerv(GL_MAJOR_VERSION, &major);
+            glGetIntegerv(GL_MINOR_VERSION, &minor);
+            const bool core = major > 4 || (major == 4 && minor >= 3);
+            if (core || hasExtension("GL_ARB_invalidate_subdata"))
+                proc = reinterpret_cast<InvalidateFramebufferProc>(
+                    SDL_GL_GetProcAddress("glInvalidateFramebuffer"));
+        }
+        return proc;
+    }
+
+    // src has to be bound for reading and dst for drawing
+    void blitBuffers(const RenderTarget& src, const RenderTarget& dst, GLbitfield mask)
+    {
+        const glm::ivec2 srcSize = src.getDimensions();
+        const glm::ivec2 dstSize = dst.getDimensions();
+        mask &= src.getClearMask() & dst.getClearMask();
+        // blits are limited by the scissor rectangle too, e.g. the last shadow atlas tile
+        const bool scissorEnabled = getScissor().z >= 0;
+        if (scissorEnabled)
+            glDisable(GL_SCISSOR_TEST);
+        // blit depth/stencil and color separately and turn off GL_FRAMEBUFFER_SRGB before
+        // see here:
+        // https://devtalk.nvidia.com/default/topic/1038547/opengl/depth-blit-using-glblitframebuffer-yields-wrong-results-when-gl_framebuffer_srgb-is-enabled/
+        if (mask & GL_COLOR_BUFFER_BIT) {
+            glBlitFramebuffer(0, 0, srcSize.x, srcSize.y, 0, 0, dstSize.x, dstSize.y,
+                GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        }
+        const GLbitfield depthStencilMask = mask & ~GL_COLOR_BUFFER_BIT;
+        if (depthStencilMask) {
+            bool enabled = getSrgbEnabled();
+            if (enabled)
+                setSrgbEnabled(false);
+            glBlitFramebuffer(0, 0, srcSize.x, srcSize.y, 0, 0, dstSize.x, dstSize.y,
+                depthStencilMask, GL_NEAREST);
+            if (enabled)
+                setSrgbEnabled(true);
+        }
+        if (scissorEnabled)
+            glEnable(GL_SCISSOR_TEST);
+    }
+
+    size_t hashAttachments(const std::vector<const RenderAttachment*>& colorAttachments,
+        const RenderAttachment* depthStencil)
+    {
+        size_t seed = std::hash<const RenderAttachment*>()(depthStencil);
+        for (auto attachment : colorAttachments)
+            seed ^= std::hash<const RenderAttachment*>()(attachment) + 0x9e3779b9 + (seed << 6)
+                + (seed >> 2);
+        return seed;
+    }
+}
+
 void RenderTarget::ensureGlState()
 {
     currentDraw->bind(false, true);
@@ -51,27 +121,66 @@ RenderTarget* RenderTarget::get(const std::vector<const RenderAttachment*>& colo
     if (colorAttachments.size() == 0 && depthStencil == nullptr)
         return RenderTarget::Window::instance();
 
-    for (auto entry : renderTargetCache) {
-        if (entry->mDepthStencil != depthStencil)
-            continue;
-        if (entry->mColorAttachments.size() == colorAttachments.size()) {
-            bool match = true;
-            for (size_t i = 0; i < colorAttachments.size(); ++i) {
-                if (entry->mColorAttachments[i] != colorAttachments[i]) {
-                    match = false;
-                    break;
-                }
-            }
-            if (match)
-                return entry;
-        }
+    auto& bucket = renderTargetCache[hashAttachments(colorAttachments, depthStencil)];
+    for (auto entry : bucket) {
+        if (entry->hasAttachments(colorAttachments, depthStencil))
+            return entry;
     }
 
     RenderTarget* target = new RenderTarget(colorAttachments, depthStencil);
-    renderTargetCache.push_back(target);
+    for (auto attachment : colorAttachments)
+        attachment->mRenderTargetCount++;
+    if (depthStencil)
+        depthStencil->mRenderTargetCount++;
+    bucket.push_back(target);
+    renderTargetCount++;
     return target;
 }
 
+void RenderTarget::removeAttachment(const RenderAttachment& attachment)
+{
+    for (auto it = renderTargetCache.begin(); it != renderTargetCache.end();) {
+        auto& bucket = it->second;
+        for (size_t i = 0; i < bucket.size();) {
+            RenderTarget* target = bucket[i];
+            if (!target->usesAttachment(attachment)) {
+                ++i;
+                continue;
+            }
+            // queued entries point to the target, draw them while it's still alive
+            if (isQueuedRenderTarget(*target))
+                flush();
+            for (auto color : target->mColorAttachments)
+                color->mRenderTargetCount--;
+            if (target->mDepthStencil)
+                target->mDepthStencil->mRenderTargetCount--;
+            delete target;
+            bucket[i] = bucket.back();
+            bucket.pop_back();
+            renderTargetCount--;
+        }
+        it = bucket.empty() ? renderTargetCache.erase(it) : std::next(it);
+    }
+}
+
+size_t RenderTarget::getCacheSize()
+{
+    return renderTargetCount;
+}
+
+bool RenderTarget::hasAttachments(const std::vector<const RenderAttachment*>& colorAttachments,
+    const RenderAttachment* depthStencil) const
+{
+    return mDepthStencil == depthStencil && mColorAttachments == colorAttachments;
+}
+
+bool RenderTarget::usesAttachment(const RenderAttachment& attachment) const
+{
+    return mDepthStencil == &attachment
+        || std::find(mColorAttachments.begin(), mColorAttachments.end(), &attachment)
+        != mColorAttachments.end();
+}
+
 void RenderTarget::createFbo()
 {
     assert(mFbo == 0);
@@ -114,6 +223,7 @@ RenderTarget::RenderTarget(const std::vector<const RenderAttachment*>& colorAtta
     , mHeight(0)
     , mSamples(0)
     , mClearMask(0)
+    , mDiscardMask(0)
 {
     // make sure all attachments have the same size/msaa samples and determine the values
     if (colorAttachments.size() > 0) {
@@ -170,6 +280,73 @@ RenderTarget::RenderTarget(const std::vector<const RenderAttachment*>& colorAtta
     createFbo();
 }
 
+RenderTarget::~RenderTarget()
+{
+    // deleting a bound framebuffer binds the default framebuffer
+    if (currentDraw == this)
+        currentDraw = Window::instance();
+    if (currentRead == this)
+        currentRead = Window::instance();
+    if (mFbo != 0)
+        glDeleteFramebuffers(1, &mFbo);
+}
+
+void RenderTarget::invalidate(GLbitfield mask) const
+{
+    const InvalidateFramebufferProc invalidateFramebuffer = getInvalidateFramebuffer();
+    mask &= mClearMask;
+    if (!invalidateFramebuffer || mask == 0)
+        return;
+    // queued draws might still render to this
+    flush();
+
+    GLenum attachments[maxColorAttachments + 2];
+    GLsizei count = 0;
+    if (mFbo == 0) {
+        if (mask & GL_COLOR_BUFFER_BIT)
+            attachments[count++] = GL_COLOR;
+        if (mask & GL_DEPTH_BUFFER_BIT)
+            attachments[count++] = GL_DEPTH;
+        if (mask & GL_STENCIL_BUFFER_BIT)
+            attachments[count++] = GL_STENCIL;
+    } else {
+        if (mask & GL_COLOR_BUFFER_BIT) {
+            for (size_t i = 0; i < mColorAttachments.size(); ++i)
+                attachments[count++] = colorAttachmentPoints[i];
+        }
+        if (mask & GL_DEPTH_BUFFER_BIT && mask & GL_STENCIL_BUFFER_BIT
+            && getDepthStencilAttachmentPoint(mDepthStencil) == GL_DEPTH_STENCIL_ATTACHMENT) {
+            attachments[count++] = GL_DEPTH_STENCIL_ATTACHMENT;
+        } else {
+            if (mask & GL_DEPTH_BUFFER_BIT)
+                attachments[count++] = GL_DEPTH_ATTACHMENT;
+            if (mask & GL_STENCIL_BUFFER_BIT)
+                attachments[count++] = GL_STENCIL_ATTACHMENT;
+        }
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mFbo);
+    invalidateFramebuffer(GL_DRAW_FRAMEBUFFER, count, attachments);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, currentDraw->mFbo);
+}
+
+bool RenderTarget::isInvalidateSupported()
+{
+    return getInvalidateFramebuffer() != nullptr;
+}
+
+void RenderTarget::resolve(const RenderTarget& dst, GLbitfield mask, bool discard) const
+{
+    flush();
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, mFbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dst.mFbo);
+    blitBuffers(*this, dst, mask);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, currentRead->mFbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, currentDraw->mFbo);
+    if (discard)
+        invalidate(mask);
+}
+
 void RenderTarget::setViewport() const
 {
     kaun::setViewport(0, 0, getWidth(), getHeight());
@@ -195,35 +372,23 @@ void RenderTarget::bind(bool read, bool draw) const
 RenderTarget* setRenderTarget(const std::vector<const RenderAttachment*>& colorAttachments,
     const RenderAttachment* depthStencil, bool blitCurrent)
 {
-    flush();
-
+    // Queued draws remember their target, so switching only needs to flush if queued draws sample
+    // the target we are about to render to again
     RenderTarget* target = RenderTarget::get(colorAttachments, depthStencil);
 
+    const RenderTarget* previous = RenderTarget::currentDraw;
+    if (!blitCurrent && isSampledByQueuedDraws(*target))
+        flush();
     if (blitCurrent) {
+        flush();
         target->bind(false, true); // bind for drawing
-        glm::ivec2 currentSize = RenderTarget::currentRead->getDimensions();
-        glm::ivec2 size = target->getDimensions();
-        GLbitfield commonMask = RenderTarget::currentRead->getClearMask() & target->getClearMask();
-        // blit depth/stencil and color separately and turn off GL_FRAMEBUFFER_SRGB before
-        // see here:
-        // https://devtalk.nvidia.com/default/topic/1038547/opengl/depth-blit-using-glblitframebuffer-yields-wrong-results-when-gl_framebuffer_srgb-is-enabled/
-        if (commonMask & GL_COLOR_BUFFER_BIT) {
-            glBlitFramebuffer(0, 0, currentSize.x, currentSize.y, 0, 0, size.x, size.y,
-                GL_COLOR_BUFFER_BIT, GL_NEAREST);
-        }
-        if (commonMask != GL_COLOR_BUFFER_BIT) {
-            // clear everything except color
-            GLbitfield mask = commonMask & ~GL_COLOR_BUFFER_BIT;
-            bool enabled = getSrgbEnabled();
-            if (enabled)
-                setSrgbEnabled(false);
-            glBlitFramebuffer(
-                0, 0, currentSize.x, currentSize.y, 0, 0, size.x, size.y, mask, GL_NEAREST);
-            if (enabled)
-                setSrgbEnabled(true);
-        }
+        blitBuffers(*RenderTarget::currentRead, *target, RenderTarget::currentRead->getClearMask());
     }
 
+    // the previous pass is over
+    if (previous && previous != target && previous->getDiscardMask() != 0)
+        previous->invalidate(previous->getDiscardMask());
+
     target->bind(true, true); // bind for both reading and writing
 
     return target;
@@ -0,0 +1,136 @@
+#include "rendertexturepool.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "log.hpp"
+
+namespace kaun {
+namespace {
+    struct PoolKey {
+        PixelFormat format;
+        int width, height;
+        size_t samples;
+
+        bool operator==(const PoolKey& other) const
+        {
+            return format == other.format && width == other.width && height == other.height
+                && samples == other.samples;
+        }
+
+        size_t hash() const
+        {
+            size_t seed = std::hash<GLenum>()(static_cast<GLenum>(format));
+            const size_t values[] = { static_cast<size_t>(width), static_cast<size_t>(height),
+                samples };
+            for (auto value : values)
+                seed ^= std::hash<size_t>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            return seed;
+        }
+    };
+
+    struct PooledTexture {
+        std::unique_ptr<Texture> texture;
+        PoolKey key;
+        bool acquired;
+        uint64_t lastRelease;
+        size_t references;
+    };
+
+    std::unordered_map<const Texture*, PooledTexture> pooledTextures;
+    // released textures by the hash of their key, the most recently released last
+    std::unordered_map<size_t, std::vector<Texture*>> freeTextures;
+    uint64_t frameCounter = 0;
+    RenderTexturePoolStats stats;
+}
+
+Texture* acquireRenderTexture(PixelFormat format, int width, int height, size_t samples)
+{
+    const PoolKey key { format, width, height, samples };
+    auto& bucket = freeTextures[key.hash()];
+    for (size_t i = bucket.size(); i-- > 0;) {
+        Texture* texture = bucket[i];
+        PooledTexture& pooled = pooledTextures.at(texture);
+        if (pooled.key == key) {
+            bucket.erase(bucket.begin() + i);
+            pooled.acquired = true;
+            stats.acquired++;
+            stats.reused++;
+            return texture;
+        }
+    }
+
+    Texture* texture = samples > 0 ? new Texture(format, width, height, samples)
+                                   : new Texture(format, width, height);
+    pooledTextures.emplace(
+        texture, PooledTexture { std::unique_ptr<Texture>(texture), key, true, 0, 0 });
+    stats.textures++;
+    stats.acquired++;
+    stats.created++;
+    return texture;
+}
+
+bool releaseRenderTexture(const Texture* texture)
+{
+    auto it = pooledTextures.find(texture);
+    if (it == pooledTextures.end() || !it->second.acquired) {
+        LOG_ERROR("Texture was not acquired from the render texture pool");
+        return false;
+    }
+    PooledTexture& pooled = it->second;
+    pooled.acquired = false;
+    pooled.lastRelease = frameCounter;
+    freeTextures[pooled.key.hash()].push_back(pooled.texture.get());
+    stats.acquired--;
+    return true;
+}
+
+bool isPooledRenderTexture(const Texture* texture)
+{
+    return pooledTextures.count(texture) > 0;
+}
+
+void addRenderTextureReference(const Texture* texture)
+{
+    pooledTextures.at(texture).references++;
+}
+
+void removeRenderTextureReference(const Texture* texture)
+{
+    PooledTexture& pooled = pooledTextures.at(texture);
+    assert(pooled.references > 0);
+    pooled.references--;
+}
+
+void trimRenderTexturePool(size_t maxUnusedFrames)
+{
+    frameCounter++;
+    for (auto it = freeTextures.begin(); it != freeTextures.end();) {
+        auto& bucket = it->second;
+        for (size_t i = 0; i < bucket.size();) {
+            auto pooled = pooledTextures.find(bucket[i]);
+            if (pooled->second.references == 0
+                && frameCounter - pooled->second.lastRelease > maxUnusedFrames) {
+                // this deletes the render targets using the texture too
+                pooledTextures.erase(pooled);
+                bucket.erase(bucket.begin() + i);
+                stats.textures--;
+            } else {
+                ++i;
+            }
+        }
+        it = bucket.empty() ? freeTextures.erase(it) : std::next(it);
+    }
+    stats.created = stats.reused = 0;
+}
+
+const RenderTexturePoolStats& getRenderTexturePoolStats()
+{
+    return stats;
+}
+}
@@ -0,0 +1,152 @@
+#include "sampler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/gtc/type_ptr.hpp>
+
+namespace kaun {
+const Sampler* Sampler::currentBoundSamplers[Sampler::MAX_UNITS] = { nullptr };
+
+namespace {
+    // collisions are resolved by comparing the states
+    std::unordered_map<size_t, std::vector<std::unique_ptr<Sampler>>> samplerCache;
+    size_t samplerCount = 0;
+
+    float getMaxAnisotropy()
+    {
+        static float maxAnisotropy = -1.0f;
+        if (maxAnisotropy < 0.0f) {
+            maxAnisotropy = 1.0f;
+            if (GLAD_GL_EXT_texture_filter_anisotropic)
+                glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+        }
+        return maxAnisotropy;
+    }
+
+    template <typename T>
+    void hashCombine(size_t& seed, const T& value)
+    {
+        seed ^= std::hash<T>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+}
+
+bool SamplerState::operator==(const SamplerState& other) const
+{
+    return wrapS == other.wrapS && wrapT == other.wrapT && wrapR == other.wrapR
+        && minFilter == other.minFilter && magFilter == other.magFilter
+        && compareFunc == other.compareFunc && maxAnisotropy == other.maxAnisotropy
+        && lodBias == other.lodBias && minLod == other.minLod && maxLod == other.maxLod
+        && borderColor == other.borderColor;
+}
+
+size_t SamplerState::hash() const
+{
+    size_t seed = 0;
+    hashCombine(seed, static_cast<GLenum>(wrapS));
+    hashCombine(seed, static_cast<GLenum>(wrapT));
+    hashCombine(seed, static_cast<GLenum>(wrapR));
+    hashCombine(seed, static_cast<GLenum>(minFilter));
+    hashCombine(seed, static_cast<GLenum>(magFilter));
+    hashCombine(seed, static_cast<GLenum>(compareFunc));
+    hashCombine(seed, maxAnisotropy);
+    hashCombine(seed, lodBias);
+    hashCombine(seed, minLod);
+    hashCombine(seed, maxLod);
+    for (int i = 0; i < 4; ++i)
+        hashCombine(seed, borderColor[i]);
+    return seed;
+}
+
+Sampler::Sampler(const SamplerState& state)
+    : mSamplerObject(0)
+    , mState(state)
+{
+    glGenSamplers(1, &mSamplerObject);
+    glSamplerParameteri(mSamplerObject, GL_TEXTURE_WRAP_S, static_cast<GLenum>(state.wrapS));
+    glSamplerParameteri(mSamplerObject, GL_TEXTURE_WRAP_T, static_cast<GLenum>(state.wrapT));
+    glSamplerParameteri(mSamplerObject, GL_TEXTURE_WRAP_R, static_cast<GLenum>(state.wrapR));
+    glSamplerParameteri(
+        mSamplerObject, GL_TEXTURE_MIN_FILTER, static_cast<GLenum>(state.minFilter));
+    glSamplerParameteri(
+        mSamplerObject, GL_TEXTURE_MAG_FILTER, static_cast<GLenum>(state.magFilter));
+    if (state.compareFunc != RenderState::DepthFunc::DISABLED) {
+        glSamplerParameteri(mSamplerObject, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glSamplerParameteri(
+            mSamplerObject, GL_TEXTURE_COMPARE_FUNC, static_cast<GLenum>(state.compareFunc));
+    } else {
+        glSamplerParameteri(mSamplerObject, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    }
+    if (GLAD_GL_EXT_texture_filter_anisotropic) {
+        const float anisotropy = std::min(std::max(state.maxAnisotropy, 1.0f), getMaxAnisotropy());
+        glSamplerParameterf(mSamplerObject, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy);
+    }
+    glSamplerParameterf(mSamplerObject, GL_TEXTURE_LOD_BIAS, state.lodBias);
+    glSamplerParameterf(mSamplerObject, GL_TEXTURE_MIN_LOD, state.minLod);
+    glSamplerParameterf(mSamplerObject, GL_TEXTURE_MAX_LOD, state.maxLod);
+    glSamplerParameterfv(
+        mSamplerObject, GL_TEXTURE_BORDER_COLOR, glm::value_ptr(state.borderColor));
+}
+
+Sampler::~Sampler()
+{
+    for (size_t unit = 0; unit < MAX_UNITS; ++unit) {
+        if (currentBoundSamplers[unit] == this)
+            currentBoundSamplers[unit] = nullptr;
+    }
+    glDeleteSamplers(1, &mSamplerObject);
+}
+
+const Sampler* Sampler::get(const SamplerState& state)
+{
+    auto& bucket = samplerCache[state.hash()];
+    for (auto& sampler : bucket) {
+        if (sampler->getState() == state)
+            return sampler.get();
+    }
+    bucket.push_back(std::make_unique<Sampler>(state));
+    samplerCount++;
+    return bucket.back().get();
+}
+
+void Sampler::clearCache()
+{
+    samplerCache.clear();
+    samplerCount = 0;
+}
+
+size_t Sampler::getCacheSize()
+{
+    return samplerCount;
+}
+
+void Sampler::ensureGlState()
+{
+    for (size_t unit = 0; unit < MAX_UNITS; ++unit) {
+        const Sampler* sampler = currentBoundSamplers[unit];
+        glBindSampler(unit, sampler ? sampler->getSamplerObject() : 0);
+    }
+}
+
+void Sampler::bind(unsigned int unit) const
+{
+    assert(unit < MAX_UNITS);
+    if (currentBoundSamplers[unit] != this) {
+        glBindSampler(unit, mSamplerObject);
+        currentBoundSamplers[unit] = this;
+    }
+}
+
+void Sampler::unbind(unsigned int unit)
+{
+    assert(unit < MAX_UNITS);
+    if (currentBoundSamplers[unit] != nullptr) {
+        glBindSampler(unit, 0);
+        currentBoundSamplers[unit] = nullptr;
+    }
+}
+}
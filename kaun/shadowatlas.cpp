@@ -0,0 +1,152 @@
+#include "shadowatlas.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+#include "log.hpp"
+#include "render.hpp"
+#include "rendertarget.hpp"
+
+namespace kaun {
+ShadowAtlas::ShadowAtlas(Texture& texture, int minTileSize)
+    : mTexture(texture)
+    , mMinTileSize(1)
+    , mUsedArea(0)
+{
+    const GLenum format = getPixelTransferFormat(texture.getPixelFormat()).first;
+    if (format != GL_DEPTH_COMPONENT && format != GL_DEPTH_STENCIL)
+        LOG_WARNING("Shadow atlas texture does not have a depth format");
+    while (mMinTileSize < minTileSize)
+        mMinTileSize *= 2;
+    reset();
+}
+
+void ShadowAtlas::reset()
+{
+    int size = 1;
+    while (size * 2 <= std::min(mTexture.getWidth(), mTexture.getHeight()))
+        size *= 2;
+    mNodes.clear();
+    mNodes.push_back(Node { glm::ivec2(0), size, NodeState::FREE, none, none });
+    mUsedArea = 0;
+}
+
+ShadowAtlas::Tile ShadowAtlas::find(size_t index, int size, bool split)
+{
+    Node& node = mNodes[index];
+    if (node.size < size || node.state == NodeState::USED)
+        return none;
+
+    if (node.state == NodeState::FREE) {
+        if (node.size == size) {
+            node.state = NodeState::USED;
+            return index;
+        }
+        if (!split)
+            return none;
+        if (node.firstChild == none) {
+            node.firstChild = mNodes.size();
+            for (size_t i = 0; i < 4; ++i)
+                mNodes.push_back(Node { glm::ivec2(0), 0, NodeState::FREE, index, none });
+        }
+        // node might be dangling now
+        Node& parent = mNodes[index];
+        parent.state = NodeState::SPLIT;
+        const int half = parent.size / 2;
+        for (size_t i = 0; i < 4; ++i) {
+            Node& child = mNodes[parent.firstChild + i];
+            child.position = parent.position + glm::ivec2(i % 2, i / 2) * half;
+            child.size = half;
+            child.state = NodeState::FREE;
+        }
+    }
+
+    const size_t firstChild = mNodes[index].firstChild;
+    for (size_t i = 0; i < 4; ++i) {
+        const Tile tile = find(firstChild + i, size, split);
+        if (tile != none)
+            return tile;
+    }
+    return none;
+}
+
+ShadowAtlas::Tile ShadowAtlas::allocate(int size)
+{
+    int tileSize = mMinTileSize;
+    while (tileSize < size)
+        tileSize *= 2;
+    // prefer free tiles of the right size over splitting larger ones
+    Tile tile = find(0, tileSize, false);
+    if (tile == none)
+        tile = find(0, tileSize, true);
+    if (tile == none) {
+        LOG_DEBUG("Shadow atlas has no free %dx%d tile", tileSize, tileSize);
+        return none;
+    }
+    mUsedArea += static_cast<size_t>(tileSize) * tileSize;
+    return tile;
+}
+
+void ShadowAtlas::merge(size_t index)
+{
+    Node& node = mNodes[index];
+    for (size_t i = 0; i < 4; ++i) {
+        if (mNodes[node.firstChild + i].state != NodeState::FREE)
+            return;
+    }
+    for (size_t i = 0; i < 4; ++i)
+        mNodes[node.firstChild + i].state = NodeState::UNUSED;
+    node.state = NodeState::FREE;
+    if (node.parent != none)
+        merge(node.parent);
+}
+
+void ShadowAtlas::free(Tile tile)
+{
+    if (!isAllocated(tile)) {
+        LOG_ERROR("Invalid shadow atlas tile");
+        return;
+    }
+    Node& node = mNodes[tile];
+    node.state = NodeState::FREE;
+    mUsedArea -= static_cast<size_t>(node.size) * node.size;
+    if (node.parent != none)
+        merge(node.parent);
+}
+
+glm::ivec4 ShadowAtlas::getRect(Tile tile) const
+{
+    assert(isAllocated(tile));
+    const Node& node = mNodes[tile];
+    return glm::ivec4(node.position, node.size, node.size);
+}
+
+AtlasRegion ShadowAtlas::getRegion(Tile tile) const
+{
+    const glm::ivec4 rect = getRect(tile);
+    const glm::vec2 textureSize(mTexture.getWidth(), mTexture.getHeight());
+    AtlasRegion region;
+    region.rect = rect;
+    region.uvScale = glm::vec2(rect.z, rect.w) / textureSize;
+    region.uvOffset = glm::vec2(rect.x, rect.y) / textureSize;
+    return region;
+}
+
+void ShadowAtlas::bindTile(Tile tile, bool clear) const
+{
+    const glm::ivec4 rect = getRect(tile);
+    if (!RenderTarget::currentDraw->usesAttachment(mTexture))
+        setRenderTarget({}, &mTexture, false);
+    setViewport(rect);
+    // clears are only limited by the scissor rectangle, not the viewport
+    setScissor(rect);
+    if (clear)
+        clearDepth();
+}
+
+float ShadowAtlas::getOccupancy() const
+{
+    const float size = static_cast<float>(mNodes[0].size);
+    return static_cast<float>(mUsedArea) / (size * size);
+}
+}
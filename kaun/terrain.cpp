@@ -0,0 +1,289 @@
+#include "terrain.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "log.hpp"
+
+namespace kaun {
+std::string_view Terrain::shaderChunk = R"(
+uniform sampler2D kaun_terrainHeightmap;
+uniform vec4 kaun_terrainParams; // size, height scale, patch resolution
+uniform vec2 kaun_terrainResolution; // heightmap resolution
+uniform vec3 kaun_terrainCamera; // model space
+uniform vec4 kaun_terrainNode; // x, z, size, level
+uniform vec2 kaun_terrainMorph; // morph start, morph end distance
+
+vec2 kaun_terrainTexCoord(vec2 pos) {
+    return (pos / kaun_terrainParams.x * (kaun_terrainResolution - 1.0) + 0.5) / kaun_terrainResolution;
+}
+
+float kaun_terrainHeight(vec2 pos) {
+    return textureLod(kaun_terrainHeightmap, kaun_terrainTexCoord(pos), 0.0).r * kaun_terrainParams.y;
+}
+
+vec3 kaun_terrainNormal(vec2 pos) {
+    vec2 d = kaun_terrainParams.x / (kaun_terrainResolution - 1.0);
+    float hl = kaun_terrainHeight(pos - vec2(d.x, 0.0));
+    float hr = kaun_terrainHeight(pos + vec2(d.x, 0.0));
+    float hd = kaun_terrainHeight(pos - vec2(0.0, d.y));
+    float hu = kaun_terrainHeight(pos + vec2(0.0, d.y));
+    return normalize(vec3((hl - hr) / (2.0 * d.x), 1.0, (hd - hu) / (2.0 * d.y)));
+}
+
+// pass the POSITION attribute of the patch mesh, returns the model space position
+vec3 kaun_terrainPosition(vec3 gridPos) {
+    vec2 pos = kaun_terrainNode.xy + gridPos.xz * kaun_terrainNode.z;
+    float dist = distance(vec3(pos.x, kaun_terrainHeight(pos), pos.y), kaun_terrainCamera);
+    float morph = clamp((dist - kaun_terrainMorph.x) / (kaun_terrainMorph.y - kaun_terrainMorph.x), 0.0, 1.0);
+    // move odd vertices onto the grid of the next coarser level
+    vec2 fracPart = fract(gridPos.xz * kaun_terrainParams.z * 0.5) * 2.0 / kaun_terrainParams.z;
+    pos -= fracPart * kaun_terrainNode.z * morph;
+    return vec3(pos.x, kaun_terrainHeight(pos), pos.y);
+}
+)";
+
+Terrain::Terrain(const float* heights, int resolutionX, int resolutionZ, float size, float height,
+    int patchResolution, int lodLevels)
+    : mHeights(heights, heights + resolutionX * resolutionZ)
+    , mResolutionX(resolutionX)
+    , mResolutionZ(resolutionZ)
+    , mSize(size)
+    , mHeight(height)
+    , mPatchResolution(patchResolution)
+    , mLodLevels(lodLevels)
+    , mHeightmap(nullptr)
+{
+    assert(resolutionX >= 2 && resolutionZ >= 2);
+    assert(patchResolution >= 2 && patchResolution % 2 == 0);
+    assert(lodLevels >= 1);
+
+    mOwnedHeightmap.reset(new Texture(PixelFormat::R32F, resolutionX, resolutionZ));
+    mOwnedHeightmap->updateData(GL_RED, GL_FLOAT, mHeights.data());
+    mHeightmap = mOwnedHeightmap.get();
+
+    buildPatch();
+    mNodes.reserve(((1 << (2 * mLodLevels)) - 1) / 3);
+    mNodes.emplace_back();
+    buildNode(0, 0.0f, 0.0f, mSize, mLodLevels - 1);
+    setLodDistance(mSize / (1 << (mLodLevels - 1)) * 2.5f);
+}
+
+Terrain::Terrain(
+    const Texture& heightmap, float size, float height, int patchResolution, int lodLevels)
+    : mResolutionX(heightmap.getWidth())
+    , mResolutionZ(heightmap.getHeight())
+    , mSize(size)
+    , mHeight(height)
+    , mPatchResolution(patchResolution)
+    , mLodLevels(lodLevels)
+    , mHeightmap(&heightmap)
+{
+    assert(heightmap.getTarget() == Texture::Target::TEX_2D);
+    assert(patchResolution >= 2 && patchResolution % 2 == 0);
+    assert(lodLevels >= 1);
+
+    mHeights.resize(mResolutionX * mResolutionZ);
+    heightmap.activate();
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, mHeights.data());
+
+    buildPatch();
+    mNodes.reserve(((1 << (2 * mLodLevels)) - 1) / 3);
+    mNodes.emplace_back();
+    buildNode(0, 0.0f, 0.0f, mSize, mLodLevels - 1);
+    setLodDistance(mSize / (1 << (mLodLevels - 1)) * 2.5f);
+}
+
+void Terrain::buildPatch()
+{
+    mPatchFormat.add(AttributeType::POSITION, 3, AttributeDataType::F32);
+    const int n = mPatchResolution;
+    mPatch.reset(new Mesh(Mesh::DrawMode::TRIANGLES));
+    const size_t vertexCount = (n + 1) * (n + 1);
+    mPatch->addVertexBuffer(mPatchFormat, vertexCount);
+    auto position = mPatch->getAccessor<glm::vec3>(AttributeType::POSITION);
+    for (int z = 0; z <= n; ++z) {
+        for (int x = 0; x <= n; ++x)
+            position.set(x + z * (n + 1), glm::vec3((float)x / n, 0.0f, (float)z / n));
+    }
+
+    IndexBuffer* iData = mPatch->setIndexBuffer(vertexCount, n * n * 6);
+    size_t index = 0;
+    const int half = n / 2;
+    for (int q = 0; q < 4; ++q) {
+        const size_t first = index;
+        const int qx = (q & 1) * half;
+        const int qz = (q >> 1) * half;
+        for (int z = qz; z < qz + half; ++z) {
+            for (int x = qx; x < qx + half; ++x) {
+                const int start = x + z * (n + 1);
+                iData->set(index++, start);
+                iData->set(index++, start + n + 1);
+                iData->set(index++, start + n + 2);
+
+                iData->set(index++, start);
+                iData->set(index++, start + n + 2);
+                iData->set(index++, start + 1);
+            }
+        }
+        mPatch->addDrawRange("quadrant" + std::to_string(q), first, index - first);
+    }
+    for (int q = 0; q < 4; ++q)
+        mQuadrants[q] = &mPatch->getDrawRanges()[q];
+}
+
+void Terrain::buildNode(size_t index, float x, float z, float size, int level)
+{
+    AABoundingBox bounds;
+    size_t children = 0;
+    if (level == 0) {
+        const float sx = (mResolutionX - 1) / mSize;
+        const float sz = (mResolutionZ - 1) / mSize;
+        const int x0 = static_cast<int>(std::floor(x * sx));
+        const int x1 = static_cast<int>(std::ceil((x + size) * sx));
+        const int z0 = static_cast<int>(std::floor(z * sz));
+        const int z1 = static_cast<int>(std::ceil((z + size) * sz));
+        float minHeight = getSample(x0, z0), maxHeight = minHeight;
+        for (int iz = z0; iz <= z1; ++iz) {
+            for (int ix = x0; ix <= x1; ++ix) {
+                minHeight = std::min(minHeight, getSample(ix, iz));
+                maxHeight = std::max(maxHeight, getSample(ix, iz));
+            }
+        }
+        bounds.min = glm::vec3(x, minHeight * mHeight, z);
+        bounds.max = glm::vec3(x + size, maxHeight * mHeight, z + size);
+    } else {
+        children = mNodes.size();
+        mNodes.resize(children + 4);
+        const float half = size * 0.5f;
+        for (int c = 0; c < 4; ++c)
+            buildNode(children + c, x + (c & 1) * half, z + (c >> 1) * half, half, level - 1);
+        bounds = mNodes[children].bounds;
+        for (int c = 1; c < 4; ++c) {
+            bounds.min = glm::min(bounds.min, mNodes[children + c].bounds.min);
+            bounds.max = glm::max(bounds.max, mNodes[children + c].bounds.max);
+        }
+    }
+    mNodes[index].bounds = bounds;
+    mNodes[index].children = children;
+}
+
+void Terrain::setLodDistance(float lodDistance, float morphStartRatio)
+{
+    mLodRanges.resize(mLodLevels);
+    for (int level = 0; level < mLodLevels; ++level)
+        mLodRanges[level] = lodDistance * (1 << level);
+    mMorphStartRatio = morphStartRatio;
+}
+
+float Terrain::getSample(int x, int z) const
+{
+    x = std::clamp(x, 0, mResolutionX - 1);
+    z = std::clamp(z, 0, mResolutionZ - 1);
+    return mHeights[x + z * mResolutionX];
+}
+
+float Terrain::getHeight(float x, float z) const
+{
+    const float hx = x / mSize * (mResolutionX - 1);
+    const float hz = z / mSize * (mResolutionZ - 1);
+    const int ix = static_cast<int>(std::floor(hx));
+    const int iz = static_cast<int>(std::floor(hz));
+    const float fx = hx - ix;
+    const float fz = hz - iz;
+
+    // same triangulation as the patch mesh (diagonal from (0, 0) to (1, 1))
+    const float h00 = getSample(ix, iz);
+    const float h11 = getSample(ix + 1, iz + 1);
+    float h;
+    if (fx > fz) {
+        const float h10 = getSample(ix + 1, iz);
+        h = h00 + fx * (h10 - h00) + fz * (h11 - h10);
+    } else {
+        const float h01 = getSample(ix, iz + 1);
+        h = h00 + fz * (h01 - h00) + fx * (h11 - h01);
+    }
+    return h * mHeight;
+}
+
+glm::vec3 Terrain::getNormal(float x, float z) const
+{
+    const float dx = mSize / (mResolutionX - 1);
+    const float dz = mSize / (mResolutionZ - 1);
+    const float hl = getHeight(x - dx, z), hr = getHeight(x + dx, z);
+    const float hd = getHeight(x, z - dz), hu = getHeight(x, z + dz);
+    return glm::normalize(glm::vec3((hl - hr) / (2.0f * dx), 1.0f, (hd - hu) / (2.0f * dz)));
+}
+
+static bool sphereIntersects(const glm::vec3& center, float radius, const AABoundingBox& box)
+{
+    const glm::vec3 closest = glm::clamp(center, box.min, box.max);
+    const glm::vec3 rel = closest - center;
+    return glm::dot(rel, rel) <= radius * radius;
+}
+
+void Terrain::selectNode(
+    size_t index, int level, const glm::vec3& cameraPos, const Frustum& frustum)
+{
+    const Node& node = mNodes[index];
+    if (!frustum.intersects(node.bounds))
+        return;
+
+    if (level == 0 || !sphereIntersects(cameraPos, mLodRanges[level - 1], node.bounds)) {
+        mSelection.push_back(Selection { index, level, -1 });
+        return;
+    }
+
+    for (int c = 0; c < 4; ++c) {
+        const Node& child = mNodes[node.children + c];
+        if (sphereIntersects(cameraPos, mLodRanges[level - 1], child.bounds)) {
+            selectNode(node.children + c, level - 1, cameraPos, frustum);
+        } else if (frustum.intersects(child.bounds)) {
+            // out of the range of the finer level, draw this part of the node at this level
+            mSelection.push_back(Selection { index, level, c });
+        }
+    }
+}
+
+size_t Terrain::draw(Shader& shader, const std::vector<Uniform>& uniforms, const RenderState& state)
+{
+    static std::vector<Uniform> nodeUniforms;
+
+    const glm::mat4 modelView = getViewMatrix() * getModelMatrix();
+    const Frustum frustum(getProjection() * modelView);
+    const glm::vec3 cameraPos = glm::vec3(glm::inverse(modelView)[3]);
+
+    mSelection.clear();
+    selectNode(0, mLodLevels - 1, cameraPos, frustum);
+
+    nodeUniforms.clear();
+    nodeUniforms.reserve(uniforms.size() + 6);
+    nodeUniforms.insert(nodeUniforms.end(), uniforms.begin(), uniforms.end());
+    nodeUniforms.emplace_back("kaun_terrainHeightmap", *mHeightmap);
+    nodeUniforms.emplace_back("kaun_terrainParams",
+        glm::vec4(mSize, mHeight, static_cast<float>(mPatchResolution), 0.0f));
+    nodeUniforms.emplace_back("kaun_terrainResolution", glm::vec2(mResolutionX, mResolutionZ));
+    nodeUniforms.emplace_back("kaun_terrainCamera", cameraPos);
+
+    for (auto& selection : mSelection) {
+        const AABoundingBox& bounds = mNodes[selection.node].bounds;
+        const float prevRange = selection.level > 0 ? mLodRanges[selection.level - 1] : 0.0f;
+        const float range = mLodRanges[selection.level];
+        const float morphStart = prevRange + (range - prevRange) * mMorphStartRatio;
+
+        nodeUniforms.emplace_back("kaun_terrainNode",
+            glm::vec4(bounds.min.x, bounds.min.z, bounds.max.x - bounds.min.x,
+                static_cast<float>(selection.level)));
+        nodeUniforms.emplace_back("kaun_terrainMorph", glm::vec2(morphStart, range));
+        if (selection.quadrant < 0) {
+            kaun::draw(*mPatch, shader, nodeUniforms, state);
+        } else {
+            kaun::draw(*mPatch, *mQuadrants[selection.quadrant], shader, nodeUniforms, state);
+        }
+        nodeUniforms.pop_back();
+        nodeUniforms.pop_back();
+    }
+    return mSelection.size();
+}
+}
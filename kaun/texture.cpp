@@ -7,12 +7,82 @@
 
 #include "texture.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
 #include "render.hpp"
+#include "texture_compression.hpp"
+#include "texture_loader.hpp"
+#include "texture_manager.hpp"
 #include "utility.hpp"
 
 namespace kaun {
 const Texture* Texture::currentBoundTextures[Texture::MAX_UNITS] = { nullptr };
 
+namespace {
+    unsigned int activeUnit = 0;
+    // when the unit was last used by bindTextures, for picking the least recently used one
+    uint64_t unitLastUse[Texture::MAX_UNITS] = { 0 };
+    uint64_t bindEpoch = 0;
+    TextureBindStats currentBindStats, lastFrameBindStats;
+
+    // empty units have never been used (or were unbound), so they come first
+    size_t leastRecentlyUsedUnit()
+    {
+        size_t lru = 0;
+        for (size_t unit = 1; unit < Texture::MAX_UNITS; ++unit) {
+            if (unitLastUse[unit] < unitLastUse[lru])
+                lru = unit;
+        }
+        return lru;
+    }
+}
+
+void DecodedImage::Deleter::operator()(uint8_t* pixels) const
+{
+    stbi_image_free(pixels);
+}
+
+bool decodeImage(const std::string& filename, DecodedImage& image, std::string& error)
+{
+    uint8_t* pixels = stbi_load(
+        filename.c_str(), &image.width, &image.height, &image.components, 0);
+    if (!pixels) {
+        error = stbi_failure_reason();
+        return false;
+    }
+    image.pixels.reset(pixels);
+    return true;
+}
+
+bool decodeImage(const uint8_t* data, size_t size, DecodedImage& image, std::string& error)
+{
+    uint8_t* pixels = stbi_load_from_memory(
+        data, size, &image.width, &image.height, &image.components, 0);
+    if (!pixels) {
+        error = stbi_failure_reason();
+        return false;
+    }
+    image.pixels.reset(pixels);
+    return true;
+}
+
+Texture::~Texture()
+{
+    removeRenderTargets();
+    if (mPendingLoads > 0)
+        TextureLoader::cancel(*this);
+    if (mManagedIndex >= 0)
+        TextureManager::remove(*this);
+    // deleting a texture unbinds it everywhere
+    for (size_t unit = 0; unit < MAX_UNITS; ++unit) {
+        if (currentBoundTextures[unit] == this)
+            currentBoundTextures[unit] = nullptr;
+    }
+    glDeleteTextures(1, &mTextureObject);
+}
+
 void Texture::ensureGlState()
 {
     for (int unit = 0; unit < Texture::MAX_UNITS; ++unit) {
@@ -24,6 +94,7 @@ void Texture::ensureGlState()
             glBindTexture(static_cast<GLenum>(texture->getTarget()), texture->getTextureObject());
         }
     }
+    activeUnit = MAX_UNITS - 1;
 }
 
 Texture* Texture::pixel(const glm::vec4& col)
@@ -77,6 +148,111 @@ void Texture::initSampler()
 const GLint channelsToInternalFormat[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
 const GLint channelsToInternalFormatSrgb[4] = { GL_R8, GL_RG8, GL_SRGB8, GL_SRGB8_ALPHA8 };
 
+void Texture::initStorage(
+    Target target, int width, int height, int components, bool srgb, int levels)
+{
+    assert(components >= 1 && components <= 4 && levels >= 1);
+    if (mTextureObject == 0)
+        glGenTextures(1, &mTextureObject);
+    activate();
+
+    const GLint* internalFormatMap = srgb ? channelsToInternalFormatSrgb : channelsToInternalFormat;
+    const GLint internalFormat = internalFormatMap[components - 1];
+    const GLint formatMap[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    for (int level = 0; level < levels; ++level) {
+        glTexImage2D(static_cast<GLenum>(target), level, internalFormat,
+            std::max(1, width >> level), std::max(1, height >> level), 0,
+            formatMap[components - 1], GL_UNSIGNED_BYTE, nullptr);
+    }
+    mPixelFormat = static_cast<PixelFormat>(internalFormat);
+    if (levels > 1) {
+        mMinFilter = MinFilter::LINEAR_MIPMAP_LINEAR;
+        // a chain that doesn't go down to 1x1 would be incomplete otherwise
+        glTexParameteri(static_cast<GLenum>(mTarget), GL_TEXTURE_MAX_LEVEL, levels - 1);
+    }
+    initSampler();
+    mWidth = width;
+    mHeight = height;
+    mLevels = levels;
+}
+
+void Texture::reallocateLevels(int width, int height, int levels, int shift)
+{
+    assert(mTarget == Target::TEX_2D && mTextureObject != 0 && levels >= 1);
+    const GLenum target = static_cast<GLenum>(mTarget);
+    const auto transfer = getPixelTransferFormat(mPixelFormat);
+    const int firstKept = std::max(0, -shift);
+    const int lastKept = std::min(levels, mLevels - shift); // exclusive
+
+    // read the kept levels into a pixel buffer
+    std::vector<size_t> offsets;
+    size_t bufferSize = 0;
+    for (int level = firstKept; level < lastKept; ++level) {
+        offsets.push_back(bufferSize);
+        const int old = level + shift;
+        bufferSize += getImageSize(
+            mPixelFormat, std::max(1, mWidth >> old), std::max(1, mHeight >> old));
+    }
+    activate();
+    GLuint buffer = 0;
+    if (bufferSize > 0) {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, bufferSize, nullptr, GL_STREAM_COPY);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        for (int level = firstKept; level < lastKept; ++level) {
+            // with a pixel pack buffer bound, the last argument is an offset into it
+            glGetTexImage(target, level + shift, transfer.first, transfer.second,
+                reinterpret_cast<void*>(offsets[level - firstKept]));
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // the new object takes the place of the old one on its unit
+    const GLuint oldObject = mTextureObject;
+    glGenTextures(1, &mTextureObject);
+    glBindTexture(target, mTextureObject);
+    for (int level = 0; level < levels; ++level) {
+        glTexImage2D(target, level, static_cast<GLint>(mPixelFormat), std::max(1, width >> level),
+            std::max(1, height >> level), 0, transfer.first, transfer.second, nullptr);
+    }
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    initSampler();
+    glDeleteTextures(1, &oldObject);
+    mWidth = width;
+    mHeight = height;
+    mLevels = levels;
+
+    if (buffer != 0) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int level = firstKept; level < lastKept; ++level) {
+            glTexSubImage2D(target, level, 0, 0, std::max(1, width >> level),
+                std::max(1, height >> level), transfer.first, transfer.second,
+                reinterpret_cast<void*>(offsets[level - firstKept]));
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+    }
+}
+
+void Texture::loadMipChain(const MipChain& chain, bool srgb, Target target)
+{
+    assert(!chain.levels.empty());
+    if (target == Target::NONE)
+        target = mTarget;
+    const int levels = static_cast<int>(chain.levels.size());
+    initStorage(target, chain.levels[0].width, chain.levels[0].height, chain.components, srgb,
+        levels);
+    const GLint formatMap[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < levels; ++i) {
+        const auto& level = chain.levels[i];
+        glTexSubImage2D(static_cast<GLenum>(target), i, 0, 0, level.width, level.height,
+            formatMap[chain.components - 1], GL_UNSIGNED_BYTE, chain.getLevelData(i));
+    }
+}
+
 void Texture::loadFromMemory(const uint8_t* buffer, int width, int height, int components,
     bool genMipmaps, Target target, bool replace)
 {
@@ -86,7 +262,7 @@ void Texture::loadFromMemory(const uint8_t* buffer, int width, int height, int c
 
     if (mTextureObject == 0)
         glGenTextures(1, &mTextureObject);
-    bind(0);
+    activate();
 
     const GLint* internalFormatMap
         = getSrgbEnabled() ? channelsToInternalFormatSrgb : channelsToInternalFormat;
@@ -116,24 +292,127 @@ void Texture::loadFromMemory(const uint8_t* buffer, int width, int height, int c
 
     mWidth = width;
     mHeight = height;
+    mLevels = genMipmaps ? getMipLevelCount(width, height) : 1;
+}
+
+void Texture::loadArrayFromMemory(const uint8_t* buffer, int width, int height, int layers,
+    int components, bool genMipmaps)
+{
+    assert(components >= 1 && components <= 4 && layers >= 1);
+    if (mTarget != Target::TEX_2D_ARRAY) {
+        LOG_ERROR("Layers can only be loaded into TEX_2D_ARRAY textures");
+        return;
+    }
+    if (mImmutable) {
+        LOG_ERROR("Can't load layers into an immutable texture");
+        return;
+    }
+
+    if (mTextureObject == 0)
+        glGenTextures(1, &mTextureObject);
+    activate();
+
+    const GLint* internalFormatMap
+        = getSrgbEnabled() ? channelsToInternalFormatSrgb : channelsToInternalFormat;
+    const GLint internalFormat = internalFormatMap[components - 1];
+    const GLint formatMap[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, width, height, layers, 0,
+        formatMap[components - 1], GL_UNSIGNED_BYTE, buffer);
+    mPixelFormat = static_cast<PixelFormat>(internalFormat);
+    if (genMipmaps)
+        mMinFilter = MinFilter::LINEAR_MIPMAP_LINEAR;
+    initSampler();
+    // every layer is filtered on its own, so the layers don't bleed into each other
+    if (genMipmaps)
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+    mWidth = width;
+    mHeight = height;
+    mLayers = layers;
+    mLevels = genMipmaps ? getMipLevelCount(width, height) : 1;
+}
+
+void Texture::loadFromMemory(
+    PixelFormat format, const void* data, int width, int height, bool genMipmaps)
+{
+    const bool sameStorage = format == mPixelFormat && width == mWidth && height == mHeight;
+    if (mImmutable && !sameStorage) {
+        LOG_ERROR("Loading texture data of size %d, %d (format 0x%X) that does not fit into an "
+                  "immutable texture of size %d, %d (format 0x%X)",
+            width, height, static_cast<GLenum>(format), mWidth, mHeight,
+            static_cast<GLenum>(mPixelFormat));
+        return;
+    }
+
+    if (mTextureObject == 0)
+        glGenTextures(1, &mTextureObject);
+    activate();
+
+    const GLenum target = static_cast<GLenum>(mTarget);
+    const auto transfer = getPixelTransferFormat(format);
+    // rows are tightly packed
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (sameStorage) {
+        if (data != nullptr)
+            glTexSubImage2D(
+                target, 0, 0, 0, width, height, transfer.first, transfer.second, data);
+    } else {
+        glTexImage2D(target, 0, static_cast<GLint>(format), width, height, 0, transfer.first,
+            transfer.second, data);
+        mPixelFormat = format;
+        if (genMipmaps)
+            mMinFilter = MinFilter::LINEAR_MIPMAP_LINEAR;
+        initSampler();
+    }
+
+    if (genMipmaps)
+        glGenerateMipmap(target);
+
+    mWidth = width;
+    mHeight = height;
+    mLevels = genMipmaps ? getMipLevelCount(width, height) : 1;
 }
 
 bool Texture::loadEncodedFromMemory(
     const uint8_t* encBuffer, int len, bool genMipmaps, Target target)
 {
+    if (isCompressedImageContainer(encBuffer, len)) {
+        CompressedImage image;
+        std::string error;
+        if (!loadCompressedImage(encBuffer, len, image, error)) {
+            LOG_ERROR("Compressed image could not be loaded from memory: %s", error.c_str());
+            return false;
+        }
+        return loadCompressed(image, target);
+    }
+
     int w, h, c;
-    const unsigned char* buf = stbi_load_from_memory(encBuffer, len, &w, &h, &c, 0);
+    unsigned char* buf = stbi_load_from_memory(encBuffer, len, &w, &h, &c, 0);
     if (!buf) {
         LOG_ERROR("Image could not be loaded from memory: %s", stbi_failure_reason());
         return false;
     }
     loadFromMemory(buf, w, h, c, genMipmaps, target);
-    delete[] buf;
+    stbi_image_free(buf);
     return true;
 }
 
 bool Texture::loadFromFile(const std::string& filename, bool genMipmaps, Target target)
 {
+    uint8_t magic[12];
+    std::ifstream file(filename, std::ios::binary);
+    if (file.read(reinterpret_cast<char*>(magic), sizeof(magic))
+        && isCompressedImageContainer(magic, sizeof(magic))) {
+        CompressedImage image;
+        std::string error;
+        if (!loadCompressedImage(filename, image, error)) {
+            LOG_ERROR("Image file '%s' could not be loaded: %s", filename.c_str(), error.c_str());
+            return false;
+        }
+        return loadCompressed(image, target);
+    }
+
     int w, h, c;
     unsigned char* buf = stbi_load(filename.c_str(), &w, &h, &c, 0);
     if (!buf) {
@@ -142,10 +421,67 @@ bool Texture::loadFromFile(const std::string& filename, bool genMipmaps, Target
         return false;
     }
     loadFromMemory(buf, w, h, c, genMipmaps, target);
-    delete[] buf;
+    stbi_image_free(buf);
     return true;
 }
 
+bool Texture::loadCompressed(const CompressedImage& image, Target target)
+{
+    if (image.levels.empty()) {
+        LOG_ERROR("Trying to load an empty compressed image");
+        return false;
+    }
+    if (!isPixelFormatSupported(image.format)) {
+        LOG_ERROR("Compressed format 0x%X is not supported", static_cast<GLenum>(image.format));
+        return false;
+    }
+    const int width = image.levels[0].width, height = image.levels[0].height;
+    if (mImmutable && (image.format != mPixelFormat || width != mWidth || height != mHeight)) {
+        LOG_ERROR("Compressed image does not fit into the immutable texture");
+        return false;
+    }
+    if (target == Target::NONE)
+        target = mTarget;
+
+    if (mTextureObject == 0)
+        glGenTextures(1, &mTextureObject);
+    activate();
+    for (size_t i = 0; i < image.levels.size(); ++i) {
+        const auto& level = image.levels[i];
+        glCompressedTexImage2D(static_cast<GLenum>(target), i, static_cast<GLenum>(image.format),
+            level.width, level.height, 0, level.size, image.getLevelData(i));
+    }
+    // otherwise the texture is incomplete, if the chain doesn't go down to 1x1
+    glTexParameteri(static_cast<GLenum>(mTarget), GL_TEXTURE_MAX_LEVEL, image.levels.size() - 1);
+    if (image.levels.size() > 1)
+        mMinFilter = MinFilter::LINEAR_MIPMAP_LINEAR;
+    initSampler();
+    mPixelFormat = image.format;
+    mWidth = width;
+    mHeight = height;
+    mLevels = static_cast<int>(image.levels.size());
+    return true;
+}
+
+bool Texture::loadEncodedCompressed(
+    const uint8_t* encBuffer, int len, PixelFormat format, bool genMipmaps)
+{
+    if (isCompressedImageContainer(encBuffer, len))
+        return loadEncodedFromMemory(encBuffer, len, genMipmaps);
+
+    DecodedImage decoded;
+    std::string error;
+    if (!decodeImage(encBuffer, len, decoded, error)) {
+        LOG_ERROR("Image could not be loaded from memory: %s", error.c_str());
+        return false;
+    }
+    CompressedImage image;
+    if (!compressImage(decoded.pixels.get(), decoded.width, decoded.height, decoded.components,
+            format, image, genMipmaps))
+        return false;
+    return loadCompressed(image);
+}
+
 void Texture::attach(GLenum attachmentPoint) const
 {
     glFramebufferTexture2D(
@@ -163,11 +499,12 @@ void Texture::setStorageMultisample(
             return;
         }
     }
-    bind(0);
+    activate();
     mWidth = width;
     mHeight = height;
     mPixelFormat = internalFormat;
     mSamples = samples;
+    mLevels = 1;
 
     glTexImage2DMultisample(static_cast<GLenum>(mTarget), samples,
         static_cast<GLenum>(internalFormat), width, height, fixedSampleLocations);
@@ -185,10 +522,11 @@ void Texture::setStorage(PixelFormat internalFormat, int width, int height, int
             return;
         }
     }
-    bind(0);
+    activate();
     // glTexStorage2D(mTarget, levels, internalFormat, width, height);
     mWidth = width;
     mHeight = height;
+    mLevels = levels;
     mImmutable = true;
     mPixelFormat = internalFormat;
 
@@ -241,33 +579,221 @@ void Texture::updateData(
         LOG_ERROR("Trying to update texture that is not initialized yet!");
         return;
     }
-    bind(0);
+    activate();
     glTexSubImage2D(static_cast<GLenum>(mTarget), level, x, y, width, height, format, type, data);
 }
 
-void Texture::bindTextures(const std::vector<const Texture*>& textures)
+bool Texture::checkRegion(int x, int y, int width, int height) const
 {
-    assert(textures.size() <= MAX_UNITS);
-    bool unitInUse[MAX_UNITS] = { false };
-    std::vector<const Texture*> toBind;
-    for (auto tex : textures) {
-        int unit = tex->getUnit();
-        if (unit >= 0) { // already bound
-            unitInUse[unit] = true;
-        } else {
-            toBind.push_back(tex);
-        }
+    if (mTextureObject == 0 || mPixelFormat == PixelFormat::NONE) {
+        LOG_ERROR("Trying to update texture that is not initialized yet!");
+        return false;
+    }
+    if (isCompressed(mPixelFormat)) {
+        LOG_ERROR("Compressed textures can not be updated with pixel data");
+        return false;
+    }
+    if (x < 0 || y < 0 || width < 0 || height < 0 || x + width > mWidth
+        || y + height > mHeight) {
+        LOG_ERROR("Region %d, %d, %d, %d is outside of the texture (%d, %d)", x, y, width, height,
+            mWidth, mHeight);
+        return false;
+    }
+    return true;
+}
+
+bool Texture::replacePixels(
+    const void* data, int x, int y, int width, int height, bool updateMipmaps)
+{
+    if (!checkRegion(x, y, width, height))
+        return false;
+    const auto transfer = getPixelTransferFormat(mPixelFormat);
+    activate();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(static_cast<GLenum>(mTarget), 0, x, y, width, height, transfer.first,
+        transfer.second, data);
+    if (updateMipmaps)
+        glGenerateMipmap(static_cast<GLenum>(mTarget));
+    return true;
+}
+
+void Texture::setStreaming(size_t bufferCount)
+{
+    if (mStreamBuffers && mMappedRegion.z > 0) {
+        LOG_ERROR("Trying to change streaming mode while the pixels are mapped");
+        return;
+    }
+    if (bufferCount == 0)
+        mStreamBuffers.reset();
+    else if (!mStreamBuffers || mStreamBuffers->getCount() != bufferCount)
+        mStreamBuffers.reset(new PixelBufferRing(bufferCount));
+}
+
+void* Texture::mapPixels(int x, int y, int width, int height, bool wait)
+{
+    if (!mStreamBuffers) {
+        LOG_ERROR("Trying to map pixels of a texture that is not in streaming mode");
+        return nullptr;
+    }
+    if (mMappedRegion.z > 0) {
+        LOG_ERROR("Texture pixels are already mapped");
+        return nullptr;
     }
-    unsigned int unit;
-    for (auto tex : toBind) {
-        // get first available unit
-        for (unit = 0; unit < MAX_UNITS; ++unit) {
-            if (!unitInUse[unit])
-                break;
+    if (!checkRegion(x, y, width, height) || width == 0 || height == 0)
+        return nullptr;
+    const size_t size = static_cast<size_t>(width) * height * getPixelSize(mPixelFormat);
+    void* data = mStreamBuffers->map(size, wait);
+    if (data)
+        mMappedRegion = glm::ivec4(x, y, width, height);
+    return data;
+}
+
+bool Texture::unmapPixels(bool updateMipmaps)
+{
+    if (!mStreamBuffers || mMappedRegion.z == 0) {
+        LOG_ERROR("Trying to unmap texture pixels that are not mapped");
+        return false;
+    }
+    const glm::ivec4 region = mMappedRegion;
+    mMappedRegion = glm::ivec4(0);
+    if (!mStreamBuffers->unmap()) {
+        mStreamBuffers->finish();
+        return false;
+    }
+
+    const auto transfer = getPixelTransferFormat(mPixelFormat);
+    activate();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // with a pixel unpack buffer bound, the last argument is an offset into it
+    glTexSubImage2D(static_cast<GLenum>(mTarget), 0, region.x, region.y, region.z, region.w,
+        transfer.first, transfer.second, nullptr);
+    mStreamBuffers->finish();
+    if (updateMipmaps)
+        glGenerateMipmap(static_cast<GLenum>(mTarget));
+    return true;
+}
+
+bool Texture::streamPixels(const void* data, int x, int y, int width, int height, bool wait,
+    bool updateMipmaps)
+{
+    void* mapped = mapPixels(x, y, width, height, wait);
+    if (!mapped)
+        return false;
+    ::memcpy(mapped, data, static_cast<size_t>(width) * height * getPixelSize(mPixelFormat));
+    return unmapPixels(updateMipmaps);
+}
+
+size_t Texture::getMemorySize() const
+{
+    if (mTextureObject == 0 || mPixelFormat == PixelFormat::NONE)
+        return 0;
+    size_t size = 0;
+    for (int level = 0; level < mLevels; ++level)
+        size += getImageSize(mPixelFormat, std::max(1, mWidth >> level),
+            std::max(1, mHeight >> level));
+    if (mTarget == Target::TEX_CUBE_MAP)
+        size *= 6;
+    return size * mLayers * std::max<size_t>(1, mSamples);
+}
+
+void Texture::bind(unsigned int unit) const
+{
+    assert(unit < MAX_UNITS);
+    const Texture* previous = currentBoundTextures[unit];
+    if (mTextureObject == 0)
+        return;
+    if (activeUnit != unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        activeUnit = unit;
+        currentBindStats.unitSwitches++;
+    }
+    // already bound, but callers still expect the unit to be active and getUnit() to return it
+    if (previous == this) {
+        mUnit = unit;
+        return;
+    }
+    glBindTexture(static_cast<GLenum>(mTarget), mTextureObject);
+    currentBindStats.binds++;
+    // the previous texture might still be bound to another unit, if it was bound explicitly
+    if (previous && previous->mUnit == static_cast<int>(unit))
+        previous->mUnit = -1;
+    currentBoundTextures[unit] = this;
+    mUnit = unit;
+}
+
+void Texture::unbind(unsigned int unit)
+{
+    const Texture* previous = currentBoundTextures[unit];
+    if (previous == nullptr)
+        return;
+    if (activeUnit != unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        activeUnit = unit;
+        currentBindStats.unitSwitches++;
+    }
+    // There can only be one texture bound to a single unit (independent of type), so i can
+    // unbind with whatever I want Bonus: unbind can be static!
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (previous->mUnit == static_cast<int>(unit))
+        previous->mUnit = -1;
+    currentBoundTextures[unit] = nullptr;
+    unitLastUse[unit] = 0;
+}
+
+void Texture::activate() const
+{
+    if (mTextureObject == 0)
+        return;
+    if (mUnit < 0) {
+        const size_t unit = leastRecentlyUsedUnit();
+        bind(unit);
+        unitLastUse[unit] = ++bindEpoch;
+    } else if (activeUnit != static_cast<unsigned int>(mUnit)) {
+        glActiveTexture(GL_TEXTURE0 + mUnit);
+        activeUnit = mUnit;
+        currentBindStats.unitSwitches++;
+    }
+}
+
+void Texture::bindTextures(const Texture* const* textures, size_t count)
+{
+    assert(count <= MAX_UNITS);
+    // units used by this set must not be taken by other textures of it
+    const uint64_t epoch = ++bindEpoch;
+    size_t missing = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const int unit = textures[i]->mUnit;
+        if (unit >= 0) {
+            unitLastUse[unit] = epoch;
+            currentBindStats.hits++;
+        } else if (textures[i]->mTextureObject != 0) {
+            ++missing;
         }
-        assert(unit < MAX_UNITS);
-        tex->bind(unit);
-        unitInUse[unit] = true;
     }
+    if (missing == 0)
+        return;
+
+    for (size_t i = 0; i < count; ++i) {
+        const Texture* tex = textures[i];
+        if (tex->mUnit >= 0 || tex->mTextureObject == 0)
+            continue;
+        const size_t lru = leastRecentlyUsedUnit();
+        assert(unitLastUse[lru] != epoch);
+        if (currentBoundTextures[lru])
+            currentBindStats.evictions++;
+        tex->bind(lru);
+        unitLastUse[lru] = epoch;
+    }
+}
+
+const TextureBindStats& Texture::getBindStats()
+{
+    return lastFrameBindStats;
+}
+
+void Texture::endFrame()
+{
+    lastFrameBindStats = currentBindStats;
+    currentBindStats = TextureBindStats();
 }
 }
@@ -0,0 +1,193 @@
+#include "texture_atlas.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+#include "log.hpp"
+
+namespace kaun {
+SkylinePacker::SkylinePacker(int width, int height)
+    : mWidth(width)
+    , mHeight(height)
+    , mUsedArea(0)
+{
+    reset();
+}
+
+void SkylinePacker::reset()
+{
+    mSkyline.clear();
+    mSkyline.push_back(Segment { 0, 0, mWidth });
+    mUsedArea = 0;
+}
+
+int SkylinePacker::fit(size_t index, int width, int height) const
+{
+    const int x = mSkyline[index].x;
+    if (x + width > mWidth)
+        return -1;
+    // the rectangle rests on the highest segment below it
+    int y = 0, remaining = width;
+    for (size_t i = index; remaining > 0; ++i) {
+        assert(i < mSkyline.size());
+        y = std::max(y, mSkyline[i].y);
+        if (y + height > mHeight)
+            return -1;
+        remaining -= mSkyline[i].width;
+    }
+    return y;
+}
+
+bool SkylinePacker::insert(int width, int height, glm::ivec2& position)
+{
+    int bestIndex = -1, bestTop = mHeight + 1, bestWidth = 0;
+    for (size_t i = 0; i < mSkyline.size(); ++i) {
+        const int y = fit(i, width, height);
+        if (y < 0)
+            continue;
+        // lowest top edge, then the narrowest segment (less wasted space next to it)
+        if (y + height < bestTop || (y + height == bestTop && mSkyline[i].width < bestWidth)) {
+            bestIndex = static_cast<int>(i);
+            bestTop = y + height;
+            bestWidth = mSkyline[i].width;
+        }
+    }
+    if (bestIndex < 0)
+        return false;
+
+    position = glm::ivec2(mSkyline[bestIndex].x, bestTop - height);
+    mSkyline.insert(mSkyline.begin() + bestIndex, Segment { position.x, bestTop, width });
+
+    // cut away the segments now covered by the new one
+    const int right = position.x + width;
+    for (size_t i = bestIndex + 1; i < mSkyline.size();) {
+        Segment& segment = mSkyline[i];
+        if (segment.x >= right)
+            break;
+        const int overlap = right - segment.x;
+        if (overlap >= segment.width) {
+            mSkyline.erase(mSkyline.begin() + i);
+        } else {
+            segment.x += overlap;
+            segment.width -= overlap;
+            break;
+        }
+    }
+
+    // merge neighbouring segments with the same height
+    for (size_t i = 0; i + 1 < mSkyline.size();) {
+        if (mSkyline[i].y == mSkyline[i + 1].y) {
+            mSkyline[i].width += mSkyline[i + 1].width;
+            mSkyline.erase(mSkyline.begin() + i + 1);
+        } else {
+            ++i;
+        }
+    }
+    mUsedArea += static_cast<size_t>(width) * height;
+    return true;
+}
+
+TextureAtlas::TextureAtlas(int width, int height, int padding)
+    : mWidth(width)
+    , mHeight(height)
+    , mPadding(padding)
+    , mLayerCount(0)
+{
+}
+
+size_t TextureAtlas::add(const uint8_t* pixels, int width, int height, int components)
+{
+    assert(components >= 1 && components <= 4);
+    Image image { std::vector<uint8_t>(static_cast<size_t>(width) * height * 4), width, height };
+    for (size_t i = 0; i < static_cast<size_t>(width) * height; ++i) {
+        for (int c = 0; c < 4; ++c) {
+            uint8_t value = c == 3 ? 255 : 0;
+            if (c < components)
+                value = pixels[i * components + c];
+            image.pixels[i * 4 + c] = value;
+        }
+    }
+    mImages.push_back(std::move(image));
+    return mImages.size() - 1;
+}
+
+Texture* TextureAtlas::build(Texture::Target target, bool genMipmaps)
+{
+    if (target != Texture::Target::TEX_2D && target != Texture::Target::TEX_2D_ARRAY) {
+        LOG_ERROR("Texture atlases can only be TEX_2D or TEX_2D_ARRAY");
+        return nullptr;
+    }
+    const bool array = target == Texture::Target::TEX_2D_ARRAY;
+
+    // big images first pack a lot better
+    std::vector<size_t> order(mImages.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        const Image &imgA = mImages[a], &imgB = mImages[b];
+        return imgA.height != imgB.height ? imgA.height > imgB.height : imgA.width > imgB.width;
+    });
+
+    std::vector<SkylinePacker> layers;
+    mRegions.assign(mImages.size(), AtlasRegion());
+    for (auto id : order) {
+        const Image& image = mImages[id];
+        const int paddedWidth = image.width + 2 * mPadding;
+        const int paddedHeight = image.height + 2 * mPadding;
+        if (paddedWidth > mWidth || paddedHeight > mHeight) {
+            LOG_ERROR("Image %zu (%dx%d) is too big for an atlas of size %dx%d", id, image.width,
+                image.height, mWidth, mHeight);
+            return nullptr;
+        }
+
+        glm::ivec2 position;
+        size_t layer = 0;
+        while (layer < layers.size() && !layers[layer].insert(paddedWidth, paddedHeight, position))
+            ++layer;
+        if (layer == layers.size()) {
+            if (!array && !layers.empty()) {
+                LOG_ERROR("Images don't fit into an atlas of size %dx%d", mWidth, mHeight);
+                return nullptr;
+            }
+            layers.emplace_back(mWidth, mHeight);
+            layers.back().insert(paddedWidth, paddedHeight, position);
+        }
+
+        AtlasRegion& region = mRegions[id];
+        region.layer = static_cast<int>(layer);
+        region.rect = glm::ivec4(position + mPadding, image.width, image.height);
+        region.uvScale = glm::vec2(image.width, image.height) / glm::vec2(mWidth, mHeight);
+        region.uvOffset = glm::vec2(region.rect.x, region.rect.y) / glm::vec2(mWidth, mHeight);
+    }
+    mLayerCount = std::max<size_t>(1, layers.size());
+
+    const size_t layerSize = static_cast<size_t>(mWidth) * mHeight * 4;
+    std::vector<uint8_t> pixels(layerSize * mLayerCount, 0);
+    for (size_t id = 0; id < mImages.size(); ++id) {
+        const Image& image = mImages[id];
+        const AtlasRegion& region = mRegions[id];
+        uint8_t* layer = pixels.data() + layerSize * region.layer;
+        // the padding repeats the edge pixels
+        for (int y = -mPadding; y < image.height + mPadding; ++y) {
+            const int srcY = std::min(std::max(y, 0), image.height - 1);
+            for (int x = -mPadding; x < image.width + mPadding; ++x) {
+                const int srcX = std::min(std::max(x, 0), image.width - 1);
+                const size_t srcIndex = static_cast<size_t>(srcY) * image.width + srcX;
+                const size_t dstIndex
+                    = static_cast<size_t>(region.rect.y + y) * mWidth + region.rect.x + x;
+                const uint8_t* src = &image.pixels[srcIndex * 4];
+                uint8_t* dst = layer + dstIndex * 4;
+                std::copy(src, src + 4, dst);
+            }
+        }
+    }
+
+    Texture* texture = new Texture(target);
+    if (array)
+        texture->loadArrayFromMemory(
+            pixels.data(), mWidth, mHeight, static_cast<int>(mLayerCount), 4, genMipmaps);
+    else
+        texture->loadFromMemory(pixels.data(), mWidth, mHeight, 4, genMipmaps);
+    return texture;
+}
+}
@@ -0,0 +1,624 @@
+#include "texture_compression.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+#include "log.hpp"
+
+namespace kaun {
+namespace {
+    const uint8_t ktxIdentifier[12]
+        = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+    const uint32_t ktxEndianness = 0x04030201;
+    const size_t ktxHeaderSize = 64;
+
+    const size_t ddsHeaderSize = 4 + 124; // with the magic
+    const size_t ddsDx10HeaderSize = 20;
+
+    // Both containers are little endian
+    uint32_t readU32(const uint8_t* data)
+    {
+        return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    constexpr uint32_t fourCC(const char (&str)[5])
+    {
+        return str[0] | (str[1] << 8) | (str[2] << 16) | (static_cast<uint32_t>(str[3]) << 24);
+    }
+
+    bool addLevel(CompressedImage& image, int width, int height, size_t offset, size_t available,
+        std::string& error)
+    {
+        const size_t size = getImageSize(image.format, width, height);
+        if (size > available) {
+            error = "File is truncated";
+            return false;
+        }
+        image.levels.push_back(CompressedImage::Level { width, height, offset, size });
+        return true;
+    }
+
+    bool loadKtx(const uint8_t* data, size_t size, CompressedImage& image, std::string& error)
+    {
+        if (size < ktxHeaderSize) {
+            error = "File is too small for a KTX header";
+            return false;
+        }
+        const uint8_t* header = data + sizeof(ktxIdentifier);
+        if (readU32(header) != ktxEndianness) {
+            error = "Big endian KTX files are not supported";
+            return false;
+        }
+        const uint32_t glType = readU32(header + 4);
+        const GLenum internalFormat = readU32(header + 16);
+        const int width = readU32(header + 24);
+        const int height = readU32(header + 28);
+        const uint32_t depth = readU32(header + 32);
+        const uint32_t arrayElements = readU32(header + 36);
+        const uint32_t faces = readU32(header + 40);
+        // 0 means the loader should generate mipmaps, which is impossible for compressed data
+        const uint32_t levelCount = std::max(1u, readU32(header + 44));
+        const uint32_t keyValueBytes = readU32(header + 48);
+
+        image.format = static_cast<PixelFormat>(internalFormat);
+        if (glType != 0 || !isCompressed(image.format)) {
+            error = "Unsupported KTX format 0x" + std::to_string(internalFormat);
+            return false;
+        }
+        if (depth > 1 || arrayElements > 0 || faces != 1 || width <= 0 || height <= 0) {
+            error = "Only 2D KTX textures are supported";
+            return false;
+        }
+
+        size_t offset = ktxHeaderSize + keyValueBytes;
+        int levelWidth = width, levelHeight = height;
+        for (uint32_t i = 0; i < levelCount; ++i) {
+            if (offset + 4 > size) {
+                error = "File is truncated";
+                return false;
+            }
+            const size_t imageSize = readU32(data + offset);
+            offset += 4;
+            if (imageSize > size - offset
+                || !addLevel(image, levelWidth, levelHeight, offset, imageSize, error))
+                return false;
+            // levels are padded to 4 bytes
+            offset += (imageSize + 3) & ~static_cast<size_t>(3);
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+        }
+        image.data.assign(data, data + std::min(offset, size));
+        return true;
+    }
+
+    PixelFormat ddsFourCCToFormat(uint32_t code)
+    {
+        switch (code) {
+        case fourCC("DXT1"):
+            return PixelFormat::BC1;
+        case fourCC("DXT5"):
+            return PixelFormat::BC3;
+        case fourCC("ATI1"):
+        case fourCC("BC4U"):
+            return PixelFormat::BC4;
+        case fourCC("ATI2"):
+        case fourCC("BC5U"):
+            return PixelFormat::BC5;
+        default:
+            return PixelFormat::NONE;
+        }
+    }
+
+    PixelFormat dxgiToFormat(uint32_t dxgiFormat)
+    {
+        switch (dxgiFormat) {
+        case 71:
+            return PixelFormat::BC1;
+        case 72:
+            return PixelFormat::BC1_SRGB;
+        case 77:
+            return PixelFormat::BC3;
+        case 78:
+            return PixelFormat::BC3_SRGB;
+        case 80:
+            return PixelFormat::BC4;
+        case 83:
+            return PixelFormat::BC5;
+        case 98:
+            return PixelFormat::BC7;
+        case 99:
+            return PixelFormat::BC7_SRGB;
+        default:
+            return PixelFormat::NONE;
+        }
+    }
+
+    bool loadDds(const uint8_t* data, size_t size, CompressedImage& image, std::string& error)
+    {
+        if (size < ddsHeaderSize) {
+            error = "File is too small for a DDS header";
+            return false;
+        }
+        const uint8_t* header = data + 4;
+        const uint32_t flags = readU32(header + 4);
+        const int height = readU32(header + 8);
+        const int width = readU32(header + 12);
+        const bool hasMipCount = (flags & 0x20000) != 0; // DDSD_MIPMAPCOUNT
+        const uint32_t levelCount = hasMipCount ? std::max(1u, readU32(header + 24)) : 1;
+        const uint32_t pixelFormatFlags = readU32(header + 76);
+        const uint32_t code = readU32(header + 80);
+        const uint32_t caps2 = readU32(header + 108);
+
+        if ((pixelFormatFlags & 0x4) == 0) { // DDPF_FOURCC
+            error = "Only compressed DDS files are supported";
+            return false;
+        }
+        // cube map or volume texture
+        if ((caps2 & 0x200) != 0 || (caps2 & 0x200000) != 0 || width <= 0 || height <= 0) {
+            error = "Only 2D DDS textures are supported";
+            return false;
+        }
+
+        size_t offset = ddsHeaderSize;
+        if (code == fourCC("DX10")) {
+            if (size < ddsHeaderSize + ddsDx10HeaderSize) {
+                error = "File is too small for a DX10 header";
+                return false;
+            }
+            const uint8_t* dx10 = data + ddsHeaderSize;
+            const uint32_t dimension = readU32(dx10 + 4);
+            const uint32_t miscFlag = readU32(dx10 + 8);
+            const uint32_t arraySize = readU32(dx10 + 12);
+            // 3 = D3D10_RESOURCE_DIMENSION_TEXTURE2D, 0x4 = D3D10_RESOURCE_MISC_TEXTURECUBE
+            if (dimension != 3 || (miscFlag & 0x4) != 0 || arraySize > 1) {
+                error = "Only 2D DDS textures are supported";
+                return false;
+            }
+            image.format = dxgiToFormat(readU32(dx10));
+            if (image.format == PixelFormat::NONE) {
+                error = "Unsupported DXGI format " + std::to_string(readU32(dx10));
+                return false;
+            }
+            offset += ddsDx10HeaderSize;
+        } else {
+            image.format = ddsFourCCToFormat(code);
+            if (image.format == PixelFormat::NONE) {
+                const char str[5] = { static_cast<char>(code), static_cast<char>(code >> 8),
+                    static_cast<char>(code >> 16), static_cast<char>(code >> 24), '\0' };
+                error = std::string("Unsupported DDS format '") + str + "'";
+                return false;
+            }
+        }
+
+        int levelWidth = width, levelHeight = height;
+        for (uint32_t i = 0; i < levelCount; ++i) {
+            if (!addLevel(image, levelWidth, levelHeight, offset, size - offset, error))
+                return false;
+            offset += image.levels.back().size;
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+        }
+        image.data.assign(data, data + offset);
+        return true;
+    }
+
+    // Encoder
+
+    using BlockPixels = uint8_t[16][4];
+
+    // Clamps at the edges, missing components are 0, missing alpha is 255
+    void fetchBlock(const uint8_t* pixels, int width, int height, int components, int blockX,
+        int blockY, BlockPixels& block)
+    {
+        for (int y = 0; y < 4; ++y) {
+            const int py = std::min(blockY * 4 + y, height - 1);
+            for (int x = 0; x < 4; ++x) {
+                const int px = std::min(blockX * 4 + x, width - 1);
+                const uint8_t* pixel = pixels + (static_cast<size_t>(py) * width + px) * components;
+                uint8_t* out = block[y * 4 + x];
+                for (int c = 0; c < 4; ++c)
+                    out[c] = c < components ? pixel[c] : (c == 3 ? 255 : 0);
+            }
+        }
+    }
+
+    uint16_t to565(const float color[3])
+    {
+        auto quantize = [](float v, int max) {
+            return static_cast<uint16_t>(
+                std::lround(std::min(std::max(v, 0.0f), 255.0f) * max / 255.0f));
+        };
+        return (quantize(color[0], 31) << 11) | (quantize(color[1], 63) << 5)
+            | quantize(color[2], 31);
+    }
+
+    void from565(uint16_t color, int out[3])
+    {
+        const int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+        // replicate the high bits into the low ones, like the hardware does
+        out[0] = (r << 3) | (r >> 2);
+        out[1] = (g << 2) | (g >> 4);
+        out[2] = (b << 3) | (b >> 2);
+    }
+
+    // Picks the closest of the four palette colors for each pixel. Returns the squared error.
+    int colorIndices(const BlockPixels& block, uint16_t c0, uint16_t c1, uint32_t& indices)
+    {
+        int palette[4][3];
+        from565(c0, palette[0]);
+        from565(c1, palette[1]);
+        for (int c = 0; c < 3; ++c) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        indices = 0;
+        int totalError = 0;
+        for (int i = 0; i < 16; ++i) {
+            int bestError = 0x7fffffff;
+            uint32_t best = 0;
+            for (uint32_t p = 0; p < 4; ++p) {
+                int error = 0;
+                for (int c = 0; c < 3; ++c) {
+                    const int d = block[i][c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= best << (i * 2);
+            totalError += bestError;
+        }
+        return totalError;
+    }
+
+    void writeColorBlock(uint16_t c0, uint16_t c1, uint32_t indices, uint8_t* dest)
+    {
+        dest[0] = c0 & 0xff;
+        dest[1] = c0 >> 8;
+        dest[2] = c1 & 0xff;
+        dest[3] = c1 >> 8;
+        for (int i = 0; i < 4; ++i)
+            dest[4 + i] = (indices >> (i * 8)) & 0xff;
+    }
+
+    // c0 > c1 selects the four color mode (BC1 only, BC3 always uses it). Has to be done before
+    // the indices are computed.
+    void orderEndpoints(uint16_t& c0, uint16_t& c1)
+    {
+        if (c0 < c1)
+            std::swap(c0, c1);
+    }
+
+    // RGB endpoints along the principal axis of the colors, refined once with least squares
+    void encodeColorBlock(const BlockPixels& block, uint8_t* dest)
+    {
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; ++i) {
+            for (int c = 0; c < 3; ++c)
+                mean[c] += block[i][c] / 16.0f;
+        }
+        float cov[6] = { 0.0f }; // rr, rg, rb, gg, gb, bb
+        for (int i = 0; i < 16; ++i) {
+            const float r = block[i][0] - mean[0], g = block[i][1] - mean[1],
+                        b = block[i][2] - mean[2];
+            cov[0] += r * r;
+            cov[1] += r * g;
+            cov[2] += r * b;
+            cov[3] += g * g;
+            cov[4] += g * b;
+            cov[5] += b * b;
+        }
+
+        // power iteration
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for (int iteration = 0; iteration < 8; ++iteration) {
+            const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+            const float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+            const float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+            const float len = std::max(std::abs(x), std::max(std::abs(y), std::abs(z)));
+            if (len < 1e-6f)
+                break; // all colors are the same
+            axis[0] = x / len;
+            axis[1] = y / len;
+            axis[2] = z / len;
+        }
+
+        float minT = 1e30f, maxT = -1e30f;
+        for (int i = 0; i < 16; ++i) {
+            float t = 0.0f;
+            for (int c = 0; c < 3; ++c)
+                t += (block[i][c] - mean[c]) * axis[c];
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+        // inset the endpoints a little, so the rounding error is spread more evenly
+        const float inset = (maxT - minT) / 16.0f;
+        float end0[3], end1[3];
+        for (int c = 0; c < 3; ++c) {
+            end0[c] = mean[c] + axis[c] * (maxT - inset);
+            end1[c] = mean[c] + axis[c] * (minT + inset);
+        }
+
+        uint16_t c0 = to565(end0), c1 = to565(end1);
+        orderEndpoints(c0, c1);
+        if (c0 == c1) {
+            // the palette would be three colors + transparent black in BC1
+            writeColorBlock(c0, c1, 0, dest);
+            return;
+        }
+        uint32_t indices = 0;
+        int error = colorIndices(block, c0, c1, indices);
+
+        // solve for the endpoints that minimize the error for these indices
+        const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[3] = { 0.0f }, bx[3] = { 0.0f };
+        for (int i = 0; i < 16; ++i) {
+            const float a = weights[(indices >> (i * 2)) & 3], b = 1.0f - a;
+            aa += a * a;
+            bb += b * b;
+            ab += a * b;
+            for (int c = 0; c < 3; ++c) {
+                ax[c] += a * block[i][c];
+                bx[c] += b * block[i][c];
+            }
+        }
+        const float det = aa * bb - ab * ab;
+        if (std::abs(det) > 1e-6f) {
+            for (int c = 0; c < 3; ++c) {
+                end0[c] = (ax[c] * bb - bx[c] * ab) / det;
+                end1[c] = (bx[c] * aa - ax[c] * ab) / det;
+            }
+            uint16_t r0 = to565(end0), r1 = to565(end1);
+            orderEndpoints(r0, r1);
+            if (r0 != r1) {
+                uint32_t refined = 0;
+                const int refinedError = colorIndices(block, r0, r1, refined);
+                if (refinedError < error) {
+                    c0 = r0;
+                    c1 = r1;
+                    indices = refined;
+                    error = refinedError;
+                }
+            }
+        }
+        writeColorBlock(c0, c1, indices, dest);
+    }
+
+    // BC4 (also BC3 alpha and both BC5 channels) in the eight value mode (v0 > v1)
+    void encodeChannelBlock(const BlockPixels& block, int channel, uint8_t* dest)
+    {
+        int minV = 255, maxV = 0;
+        for (int i = 0; i < 16; ++i) {
+            minV = std::min(minV, static_cast<int>(block[i][channel]));
+            maxV = std::max(maxV, static_cast<int>(block[i][channel]));
+        }
+        dest[0] = maxV;
+        dest[1] = minV;
+        uint64_t indices = 0;
+        if (maxV > minV) {
+            const int range = maxV - minV;
+            for (int i = 0; i < 16; ++i) {
+                // position between min (0) and max (7)
+                const int t = ((block[i][channel] - minV) * 7 + range / 2) / range;
+                // index 0 is v0 (max), 1 is v1 (min), 2-7 go from max to min
+                const uint64_t index = t == 7 ? 0 : (t == 0 ? 1 : 8 - t);
+                indices |= index << (i * 3);
+            }
+        }
+        for (int i = 0; i < 6; ++i)
+            dest[2 + i] = (indices >> (i * 8)) & 0xff;
+    }
+
+    void encodeBlock(const BlockPixels& block, PixelFormat format, uint8_t* dest)
+    {
+        switch (format) {
+        case PixelFormat::BC1:
+        case PixelFormat::BC1_SRGB:
+            encodeColorBlock(block, dest);
+            break;
+        case PixelFormat::BC3:
+        case PixelFormat::BC3_SRGB:
+            encodeChannelBlock(block, 3, dest);
+            encodeColorBlock(block, dest + 8);
+            break;
+        case PixelFormat::BC4:
+            encodeChannelBlock(block, 0, dest);
+            break;
+        case PixelFormat::BC5:
+            encodeChannelBlock(block, 0, dest);
+            encodeChannelBlock(block, 1, dest + 8);
+            break;
+        default:
+            assert(false);
+        }
+    }
+
+    void compressBlockRows(const uint8_t* pixels, int width, int height, int components,
+        PixelFormat format, uint8_t* dest, int firstRow, int lastRow)
+    {
+        const int blocksX = (width + 3) / 4;
+        const size_t blockSize = getBlockSize(format);
+        BlockPixels block;
+        for (int by = firstRow; by < lastRow; ++by) {
+            for (int bx = 0; bx < blocksX; ++bx) {
+                fetchBlock(pixels, width, height, components, bx, by, block);
+                const size_t index = static_cast<size_t>(by) * blocksX + bx;
+                encodeBlock(block, format, dest + index * blockSize);
+            }
+        }
+    }
+
+    void compressLevel(const uint8_t* pixels, int width, int height, int components,
+        PixelFormat format, uint8_t* dest, int threadCount)
+    {
+        const int blocksY = (height + 3) / 4;
+        // don't bother with threads for tiny levels
+        threadCount = std::min(threadCount, std::max(1, width * height / (64 * 64)));
+        threadCount = std::min(threadCount, blocksY);
+
+        std::vector<std::thread> threads;
+        threads.reserve(threadCount - 1);
+        const int rowsPerThread = (blocksY + threadCount - 1) / threadCount;
+        for (int t = 1; t < threadCount; ++t) {
+            const int first = t * rowsPerThread;
+            const int last = std::min(blocksY, first + rowsPerThread);
+            if (first >= last)
+                break;
+            threads.emplace_back(
+                compressBlockRows, pixels, width, height, components, format, dest, first, last);
+        }
+        // the calling thread does the first chunk
+        compressBlockRows(pixels, width, height, components, format, dest, 0,
+            std::min(blocksY, rowsPerThread));
+        for (auto& thread : threads)
+            thread.join();
+    }
+}
+
+bool isCompressedImageContainer(const uint8_t* data, size_t size)
+{
+    return (size >= sizeof(ktxIdentifier)
+               && std::memcmp(data, ktxIdentifier, sizeof(ktxIdentifier)) == 0)
+        || (size >= 4 && std::memcmp(data, "DDS ", 4) == 0);
+}
+
+bool loadCompressedImage(
+    const uint8_t* data, size_t size, CompressedImage& image, std::string& error)
+{
+    image = CompressedImage();
+    bool success = false;
+    if (size >= sizeof(ktxIdentifier)
+        && std::memcmp(data, ktxIdentifier, sizeof(ktxIdentifier)) == 0)
+        success = loadKtx(data, size, image, error);
+    else if (size >= 4 && std::memcmp(data, "DDS ", 4) == 0)
+        success = loadDds(data, size, image, error);
+    else
+        error = "Not a KTX or DDS file";
+    if (!success)
+        image = CompressedImage();
+    return success;
+}
+
+bool loadCompressedImage(const std::string& filename, CompressedImage& image, std::string& error)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        error = "Could not open file";
+        return false;
+    }
+    const std::vector<uint8_t> data(
+        (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return loadCompressedImage(data.data(), data.size(), image, error);
+}
+
+bool saveKtx(const std::string& filename, const CompressedImage& image)
+{
+    if (image.levels.empty()) {
+        LOG_ERROR("Trying to save an empty image");
+        return false;
+    }
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        LOG_ERROR("Could not open '%s' for writing", filename.c_str());
+        return false;
+    }
+    auto writeU32 = [&file](uint32_t v) {
+        const uint8_t bytes[4] = { static_cast<uint8_t>(v), static_cast<uint8_t>(v >> 8),
+            static_cast<uint8_t>(v >> 16), static_cast<uint8_t>(v >> 24) };
+        file.write(reinterpret_cast<const char*>(bytes), 4);
+    };
+    GLenum baseFormat = GL_RGBA;
+    if (image.format == PixelFormat::BC4)
+        baseFormat = GL_RED;
+    else if (image.format == PixelFormat::BC5)
+        baseFormat = GL_RG;
+
+    file.write(reinterpret_cast<const char*>(ktxIdentifier), sizeof(ktxIdentifier));
+    writeU32(ktxEndianness);
+    writeU32(0); // glType
+    writeU32(1); // glTypeSize
+    writeU32(0); // glFormat
+    writeU32(static_cast<GLenum>(image.format));
+    writeU32(baseFormat);
+    writeU32(image.levels[0].width);
+    writeU32(image.levels[0].height);
+    writeU32(0); // depth
+    writeU32(0); // array elements
+    writeU32(1); // faces
+    writeU32(image.levels.size());
+    writeU32(0); // key/value data
+    for (auto& level : image.levels) {
+        writeU32(level.size);
+        // block sizes are multiples of 4, so there is no padding
+        file.write(reinterpret_cast<const char*>(image.data.data() + level.offset), level.size);
+    }
+    if (!file) {
+        LOG_ERROR("Could not write '%s'", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool compressImage(const uint8_t* pixels, int width, int height, int components,
+    PixelFormat format, CompressedImage& image, bool genMipmaps, int threadCount)
+{
+    if (width <= 0 || height <= 0 || components < 1 || components > 4) {
+        LOG_ERROR("Invalid image to compress (%dx%d, %d components)", width, height, components);
+        return false;
+    }
+    MipmapParams params;
+    params.srgb = format == PixelFormat::BC1_SRGB || format == PixelFormat::BC3_SRGB;
+    params.maxLevels = genMipmaps ? 0 : 1;
+    params.threadCount = threadCount;
+    MipChain chain;
+    buildMipChain(pixels, width, height, components, chain, params);
+    return compressMipChain(chain, format, image, threadCount);
+}
+
+bool compressMipChain(
+    const MipChain& chain, PixelFormat format, CompressedImage& image, int threadCount)
+{
+    switch (format) {
+    case PixelFormat::BC1:
+    case PixelFormat::BC1_SRGB:
+    case PixelFormat::BC3:
+    case PixelFormat::BC3_SRGB:
+    case PixelFormat::BC4:
+    case PixelFormat::BC5:
+        break;
+    default:
+        LOG_ERROR("Can only compress to BC1, BC3, BC4 and BC5 (format 0x%X)",
+            static_cast<GLenum>(format));
+        return false;
+    }
+    if (chain.levels.empty()) {
+        LOG_ERROR("Trying to compress an empty image");
+        return false;
+    }
+    if (threadCount <= 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    image = CompressedImage();
+    image.format = format;
+    size_t offset = 0;
+    for (auto& level : chain.levels) {
+        const size_t size = getImageSize(format, level.width, level.height);
+        image.levels.push_back(CompressedImage::Level { level.width, level.height, offset, size });
+        offset += size;
+    }
+    image.data.resize(offset);
+    for (size_t i = 0; i < chain.levels.size(); ++i) {
+        const auto& level = image.levels[i];
+        compressLevel(chain.getLevelData(i), level.width, level.height, chain.components, format,
+            image.data.data() + level.offset, threadCount);
+    }
+    return true;
+}
+}
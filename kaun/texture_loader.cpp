@@ -0,0 +1,393 @@
+#include "texture_loader.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "log.hpp"
+#include "pixelbuffer.hpp"
+#include "render.hpp"
+
+namespace kaun {
+namespace {
+    class DecodePool {
+    private:
+        std::vector<std::thread> mThreads;
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+        std::deque<std::function<void()>> mJobs;
+        bool mStop;
+
+        void run()
+        {
+            while (true) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(mMutex);
+                    mCondition.wait(lock, [this]() { return mStop || !mJobs.empty(); });
+                    if (mStop)
+                        return;
+                    job = std::move(mJobs.front());
+                    mJobs.pop_front();
+                }
+                job();
+            }
+        }
+
+    public:
+        DecodePool()
+            : mStop(false)
+        {
+            // leave one hardware thread for the main thread
+            const unsigned count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+            for (unsigned i = 0; i < count; ++i)
+                mThreads.emplace_back(&DecodePool::run, this);
+        }
+
+        ~DecodePool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mStop = true;
+            }
+            mCondition.notify_all();
+            for (auto& thread : mThreads)
+                thread.join();
+        }
+
+        void push(std::function<void()> job)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mJobs.push_back(std::move(job));
+            }
+            mCondition.notify_one();
+        }
+    };
+
+    DecodePool& getDecodePool()
+    {
+        static DecodePool pool;
+        return pool;
+    }
+
+    PixelBufferRing& getPixelBufferRing()
+    {
+        // Never destroyed, because the GL context is probably gone at static destruction time
+        static PixelBufferRing* ring = new PixelBufferRing(3);
+        return *ring;
+    }
+
+    // In the order they were started. Only touched on the GL thread.
+    std::vector<std::shared_ptr<TextureLoad>> pendingLoads;
+    MipmapParams mipmapParams;
+
+    const GLenum componentsToFormat[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+}
+
+std::shared_ptr<TextureLoad> TextureLoader::start(Texture& texture,
+    std::shared_ptr<TextureLoad> load, bool genMipmaps, Texture::Target target,
+    Texture::LoadCallback callback, int maxSize, int residentLevel)
+{
+    if (target == Texture::Target::NONE)
+        target = texture.getTarget();
+    load->mTexture = &texture;
+    load->mTarget = target;
+    load->mGenMipmaps = genMipmaps;
+    load->mMaxSize = genMipmaps ? std::max(0, maxSize) : 0;
+    load->mSrgb = getSrgbEnabled();
+    load->mMipmapParams = mipmapParams;
+    load->mCallback = std::move(callback);
+    load->mResidentLevel = genMipmaps && target == Texture::Target::TEX_2D ? residentLevel : -1;
+
+    if (!texture.isValid()) {
+        const uint8_t placeholder[4] = { 128, 128, 128, 255 };
+        if (texture.getTarget() == Texture::Target::TEX_CUBE_MAP) {
+            // otherwise the cube map is incomplete until all faces are loaded
+            for (int i = 0; i < 6; ++i) {
+                const auto face = static_cast<Texture::Target>(
+                    static_cast<GLenum>(Texture::Target::TEX_CUBE_MAP_POS_X) + i);
+                texture.loadFromMemory(placeholder, 1, 1, 4, false, face);
+            }
+        } else {
+            texture.loadFromMemory(placeholder, 1, 1, 4, false, target);
+        }
+    }
+
+    texture.mPendingLoads++;
+    pendingLoads.push_back(load);
+    // the job keeps the load alive, even if the texture is destroyed in the meantime
+    getDecodePool().push([load]() { decode(*load); });
+    return load;
+}
+
+void TextureLoader::decode(TextureLoad& load)
+{
+    bool success;
+    if (load.mEncoded.empty()) {
+        success = decodeImage(load.mFilename, load.mImage, load.mError);
+    } else {
+        success = decodeImage(load.mEncoded.data(), load.mEncoded.size(), load.mImage, load.mError);
+        load.mEncoded = std::vector<uint8_t>();
+    }
+    if (success && load.mGenMipmaps) {
+        const DecodedImage& image = load.mImage;
+        MipmapParams params = load.mMipmapParams;
+        // sRGB textures only exist with 3 or 4 components (see loadFromMemory)
+        params.srgb = load.mSrgb;
+        // the other workers are busy with other images
+        params.threadCount = 1;
+        buildMipChain(image.pixels.get(), image.width, image.height, image.components, load.mMips,
+            params);
+        load.mImage.pixels.reset();
+    }
+    load.mStatus = success ? TextureLoad::Status::DECODED : TextureLoad::Status::FAILED;
+}
+
+int TextureLoader::getLevelCount(const TextureLoad& load)
+{
+    return load.mMips.levels.empty() ? 1 : static_cast<int>(load.mMips.levels.size());
+}
+
+const uint8_t* TextureLoader::getLevel(
+    const TextureLoad& load, int level, int& width, int& height)
+{
+    if (load.mMips.levels.empty()) {
+        width = load.mImage.width;
+        height = load.mImage.height;
+        return load.mImage.pixels.get();
+    }
+    const auto& info = load.mMips.levels[level];
+    width = info.width;
+    height = info.height;
+    return load.mMips.getLevelData(level);
+}
+
+size_t TextureLoader::upload(TextureLoad& load, size_t byteBudget)
+{
+    int width, height;
+    const uint8_t* pixels = getLevel(load, load.mUploadLevel, width, height);
+    const int components = load.mImage.components;
+    const size_t rowSize = static_cast<size_t>(width) * components;
+    const size_t remainingRows = height - load.mUploadedRows;
+    const int rows = static_cast<int>(
+        std::min(remainingRows, std::max<size_t>(1, byteBudget / rowSize)));
+    const size_t size = rows * rowSize;
+
+    PixelBufferRing& ring = getPixelBufferRing();
+    void* data = ring.map(size);
+    if (data == nullptr)
+        return 0;
+    ::memcpy(data, pixels + load.mUploadedRows * rowSize, size);
+    if (!ring.unmap()) {
+        // try again next time
+        ring.finish();
+        return 0;
+    }
+
+    load.mTexture->activate();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // with a pixel unpack buffer bound, the last argument is an offset into it
+    const int level = load.mUploadLevel - load.mSkipLevels;
+    glTexSubImage2D(static_cast<GLenum>(load.mTarget), level, 0, load.mUploadedRows, width, rows,
+        componentsToFormat[components - 1], GL_UNSIGNED_BYTE, nullptr);
+    ring.finish();
+
+    load.mUploadedRows += rows;
+    load.mUploadedBytes += size;
+    if (load.mUploadedRows == height) {
+        // Sample only the finished levels, so the texture gets sharper while it is uploaded.
+        // Cube map faces share the base level, so they wait until the end.
+        if (load.mTarget == load.mTexture->getTarget())
+            glTexParameteri(static_cast<GLenum>(load.mTarget), GL_TEXTURE_BASE_LEVEL, level);
+        if (load.mUploadLevel > load.mSkipLevels) {
+            load.mUploadLevel--;
+            load.mUploadedRows = 0;
+        }
+    }
+    return size;
+}
+
+void TextureLoader::finish(TextureLoad& load, bool success)
+{
+    Texture& texture = *load.mTexture;
+    texture.mPendingLoads--;
+    if (success) {
+        load.mStatus = TextureLoad::Status::DONE;
+    } else {
+        const char* name = load.mFilename.empty() ? "(memory)" : load.mFilename.c_str();
+        LOG_ERROR("Image '%s' could not be loaded: %s", name, load.mError.c_str());
+    }
+    load.mImage.pixels.reset();
+    load.mMips = MipChain();
+    // release what the callback holds on to right after calling it
+    const Texture::LoadCallback callback = std::move(load.mCallback);
+    load.mCallback = nullptr;
+    if (callback)
+        callback(success, load.mError);
+}
+
+size_t TextureLoader::update(size_t byteBudget)
+{
+    size_t uploaded = 0;
+    for (size_t i = 0; i < pendingLoads.size();) {
+        const std::shared_ptr<TextureLoad> load = pendingLoads[i];
+        TextureLoad::Status status = load->mStatus;
+        if (status == TextureLoad::Status::DECODING) {
+            ++i;
+            continue;
+        }
+        if (status == TextureLoad::Status::FAILED) {
+            pendingLoads.erase(pendingLoads.begin() + i);
+            finish(*load, false);
+            continue;
+        }
+
+        if (uploaded >= byteBudget)
+            break;
+        if (status == TextureLoad::Status::DECODED) {
+            const DecodedImage& image = load->mImage;
+            const int levels = getLevelCount(*load);
+            int skip = 0;
+            if (load->mMaxSize > 0) {
+                while (skip + 1 < levels
+                    && std::max(image.width >> skip, image.height >> skip) > load->mMaxSize)
+                    ++skip;
+            }
+            int width, height;
+            getLevel(*load, skip, width, height);
+            Texture& texture = *load->mTexture;
+            const int resident = load->mResidentLevel;
+            int residentWidth = 0, residentHeight = 0;
+            if (resident > skip && resident < levels)
+                getLevel(*load, resident, residentWidth, residentHeight);
+            if (residentWidth > 0 && texture.getWidth() == residentWidth
+                && texture.getHeight() == residentHeight
+                && texture.getLevelCount() == levels - resident) {
+                // keep the resident levels and only upload the ones above them
+                texture.reallocateLevels(width, height, levels - skip, skip - resident);
+                glTexParameteri(
+                    static_cast<GLenum>(load->mTarget), GL_TEXTURE_BASE_LEVEL, resident - skip);
+                load->mUploadLevel = resident - 1;
+                load->mTotalBytes
+                    = load->mMips.levels[resident].offset - load->mMips.levels[skip].offset;
+            } else {
+                texture.initStorage(
+                    load->mTarget, width, height, image.components, load->mSrgb, levels - skip);
+                if (load->mTarget == texture.getTarget())
+                    glTexParameteri(static_cast<GLenum>(load->mTarget), GL_TEXTURE_BASE_LEVEL,
+                        levels - 1 - skip);
+                load->mUploadLevel = levels - 1;
+                load->mTotalBytes = load->mMips.levels.empty()
+                    ? static_cast<size_t>(image.width) * image.height * image.components
+                    : load->mMips.data.size() - load->mMips.levels[skip].offset;
+            }
+            load->mSkipLevels = skip;
+            load->mStatus = TextureLoad::Status::UPLOADING;
+        }
+
+        while (load->mUploadedBytes < load->mTotalBytes && uploaded < byteBudget) {
+            const size_t size = upload(*load, byteBudget - uploaded);
+            // all pixel buffers are still in use, try again next frame
+            if (size == 0)
+                return uploaded;
+            uploaded += size;
+        }
+
+        if (load->mUploadedBytes < load->mTotalBytes)
+            break;
+        pendingLoads.erase(pendingLoads.begin() + i);
+        finish(*load, true);
+    }
+    return uploaded;
+}
+
+void TextureLoader::cancel(const Texture& texture)
+{
+    // Loads that are still decoding keep running, but their result is thrown away. The callbacks
+    // are destroyed here, because the worker thread might hold the last reference to the load.
+    for (auto& load : pendingLoads) {
+        if (load->mTexture == &texture) {
+            load->mTexture = nullptr;
+            load->mCallback = nullptr;
+        }
+    }
+    pendingLoads.erase(std::remove_if(pendingLoads.begin(), pendingLoads.end(),
+                           [](const std::shared_ptr<TextureLoad>& load) {
+                               return load->mTexture == nullptr;
+                           }),
+        pendingLoads.end());
+}
+
+void TextureLoader::setMipmapParams(const MipmapParams& params)
+{
+    mipmapParams = params;
+}
+
+const MipmapParams& TextureLoader::getMipmapParams()
+{
+    return mipmapParams;
+}
+
+size_t TextureLoader::getPendingCount()
+{
+    return pendingLoads.size();
+}
+
+std::shared_ptr<TextureLoad> TextureLoader::load(Texture& texture, const std::string& filename,
+    bool genMipmaps, Texture::Target target, Texture::LoadCallback callback, int maxSize,
+    int residentLevel)
+{
+    auto load = std::make_shared<TextureLoad>();
+    load->mFilename = filename;
+    return start(
+        texture, load, genMipmaps, target, std::move(callback), maxSize, residentLevel);
+}
+
+std::shared_ptr<TextureLoad> TextureLoader::load(Texture& texture, std::vector<uint8_t> encoded,
+    bool genMipmaps, Texture::Target target, Texture::LoadCallback callback, int maxSize,
+    int residentLevel)
+{
+    auto load = std::make_shared<TextureLoad>();
+    load->mEncoded = std::move(encoded);
+    return start(
+        texture, load, genMipmaps, target, std::move(callback), maxSize, residentLevel);
+}
+
+std::shared_ptr<TextureLoad> Texture::loadAsync(
+    const std::string& filename, bool genMipmaps, Target target, LoadCallback callback)
+{
+    return TextureLoader::load(*this, filename, genMipmaps, target, std::move(callback));
+}
+
+std::shared_ptr<TextureLoad> Texture::loadEncodedAsync(
+    std::vector<uint8_t> encoded, bool genMipmaps, Target target, LoadCallback callback)
+{
+    return TextureLoader::load(*this, std::move(encoded), genMipmaps, target, std::move(callback));
+}
+
+Texture* Texture::cubeMapAsync(const std::string& posX, const std::string& negX,
+    const std::string& posY, const std::string& negY, const std::string& posZ,
+    const std::string& negZ, LoadCallback callback)
+{
+    Texture* tex = new Texture(Texture::Target::TEX_CUBE_MAP);
+    auto remaining = std::make_shared<int>(6);
+    auto error = std::make_shared<std::string>();
+    LoadCallback faceCallback = [remaining, error, callback](bool success, const std::string& err) {
+        if (!success && error->empty())
+            *error = err;
+        if (--*remaining == 0 && callback)
+            callback(error->empty(), *error);
+    };
+    const std::string* faces[6] = { &posX, &negX, &posY, &negY, &posZ, &negZ };
+    for (int i = 0; i < 6; ++i) {
+        const auto target = static_cast<Texture::Target>(
+            static_cast<GLenum>(Texture::Target::TEX_CUBE_MAP_POS_X) + i);
+        tex->loadAsync(*faces[i], true, target, faceCallback);
+    }
+    return tex;
+}
+}
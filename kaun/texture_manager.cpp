@@ -0,0 +1,269 @@
+#include "texture_manager.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include "log.hpp"
+#include "renderattachment.hpp"
+
+namespace kaun {
+namespace {
+    struct ManagedTexture {
+        Texture* texture;
+        // either a file name or the encoded data is used for reloads
+        std::string filename;
+        std::vector<uint8_t> encoded;
+        // the last load, reset once it's finished
+        std::shared_ptr<TextureLoad> load;
+        int loadSkip = 0;
+        // full size, known once the first load has been decoded (levels is 0 until then)
+        int width = 0, height = 0, levels = 0;
+        // top levels currently left out and how many could be left out for the current draws
+        int skip = 0;
+        int wantedSkip = std::numeric_limits<int>::max();
+        // largest screen size since the last update
+        float screenSize = 0.0f;
+        uint64_t lastUse = 0;
+    };
+
+    std::vector<ManagedTexture> managedTextures;
+    size_t budget = TextureManager::defaultBudget;
+    float lodBias = 0.0f;
+    uint64_t frameCounter = 0;
+    TextureManagerStats stats;
+
+    int getMaxSkip(const ManagedTexture& managed)
+    {
+        const int size = std::max(managed.width, managed.height);
+        int skip = 0;
+        while (skip + 1 < managed.levels && (size >> (skip + 1)) >= TextureManager::minSize)
+            ++skip;
+        return skip;
+    }
+
+    size_t getSize(const ManagedTexture& managed, int skip)
+    {
+        size_t size = 0;
+        for (int level = skip; level < managed.levels; ++level)
+            size += getImageSize(managed.texture->getPixelFormat(),
+                std::max(1, managed.width >> level), std::max(1, managed.height >> level));
+        return size;
+    }
+
+    // a level has to be at least as large as the draw on screen
+    int getWantedSkip(const ManagedTexture& managed)
+    {
+        const float size = static_cast<float>(std::max(managed.width, managed.height));
+        const float lod = std::log2(size / std::max(managed.screenSize, 1.0f)) + lodBias;
+        return std::min(std::max(static_cast<int>(std::floor(lod)), 0), getMaxSkip(managed));
+    }
+
+    std::shared_ptr<TextureLoad> startLoad(ManagedTexture& managed, int maxSize, int residentLevel)
+    {
+        // don't move the encoded data, it's needed for the next reload
+        if (managed.encoded.empty())
+            managed.load = TextureLoader::load(*managed.texture, managed.filename, true,
+                Texture::Target::TEX_2D, nullptr, maxSize, residentLevel);
+        else
+            managed.load = TextureLoader::load(*managed.texture, managed.encoded, true,
+                Texture::Target::TEX_2D, nullptr, maxSize, residentLevel);
+        return managed.load;
+    }
+
+    // Dropping levels only moves the remaining ones to smaller storage on the GPU. Restoring them
+    // decodes the image again, but keeps the resident levels and only uploads the missing ones.
+    void setSkip(ManagedTexture& managed, int skip)
+    {
+        if (skip > managed.skip) {
+            managed.texture->reallocateLevels(std::max(1, managed.width >> skip),
+                std::max(1, managed.height >> skip), managed.levels - skip, skip - managed.skip);
+            managed.skip = skip;
+            return;
+        }
+        managed.loadSkip = skip;
+        startLoad(managed, std::max(managed.width, managed.height) >> skip, managed.skip);
+    }
+
+    ManagedTexture* add(Texture& texture)
+    {
+        if (texture.isManaged()) {
+            LOG_ERROR("Texture is already managed");
+            return nullptr;
+        }
+        managedTextures.push_back(ManagedTexture());
+        managedTextures.back().texture = &texture;
+        return &managedTextures.back();
+    }
+}
+
+std::shared_ptr<TextureLoad> TextureManager::load(
+    Texture& texture, const std::string& filename, int initialSize)
+{
+    ManagedTexture* managed = add(texture);
+    if (!managed)
+        return nullptr;
+    texture.mManagedIndex = static_cast<int>(managedTextures.size()) - 1;
+    managed->filename = filename;
+    return startLoad(*managed, std::max(initialSize, 0), -1);
+}
+
+std::shared_ptr<TextureLoad> TextureManager::load(
+    Texture& texture, std::vector<uint8_t> encoded, int initialSize)
+{
+    ManagedTexture* managed = add(texture);
+    if (!managed)
+        return nullptr;
+    texture.mManagedIndex = static_cast<int>(managedTextures.size()) - 1;
+    managed->encoded = std::move(encoded);
+    return startLoad(*managed, std::max(initialSize, 0), -1);
+}
+
+void TextureManager::remove(Texture& texture)
+{
+    const int index = texture.mManagedIndex;
+    if (index < 0)
+        return;
+    assert(managedTextures[index].texture == &texture);
+    if (static_cast<size_t>(index) + 1 < managedTextures.size()) {
+        managedTextures[index] = std::move(managedTextures.back());
+        managedTextures[index].texture->mManagedIndex = index;
+    }
+    managedTextures.pop_back();
+    texture.mManagedIndex = -1;
+}
+
+void TextureManager::setBudget(size_t bytes)
+{
+    budget = bytes;
+}
+
+size_t TextureManager::getBudget()
+{
+    return budget;
+}
+
+void TextureManager::setLodBias(float bias)
+{
+    lodBias = bias;
+}
+
+float TextureManager::getLodBias()
+{
+    return lodBias;
+}
+
+void TextureManager::touch(const Texture& texture, float screenSize)
+{
+    if (texture.mManagedIndex < 0)
+        return;
+    ManagedTexture& managed = managedTextures[texture.mManagedIndex];
+    managed.screenSize = std::max(managed.screenSize, screenSize);
+}
+
+void TextureManager::update(size_t maxReloads)
+{
+    frameCounter++;
+    stats.droppedLevels = stats.restoredLevels = stats.pendingLoads = 0;
+
+    size_t resident = 0;
+    for (auto& managed : managedTextures) {
+        if (managed.load && managed.load->isFinished()) {
+            if (managed.load->getStatus() == TextureLoad::Status::DONE) {
+                if (managed.levels == 0) {
+                    managed.width = managed.load->getImageWidth();
+                    managed.height = managed.load->getImageHeight();
+                    managed.levels = Texture::getMipLevelCount(managed.width, managed.height);
+                }
+                managed.skip = managed.load->getSkippedLevels();
+            }
+            managed.load.reset();
+        }
+
+        if (managed.screenSize > 0.0f) {
+            managed.lastUse = frameCounter;
+            if (managed.levels > 0)
+                managed.wantedSkip = getWantedSkip(managed);
+            managed.screenSize = 0.0f;
+        }
+
+        // the old storage is freed as soon as a reload is decoded
+        if (managed.load && managed.levels > 0) {
+            resident += getSize(managed, managed.loadSkip);
+            stats.pendingLoads++;
+        } else {
+            resident += managed.texture->getMemorySize();
+            stats.pendingLoads += managed.load ? 1 : 0;
+        }
+    }
+
+    std::vector<size_t> order(managedTextures.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto canReload = [](const ManagedTexture& managed) {
+        return !managed.load && managed.levels > 0;
+    };
+
+    size_t reloads = 0;
+    if (resident > budget) {
+        // least recently used first
+        std::sort(order.begin(), order.end(), [](size_t a, size_t b) {
+            return managedTextures[a].lastUse < managedTextures[b].lastUse;
+        });
+        // first drop the levels that are not needed at all, then one level at a time
+        for (int pass = 0; pass < 2; ++pass) {
+            for (auto index : order) {
+                if (resident <= budget || reloads >= maxReloads)
+                    break;
+                ManagedTexture& managed = managedTextures[index];
+                if (!canReload(managed))
+                    continue;
+                const int maxSkip = getMaxSkip(managed);
+                const int skip
+                    = std::min(pass == 0 ? managed.wantedSkip : managed.skip + 1, maxSkip);
+                if (skip <= managed.skip)
+                    continue;
+                resident -= getSize(managed, managed.skip) - getSize(managed, skip);
+                stats.droppedLevels += skip - managed.skip;
+                setSkip(managed, skip);
+                reloads++;
+            }
+        }
+    } else {
+        // most recently used first
+        std::sort(order.begin(), order.end(), [](size_t a, size_t b) {
+            return managedTextures[a].lastUse > managedTextures[b].lastUse;
+        });
+        for (auto index : order) {
+            if (reloads >= maxReloads)
+                break;
+            ManagedTexture& managed = managedTextures[index];
+            if (!canReload(managed) || managed.wantedSkip >= managed.skip)
+                continue;
+            // restore as many of the wanted levels as fit
+            const size_t current = getSize(managed, managed.skip);
+            int skip = managed.skip;
+            while (skip > managed.wantedSkip
+                && resident - current + getSize(managed, skip - 1) <= budget)
+                --skip;
+            if (skip == managed.skip)
+                continue;
+            resident += getSize(managed, skip) - current;
+            stats.restoredLevels += managed.skip - skip;
+            setSkip(managed, skip);
+            reloads++;
+            stats.pendingLoads++;
+        }
+    }
+
+    stats.budget = budget;
+    stats.residentBytes = resident;
+    stats.textureCount = managedTextures.size();
+}
+
+const TextureManagerStats& TextureManager::getStats()
+{
+    return stats;
+}
+}
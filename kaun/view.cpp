@@ -0,0 +1,75 @@
+#include "view.hpp"
+
+namespace kaun {
+View::View()
+    : mProjection(1.0f)
+    , mInvProjection(1.0f)
+    , mView(1.0f)
+    , mInvView(1.0f)
+    , mViewProjection(1.0f)
+    , mInvViewProjection(1.0f)
+    , mHasTarget(false)
+    , mDepthStencil(nullptr)
+    , mViewport(0, 0, -1, -1)
+    , mScissor(0, 0, -1, -1)
+    , mShader(nullptr)
+    , mRenderState(nullptr)
+{
+}
+
+void View::updateViewProjection()
+{
+    mViewProjection = mProjection * mView;
+    mInvViewProjection = mInvView * mInvProjection;
+}
+
+void View::setProjection(const glm::mat4& matrix)
+{
+    mProjection = matrix;
+    mInvProjection = glm::inverse(mProjection);
+    updateViewProjection();
+}
+
+void View::setViewMatrix(const glm::mat4& view)
+{
+    mView = view;
+    mInvView = glm::inverse(mView);
+    updateViewProjection();
+}
+
+void View::setViewTransform(const Transform& viewTransform)
+{
+    mInvView = viewTransform.getMatrix();
+    mView = glm::inverse(mInvView);
+    updateViewProjection();
+}
+
+void View::setRenderTarget(const std::vector<const RenderAttachment*>& colorAttachments,
+    const RenderAttachment* depthStencil)
+{
+    mHasTarget = true;
+    mColorAttachments = colorAttachments;
+    mDepthStencil = depthStencil;
+}
+
+void View::resetRenderTarget()
+{
+    mHasTarget = false;
+    mColorAttachments.clear();
+    mDepthStencil = nullptr;
+}
+
+RenderTarget* View::getRenderTarget() const
+{
+    return mHasTarget ? RenderTarget::get(mColorAttachments, mDepthStencil) : nullptr;
+}
+
+glm::ivec4 View::getViewport() const
+{
+    if (mViewport.z < 0 && mHasTarget) {
+        const RenderTarget* target = getRenderTarget();
+        return glm::ivec4(0, 0, target->getWidth(), target->getHeight());
+    }
+    return mViewport;
+}
+}
@@ -27,7 +27,7 @@ local defaultShader = kaun.newShader(shaders.defaultVert, shaders.defaultFrag)
 -- TERRAIN
 local terrainSize = 60
 local terrainHeight = 3.0
-terrain.setup(terrainSize, terrainHeight, 64, 4.0, 2.0, {1.0, 0.5, 0.25}, nil, 0.4)
+terrain.setup(terrainSize, terrainHeight, 64, 4.0, 2.0, {1.0, 0.5, 0.25}, 0.4)
 
 local sandTexture = kaun.newTexture(media("sand.png"))
 sandTexture:setWrap("repeat", "repeat")
@@ -113,6 +113,12 @@ local shadowProjParams = {-28, 28, 13, -10, 10.0, 80.0}
 local shadowProjection = mat4.from_ortho(unpack(shadowProjParams))
 local shadowMatrix = lightView * shadowProjection
 local shadowMapShader = kaun.newShader(shaders.shadowMap)
+-- the scene is drawn into both views at once, this one replaces the shader
+local shadowView = kaun.newView()
+shadowView:setRenderTarget({}, shadowMap)
+shadowView:setProjection(unpackmat4(shadowProjection))
+shadowView:setViewTransform(shadowCamera)
+shadowView:setShader(shadowMapShader)
 
 
 -- CAMERA AND RENDER TARGETS
@@ -122,17 +128,28 @@ camera.lookAt(0, 0, -terrainSize/2)
 -- initialized in love.resize
 local projection = {}
 local colorTarget, depthTarget, colorTargetMS, depthTargetMS
+local mainView = kaun.newView()
 
 
 function love.resize(w, h)
     projection = {45, w/h, 0.1, 100.0}
     kaun.setWindowDimensions(w, h)
 
+    -- the old targets go back to the pool, which deletes them if they are not used again
+    if colorTarget then
+        kaun.releaseRenderTexture(colorTarget)
+        kaun.releaseRenderTexture(depthTarget)
+        kaun.releaseRenderTexture(colorTargetMS)
+        kaun.releaseRenderTexture(depthTargetMS)
+    end
+
     local msaa = select(3, love.window.getMode()).msaa
-    colorTarget = kaun.newRenderTexture("srgb8a8", w, h)
-    depthTarget = kaun.newRenderTexture("depth24", w, h)
-    colorTargetMS = kaun.newRenderTexture("srgb8a8", w, h, msaa)
-    depthTargetMS = kaun.newRenderTexture("depth24", w, h, msaa)
+    colorTarget = kaun.acquireRenderTexture("srgb8a8", w, h)
+    depthTarget = kaun.acquireRenderTexture("depth24", w, h)
+    colorTargetMS = kaun.acquireRenderTexture("srgb8a8", w, h, msaa)
+    depthTargetMS = kaun.acquireRenderTexture("depth24", w, h, msaa)
+    mainView:setRenderTarget(colorTargetMS, depthTargetMS)
+    mainView:setProjection(unpack(projection))
 end
 
 
@@ -155,10 +172,10 @@ function love.mousemoved(x, y, dx, dy)
 end
 
 
-function renderScene(shader)
+function renderScene(views, shader)
     local terrainTexScale = 5
     kaun.setModelTransform(terrain.transform)
-    kaun.draw(terrain.mesh, shader, {
+    kaun.draw(views, terrain.mesh, shader, {
         color = {1, 1, 1, 1},
         ambientColor = ambientColor,
         lightDir = lightDir,
@@ -171,7 +188,7 @@ function renderScene(shader)
     })
 
     kaun.setModelTransform(groundTrafo)
-    kaun.draw(groundMesh, shader, {
+    kaun.draw(views, groundMesh, shader, {
         color = {1, 1, 1, 1},
         ambientColor = ambientColor,
         lightDir = lightDir,
@@ -185,7 +202,7 @@ function renderScene(shader)
 
     for i = 1, #palms do
         kaun.setModelTransform(palms[i].trafo)
-        kaun.draw(palms[i].mesh, shader, {
+        kaun.draw(views, palms[i].mesh, shader, {
             color = {1, 1, 1, 1},
             ambientColor = ambientColor,
             lightDir = lightDir,
@@ -200,39 +217,29 @@ end
 
 
 function love.draw()
-    -- render shadow map
-    kaun.setRenderTarget({}, shadowMap)
-    kaun.clearDepth()
-
-    kaun.setProjection(unpackmat4(shadowProjection))
-    kaun.setViewTransform(shadowCamera)
-
-    renderScene(shadowMapShader)
-
-    -- render actual scene
-    --kaun.setRenderTarget(colorTarget, depthTarget)
-    kaun.setRenderTarget(colorTargetMS, depthTargetMS)
-    kaun.clear(0.9, 1, 1, 1)
-    kaun.clearDepth()
-
-    kaun.setProjection(unpack(projection))
-    kaun.setViewTransform(camera.getTransform())
+    -- the shadow map is rendered first, because the main view samples it
+    shadowView:clearDepth()
+    mainView:clear(0.9, 1, 1, 1)
+    mainView:clearDepth()
+    mainView:setViewTransform(camera.getTransform())
 
     local camX, camY, camZ = camera.getPosition()
     skyboxTransform:setPosition(camX, camY - 0.04, camZ)
     kaun.setModelTransform(skyboxTransform)
-    kaun.draw(skyboxMesh, skyboxShader, {
+    kaun.draw({mainView}, skyboxMesh, skyboxShader, {
         skyboxTexture = skyboxTexture,
     }, skyboxState)
 
-    renderScene(defaultShader)
-
-    -- resolve render targets
-    kaun.setRenderTarget(colorTarget, depthTarget, true)
+    renderScene({shadowView, mainView}, defaultShader)
 
+    -- resolve render targets, the multisampled buffers are not needed after the second one
     kaun.setRenderTarget(colorTargetMS, depthTargetMS)
-    kaun.setRenderTarget({}, nil, true)
+    kaun.resolveRenderTarget(colorTarget, depthTarget)
+    kaun.resolveRenderTarget({}, nil, true)
+    kaun.setRenderTarget({}, nil)
 
+    kaun.setProjection(unpack(projection))
+    kaun.setViewTransform(camera.getTransform())
     kaun.setModelTransform(waterTrafo)
     kaun.draw(waterMesh, waterShader, {
         color = {1, 1, 1, 1},
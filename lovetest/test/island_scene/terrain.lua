@@ -4,48 +4,15 @@ local vertexFormat = kaun.newVertexFormat({"POSITION", 3, "F32"},
                                           {"NORMAL", 3, "F32"},
                                           {"TEXCOORD0", 2, "F32"})
 
-local function hullCurve(nx, ny, hullRadius)
-    local relX, relY = nx - 0.5, ny - 0.5
-    local dist = math.sqrt(relX*relX + relY*relY)
-    if dist < hullRadius then
-        return 1
-    else
-        return math.max(0.0, 1.0 - (dist - hullRadius) / (0.5 - hullRadius))
-    end
-end
-
-local function generateHeightmap(subDiv, baseFreq, intervalFactor, weights, redistribution, hullRadius)
-    local weightSum = 0
-    for _, weight in ipairs(weights) do
-        weightSum = weightSum + weight
-    end
-
-    local heightmap = {}
-    local nx, ny -- normalized coordinates
-    for y = 1, subDiv do
-        heightmap[y] = {}
-        ny = (y-1) / subDiv
-        for x = 1, subDiv do
-            nx = (x-1) / subDiv
-
-            local height = 0
-            local freq = baseFreq
-            for _, weight in ipairs(weights) do
-                local noise = love.math.noise(nx * freq, ny * freq)
-                height = height + weight / weightSum * noise
-                freq = freq * intervalFactor
-            end
-            if hullRadius then
-                height = height * hullCurve(nx, ny, hullRadius)
-            end
-            if redistribution then
-                height = redistribution(height)
-            end
-            heightmap[y][x] = height
-        end
-    end
-
-    return heightmap
+-- redistribution is an exponent: height = height^redistribution
+local function generateHeightmap(subDiv, baseFreq, intervalFactor, weights, hullRadius, redistribution)
+    return kaun.fbmNoise(subDiv, subDiv, {
+        baseFrequency = baseFreq,
+        frequencyFactor = intervalFactor,
+        weights = weights,
+        hullRadius = hullRadius,
+        redistribution = redistribution,
+    })
 end
 
 local function createMesh(heightmap, sizeXZ, height)
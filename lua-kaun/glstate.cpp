@@ -38,12 +38,14 @@ LoveGlState saveLoveGlState()
     for (int t = 0; t < numTextureTargets; ++t) {
         state.boundTextures[t].resize(maxTextureUnits, 0);
     }
+    state.boundSamplers.resize(maxTextureUnits, 0);
 
     for (int u = 0; u < maxTextureUnits; ++u) {
         glActiveTexture(GL_TEXTURE0 + u);
         for (int t = 0; t < numTextureTargets; ++t) {
             state.boundTextures[t][u] = glGetInteger(getTextureTargets[t]);
         }
+        state.boundSamplers[u] = glGetInteger(GL_SAMPLER_BINDING);
     }
 
     state.depthTestEnabled = glIsEnabled(GL_DEPTH_TEST);
@@ -116,6 +118,7 @@ void restoreLoveGlState(const LoveGlState& state)
         for (int t = 0; t < numTextureTargets; ++t) {
             glBindTexture(textureTargets[t], state.boundTextures[t][u]);
         }
+        glBindSampler(u, state.boundSamplers[u]);
     }
 
     glActiveTexture(state.activeTexture);
@@ -18,6 +18,10 @@ struct LoveGlState {
     // index is target, vector index is texture unit
     std::vector<GLuint> boundTextures[numTextureTargets];
 
+    // glBindSampler
+    // index is texture unit
+    std::vector<GLuint> boundSamplers;
+
     // glEnable
     GLboolean depthTestEnabled; // GL_DEPTH_TEST
     GLboolean stencilTestEnabled; // GL_STENCIL_TEST
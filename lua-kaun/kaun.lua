@@ -55,6 +55,7 @@ function love.run()
 
         -- Call update and draw
         if love.update then love.update(dt) end -- will pass 0 if love.timer is disabled
+        kaun.updateTextureLoads()
 
         if love.graphics.isActive() then
             if love.draw then love.draw() end
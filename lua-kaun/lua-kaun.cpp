@@ -1,3 +1,4 @@
+#include <cstring>
 #include <string>
 
 using namespace std::string_literals;
@@ -64,6 +65,67 @@ std::pair<const uint8_t*, int> getFileData(lua_State* L, const char* filename)
     }
 }
 
+// LuaJIT type for FFI cdata, which is not part of the regular Lua API
+const int LUA_TCDATA = 10;
+
+// Accepts love Data objects (ByteData, ImageData, ...), LuaJIT FFI pointers (e.g. from ffi.cast
+// or Data:getFFIPointer()), FFI arrays and structs (e.g. ffi.new("float[16]")) and light userdata.
+// size is set to the size of the Data object or FFI array or to 0 if it is unknown. No data is
+// copied.
+uint8_t* checkDataPointer(lua_State* L, int idx, size_t& size)
+{
+    size = 0;
+    switch (lua_type(L, idx)) {
+    case LUA_TLIGHTUSERDATA:
+        return reinterpret_cast<uint8_t*>(lua_touserdata(L, idx));
+    case LUA_TCDATA: {
+        // The C API can't tell the cdata types apart, but tostring gives "cdata<type>: address"
+        lua_getglobal(L, "tostring");
+        lua_pushvalue(L, idx);
+        lua_call(L, 1, 1);
+        const char* name = lua_tostring(L, -1);
+        const char* typeEnd = name ? std::strstr(name, ">:") : nullptr;
+        const bool valid = typeEnd && typeEnd > name;
+        const bool pointer = valid && typeEnd[-1] == '*';
+        lua_pop(L, 1);
+        if (!valid)
+            luaL_typerror(L, idx, "Data, pointer or light userdata");
+        // lua_topointer returns the address of the cdata payload
+        const void* payload = lua_topointer(L, idx);
+        if (pointer)
+            return *static_cast<uint8_t* const*>(payload);
+        // arrays and structs are stored in the payload
+        lua_getglobal(L, "require");
+        lua_pushstring(L, "ffi");
+        lua_call(L, 1, 1);
+        lua_getfield(L, -1, "sizeof");
+        lua_pushvalue(L, idx);
+        lua_call(L, 1, 1);
+        size = lua_tointeger(L, -1);
+        lua_pop(L, 2); // pop size and ffi
+        return static_cast<uint8_t*>(const_cast<void*>(payload));
+    }
+    case LUA_TUSERDATA: {
+        lua_getfield(L, idx, "getSize");
+        lua_getfield(L, idx, "getPointer");
+        if (!lua_isfunction(L, -1) || !lua_isfunction(L, -2))
+            luaL_typerror(L, idx, "Data, pointer or light userdata");
+        lua_pushvalue(L, idx);
+        lua_call(L, 1, 1);
+        uint8_t* data = reinterpret_cast<uint8_t*>(lua_touserdata(L, -1));
+        lua_pop(L, 1);
+        lua_pushvalue(L, idx);
+        lua_call(L, 1, 1);
+        size = lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        return data;
+    }
+    default:
+        luaL_typerror(L, idx, "Data, pointer or light userdata");
+        return nullptr;
+    }
+}
+
 struct TransformWrapper : public kaun::Transform {
     void setPosition(float x, float y, float z)
     {
@@ -337,6 +399,38 @@ LuaEnum<kaun::UsageHint> usageHint("usage hint",
         { "dynamic", kaun::UsageHint::DYNAMIC },
     });
 
+LuaEnum<kaun::IndexBufferType> indexBufferType("index type",
+    {
+        { "u8", kaun::IndexBufferType::UI8 },
+        { "u16", kaun::IndexBufferType::UI16 },
+        { "u32", kaun::IndexBufferType::UI32 },
+    });
+
+// 2D table [z][x] of heights
+void checkHeightmap(lua_State* L, int index, std::vector<float>& heights, int& resX, int& resZ)
+{
+    luaL_checktype(L, index, LUA_TTABLE);
+    resZ = lua_objlen(L, index);
+    resX = 0;
+    heights.clear();
+    for (int z = 1; z <= resZ; ++z) {
+        lua_rawgeti(L, index, z);
+        luaL_checktype(L, -1, LUA_TTABLE);
+        if (z == 1)
+            resX = lua_objlen(L, -1);
+        else if (static_cast<int>(lua_objlen(L, -1)) != resX)
+            luaL_error(L, "All rows of the heightmap need the same length");
+        for (int x = 1; x <= resX; ++x) {
+            lua_rawgeti(L, -1, x);
+            heights.push_back(luax_check<float>(L, -1));
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+    if (resX < 2 || resZ < 2)
+        luaL_error(L, "Heightmap has to be at least 2x2");
+}
+
 struct MeshWrapper : public kaun::Mesh {
     // This function assumes the element at idx is already a table
     int setVerticesInternal(lua_State* L, int idx)
@@ -417,6 +511,174 @@ struct MeshWrapper : public kaun::Mesh {
         return setVerticesInternal(L, 1);
     }
 
+    // data (Data, FFI pointer or light userdata), (byteOffset), (size)
+    // size may only be omitted for Data objects
+    int setVertexData(lua_State* L)
+    {
+        size_t dataSize = 0;
+        const uint8_t* data = checkDataPointer(L, 2, dataSize);
+        const int byteOffset = luaL_optint(L, 3, 0);
+        if (byteOffset < 0)
+            return luaL_error(L, "The offset can't be negative");
+        size_t size = dataSize;
+        if (lua_gettop(L) >= 4) {
+            const int checkedSize = luaL_checkint(L, 4);
+            if (checkedSize < 0)
+                return luaL_error(L, "The size can't be negative");
+            size = checkedSize;
+        } else if (dataSize == 0) {
+            return luaL_error(L, "The size is required for pointers");
+        }
+        if (dataSize > 0 && size > dataSize)
+            return luaL_error(
+                L, "Size exceeds the size of the Data (%d)", static_cast<int>(dataSize));
+        if (getVertexBuffers().empty())
+            return luaL_error(L, "Mesh has no vertex buffer");
+        if (!Mesh::setVertexData(data, byteOffset, size))
+            return luaL_error(L, "Could not set vertex data");
+        return 0;
+    }
+
+    // returns a light userdata (use ffi.cast) and the size in bytes. The pointer is invalidated
+    // if the vertex buffer is resized. Call markVertexDataDirty after writing to it.
+    int getVertexDataPointer(lua_State* L)
+    {
+        if (getVertexBuffers().empty())
+            return luaL_error(L, "Mesh has no vertex buffer");
+        auto vertexBuffer = getVertexBuffers()[0];
+        lua_pushlightuserdata(L, vertexBuffer->getData());
+        lua_pushinteger(L, vertexBuffer->getSize());
+        return 2;
+    }
+
+    // (byteOffset), (size) - marks the whole buffer by default
+    int markVertexDataDirty(lua_State* L)
+    {
+        if (getVertexBuffers().empty())
+            return luaL_error(L, "Mesh has no vertex buffer");
+        const size_t byteOffset = luaL_optint(L, 2, 0);
+        const size_t size = luaL_optint(L, 3, getVertexBuffers()[0]->getSize() - byteOffset);
+        Mesh::markVertexDataDirty(byteOffset, size);
+        return 0;
+    }
+
+    // indices (table of 1-based indices), (usage)
+    // data (Data, FFI pointer or light userdata with 0-based indices), count, (type), (usage)
+    // type defaults to "u32", count may be omitted for Data objects
+    int setIndices(lua_State* L)
+    {
+        if (getVertexBuffers().empty())
+            return luaL_error(L, "Mesh has no vertex buffer");
+        kaun::IndexBuffer* indexBuffer = nullptr;
+        if (lua_istable(L, 2)) {
+            kaun::UsageHint usage = kaun::UsageHint::STATIC;
+            if (lua_gettop(L) >= 3)
+                usage = usageHint.check(L, 3);
+            const size_t count = lua_objlen(L, 2);
+            std::vector<uint32_t> indices(count);
+            for (size_t i = 0; i < count; ++i) {
+                lua_rawgeti(L, 2, i + 1);
+                const int index = luaL_checkint(L, -1);
+                if (index < 1)
+                    return luaL_error(L, "Indices start at 1");
+                indices[i] = index - 1;
+                lua_pop(L, 1);
+            }
+            indexBuffer = Mesh::setIndices(
+                indices.data(), kaun::IndexBufferType::UI32, indices.size(), usage);
+        } else {
+            size_t dataSize = 0;
+            const uint8_t* data = checkDataPointer(L, 2, dataSize);
+            kaun::IndexBufferType type = kaun::IndexBufferType::UI32;
+            if (lua_gettop(L) >= 4 && !lua_isnil(L, 4))
+                type = indexBufferType.check(L, 4);
+            const size_t typeSize = kaun::getIndexBufferTypeSize(type);
+            size_t count = dataSize / typeSize;
+            if (lua_gettop(L) >= 3 && !lua_isnil(L, 3)) {
+                const int checkedCount = luaL_checkint(L, 3);
+                if (checkedCount < 0)
+                    return luaL_error(L, "The index count can't be negative");
+                count = checkedCount;
+            } else if (dataSize == 0) {
+                return luaL_error(L, "The index count is required for pointers");
+            }
+            if (dataSize > 0 && count * typeSize > dataSize)
+                return luaL_error(L, "Index count exceeds the size of the Data");
+            kaun::UsageHint usage = kaun::UsageHint::STATIC;
+            if (lua_gettop(L) >= 5)
+                usage = usageHint.check(L, 5);
+            indexBuffer = Mesh::setIndices(data, type, count, usage);
+        }
+        if (indexBuffer == nullptr)
+            return luaL_error(L, "Could not set indices");
+        return 0;
+    }
+
+    // name, firstIndex (1-based), count, baseVertex, materialSlot (1-based)
+    int addDrawRange(lua_State* L)
+    {
+        const char* name = luaL_checklstring(L, 2, nullptr);
+        int first = luaL_checkint(L, 3);
+        int count = luaL_checkint(L, 4);
+        int baseVertex = luaL_optint(L, 5, 0);
+        int material = luaL_optint(L, 6, 0);
+        if (first < 1 || count < 0 || baseVertex < 0)
+            return luaL_error(L, "Invalid draw range");
+        if (!Mesh::addDrawRange(name, first - 1, count, baseVertex, material - 1))
+            return luaL_error(L, "Draw range exceeds the indices or vertices of the mesh");
+        return 0;
+    }
+
+    // maxVertices, maxTriangles - returns the number of clusters
+    int buildClusters(lua_State* L)
+    {
+        int maxVertices = luaL_optint(L, 2, 64);
+        int maxTriangles = luaL_optint(L, 3, 124);
+        if (maxVertices < 3 || maxTriangles < 1)
+            return luaL_error(L, "Clusters need to contain at least one triangle");
+        if (!Mesh::buildClusters(maxVertices, maxTriangles))
+            return luaL_error(L, "Could not build clusters");
+        lua_pushinteger(L, getClusters().size());
+        return 1;
+    }
+
+    // scaleU, scaleV, offsetU, offsetV, (layer), (attribute) - e.g. from TextureAtlas:getRegion
+    int remapTexCoords(lua_State* L)
+    {
+        const glm::vec4 uvTransform(luax_check<float>(L, 2), luax_check<float>(L, 3),
+            luax_check<float>(L, 4), luax_check<float>(L, 5));
+        const int layer = luaL_optint(L, 6, -1);
+        kaun::AttributeType attrType = kaun::AttributeType::TEXCOORD0;
+        if (lua_gettop(L) >= 7)
+            attrType = attributeType.check(L, 7);
+        if (!Mesh::remapTexCoords(uvTransform, layer, attrType))
+            return luaL_error(L, "Could not remap texture coordinates");
+        return 0;
+    }
+
+    // returns a list of {name, first, count, baseVertex, material}
+    int getDrawRanges(lua_State* L)
+    {
+        const auto& ranges = Mesh::getDrawRanges();
+        lua_createtable(L, ranges.size(), 0);
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            const auto& range = ranges[i];
+            lua_createtable(L, 5, 0);
+            lua_pushstring(L, range.name.c_str());
+            lua_rawseti(L, -2, 1);
+            lua_pushinteger(L, range.firstIndex + 1);
+            lua_rawseti(L, -2, 2);
+            lua_pushinteger(L, range.count);
+            lua_rawseti(L, -2, 3);
+            lua_pushinteger(L, range.baseVertex);
+            lua_rawseti(L, -2, 4);
+            lua_pushinteger(L, range.materialSlot + 1);
+            lua_rawseti(L, -2, 5);
+            lua_rawseti(L, -2, i + 1);
+        }
+        return 1;
+    }
+
     static int newObjMesh(lua_State* L)
     {
         const char* path = luaL_checklstring(L, 1, nullptr);
@@ -539,6 +801,93 @@ struct MeshWrapper : public kaun::Mesh {
         }
         return 1;
     }
+
+    // width, depth, heights (2D table [z][x]), heightScale, (format)
+    static int newHeightmapMesh(lua_State* L)
+    {
+        float width = luax_check<float>(L, 1);
+        float depth = luax_check<float>(L, 2);
+        int resX = 0, resZ = 0;
+        std::vector<float> heights;
+        checkHeightmap(L, 3, heights, resX, resZ);
+        float heightScale = luax_check<float>(L, 4);
+        const kaun::VertexFormat* format = &kaun::defaultVertexFormat;
+        if (lua_gettop(L) >= 5)
+            format = lb::Userdata::get<VertexFormatWrapper>(L, 5, true);
+        pushWithGC(L,
+            reinterpret_cast<MeshWrapper*>(kaun::Mesh::plane(
+                width, depth, resX - 1, resZ - 1, heights.data(), heightScale, *format)));
+        return 1;
+    }
+
+    // {{mesh, transform}, ...}, chunkSize
+    static int newMergedMesh(lua_State* L)
+    {
+        luaL_checktype(L, 1, LUA_TTABLE);
+        float chunkSize = 0.0f;
+        if (lua_gettop(L) >= 2)
+            chunkSize = luax_check<float>(L, 2);
+
+        std::vector<std::pair<kaun::Mesh*, glm::mat4>> meshes;
+        size_t count = lua_objlen(L, 1);
+        for (size_t i = 1; i <= count; ++i) {
+            lua_rawgeti(L, 1, i);
+            if (!lua_istable(L, -1))
+                return luaL_error(L, "Each element has to be a table {mesh, transform}");
+            lua_rawgeti(L, -1, 1);
+            MeshWrapper* mesh = lb::Userdata::get<MeshWrapper>(L, lua_gettop(L), true);
+            lua_rawgeti(L, -2, 2);
+            glm::mat4 transform(1.0f);
+            if (!lua_isnil(L, -1)) {
+                auto trafo = lb::Userdata::get<TransformWrapper>(L, lua_gettop(L), true);
+                transform = trafo->Transform::getMatrix();
+            }
+            meshes.emplace_back(mesh, transform);
+            lua_pop(L, 3);
+        }
+
+        kaun::Mesh* mesh = kaun::Mesh::merge(meshes, chunkSize);
+        if (mesh == nullptr)
+            return luaL_error(L, "Could not merge meshes");
+        pushWithGC(L, reinterpret_cast<MeshWrapper*>(mesh));
+        return 1;
+    }
+};
+
+struct MeshArenaWrapper : public kaun::MeshArena {
+    int add(lua_State* L)
+    {
+        MeshWrapper* mesh = lb::Userdata::get<MeshWrapper>(L, 2, true);
+        lua_pushboolean(L, MeshArena::add(*mesh));
+        return 1;
+    }
+
+    int remove(lua_State* L)
+    {
+        MeshWrapper* mesh = lb::Userdata::get<MeshWrapper>(L, 2, true);
+        MeshArena::remove(*mesh);
+        return 0;
+    }
+
+    int getFreeSpace(lua_State* L)
+    {
+        lua_pushinteger(L, getFreeVertexCount());
+        lua_pushinteger(L, getFreeIndexCount());
+        return 2;
+    }
+
+    static int newMeshArena(lua_State* L)
+    {
+        VertexFormatWrapper* format = lb::Userdata::get<VertexFormatWrapper>(L, 1, true);
+        int vertexCapacity = luaL_checkint(L, 2);
+        int indexCapacity = luaL_checkint(L, 3);
+        if (vertexCapacity < 1 || indexCapacity < 1)
+            luaL_error(L, "Vertex and index capacity have to be positive");
+        pushWithGC(L,
+            reinterpret_cast<MeshArenaWrapper*>(
+                new kaun::MeshArena(*format, vertexCapacity, indexCapacity)));
+        return 1;
+    }
 };
 
 struct ShaderWrapper : public kaun::Shader {
@@ -800,8 +1149,97 @@ LuaEnum<kaun::PixelFormat> pixelFormat("pixel format",
         { "depth32f_stencil8", kaun::PixelFormat::DEPTH32F_STENCIL8 },
         { "depth24_stencil8", kaun::PixelFormat::DEPTH24_STENCIL8 },
         { "stencil8", kaun::PixelFormat::STENCIL8 },
+        { "bc1", kaun::PixelFormat::BC1 },
+        { "bc1_srgb", kaun::PixelFormat::BC1_SRGB },
+        { "bc3", kaun::PixelFormat::BC3 },
+        { "bc3_srgb", kaun::PixelFormat::BC3_SRGB },
+        { "bc4", kaun::PixelFormat::BC4 },
+        { "bc5", kaun::PixelFormat::BC5 },
+        { "bc7", kaun::PixelFormat::BC7 },
+        { "bc7_srgb", kaun::PixelFormat::BC7_SRGB },
+    });
+
+// The state async texture load callbacks are called in (the one updateTextureLoads is called from)
+lua_State* loadCallbackState = nullptr;
+size_t textureUploadBudget = kaun::TextureLoader::defaultUploadBudget;
+// The first error of a load callback, raised by updateTextureLoads once the loader is done, so it
+// doesn't longjmp through the loader's frames
+std::string loadCallbackError;
+
+// Optional function argument, called with (success, error)
+kaun::Texture::LoadCallback checkLoadCallback(lua_State* L, int idx)
+{
+    if (lua_gettop(L) < idx || lua_isnil(L, idx))
+        return nullptr;
+    luaL_checktype(L, idx, LUA_TFUNCTION);
+    lua_pushvalue(L, idx);
+    // unreferenced with the last copy of the callback, so cancelled loads don't leak the function
+    std::shared_ptr<int> ref(new int(luaL_ref(L, LUA_REGISTRYINDEX)), [L](int* ref) {
+        luaL_unref(L, LUA_REGISTRYINDEX, *ref);
+        delete ref;
+    });
+    return [ref](bool success, const std::string& error) {
+        lua_State* L = loadCallbackState;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, *ref);
+        lua_pushboolean(L, success);
+        if (success)
+            lua_pushnil(L);
+        else
+            lua_pushstring(L, error.c_str());
+        if (lua_pcall(L, 2, 0, 0)) {
+            if (loadCallbackError.empty())
+                loadCallbackError = lua_tostring(L, -1);
+            lua_pop(L, 1);
+        }
+    };
+}
+
+LuaEnum<kaun::TextureLoad::Status> textureLoadStatus("texture load status",
+    {
+        { "decoding", kaun::TextureLoad::Status::DECODING },
+        { "decoded", kaun::TextureLoad::Status::DECODED },
+        { "uploading", kaun::TextureLoad::Status::UPLOADING },
+        { "done", kaun::TextureLoad::Status::DONE },
+        { "failed", kaun::TextureLoad::Status::FAILED },
     });
 
+struct TextureLoadWrapper {
+    std::shared_ptr<kaun::TextureLoad> load;
+
+    int getStatus(lua_State* L)
+    {
+        textureLoadStatus.push(L, load->getStatus());
+        return 1;
+    }
+
+    int isFinished(lua_State* L)
+    {
+        lua_pushboolean(L, load->isFinished());
+        return 1;
+    }
+
+    int getProgress(lua_State* L)
+    {
+        lua_pushnumber(L, load->getProgress());
+        return 1;
+    }
+
+    // nil if the load did not fail
+    int getError(lua_State* L)
+    {
+        if (load->getStatus() == kaun::TextureLoad::Status::FAILED)
+            lua_pushstring(L, load->getError().c_str());
+        else
+            lua_pushnil(L);
+        return 1;
+    }
+};
+
+// All textures share a metatable, but pooled render textures are owned by the pool
+struct TextureWrapper;
+template <>
+int __gc<TextureWrapper>(lua_State* L);
+
 struct TextureWrapper : public kaun::Texture {
     int getDimensions(lua_State* L)
     {
@@ -843,6 +1281,93 @@ struct TextureWrapper : public kaun::Texture {
         Texture::setBorderColor(glm::vec4(r, g, b, a));
     }
 
+    // data (Data, FFI pointer or light userdata), (x), (y), (width), (height), (updateMipmaps)
+    // data has to be in the format of the texture
+    int replacePixels(lua_State* L)
+    {
+        size_t dataSize = 0;
+        const uint8_t* data = checkDataPointer(L, 2, dataSize);
+        int x = luaL_optint(L, 3, 0);
+        int y = luaL_optint(L, 4, 0);
+        int width = luaL_optint(L, 5, Texture::getWidth() - x);
+        int height = luaL_optint(L, 6, Texture::getHeight() - y);
+        bool updateMipmaps = false;
+        if (lua_gettop(L) >= 7)
+            updateMipmaps = luax_check<bool>(L, 7);
+        const size_t regionSize
+            = static_cast<size_t>(width) * height * kaun::getPixelSize(getPixelFormat());
+        if (dataSize > 0 && dataSize < regionSize)
+            return luaL_error(L, "Data is too small for a %dx%d region", width, height);
+        if (!Texture::replacePixels(data, x, y, width, height, updateMipmaps))
+            return luaL_error(L, "Could not replace pixels");
+        return 0;
+    }
+
+    // (bufferCount) - 0 disables streaming
+    int setStreaming(lua_State* L)
+    {
+        const int bufferCount = luaL_optint(L, 2, 3);
+        if (bufferCount < 0)
+            return luaL_error(L, "Buffer count must not be negative");
+        Texture::setStreaming(bufferCount);
+        return 0;
+    }
+
+    // data, (x), (y), (width), (height), (wait), (updateMipmaps)
+    // Returns false if all pixel buffers were still in use and the update was skipped
+    int streamPixels(lua_State* L)
+    {
+        size_t dataSize = 0;
+        const uint8_t* data = checkDataPointer(L, 2, dataSize);
+        int x = luaL_optint(L, 3, 0);
+        int y = luaL_optint(L, 4, 0);
+        int width = luaL_optint(L, 5, Texture::getWidth() - x);
+        int height = luaL_optint(L, 6, Texture::getHeight() - y);
+        bool wait = false, updateMipmaps = false;
+        if (lua_gettop(L) >= 7)
+            wait = luax_check<bool>(L, 7);
+        if (lua_gettop(L) >= 8)
+            updateMipmaps = luax_check<bool>(L, 8);
+        if (!Texture::isStreaming())
+            return luaL_error(L, "Texture is not in streaming mode");
+        const size_t regionSize
+            = static_cast<size_t>(width) * height * kaun::getPixelSize(getPixelFormat());
+        if (dataSize > 0 && dataSize < regionSize)
+            return luaL_error(L, "Data is too small for a %dx%d region", width, height);
+        lua_pushboolean(L, Texture::streamPixels(data, x, y, width, height, wait, updateMipmaps));
+        return 1;
+    }
+
+    // (x), (y), (width), (height), (wait) - returns a pointer to write the pixels into and its
+    // size or nil if the update has to be skipped
+    int mapPixels(lua_State* L)
+    {
+        int x = luaL_optint(L, 2, 0);
+        int y = luaL_optint(L, 3, 0);
+        int width = luaL_optint(L, 4, Texture::getWidth() - x);
+        int height = luaL_optint(L, 5, Texture::getHeight() - y);
+        bool wait = false;
+        if (lua_gettop(L) >= 6)
+            wait = luax_check<bool>(L, 6);
+        void* data = Texture::mapPixels(x, y, width, height, wait);
+        if (!data) {
+            lua_pushnil(L);
+            return 1;
+        }
+        lua_pushlightuserdata(L, data);
+        lua_pushinteger(L, width * height * kaun::getPixelSize(getPixelFormat()));
+        return 2;
+    }
+
+    int unmapPixels(lua_State* L)
+    {
+        bool updateMipmaps = false;
+        if (lua_gettop(L) >= 2)
+            updateMipmaps = luax_check<bool>(L, 2);
+        lua_pushboolean(L, Texture::unmapPixels(updateMipmaps));
+        return 1;
+    }
+
     int setCompareFunc(lua_State* L)
     {
         Texture::setCompareFunc(depthFunc.check(L, 2));
@@ -866,6 +1391,56 @@ struct TextureWrapper : public kaun::Texture {
         }
     }
 
+    // path, format, (genMipmaps) - compresses the image on the CPU (bc1, bc3, bc4 or bc5 and the
+    // srgb variants). KTX and DDS files can be loaded with newTexture directly.
+    static int newCompressedTexture(lua_State* L)
+    {
+        const char* path = luaL_checklstring(L, 1, nullptr);
+        const kaun::PixelFormat format = pixelFormat.check(L, 2);
+        bool genMipmaps = true;
+        if (lua_gettop(L) >= 3)
+            genMipmaps = luax_check<bool>(L, 3);
+        auto fileData = getFileData(L, path);
+        if (!fileData.first)
+            return luaL_error(L, "Could not load file %s", path);
+        TextureWrapper* texture = new TextureWrapper;
+        const bool success
+            = texture->loadEncodedCompressed(fileData.first, fileData.second, format, genMipmaps);
+        lua_pop(L, 1); // Pop the FileData
+        if (!success) {
+            delete texture;
+            return luaL_error(L, "Could not compress %s", path);
+        }
+        pushWithGC(L, texture);
+        return 1;
+    }
+
+    // data (Data, FFI pointer or light userdata), width, height, (format), (genMipmaps)
+    // data is read directly, e.g. from an ImageData with the same format (rgba8 by default)
+    static int newTextureFromData(lua_State* L)
+    {
+        size_t dataSize = 0;
+        const uint8_t* data = checkDataPointer(L, 1, dataSize);
+        int width = luaL_checkint(L, 2);
+        int height = luaL_checkint(L, 3);
+        kaun::PixelFormat format = kaun::PixelFormat::RGBA8;
+        if (lua_gettop(L) >= 4 && !lua_isnil(L, 4))
+            format = pixelFormat.check(L, 4);
+        bool genMipmaps = false;
+        if (lua_gettop(L) >= 5)
+            genMipmaps = luax_check<bool>(L, 5);
+        if (width < 1 || height < 1)
+            return luaL_error(L, "Texture dimensions have to be positive");
+        const size_t textureSize
+            = static_cast<size_t>(width) * height * kaun::getPixelSize(format);
+        if (dataSize > 0 && dataSize < textureSize)
+            return luaL_error(L, "Data is too small for a %dx%d texture", width, height);
+        TextureWrapper* texture = new TextureWrapper;
+        texture->loadFromMemory(format, data, width, height, genMipmaps);
+        pushWithGC(L, texture);
+        return 1;
+    }
+
     static int newPixelTexture(lua_State* L)
     {
         glm::vec4 col = luax_check<glm::vec4>(L, 1);
@@ -914,6 +1489,85 @@ struct TextureWrapper : public kaun::Texture {
         return 1;
     }
 
+    // path, (genMipmaps), (callback) - returns the texture and a load handle
+    // The file is read synchronously, but decoded on a worker thread and uploaded over the next
+    // frames (see kaun.updateTextureLoads). Until then the texture is a placeholder.
+    static int newTextureAsync(lua_State* L)
+    {
+        const char* path = luaL_checklstring(L, 1, nullptr);
+        bool genMipmaps = false;
+        if (lua_gettop(L) >= 2 && !lua_isnil(L, 2))
+            genMipmaps = luax_check<bool>(L, 2);
+        auto callback = checkLoadCallback(L, 3);
+        auto fileData = getFileData(L, path);
+        if (!fileData.first)
+            return luaL_error(L, "Could not load file %s", path);
+        std::vector<uint8_t> encoded(fileData.first, fileData.first + fileData.second);
+        lua_pop(L, 1); // Pop the FileData
+
+        TextureWrapper* texture = new TextureWrapper;
+        auto load = texture->loadEncodedAsync(
+            std::move(encoded), genMipmaps, Target::NONE, std::move(callback));
+        pushWithGC(L, texture);
+        pushWithGC(L, new TextureLoadWrapper { load });
+        return 2;
+    }
+
+    // posX, negX, posY, negY, posZ, negZ, (callback) - the callback is called once all faces are
+    // loaded
+    static int newCubeTextureAsync(lua_State* L)
+    {
+        auto callback = checkLoadCallback(L, 7);
+        std::vector<uint8_t> faces[6];
+        for (int i = 0; i < 6; ++i) {
+            const char* path = luaL_checkstring(L, i + 1);
+            auto fileData = getFileData(L, path);
+            if (!fileData.first)
+                return luaL_error(L, "Could not load file %s", path);
+            faces[i].assign(fileData.first, fileData.first + fileData.second);
+            lua_pop(L, 1); // Pop the FileData
+        }
+
+        auto remaining = std::make_shared<int>(6);
+        auto error = std::make_shared<std::string>();
+        LoadCallback faceCallback = [remaining, error, callback](bool success,
+                                        const std::string& err) {
+            if (!success && error->empty())
+                *error = err;
+            if (--*remaining == 0 && callback)
+                callback(error->empty(), *error);
+        };
+        TextureWrapper* texture = reinterpret_cast<TextureWrapper*>(
+            new kaun::Texture(kaun::Texture::Target::TEX_CUBE_MAP));
+        for (int i = 0; i < 6; ++i) {
+            const Texture::Target target = static_cast<Texture::Target>(
+                static_cast<GLenum>(Texture::Target::TEX_CUBE_MAP_POS_X) + i);
+            texture->loadEncodedAsync(std::move(faces[i]), true, target, faceCallback);
+        }
+        pushWithGC(L, texture);
+        return 1;
+    }
+
+    // path, (initialSize) - returns the texture and a load handle
+    // Like newTextureAsync with mipmaps, but the texture manager decides how many mip levels are
+    // resident, depending on the texture budget and how large the texture is drawn.
+    static int newManagedTexture(lua_State* L)
+    {
+        const char* path = luaL_checklstring(L, 1, nullptr);
+        const int initialSize = luaL_optint(L, 2, 64);
+        auto fileData = getFileData(L, path);
+        if (!fileData.first)
+            return luaL_error(L, "Could not load file %s", path);
+        std::vector<uint8_t> encoded(fileData.first, fileData.first + fileData.second);
+        lua_pop(L, 1); // Pop the FileData
+
+        TextureWrapper* texture = new TextureWrapper;
+        auto load = kaun::TextureManager::load(*texture, std::move(encoded), initialSize);
+        pushWithGC(L, texture);
+        pushWithGC(L, new TextureLoadWrapper { load });
+        return 2;
+    }
+
     static int newCheckerTexture(lua_State* L)
     {
         int args = lua_gettop(L);
@@ -947,6 +1601,180 @@ struct TextureWrapper : public kaun::Texture {
     }
 };
 
+// Pooled textures are pushed with pushPooledTexture, which keeps the pool from deleting them while
+// the userdata is alive
+template <>
+int __gc<TextureWrapper>(lua_State* L)
+{
+    TextureWrapper* texture = lb::Userdata::get<TextureWrapper>(L, 1, false);
+    if (kaun::isPooledRenderTexture(texture))
+        kaun::removeRenderTextureReference(texture);
+    else
+        delete texture;
+    return 0;
+}
+
+void pushPooledTexture(lua_State* L, kaun::Texture* texture)
+{
+    kaun::addRenderTextureReference(texture);
+    pushWithGC(L, reinterpret_cast<TextureWrapper*>(texture));
+}
+
+// Samplers are owned by the sampler cache, so they are pushed without __gc
+struct SamplerWrapper : public kaun::Sampler {
+    // {wrap = "clamp" or {s, t, (r)}, minFilter, magFilter, compare, anisotropy, lodBias, minLod,
+    // maxLod, borderColor}
+    static int newSampler(lua_State* L)
+    {
+        luaL_checktype(L, 1, LUA_TTABLE);
+        kaun::SamplerState state;
+        lua_getfield(L, 1, "wrap");
+        if (lua_type(L, -1) == LUA_TSTRING) {
+            state.wrapS = state.wrapT = state.wrapR = wrapMode.check(L, -1);
+        } else if (lua_istable(L, -1)) {
+            lua_rawgeti(L, -1, 1);
+            state.wrapS = wrapMode.check(L, -1);
+            lua_rawgeti(L, -2, 2);
+            state.wrapT = lua_isnil(L, -1) ? state.wrapS : wrapMode.check(L, -1);
+            lua_rawgeti(L, -3, 3);
+            state.wrapR = lua_isnil(L, -1) ? state.wrapT : wrapMode.check(L, -1);
+            lua_pop(L, 3);
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, 1, "minFilter");
+        if (!lua_isnil(L, -1))
+            state.minFilter = minFilter.check(L, -1);
+        lua_getfield(L, 1, "magFilter");
+        if (!lua_isnil(L, -1))
+            state.magFilter = magFilter.check(L, -1);
+        lua_getfield(L, 1, "compare");
+        if (!lua_isnil(L, -1))
+            state.compareFunc = depthFunc.check(L, -1);
+        lua_pop(L, 3);
+
+        lua_getfield(L, 1, "anisotropy");
+        state.maxAnisotropy = luaL_optnumber(L, -1, state.maxAnisotropy);
+        lua_getfield(L, 1, "lodBias");
+        state.lodBias = luaL_optnumber(L, -1, state.lodBias);
+        lua_getfield(L, 1, "minLod");
+        state.minLod = luaL_optnumber(L, -1, state.minLod);
+        lua_getfield(L, 1, "maxLod");
+        state.maxLod = luaL_optnumber(L, -1, state.maxLod);
+        lua_pop(L, 4);
+
+        lua_getfield(L, 1, "borderColor");
+        if (!lua_isnil(L, -1))
+            state.borderColor = luax_checkvectable<glm::vec4>(L, -1);
+        lua_pop(L, 1);
+
+        kaun::Sampler* sampler = const_cast<kaun::Sampler*>(kaun::Sampler::get(state));
+        lb::push(L, reinterpret_cast<SamplerWrapper*>(sampler));
+        return 1;
+    }
+};
+
+LuaEnum<kaun::Texture::Target> atlasTarget("atlas type",
+    {
+        { "2d", kaun::Texture::Target::TEX_2D },
+        { "array", kaun::Texture::Target::TEX_2D_ARRAY },
+    });
+
+struct TextureAtlasWrapper : public kaun::TextureAtlas {
+    // path or data (Data, FFI pointer or light userdata), width, height, (components)
+    // returns the id of the image
+    int add(lua_State* L)
+    {
+        if (lua_type(L, 2) == LUA_TSTRING) {
+            const char* path = lua_tostring(L, 2);
+            auto fileData = getFileData(L, path);
+            if (!fileData.first)
+                return luaL_error(L, "Could not load file %s", path);
+            kaun::DecodedImage image;
+            std::string error;
+            const bool success = kaun::decodeImage(fileData.first, fileData.second, image, error);
+            lua_pop(L, 1); // Pop the FileData
+            if (!success)
+                return luaL_error(L, "Could not decode %s: %s", path, error.c_str());
+            lua_pushinteger(L,
+                TextureAtlas::add(image.pixels.get(), image.width, image.height, image.components)
+                    + 1);
+            return 1;
+        }
+
+        size_t dataSize = 0;
+        const uint8_t* data = checkDataPointer(L, 2, dataSize);
+        const int width = luaL_checkint(L, 3);
+        const int height = luaL_checkint(L, 4);
+        const int components = luaL_optint(L, 5, 4);
+        if (width < 1 || height < 1)
+            return luaL_error(L, "Image dimensions have to be positive");
+        if (components < 1 || components > 4)
+            return luaL_error(L, "Images need 1-4 components");
+        if (dataSize > 0 && dataSize < static_cast<size_t>(width) * height * components)
+            return luaL_error(L, "Data is too small for a %dx%d image", width, height);
+        lua_pushinteger(L, TextureAtlas::add(data, width, height, components) + 1);
+        return 1;
+    }
+
+    // (type), (genMipmaps) - returns the texture
+    int build(lua_State* L)
+    {
+        kaun::Texture::Target target = kaun::Texture::Target::TEX_2D_ARRAY;
+        if (lua_gettop(L) >= 2 && !lua_isnil(L, 2))
+            target = atlasTarget.check(L, 2);
+        bool genMipmaps = true;
+        if (lua_gettop(L) >= 3)
+            genMipmaps = luax_check<bool>(L, 3);
+        kaun::Texture* texture = TextureAtlas::build(target, genMipmaps);
+        if (!texture)
+            return luaL_error(L, "Could not build texture atlas");
+        pushWithGC(L, reinterpret_cast<TextureWrapper*>(texture));
+        return 1;
+    }
+
+    // id - returns scaleU, scaleV, offsetU, offsetV, layer, which can be passed to
+    // Mesh:remapTexCoords or sent to a shader directly
+    int getRegion(lua_State* L)
+    {
+        const int id = luaL_checkint(L, 2);
+        if (id < 1 || id > static_cast<int>(getImageCount()))
+            return luaL_error(L, "Invalid image id %d", id);
+        if (TextureAtlas::getLayerCount() == 0)
+            return luaL_error(L, "Atlas has not been built yet");
+        if (id > static_cast<int>(getRegionCount()))
+            return luaL_error(L, "Image %d was added after the atlas was built", id);
+        const auto& region = TextureAtlas::getRegion(id - 1);
+        lua_pushnumber(L, region.uvScale.x);
+        lua_pushnumber(L, region.uvScale.y);
+        lua_pushnumber(L, region.uvOffset.x);
+        lua_pushnumber(L, region.uvOffset.y);
+        lua_pushinteger(L, region.layer);
+        return 5;
+    }
+
+    int getLayerCount(lua_State* L)
+    {
+        lua_pushinteger(L, TextureAtlas::getLayerCount());
+        return 1;
+    }
+
+    // width, height, (padding)
+    static int newTextureAtlas(lua_State* L)
+    {
+        const int width = luaL_checkint(L, 1);
+        const int height = luaL_checkint(L, 2);
+        const int padding = luaL_optint(L, 3, 2);
+        if (width < 1 || height < 1)
+            return luaL_error(L, "Atlas dimensions have to be positive");
+        if (padding < 0)
+            return luaL_error(L, "Padding must not be negative");
+        pushWithGC(L,
+            reinterpret_cast<TextureAtlasWrapper*>(new kaun::TextureAtlas(width, height, padding)));
+        return 1;
+    }
+};
+
 struct RenderBufferWrapper : public kaun::RenderBuffer {
 };
 
@@ -978,22 +1806,40 @@ int clearDepth(lua_State* L)
     return 0;
 }
 
-int setProjection(lua_State* L)
+// x, y, w, h or nothing to disable the scissor test
+int setScissor(lua_State* L)
 {
-    int args = lua_gettop(L);
+    if (lua_gettop(L) == 0) {
+        kaun::resetScissor();
+    } else {
+        kaun::setScissor(
+            luaL_checkint(L, 1), luaL_checkint(L, 2), luaL_checkint(L, 3), luaL_checkint(L, 4));
+    }
+    return 0;
+}
+
+// fovy, aspect, near, far or left, right, bottom, top, near, far or a matrix from idx on
+glm::mat4 checkProjection(lua_State* L, int idx, const char* function)
+{
+    const int args = lua_gettop(L) - idx + 1;
     if (args == 4) {
-        kaun::setProjection(glm::perspective(glm::radians(luax_check<float>(L, 1)),
-            luax_check<float>(L, 2), luax_check<float>(L, 3), luax_check<float>(L, 4)));
+        return glm::perspective(glm::radians(luax_check<float>(L, idx)),
+            luax_check<float>(L, idx + 1), luax_check<float>(L, idx + 2),
+            luax_check<float>(L, idx + 3));
     } else if (args == 6) {
-        kaun::setProjection(
-            glm::ortho(luax_check<float>(L, 1), luax_check<float>(L, 2), luax_check<float>(L, 3),
-                luax_check<float>(L, 4), luax_check<float>(L, 5), luax_check<float>(L, 6)));
+        return glm::ortho(luax_check<float>(L, idx), luax_check<float>(L, idx + 1),
+            luax_check<float>(L, idx + 2), luax_check<float>(L, idx + 3),
+            luax_check<float>(L, idx + 4), luax_check<float>(L, idx + 5));
     } else if (args == 16) {
-        kaun::setProjection(luax_check<glm::mat4>(L, 1));
-    } else {
-        luaL_error(
-            L, "Number of arguments to kaun.setProjection must be 4, 6, or 16. Got %d", args);
+        return luax_check<glm::mat4>(L, idx);
     }
+    luaL_error(L, "Number of arguments to %s must be 4, 6, or 16. Got %d", function, args);
+    return glm::mat4(1.0f);
+}
+
+int setProjection(lua_State* L)
+{
+    kaun::setProjection(checkProjection(L, 1, "kaun.setProjection"));
     return 0;
 }
 
@@ -1034,28 +1880,37 @@ int getModelMatrix(lua_State* L)
     return luax_pushmat4(L, kaun::getModelMatrix());
 }
 
-int setRenderTarget(lua_State* L)
+// colorAttachments (texture or table of textures), depthStencil at idx and idx + 1
+void checkAttachments(lua_State* L, int idx,
+    std::vector<const kaun::RenderAttachment*>& colorAttachments,
+    const kaun::RenderAttachment*& depthStencil)
 {
     int nargs = lua_gettop(L);
-    std::vector<const kaun::RenderAttachment*> colorAttachments;
-    const kaun::RenderAttachment* depthStencil = nullptr;
-    bool blitCurrent = false;
-    if (nargs >= 1) {
-        if (lua_istable(L, 1)) {
-            int n = lua_objlen(L, 1);
+    if (nargs >= idx) {
+        if (lua_istable(L, idx)) {
+            int n = lua_objlen(L, idx);
             for (int i = 1; i <= n; ++i) {
-                lua_rawgeti(L, 1, i);
+                lua_rawgeti(L, idx, i);
                 colorAttachments.push_back(
                     lb::Userdata::get<TextureWrapper>(L, lua_gettop(L), true));
                 lua_pop(L, 1);
             }
         } else {
-            colorAttachments.push_back(lb::Userdata::get<TextureWrapper>(L, 1, true));
+            colorAttachments.push_back(lb::Userdata::get<TextureWrapper>(L, idx, true));
         }
     }
-    if (nargs >= 2) {
-        depthStencil = lua_isnil(L, 2) ? nullptr : lb::Userdata::get<TextureWrapper>(L, 2, true);
+    if (nargs >= idx + 1 && !lua_isnil(L, idx + 1)) {
+        depthStencil = lb::Userdata::get<TextureWrapper>(L, idx + 1, true);
     }
+}
+
+int setRenderTarget(lua_State* L)
+{
+    int nargs = lua_gettop(L);
+    std::vector<const kaun::RenderAttachment*> colorAttachments;
+    const kaun::RenderAttachment* depthStencil = nullptr;
+    bool blitCurrent = false;
+    checkAttachments(L, 1, colorAttachments, depthStencil);
     if (nargs >= 3) {
         blitCurrent = luax_check<bool>(L, 3);
     }
@@ -1063,115 +1918,1088 @@ int setRenderTarget(lua_State* L)
     return 0;
 }
 
-int draw(lua_State* L)
+LuaEnum<GLbitfield> bufferBit("buffer",
+    {
+        { "color", GL_COLOR_BUFFER_BIT },
+        { "depth", GL_DEPTH_BUFFER_BIT },
+        { "stencil", GL_STENCIL_BUFFER_BIT },
+    });
+
+// buffer names from idx on, all buffers if there are none
+GLbitfield checkBufferMask(lua_State* L, int idx)
 {
-    int args = lua_gettop(L);
-    if (args == 3 || args == 4) {
-        MeshWrapper* mesh = lb::Userdata::get<MeshWrapper>(L, 1, false);
-        ShaderWrapper* shader = lb::Userdata::get<ShaderWrapper>(L, 2, false);
+    const int nargs = lua_gettop(L);
+    if (nargs < idx)
+        return GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+    GLbitfield mask = 0;
+    for (int i = idx; i <= nargs; ++i)
+        mask |= bufferBit.check(L, i);
+    return mask;
+}
 
-        // build uniform list
-        std::vector<kaun::Uniform> uniforms;
+// colorAttachments, depthStencil, (discard), (buffers...)
+// Resolves the current render target into another one (the window if there are no attachments)
+// without switching to it. If discard is true, the resolved buffers are invalidated afterwards.
+int resolveRenderTarget(lua_State* L)
+{
+    std::vector<const kaun::RenderAttachment*> colorAttachments;
+    const kaun::RenderAttachment* depthStencil = nullptr;
+    checkAttachments(L, 1, colorAttachments, depthStencil);
+    bool discard = false;
+    if (lua_gettop(L) >= 3 && !lua_isnil(L, 3))
+        discard = luax_check<bool>(L, 3);
+    const GLbitfield mask = checkBufferMask(L, 4);
+    const kaun::RenderTarget* dst = kaun::RenderTarget::get(colorAttachments, depthStencil);
+    kaun::RenderTarget::currentDraw->resolve(*dst, mask, discard);
+    return 0;
+}
+
+// (buffers...) - of the current render target
+int invalidateRenderTarget(lua_State* L)
+{
+    kaun::RenderTarget::currentDraw->invalidate(checkBufferMask(L, 1));
+    return 0;
+}
+
+// colorAttachments, depthStencil, (buffers...) - no buffers means none are discarded
+int setRenderTargetDiscard(lua_State* L)
+{
+    std::vector<const kaun::RenderAttachment*> colorAttachments;
+    const kaun::RenderAttachment* depthStencil = nullptr;
+    checkAttachments(L, 1, colorAttachments, depthStencil);
+    const GLbitfield mask = lua_gettop(L) >= 3 ? checkBufferMask(L, 3) : 0;
+    kaun::RenderTarget::get(colorAttachments, depthStencil)->setDiscardMask(mask);
+    return 0;
+}
+
+int isInvalidateSupported(lua_State* L)
+{
+    lua_pushboolean(L, kaun::RenderTarget::isInvalidateSupported());
+    return 1;
+}
+
+struct ViewWrapper : public kaun::View {
+    // the render target attachments, shader and render state are kept in the registry while the
+    // view uses them
+    lua_State* mState = nullptr;
+    int mTargetRef = LUA_NOREF;
+    int mShaderRef = LUA_NOREF;
+    int mRenderStateRef = LUA_NOREF;
+
+    ~ViewWrapper()
+    {
+        if (mState) {
+            luaL_unref(mState, LUA_REGISTRYINDEX, mTargetRef);
+            luaL_unref(mState, LUA_REGISTRYINDEX, mShaderRef);
+            luaL_unref(mState, LUA_REGISTRYINDEX, mRenderStateRef);
+        }
+    }
+
+    // replaces ref with a reference to the value at the top of the stack and pops it
+    void setRef(lua_State* L, int& ref)
+    {
+        mState = L;
+        luaL_unref(L, LUA_REGISTRYINDEX, ref);
+        ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    int setProjection(lua_State* L)
+    {
+        View::setProjection(checkProjection(L, 2, "View:setProjection"));
+        return 0;
+    }
+
+    int getProjection(lua_State* L)
+    {
+        return luax_pushmat4(L, View::getProjection());
+    }
+
+    int setViewTransform(lua_State* L)
+    {
+        View::setViewTransform(*lb::Userdata::get<TransformWrapper>(L, 2, true));
+        return 0;
+    }
+
+    int setViewMatrix(lua_State* L)
+    {
+        View::setViewMatrix(luax_check<glm::mat4>(L, 2));
+        return 0;
+    }
 
-        if (lua_istable(L, 3)) {
+    int getViewMatrix(lua_State* L)
+    {
+        return luax_pushmat4(L, View::getViewMatrix());
+    }
+
+    // colorAttachments, depthStencil like kaun.setRenderTarget or nothing to draw to the current
+    // render target
+    int setRenderTarget(lua_State* L)
+    {
+        if (lua_gettop(L) < 2) {
+            View::resetRenderTarget();
             lua_pushnil(L);
-            while (lua_next(L, 3) != 0) {
-                // lua_next pops key from stack, then pushes new key and value
-                // => key is at -2, value at -1 (top)
-                const char* name = luaL_checklstring(L, -2, nullptr);
-                const kaun::UniformInfo& uniformInfo = shader->getUniformInfo(name);
-                int uniformSize = uniformInfo.getSize();
-                if (uniformSize > 1) {
-                    if (lua_istable(L, -1)) {
-                        int num = lua_objlen(L, -1);
-                        if (num != uniformSize) {
-                            luaL_error(L,
-                                "Number of elements in uniform table is not equal to the size of "
-                                "the uniform array (%d)",
-                                uniformSize);
-                            return 0;
-                        } else {
-                            luaL_error(L, "Uniform arrays are not yet implemented yet.");
-                            return 0;
-                        }
+            setRef(L, mTargetRef);
+            return 0;
+        }
+        std::vector<const kaun::RenderAttachment*> colorAttachments;
+        const kaun::RenderAttachment* depthStencil = nullptr;
+        checkAttachments(L, 2, colorAttachments, depthStencil);
+        View::setRenderTarget(colorAttachments, depthStencil);
+        lua_settop(L, 3);
+        lua_createtable(L, 2, 0);
+        lua_pushvalue(L, 2);
+        lua_rawseti(L, -2, 1);
+        lua_pushvalue(L, 3);
+        lua_rawseti(L, -2, 2);
+        setRef(L, mTargetRef);
+        return 0;
+    }
+
+    // x, y, w, h or nothing for the whole render target
+    int setViewport(lua_State* L)
+    {
+        if (lua_gettop(L) < 2) {
+            View::setViewport(glm::ivec4(0, 0, -1, -1));
+        } else {
+            View::setViewport(glm::ivec4(luaL_checkint(L, 2), luaL_checkint(L, 3),
+                luaL_checkint(L, 4), luaL_checkint(L, 5)));
+        }
+        return 0;
+    }
+
+    // x, y, w, h or nothing to disable the scissor test
+    int setScissor(lua_State* L)
+    {
+        if (lua_gettop(L) < 2) {
+            View::setScissor(glm::ivec4(0, 0, -1, -1));
+        } else {
+            View::setScissor(glm::ivec4(luaL_checkint(L, 2), luaL_checkint(L, 3),
+                std::max(luaL_checkint(L, 4), 0), std::max(luaL_checkint(L, 5), 0)));
+        }
+        return 0;
+    }
+
+    // shader or nil to use the one passed to kaun.draw
+    int setShader(lua_State* L)
+    {
+        ShaderWrapper* shader = nullptr;
+        if (lua_gettop(L) >= 2 && !lua_isnil(L, 2))
+            shader = lb::Userdata::get<ShaderWrapper>(L, 2, false);
+        View::setShader(shader);
+        lua_settop(L, 2);
+        lua_pushvalue(L, 2);
+        setRef(L, mShaderRef);
+        return 0;
+    }
+
+    // render state or nil to use the one passed to kaun.draw
+    int setRenderState(lua_State* L)
+    {
+        const RenderStateWrapper* state = nullptr;
+        if (lua_gettop(L) >= 2 && !lua_isnil(L, 2))
+            state = lb::Userdata::get<RenderStateWrapper>(L, 2, true);
+        View::setRenderState(state);
+        lua_settop(L, 2);
+        lua_pushvalue(L, 2);
+        setRef(L, mRenderStateRef);
+        return 0;
+    }
+
+    // (r, g, b, a, (colorAttachmentIndex))
+    int clear(lua_State* L)
+    {
+        const int args = lua_gettop(L) - 1;
+        if (args == 0) {
+            kaun::clear(*this);
+        } else if (args == 4) {
+            kaun::clear(*this, luax_check<glm::vec4>(L, 2));
+        } else if (args == 5) {
+            kaun::clear(*this, luax_check<glm::vec4>(L, 2), luaL_checkinteger(L, 6));
+        } else {
+            luaL_error(L, "Number of arguments to View:clear must be 0, 4 or 5. Got %d", args);
+        }
+        return 0;
+    }
+
+    // (value)
+    int clearDepth(lua_State* L)
+    {
+        kaun::clearDepth(*this, static_cast<float>(luaL_optnumber(L, 2, 1.0)));
+        return 0;
+    }
+
+    static int newView(lua_State* L)
+    {
+        pushWithGC(L, new ViewWrapper);
+        return 1;
+    }
+};
+
+// format, width, height, (samples)
+// The texture is owned by the pool and must not be drawn to after releaseRenderTexture. It is only
+// deleted once it was released and collected.
+int acquireRenderTexture(lua_State* L)
+{
+    const kaun::PixelFormat format = pixelFormat.check(L, 1);
+    const int width = luaL_checkint(L, 2);
+    const int height = luaL_checkint(L, 3);
+    const int samples = luaL_optint(L, 4, 0);
+    if (width < 1 || height < 1 || samples < 0)
+        return luaL_error(L, "Invalid render texture size or number of samples");
+    pushPooledTexture(L, kaun::acquireRenderTexture(format, width, height, samples));
+    return 1;
+}
+
+int releaseRenderTexture(lua_State* L)
+{
+    if (!kaun::releaseRenderTexture(lb::Userdata::get<TextureWrapper>(L, 1, true)))
+        return luaL_error(L, "Texture was not acquired with acquireRenderTexture");
+    return 0;
+}
+
+int getRenderTexturePoolStats(lua_State* L)
+{
+    const kaun::RenderTexturePoolStats& stats = kaun::getRenderTexturePoolStats();
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, stats.textures);
+    lua_setfield(L, -2, "textures");
+    lua_pushinteger(L, stats.acquired);
+    lua_setfield(L, -2, "acquired");
+    lua_pushinteger(L, stats.created);
+    lua_setfield(L, -2, "created");
+    lua_pushinteger(L, stats.reused);
+    lua_setfield(L, -2, "reused");
+    lua_pushinteger(L, kaun::RenderTarget::getCacheSize());
+    lua_setfield(L, -2, "renderTargets");
+    return 1;
+}
+
+struct FrameGraphWrapper : public kaun::FrameGraph {
+    using Resource = kaun::FrameGraph::Resource;
+
+    // Imported textures are kept in the registry until the graph is cleared or collected. Pass
+    // callbacks usually reference the graph, so they are kept in the environment table of its
+    // userdata instead, where the garbage collector can still collect the cycle.
+    lua_State* mState = nullptr;
+    std::unordered_map<Resource, int> mTextureRefs;
+    // stack index of the callback table and the first callback error while executing
+    int mCallbacksIndex = 0;
+    std::string mCallbackError;
+
+    ~FrameGraphWrapper()
+    {
+        unrefTextures();
+    }
+
+    void unrefTextures()
+    {
+        for (auto& textureRef : mTextureRefs)
+            luaL_unref(mState, LUA_REGISTRYINDEX, textureRef.second);
+        mTextureRefs.clear();
+    }
+
+    // Errors are raised by execute after the graph is done, so its transient textures are released.
+    // The callbacks of later passes are skipped.
+    void runCallback(int index)
+    {
+        if (!mCallbackError.empty())
+            return;
+        lua_rawgeti(mState, mCallbacksIndex, index);
+        if (lua_pcall(mState, 0, 0, 0)) {
+            const char* error = lua_tostring(mState, -1);
+            mCallbackError = error ? error : "Error in frame graph pass callback";
+            lua_pop(mState, 1);
+        }
+    }
+
+    Resource checkResource(lua_State* L, int idx)
+    {
+        const char* name = luaL_checkstring(L, idx);
+        const Resource resource = getResource(name);
+        if (resource == none)
+            luaL_error(L, "Unknown frame graph resource '%s'", name);
+        return resource;
+    }
+
+    // name or list of names in the field of the table at idx
+    std::vector<Resource> checkResourceList(lua_State* L, int idx, const char* field)
+    {
+        std::vector<Resource> resources;
+        lua_getfield(L, idx, field);
+        if (lua_istable(L, -1)) {
+            const int n = lua_objlen(L, -1);
+            for (int i = 1; i <= n; ++i) {
+                lua_rawgeti(L, -1, i);
+                resources.push_back(checkResource(L, lua_gettop(L)));
+                lua_pop(L, 1);
+            }
+        } else if (!lua_isnil(L, -1)) {
+            resources.push_back(checkResource(L, lua_gettop(L)));
+        }
+        lua_pop(L, 1);
+        return resources;
+    }
+
+    Resource checkOptResource(lua_State* L, int idx, const char* field)
+    {
+        lua_getfield(L, idx, field);
+        const Resource resource = lua_isnil(L, -1) ? none : checkResource(L, lua_gettop(L));
+        lua_pop(L, 1);
+        return resource;
+    }
+
+    // name, format, width, height, (samples)
+    int createTexture(lua_State* L)
+    {
+        const char* name = luaL_checkstring(L, 2);
+        TextureDesc desc;
+        desc.format = pixelFormat.check(L, 3);
+        desc.width = luaL_checkint(L, 4);
+        desc.height = luaL_checkint(L, 5);
+        desc.samples = luaL_optint(L, 6, 0);
+        if (FrameGraph::createTexture(name, desc) == none)
+            return luaL_error(L, "Frame graph resource '%s' already exists", name);
+        return 0;
+    }
+
+    // name, texture, (output)
+    int importTexture(lua_State* L)
+    {
+        const char* name = luaL_checkstring(L, 2);
+        TextureWrapper* texture = lb::Userdata::get<TextureWrapper>(L, 3, false);
+        bool output = false;
+        if (lua_gettop(L) >= 4)
+            output = luax_check<bool>(L, 4);
+        const Resource resource = FrameGraph::importTexture(name, texture, output);
+        if (resource == none)
+            return luaL_error(L, "Frame graph resource '%s' already exists", name);
+        mState = L;
+        lua_pushvalue(L, 3);
+        mTextureRefs[resource] = luaL_ref(L, LUA_REGISTRYINDEX);
+        return 0;
+    }
+
+    // name, {color = names, depth = name, read = names, clearColor = {r, g, b, a},
+    // clearDepth = value}, (function)
+    int addPass(lua_State* L)
+    {
+        kaun::FramePass pass;
+        pass.name = luaL_checkstring(L, 2);
+        luaL_checktype(L, 3, LUA_TTABLE);
+        pass.colorAttachments = checkResourceList(L, 3, "color");
+        pass.depthStencil = checkOptResource(L, 3, "depth");
+        pass.reads = checkResourceList(L, 3, "read");
+        lua_getfield(L, 3, "clearColor");
+        if (!lua_isnil(L, -1)) {
+            pass.clearColor = true;
+            pass.clearColorValue = luax_checkvectable<glm::vec4>(L, lua_gettop(L));
+        }
+        lua_getfield(L, 3, "clearDepth");
+        if (!lua_isnil(L, -1)) {
+            pass.clearDepth = true;
+            pass.clearDepthValue = luaL_checknumber(L, -1);
+        }
+        lua_pop(L, 2);
+
+        if (lua_gettop(L) >= 4 && !lua_isnil(L, 4)) {
+            luaL_checktype(L, 4, LUA_TFUNCTION);
+            lua_getfenv(L, 1);
+            const int index = lua_objlen(L, -1) + 1;
+            lua_pushvalue(L, 4);
+            lua_rawseti(L, -2, index);
+            lua_pop(L, 1);
+            pass.execute = [this, index]() { runCallback(index); };
+        }
+        if (FrameGraph::addPass(std::move(pass)) == none)
+            return luaL_error(L, "Invalid frame graph pass");
+        return 0;
+    }
+
+    // name, {color = names, depth = name} (source), {color = names, depth = name} (destination)
+    // An empty destination is the window.
+    int addResolvePass(lua_State* L)
+    {
+        const char* name = luaL_checkstring(L, 2);
+        luaL_checktype(L, 3, LUA_TTABLE);
+        luaL_checktype(L, 4, LUA_TTABLE);
+        const Resource pass = FrameGraph::addResolvePass(name, checkResourceList(L, 3, "color"),
+            checkOptResource(L, 3, "depth"), checkResourceList(L, 4, "color"),
+            checkOptResource(L, 4, "depth"));
+        if (pass == none)
+            return luaL_error(L, "Invalid frame graph resolve pass");
+        return 0;
+    }
+
+    // name, output
+    int setOutput(lua_State* L)
+    {
+        FrameGraph::setOutput(checkResource(L, 2), luax_check<bool>(L, 3));
+        return 0;
+    }
+
+    // name - transient textures are only valid in the passes using them
+    int getTexture(lua_State* L)
+    {
+        const Resource resource = checkResource(L, 2);
+        kaun::Texture* texture = FrameGraph::getTexture(resource);
+        auto ref = mTextureRefs.find(resource);
+        if (ref != mTextureRefs.end())
+            lua_rawgeti(L, LUA_REGISTRYINDEX, ref->second);
+        else if (texture)
+            pushPooledTexture(L, texture);
+        else
+            lua_pushnil(L);
+        return 1;
+    }
+
+    int compile(lua_State* L)
+    {
+        lua_pushboolean(L, FrameGraph::compile());
+        return 1;
+    }
+
+    int execute(lua_State* L)
+    {
+        mState = L;
+        lua_getfenv(L, 1);
+        mCallbacksIndex = lua_gettop(L);
+        const bool success = FrameGraph::execute();
+        lua_pop(L, 1);
+        if (!success)
+            return luaL_error(L, "Frame graph passes have cyclic dependencies");
+        if (!mCallbackError.empty()) {
+            lua_pushstring(L, mCallbackError.c_str());
+            mCallbackError.clear();
+            return lua_error(L);
+        }
+        return 0;
+    }
+
+    int clear(lua_State* L)
+    {
+        FrameGraph::clear();
+        lua_newtable(L);
+        lua_setfenv(L, 1);
+        unrefTextures();
+        return 0;
+    }
+
+    // returns the names of the passes that are executed, in order
+    int getExecutionOrder(lua_State* L)
+    {
+        if (!FrameGraph::compile())
+            return luaL_error(L, "Frame graph passes have cyclic dependencies");
+        const std::vector<size_t>& order = FrameGraph::getExecutionOrder();
+        lua_createtable(L, order.size(), 0);
+        for (size_t i = 0; i < order.size(); ++i) {
+            lua_pushstring(L, getPass(order[i]).name.c_str());
+            lua_rawseti(L, -2, i + 1);
+        }
+        return 1;
+    }
+
+    static int newFrameGraph(lua_State* L)
+    {
+        pushWithGC(L, new FrameGraphWrapper);
+        lua_newtable(L);
+        lua_setfenv(L, -2);
+        return 1;
+    }
+};
+
+struct ShadowAtlasWrapper : public kaun::ShadowAtlas {
+    using Tile = kaun::ShadowAtlas::Tile;
+
+    // the texture is kept in the registry, so it is not collected before the atlas
+    lua_State* mState;
+    int mTextureRef;
+
+    ShadowAtlasWrapper(kaun::Texture& texture, int minTileSize, lua_State* L, int textureRef)
+        : ShadowAtlas(texture, minTileSize)
+        , mState(L)
+        , mTextureRef(textureRef)
+    {
+    }
+
+    ~ShadowAtlasWrapper()
+    {
+        luaL_unref(mState, LUA_REGISTRYINDEX, mTextureRef);
+    }
+
+    Tile checkTile(lua_State* L, int idx)
+    {
+        const Tile tile = luaL_checkint(L, idx);
+        if (!isAllocated(tile))
+            luaL_error(L, "Invalid shadow atlas tile %d", static_cast<int>(tile));
+        return tile;
+    }
+
+    // size - returns a tile or nil if there is no space left
+    int allocate(lua_State* L)
+    {
+        const Tile tile = ShadowAtlas::allocate(luaL_checkint(L, 2));
+        if (tile == none)
+            lua_pushnil(L);
+        else
+            lua_pushinteger(L, tile);
+        return 1;
+    }
+
+    int free(lua_State* L)
+    {
+        ShadowAtlas::free(checkTile(L, 2));
+        return 0;
+    }
+
+    int reset(lua_State* L)
+    {
+        ShadowAtlas::reset();
+        return 0;
+    }
+
+    int getTexture(lua_State* L)
+    {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, mTextureRef);
+        return 1;
+    }
+
+    // tile - returns x, y, width, height in pixels
+    int getRect(lua_State* L)
+    {
+        const glm::ivec4 rect = ShadowAtlas::getRect(checkTile(L, 2));
+        for (int i = 0; i < 4; ++i)
+            lua_pushinteger(L, rect[i]);
+        return 4;
+    }
+
+    // tile - returns scaleX, scaleY, offsetX, offsetY for uv' = uv * scale + offset
+    int getUvTransform(lua_State* L)
+    {
+        const glm::vec4 transform = ShadowAtlas::getRegion(checkTile(L, 2)).getUvTransform();
+        for (int i = 0; i < 4; ++i)
+            lua_pushnumber(L, transform[i]);
+        return 4;
+    }
+
+    // tile, (clear = true)
+    int bindTile(lua_State* L)
+    {
+        const Tile tile = checkTile(L, 2);
+        bool clear = true;
+        if (lua_gettop(L) >= 3)
+            clear = luax_check<bool>(L, 3);
+        ShadowAtlas::bindTile(tile, clear);
+        return 0;
+    }
+
+    int getOccupancy(lua_State* L)
+    {
+        lua_pushnumber(L, ShadowAtlas::getOccupancy());
+        return 1;
+    }
+
+    // depth texture, (minTileSize = 64)
+    static int newShadowAtlas(lua_State* L)
+    {
+        TextureWrapper* texture = lb::Userdata::get<TextureWrapper>(L, 1, false);
+        const int minTileSize = luaL_optint(L, 2, 64);
+        lua_pushvalue(L, 1);
+        const int textureRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        pushWithGC(L, new ShadowAtlasWrapper(*texture, minTileSize, L, textureRef));
+        return 1;
+    }
+};
+
+// Reads the table of uniforms at idx (name -> value) for shader
+void checkUniforms(
+    lua_State* L, int idx, ShaderWrapper* shader, std::vector<kaun::Uniform>& uniforms)
+{
+    if (lua_istable(L, idx)) {
+        lua_pushnil(L);
+        while (lua_next(L, idx) != 0) {
+            // lua_next pops key from stack, then pushes new key and value
+            // => key is at -2, value at -1 (top)
+            const char* name = luaL_checklstring(L, -2, nullptr);
+            const kaun::UniformInfo& uniformInfo = shader->getUniformInfo(name);
+            int uniformSize = uniformInfo.getSize();
+            if (uniformSize > 1) {
+                if (lua_istable(L, -1)) {
+                    int num = lua_objlen(L, -1);
+                    if (num != uniformSize) {
+                        luaL_error(L,
+                            "Number of elements in uniform table is not equal to the size of "
+                            "the uniform array (%d)",
+                            uniformSize);
+                        return;
                     } else {
-                        luaL_typerror(L, 3, "table");
-                        return 0;
+                        luaL_error(L, "Uniform arrays are not yet implemented yet.");
+                        return;
                     }
                 } else {
-                    if (uniformInfo.exists()) {
-                        switch (uniformInfo.getType()) {
-                        case kaun::UniformInfo::UniformType::BOOL:
-                            uniforms.emplace_back(name, luax_check<bool>(L, -1));
-                            break;
-                        case kaun::UniformInfo::UniformType::INT:
-                            uniforms.emplace_back(name, luaL_checkint(L, -1));
-                            break;
-                        case kaun::UniformInfo::UniformType::FLOAT:
-                            uniforms.emplace_back(name, luax_check<float>(L, -1));
-                            break;
-                        case kaun::UniformInfo::UniformType::VEC2:
-                            uniforms.emplace_back(name, luax_checkvectable<glm::vec2>(L, -1));
-                            break;
-                        case kaun::UniformInfo::UniformType::VEC3:
-                            uniforms.emplace_back(name, luax_checkvectable<glm::vec3>(L, -1));
-                            break;
-                        case kaun::UniformInfo::UniformType::VEC4:
-                            uniforms.emplace_back(name, luax_checkvectable<glm::vec4>(L, -1));
-                            break;
-                        case kaun::UniformInfo::UniformType::MAT2:
-                        case kaun::UniformInfo::UniformType::MAT3:
-                            luaL_error(L, "Uniform mat2/mat3 are not yet implemented yet.");
-                            return 0;
-                        case kaun::UniformInfo::UniformType::MAT4: {
-                            if (!lua_istable(L, -1))
-                                return luaL_error(
-                                    L, "For mat4 uniforms, please pass a table with 16 numbers.");
-                            luax_getnumtable(L, -1, 16);
-                            uniforms.emplace_back(name, luax_check<glm::mat4>(L, -16));
-                            lua_pop(L, 16);
-                            break;
-                        }
-                        case kaun::UniformInfo::UniformType::SAMPLER2D:
-                        case kaun::UniformInfo::UniformType::SAMPLER2DSHADOW:
-                        case kaun::UniformInfo::UniformType::SAMPLERCUBE: {
-                            TextureWrapper* tex
-                                = lb::Userdata::get<TextureWrapper>(L, lua_gettop(L), false);
-                            uniforms.emplace_back(name, *reinterpret_cast<kaun::Texture*>(tex));
-                            break;
+                    luaL_typerror(L, idx, "table");
+                    return;
+                }
+            } else {
+                if (uniformInfo.exists()) {
+                    switch (uniformInfo.getType()) {
+                    case kaun::UniformInfo::UniformType::BOOL:
+                        uniforms.emplace_back(name, luax_check<bool>(L, -1));
+                        break;
+                    case kaun::UniformInfo::UniformType::INT:
+                        uniforms.emplace_back(name, luaL_checkint(L, -1));
+                        break;
+                    case kaun::UniformInfo::UniformType::FLOAT:
+                        uniforms.emplace_back(name, luax_check<float>(L, -1));
+                        break;
+                    case kaun::UniformInfo::UniformType::VEC2:
+                        uniforms.emplace_back(name, luax_checkvectable<glm::vec2>(L, -1));
+                        break;
+                    case kaun::UniformInfo::UniformType::VEC3:
+                        uniforms.emplace_back(name, luax_checkvectable<glm::vec3>(L, -1));
+                        break;
+                    case kaun::UniformInfo::UniformType::VEC4:
+                        uniforms.emplace_back(name, luax_checkvectable<glm::vec4>(L, -1));
+                        break;
+                    case kaun::UniformInfo::UniformType::MAT2:
+                    case kaun::UniformInfo::UniformType::MAT3:
+                        luaL_error(L, "Uniform mat2/mat3 are not yet implemented yet.");
+                        return;
+                    case kaun::UniformInfo::UniformType::MAT4: {
+                        if (!lua_istable(L, -1)) {
+                            luaL_error(
+                                L, "For mat4 uniforms, please pass a table with 16 numbers.");
+                            return;
                         }
-                        default:
-                            luaL_error(L, "Attempting to set uniform of unsupported type.");
-                            return 0;
+                        luax_getnumtable(L, -1, 16);
+                        uniforms.emplace_back(name, luax_check<glm::mat4>(L, -16));
+                        lua_pop(L, 16);
+                        break;
+                    }
+                    case kaun::UniformInfo::UniformType::SAMPLER2D:
+                    case kaun::UniformInfo::UniformType::SAMPLER2DSHADOW:
+                    case kaun::UniformInfo::UniformType::SAMPLERCUBE: {
+                        // either a texture or {texture, sampler}
+                        const kaun::Sampler* sampler = nullptr;
+                        if (lua_istable(L, -1)) {
+                            lua_rawgeti(L, -1, 2);
+                            sampler = lb::Userdata::get<SamplerWrapper>(L, lua_gettop(L), true);
+                            lua_pop(L, 1);
+                            lua_rawgeti(L, -1, 1);
+                            lua_replace(L, -2);
                         }
-                    } else {
-                        // do nothing for now?
+                        TextureWrapper* tex
+                            = lb::Userdata::get<TextureWrapper>(L, lua_gettop(L), false);
+                        uniforms.emplace_back(
+                            name, *reinterpret_cast<kaun::Texture*>(tex), sampler);
+                        break;
                     }
+                    default:
+                        luaL_error(L, "Attempting to set uniform of unsupported type.");
+                        return;
+                    }
+                } else {
+                    // do nothing for now?
                 }
-                lua_pop(L, 1); // pop value
             }
-        } else {
-            luaL_typerror(L, 3, "table");
-            return 0;
+            lua_pop(L, 1); // pop value
         }
+    } else {
+        luaL_typerror(L, idx, "table");
+        return;
+    }
+}
 
-        if (args == 4) {
-            RenderStateWrapper* state = lb::Userdata::get<RenderStateWrapper>(L, 4, false);
-            kaun::draw(*mesh, *shader, uniforms, *state);
-        } else {
-            kaun::draw(*mesh, *shader, uniforms);
+// (views), mesh, shader, uniforms, (state), (range)
+// With a table of views, the draw is culled and queued for all of them in one call. The uniforms
+// are checked against the shader passed here, not the ones set with View:setShader.
+int draw(lua_State* L)
+{
+    std::vector<const kaun::View*> views;
+    int first = 1;
+    if (lua_istable(L, 1)) {
+        const int n = lua_objlen(L, 1);
+        for (int i = 1; i <= n; ++i) {
+            lua_rawgeti(L, 1, i);
+            views.push_back(lb::Userdata::get<ViewWrapper>(L, lua_gettop(L), true));
+            lua_pop(L, 1);
+        }
+        first = 2;
+    }
+
+    int args = lua_gettop(L) - first + 1;
+    if (args >= 3 && args <= 5) {
+        MeshWrapper* mesh = lb::Userdata::get<MeshWrapper>(L, first, false);
+        ShaderWrapper* shader = lb::Userdata::get<ShaderWrapper>(L, first + 1, false);
+
+        std::vector<kaun::Uniform> uniforms;
+        checkUniforms(L, first + 2, shader, uniforms);
+
+        const kaun::RenderState* state = &kaun::defaultRenderState;
+        if (args >= 4 && !lua_isnil(L, first + 3))
+            state = lb::Userdata::get<RenderStateWrapper>(L, first + 3, false);
+
+        // draw range, either by name or by (1-based) index
+        const kaun::DrawRange* range = nullptr;
+        if (args == 5) {
+            const int idx = first + 4;
+            if (lua_type(L, idx) == LUA_TSTRING) {
+                range = mesh->getDrawRange(lua_tostring(L, idx));
+                if (range == nullptr)
+                    return luaL_error(L, "Mesh has no draw range '%s'", lua_tostring(L, idx));
+            } else {
+                int index = luaL_checkint(L, idx);
+                const auto& ranges = mesh->Mesh::getDrawRanges();
+                if (index < 1 || index > static_cast<int>(ranges.size()))
+                    return luaL_error(L, "Draw range index out of bounds");
+                range = &ranges[index - 1];
+            }
         }
+
+        if (first > 1 && range)
+            kaun::draw(views, *mesh, *range, *shader, uniforms, *state);
+        else if (first > 1)
+            kaun::draw(views, *mesh, *shader, uniforms, *state);
+        else if (range)
+            kaun::draw(*mesh, *range, *shader, uniforms, *state);
+        else
+            kaun::draw(*mesh, *shader, uniforms, *state);
     } else {
-        luaL_error(L, "Number of arguments to kaun.draw has to be 3 or 4. Got %d", args);
+        luaL_error(L, "Number of arguments to kaun.draw has to be between 3 and 5. Got %d", args);
     }
     return 0;
 }
 
+struct TerrainWrapper : public kaun::Terrain {
+    // a heightmap texture is kept in the registry, so it is not collected before the terrain
+    lua_State* mState;
+    int mHeightmapRef;
+
+    TerrainWrapper(const float* heights, int resolutionX, int resolutionZ, float size, float height,
+        int patchResolution, int lodLevels)
+        : Terrain(heights, resolutionX, resolutionZ, size, height, patchResolution, lodLevels)
+        , mState(nullptr)
+        , mHeightmapRef(LUA_NOREF)
+    {
+    }
+
+    TerrainWrapper(const kaun::Texture& heightmap, float size, float height, int patchResolution,
+        int lodLevels, lua_State* L, int heightmapRef)
+        : Terrain(heightmap, size, height, patchResolution, lodLevels)
+        , mState(L)
+        , mHeightmapRef(heightmapRef)
+    {
+    }
+
+    ~TerrainWrapper()
+    {
+        if (mState)
+            luaL_unref(mState, LUA_REGISTRYINDEX, mHeightmapRef);
+    }
+
+    int getHeight(lua_State* L)
+    {
+        lua_pushnumber(L, Terrain::getHeight(luax_check<float>(L, 2), luax_check<float>(L, 3)));
+        return 1;
+    }
+
+    int getNormal(lua_State* L)
+    {
+        luax_pushvec3(L, Terrain::getNormal(luax_check<float>(L, 2), luax_check<float>(L, 3)));
+        return 3;
+    }
+
+    int setLodDistance(lua_State* L)
+    {
+        float distance = luax_check<float>(L, 2);
+        float morphStartRatio = 0.66f;
+        if (lua_gettop(L) >= 3)
+            morphStartRatio = luax_check<float>(L, 3);
+        Terrain::setLodDistance(distance, morphStartRatio);
+        return 0;
+    }
+
+    // shader, uniforms, (renderState) - returns the number of queued draws
+    int draw(lua_State* L)
+    {
+        ShaderWrapper* shader = lb::Userdata::get<ShaderWrapper>(L, 2, false);
+        std::vector<kaun::Uniform> uniforms;
+        checkUniforms(L, 3, shader, uniforms);
+        const kaun::RenderState* state = &kaun::defaultRenderState;
+        if (lua_gettop(L) >= 4 && !lua_isnil(L, 4))
+            state = lb::Userdata::get<RenderStateWrapper>(L, 4, false);
+        lua_pushinteger(L, Terrain::draw(*shader, uniforms, *state));
+        return 1;
+    }
+
+    // heights (2D table [z][x] or Texture), size, height, (patchResolution), (lodLevels)
+    static int newTerrain(lua_State* L)
+    {
+        float size = luax_check<float>(L, 2);
+        float height = luax_check<float>(L, 3);
+        int patchResolution = luaL_optint(L, 4, 32);
+        int lodLevels = luaL_optint(L, 5, 5);
+        if (patchResolution < 2 || patchResolution % 2 != 0)
+            return luaL_error(L, "Patch resolution has to be even and at least 2");
+        if (lodLevels < 1 || lodLevels > 12)
+            return luaL_error(L, "Number of LOD levels has to be between 1 and 12");
+
+        TerrainWrapper* terrain = nullptr;
+        if (lua_istable(L, 1)) {
+            int resX = 0, resZ = 0;
+            std::vector<float> heights;
+            checkHeightmap(L, 1, heights, resX, resZ);
+            terrain = new TerrainWrapper(
+                heights.data(), resX, resZ, size, height, patchResolution, lodLevels);
+        } else {
+            TextureWrapper* tex = lb::Userdata::get<TextureWrapper>(L, 1, true);
+            lua_pushvalue(L, 1);
+            const int heightmapRef = luaL_ref(L, LUA_REGISTRYINDEX);
+            terrain = new TerrainWrapper(
+                *tex, size, height, patchResolution, lodLevels, L, heightmapRef);
+        }
+        pushWithGC(L, terrain);
+        return 1;
+    }
+
+    static int getShaderChunk(lua_State* L)
+    {
+        lua_pushlstring(L, shaderChunk.data(), shaderChunk.size());
+        return 1;
+    }
+};
+
+// Fields (all optional): baseFrequency, frequencyFactor, weights (array), redistribution,
+// hullRadius, seed
+kaun::FbmParams checkFbmParams(lua_State* L, int index)
+{
+    kaun::FbmParams params;
+    if (lua_gettop(L) < index || lua_isnil(L, index))
+        return params;
+    luaL_checktype(L, index, LUA_TTABLE);
+
+    auto optField = [L, index](const char* name, float& value) {
+        lua_getfield(L, index, name);
+        if (!lua_isnil(L, -1))
+            value = luax_check<float>(L, -1);
+        lua_pop(L, 1);
+    };
+    optField("baseFrequency", params.baseFrequency);
+    optField("frequencyFactor", params.frequencyFactor);
+    optField("redistribution", params.redistribution);
+    optField("hullRadius", params.hullRadius);
+
+    lua_getfield(L, index, "seed");
+    if (!lua_isnil(L, -1))
+        params.seed = static_cast<uint32_t>(luaL_checkint(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, index, "weights");
+    if (!lua_isnil(L, -1)) {
+        luaL_checktype(L, -1, LUA_TTABLE);
+        params.octaveWeights.clear();
+        for (size_t i = 1; i <= lua_objlen(L, -1); ++i) {
+            lua_rawgeti(L, -1, i);
+            params.octaveWeights.push_back(luax_check<float>(L, -1));
+            lua_pop(L, 1);
+        }
+        if (params.octaveWeights.empty())
+            luaL_error(L, "fBm weights must not be empty");
+    }
+    lua_pop(L, 1);
+    return params;
+}
+
+// width, height, (params) - returns a 2D table [y][x], which can be passed to newTerrain
+int fbmNoise(lua_State* L)
+{
+    int width = luaL_checkint(L, 1);
+    int height = luaL_checkint(L, 2);
+    if (width < 1 || height < 1)
+        return luaL_error(L, "Noise dimensions have to be positive");
+    const auto heights = kaun::fbmNoise(width, height, checkFbmParams(L, 3));
+    lua_createtable(L, height, 0);
+    for (int y = 0; y < height; ++y) {
+        lua_createtable(L, width, 0);
+        for (int x = 0; x < width; ++x) {
+            lua_pushnumber(L, heights[x + y * width]);
+            lua_rawseti(L, -2, x + 1);
+        }
+        lua_rawseti(L, -2, y + 1);
+    }
+    return 1;
+}
+
+// width, height, (params), (format)
+int newNoiseTexture(lua_State* L)
+{
+    int width = luaL_checkint(L, 1);
+    int height = luaL_checkint(L, 2);
+    if (width < 1 || height < 1)
+        return luaL_error(L, "Noise dimensions have to be positive");
+    const kaun::FbmParams params = checkFbmParams(L, 3);
+    kaun::PixelFormat format = kaun::PixelFormat::R32F;
+    if (lua_gettop(L) >= 4)
+        format = pixelFormat.check(L, 4);
+    if (format != kaun::PixelFormat::R32F && format != kaun::PixelFormat::R16F)
+        return luaL_error(L, "Noise textures have to be r32f or r16f");
+    pushWithGC(L,
+        reinterpret_cast<TextureWrapper*>(kaun::fbmNoiseTexture(width, height, params, format)));
+    return 1;
+}
+
 void flush()
 {
     kaun::flush();
 }
 
+// (byteBudget) - uploads decoded images and calls the load callbacks. love.run calls this once
+// per frame, so it also ends the frame for the upload stats. Returns the number of bytes uploaded.
+int updateTextureLoads(lua_State* L)
+{
+    size_t budget = textureUploadBudget;
+    if (lua_gettop(L) >= 1)
+        budget = luaL_checkint(L, 1);
+    kaun::PixelBufferRing::endFrame();
+    kaun::Texture::endFrame();
+    kaun::TextureManager::update();
+    kaun::trimRenderTexturePool();
+    loadCallbackState = L;
+    lua_pushinteger(L, kaun::TextureLoader::update(budget));
+    if (!loadCallbackError.empty()) {
+        lua_pushstring(L, loadCallbackError.c_str());
+        loadCallbackError.clear();
+        return lua_error(L);
+    }
+    return 1;
+}
+
+LuaEnum<kaun::MipmapFilter> mipmapFilter("mipmap filter",
+    {
+        { "box", kaun::MipmapFilter::BOX },
+        { "kaiser", kaun::MipmapFilter::KAISER },
+    });
+
+// {filter = "box", alphaCoverage = 0} - for the mipmaps of async loads started after this.
+// alphaCoverage > 0 preserves the fraction of pixels with an alpha above it in every level.
+int setMipmapParams(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    kaun::MipmapParams params;
+    lua_getfield(L, 1, "filter");
+    if (!lua_isnil(L, -1))
+        params.filter = mipmapFilter.check(L, -1);
+    lua_getfield(L, 1, "alphaCoverage");
+    if (!lua_isnil(L, -1))
+        params.alphaCoverageReference = luaL_checknumber(L, -1);
+    lua_pop(L, 2);
+    kaun::TextureLoader::setMipmapParams(params);
+    return 0;
+}
+
+int isPixelFormatSupported(lua_State* L)
+{
+    lua_pushboolean(L, kaun::isPixelFormatSupported(pixelFormat.check(L, 1)));
+    return 1;
+}
+
+// path, outFilename, format, (genMipmaps) - compresses an image and writes it to a KTX file.
+// outFilename is a regular path, not one in the love file system.
+int cookCompressedTexture(lua_State* L)
+{
+    const char* path = luaL_checklstring(L, 1, nullptr);
+    const char* outFilename = luaL_checklstring(L, 2, nullptr);
+    const kaun::PixelFormat format = pixelFormat.check(L, 3);
+    bool genMipmaps = true;
+    if (lua_gettop(L) >= 4)
+        genMipmaps = luax_check<bool>(L, 4);
+    auto fileData = getFileData(L, path);
+    if (!fileData.first)
+        return luaL_error(L, "Could not load file %s", path);
+    kaun::DecodedImage decoded;
+    std::string error;
+    if (!kaun::decodeImage(fileData.first, fileData.second, decoded, error))
+        return luaL_error(L, "Could not decode %s: %s", path, error.c_str());
+    lua_pop(L, 1); // Pop the FileData
+    kaun::CompressedImage image;
+    if (!kaun::compressImage(decoded.pixels.get(), decoded.width, decoded.height,
+            decoded.components, format, image, genMipmaps))
+        return luaL_error(L, "Could not compress %s", path);
+    lua_pushboolean(L, kaun::saveKtx(outFilename, image));
+    return 1;
+}
+
+// Pixel buffer uploads (async loads and streaming textures) of the last frame
+int getTextureUploadStats(lua_State* L)
+{
+    const kaun::PixelBufferStats& stats = kaun::PixelBufferRing::getFrameStats();
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, stats.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, stats.uploads);
+    lua_setfield(L, -2, "uploads");
+    lua_pushinteger(L, stats.stalls);
+    lua_setfield(L, -2, "stalls");
+    lua_pushinteger(L, stats.busy);
+    lua_setfield(L, -2, "busy");
+    return 1;
+}
+
+// Of the last frame
+int getTextureBindStats(lua_State* L)
+{
+    const kaun::TextureBindStats& stats = kaun::Texture::getBindStats();
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, stats.binds);
+    lua_setfield(L, -2, "binds");
+    lua_pushinteger(L, stats.unitSwitches);
+    lua_setfield(L, -2, "unitSwitches");
+    lua_pushinteger(L, stats.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, stats.evictions);
+    lua_setfield(L, -2, "evictions");
+    return 1;
+}
+
+// bytes, (lodBias)
+int setTextureBudget(lua_State* L)
+{
+    const lua_Number budget = luaL_checknumber(L, 1);
+    if (budget < 0)
+        return luaL_error(L, "Texture budget can not be negative");
+    kaun::TextureManager::setBudget(static_cast<size_t>(budget));
+    if (lua_gettop(L) >= 2)
+        kaun::TextureManager::setLodBias(luax_check<float>(L, 2));
+    return 0;
+}
+
+int getTextureManagerStats(lua_State* L)
+{
+    const kaun::TextureManagerStats& stats = kaun::TextureManager::getStats();
+    lua_createtable(L, 0, 6);
+    lua_pushnumber(L, stats.budget);
+    lua_setfield(L, -2, "budget");
+    lua_pushnumber(L, stats.residentBytes);
+    lua_setfield(L, -2, "residentBytes");
+    lua_pushinteger(L, stats.textureCount);
+    lua_setfield(L, -2, "textureCount");
+    lua_pushinteger(L, stats.pendingLoads);
+    lua_setfield(L, -2, "pendingLoads");
+    lua_pushinteger(L, stats.droppedLevels);
+    lua_setfield(L, -2, "droppedLevels");
+    lua_pushinteger(L, stats.restoredLevels);
+    lua_setfield(L, -2, "restoredLevels");
+    return 1;
+}
+
+int setTextureUploadBudget(lua_State* L)
+{
+    const int budget = luaL_checkint(L, 1);
+    if (budget < 1)
+        return luaL_error(L, "Upload budget has to be positive");
+    textureUploadBudget = budget;
+    return 0;
+}
+
 int gammaToLinear(lua_State* L)
 {
     int nargs = lua_gettop(L);
@@ -1262,12 +3090,38 @@ extern "C" EXPORT int luaopen_kaun(lua_State* L)
 
         .beginClass<MeshWrapper>("Mesh")
         .addCFunction("setVertices", &MeshWrapper::setVertices)
+        .addCFunction("setVertexData", &MeshWrapper::setVertexData)
+        .addCFunction("getVertexDataPointer", &MeshWrapper::getVertexDataPointer)
+        .addCFunction("markVertexDataDirty", &MeshWrapper::markVertexDataDirty)
+        .addCFunction("setIndices", &MeshWrapper::setIndices)
+        .addCFunction("addDrawRange", &MeshWrapper::addDrawRange)
+        .addCFunction("getDrawRanges", &MeshWrapper::getDrawRanges)
+        .addCFunction("buildClusters", &MeshWrapper::buildClusters)
+        .addCFunction("remapTexCoords", &MeshWrapper::remapTexCoords)
         .endClass()
         .addCFunction("newMesh", MeshWrapper::newMesh)
         .addCFunction("newBoxMesh", MeshWrapper::newBoxMesh)
         .addCFunction("newPlaneMesh", MeshWrapper::newPlaneMesh)
+        .addCFunction("newHeightmapMesh", MeshWrapper::newHeightmapMesh)
         .addCFunction("newSphereMesh", MeshWrapper::newSphereMesh)
         .addCFunction("newObjMesh", MeshWrapper::newObjMesh)
+        .addCFunction("newMergedMesh", MeshWrapper::newMergedMesh)
+
+        .beginClass<MeshArenaWrapper>("MeshArena")
+        .addCFunction("add", &MeshArenaWrapper::add)
+        .addCFunction("remove", &MeshArenaWrapper::remove)
+        .addCFunction("getFreeSpace", &MeshArenaWrapper::getFreeSpace)
+        .endClass()
+        .addCFunction("newMeshArena", MeshArenaWrapper::newMeshArena)
+
+        .beginClass<TerrainWrapper>("Terrain")
+        .addCFunction("getHeight", &TerrainWrapper::getHeight)
+        .addCFunction("getNormal", &TerrainWrapper::getNormal)
+        .addCFunction("setLodDistance", &TerrainWrapper::setLodDistance)
+        .addCFunction("draw", &TerrainWrapper::draw)
+        .endClass()
+        .addCFunction("newTerrain", TerrainWrapper::newTerrain)
+        .addCFunction("getTerrainShaderChunk", TerrainWrapper::getShaderChunk)
 
         .beginClass<ShaderWrapper>("Shader")
         .endClass()
@@ -1277,18 +3131,102 @@ extern "C" EXPORT int luaopen_kaun(lua_State* L)
         .addFunction("getWidth", &kaun::Texture::getWidth)
         .addFunction("getHeight", &kaun::Texture::getHeight)
         .addCFunction("getDimensions", &TextureWrapper::getDimensions)
+        .addCFunction("replacePixels", &TextureWrapper::replacePixels)
         .addCFunction("getWrap", &TextureWrapper::getWrap)
         .addCFunction("setWrap", &TextureWrapper::setWrap)
         .addCFunction("getFilter", &TextureWrapper::getFilter)
         .addCFunction("setFilter", &TextureWrapper::setFilter)
         .addFunction("setBorderColor", &TextureWrapper::setBorderColor)
         .addCFunction("setCompareFunc", &TextureWrapper::setCompareFunc)
+        .addCFunction("setStreaming", &TextureWrapper::setStreaming)
+        .addFunction("isStreaming", &kaun::Texture::isStreaming)
+        .addCFunction("streamPixels", &TextureWrapper::streamPixels)
+        .addCFunction("mapPixels", &TextureWrapper::mapPixels)
+        .addCFunction("unmapPixels", &TextureWrapper::unmapPixels)
         .endClass()
         .addCFunction("newTexture", TextureWrapper::newTexture)
+        .addCFunction("newTextureFromData", TextureWrapper::newTextureFromData)
         .addCFunction("newCheckerTexture", TextureWrapper::newCheckerTexture)
         .addCFunction("newCubeTexture", TextureWrapper::newCubeTexture)
+        .addCFunction("newCompressedTexture", TextureWrapper::newCompressedTexture)
+        .addCFunction("isPixelFormatSupported", isPixelFormatSupported)
+        .addCFunction("cookCompressedTexture", cookCompressedTexture)
+        .addCFunction("newTextureAsync", TextureWrapper::newTextureAsync)
+        .addCFunction("newCubeTextureAsync", TextureWrapper::newCubeTextureAsync)
+        .addCFunction("newManagedTexture", TextureWrapper::newManagedTexture)
+
+        .beginClass<TextureLoadWrapper>("TextureLoad")
+        .addCFunction("getStatus", &TextureLoadWrapper::getStatus)
+        .addCFunction("isFinished", &TextureLoadWrapper::isFinished)
+        .addCFunction("getProgress", &TextureLoadWrapper::getProgress)
+        .addCFunction("getError", &TextureLoadWrapper::getError)
+        .endClass()
+        .addCFunction("updateTextureLoads", updateTextureLoads)
+        .addCFunction("setTextureUploadBudget", setTextureUploadBudget)
+        .addCFunction("setMipmapParams", setMipmapParams)
+        .addCFunction("getTextureUploadStats", getTextureUploadStats)
+        .addCFunction("getTextureBindStats", getTextureBindStats)
+        .addCFunction("setTextureBudget", setTextureBudget)
+        .addCFunction("getTextureManagerStats", getTextureManagerStats)
         .addCFunction("newRenderTexture", TextureWrapper::newRenderTexture)
 
+        .beginClass<FrameGraphWrapper>("FrameGraph")
+        .addCFunction("createTexture", &FrameGraphWrapper::createTexture)
+        .addCFunction("importTexture", &FrameGraphWrapper::importTexture)
+        .addCFunction("addPass", &FrameGraphWrapper::addPass)
+        .addCFunction("addResolvePass", &FrameGraphWrapper::addResolvePass)
+        .addCFunction("setOutput", &FrameGraphWrapper::setOutput)
+        .addCFunction("getTexture", &FrameGraphWrapper::getTexture)
+        .addCFunction("compile", &FrameGraphWrapper::compile)
+        .addCFunction("execute", &FrameGraphWrapper::execute)
+        .addCFunction("clear", &FrameGraphWrapper::clear)
+        .addCFunction("getExecutionOrder", &FrameGraphWrapper::getExecutionOrder)
+        .endClass()
+        .addCFunction("newFrameGraph", FrameGraphWrapper::newFrameGraph)
+
+        .beginClass<ShadowAtlasWrapper>("ShadowAtlas")
+        .addCFunction("allocate", &ShadowAtlasWrapper::allocate)
+        .addCFunction("free", &ShadowAtlasWrapper::free)
+        .addCFunction("reset", &ShadowAtlasWrapper::reset)
+        .addCFunction("getTexture", &ShadowAtlasWrapper::getTexture)
+        .addCFunction("getRect", &ShadowAtlasWrapper::getRect)
+        .addCFunction("getUvTransform", &ShadowAtlasWrapper::getUvTransform)
+        .addCFunction("bindTile", &ShadowAtlasWrapper::bindTile)
+        .addCFunction("getOccupancy", &ShadowAtlasWrapper::getOccupancy)
+        .endClass()
+        .addCFunction("newShadowAtlas", ShadowAtlasWrapper::newShadowAtlas)
+
+        .beginClass<ViewWrapper>("View")
+        .addCFunction("setProjection", &ViewWrapper::setProjection)
+        .addCFunction("getProjection", &ViewWrapper::getProjection)
+        .addCFunction("setViewTransform", &ViewWrapper::setViewTransform)
+        .addCFunction("setViewMatrix", &ViewWrapper::setViewMatrix)
+        .addCFunction("getViewMatrix", &ViewWrapper::getViewMatrix)
+        .addCFunction("setRenderTarget", &ViewWrapper::setRenderTarget)
+        .addCFunction("setViewport", &ViewWrapper::setViewport)
+        .addCFunction("setScissor", &ViewWrapper::setScissor)
+        .addCFunction("setShader", &ViewWrapper::setShader)
+        .addCFunction("setRenderState", &ViewWrapper::setRenderState)
+        .addCFunction("clear", &ViewWrapper::clear)
+        .addCFunction("clearDepth", &ViewWrapper::clearDepth)
+        .endClass()
+        .addCFunction("newView", ViewWrapper::newView)
+        .addCFunction("acquireRenderTexture", acquireRenderTexture)
+        .addCFunction("releaseRenderTexture", releaseRenderTexture)
+        .addCFunction("getRenderTexturePoolStats", getRenderTexturePoolStats)
+
+        .beginClass<SamplerWrapper>("Sampler")
+        .endClass()
+        .addCFunction("newSampler", SamplerWrapper::newSampler)
+
+        .beginClass<TextureAtlasWrapper>("TextureAtlas")
+        .addCFunction("add", &TextureAtlasWrapper::add)
+        .addCFunction("build", &TextureAtlasWrapper::build)
+        .addCFunction("getRegion", &TextureAtlasWrapper::getRegion)
+        .addCFunction("getLayerCount", &TextureAtlasWrapper::getLayerCount)
+        .endClass()
+        .addCFunction("newTextureAtlas", TextureAtlasWrapper::newTextureAtlas)
+
         .beginClass<RenderStateWrapper>("RenderState")
         .addFunction("getDepthWrite", &kaun::RenderState::getDepthWrite)
         .addCFunction("setDepthWrite", &RenderStateWrapper::setDepthWrite)
@@ -1308,7 +3246,9 @@ extern "C" EXPORT int luaopen_kaun(lua_State* L)
 
         .addCFunction("clear", clear)
         .addCFunction("clearDepth", clearDepth)
+        .addFunction("nextPass", kaun::nextPass)
         .addFunction("setViewport", (void (*)(int, int, int, int)) & kaun::setViewport)
+        .addCFunction("setScissor", setScissor)
         .addFunction("setWindowDimensions", kaun::setWindowDimensions)
         .addCFunction("setProjection", setProjection)
         .addCFunction("getProjection", getProjection)
@@ -1319,9 +3259,15 @@ extern "C" EXPORT int luaopen_kaun(lua_State* L)
         .addCFunction("setModelMatrix", setModelMatrix)
         .addCFunction("getModelMatrix", getModelMatrix)
         .addCFunction("setRenderTarget", setRenderTarget)
+        .addCFunction("resolveRenderTarget", resolveRenderTarget)
+        .addCFunction("invalidateRenderTarget", invalidateRenderTarget)
+        .addCFunction("setRenderTargetDiscard", setRenderTargetDiscard)
+        .addCFunction("isInvalidateSupported", isInvalidateSupported)
         .addCFunction("draw", draw)
         .addFunction("flush", flush)
         .addCFunction("gammaToLinear", gammaToLinear)
+        .addCFunction("fbmNoise", fbmNoise)
+        .addCFunction("newNoiseTexture", newNoiseTexture)
 
         .addFunction("beginLoveGraphics", beginLoveGraphics)
         .addFunction("endLoveGraphics", endLoveGraphics)